@@ -0,0 +1,48 @@
+/**
+ * @file blue_noise.hpp
+ * @brief Tileable blue noise dither mask
+ *
+ * Quantizing with a dither whose error is concentrated at high frequencies removes banding from
+ * smooth gradients, without the visible low frequency clumps of white noise. The mask is generated
+ * with the void and cluster method the first time it is used, and tiles seamlessly so it can cover
+ * an image of any size.
+ */
+
+#ifndef INCLUDE_UTIL_BLUE_NOISE_HPP_
+#define INCLUDE_UTIL_BLUE_NOISE_HPP_
+
+#include "specula.hpp"
+#include "util/vecmath/tuple2.hpp"
+
+namespace specula {
+  /// Width and height of the blue noise mask
+  static constexpr int BLUE_NOISE_RESOLUTION = 64;
+
+  /**
+   * @brief The blue noise mask, in scanline order
+   *
+   * Every value is unique, the mask holds \f$(i + 0.5) / n\f$ for each \f$i\f$ of the \f$n\f$
+   * pixels, so thresholding it at any level gives an evenly spread set of pixels.
+   *
+   * @return `BLUE_NOISE_RESOLUTION` squared values in \f$(0, 1)\f$.
+   */
+  const Float *blue_noise_mask();
+
+  /**
+   * @brief Value of the tiled blue noise mask at a pixel
+   *
+   * Each channel uses the mask shifted by a different offset, so that the dither of the channels of
+   * a pixel is not identical.
+   *
+   * @param channel The channel the value is used for.
+   * @param p The pixel, which may be anywhere as the mask repeats.
+   * @return The value in \f$(0, 1)\f$.
+   */
+  inline Float blue_noise(int channel, Point2i p) {
+    constexpr int mask = BLUE_NOISE_RESOLUTION - 1;
+    int x = (p.x + 29 * channel) & mask, y = (p.y + 47 * channel) & mask;
+    return blue_noise_mask()[y * BLUE_NOISE_RESOLUTION + x];
+  }
+} // namespace specula
+
+#endif // INCLUDE_UTIL_BLUE_NOISE_HPP_
@@ -27,6 +27,14 @@ namespace specula {
 
     SPECULA_CPU_GPU inline Float to_float_linear(Float v) const;
 
+    /**
+     * @brief The 256 entry table `to_linear` decodes bytes with
+     *
+     * @return The table, or `nullptr` if the encoding is not table based (or is null), in which
+     * case a byte `v` decodes to `v / 255`.
+     */
+    SPECULA_CPU_GPU inline const Float *to_linear_table() const;
+
     static const ColorEncoding get(const std::string &name, Allocator allocator);
     static void initialize(Allocator allocator);
 
@@ -36,21 +44,10 @@ namespace specula {
 
   class LinearColorEncoding {
   public:
-    SPECULA_CPU_GPU void to_linear(pstd::span<const uint8_t> vin, pstd::span<Float> vout) const {
-      DASSERT_EQ(vin.size(), vout.size());
-      for (size_t i = 0; i < vin.size(); ++i) {
-        vout[i] = vin[i] / 255.0f;
-      }
-    }
-
-    SPECULA_CPU_GPU void from_linear(pstd::span<const Float> vin, pstd::span<uint8_t> vout) const {
-      DASSERT_EQ(vin.size(), vout.size());
-      for (size_t i = 0; i < vin.size(); ++i) {
-        vout[i] = static_cast<uint8_t>(std::clamp(vin[i] * 255.0f + 0.5f, 0.0f, 255.0f));
-      }
-    }
-
+    SPECULA_CPU_GPU void to_linear(pstd::span<const uint8_t> vin, pstd::span<Float> vout) const;
+    SPECULA_CPU_GPU void from_linear(pstd::span<const Float> vin, pstd::span<uint8_t> vout) const;
     SPECULA_CPU_GPU Float to_float_linear(Float v) const { return v; }
+    SPECULA_CPU_GPU const Float *to_linear_table() const { return nullptr; }
   };
 
   class sRgbColorEncoding {
@@ -58,6 +55,7 @@ namespace specula {
     SPECULA_CPU_GPU void to_linear(pstd::span<const uint8_t> vin, pstd::span<Float> vout) const;
     SPECULA_CPU_GPU void from_linear(pstd::span<const Float> vin, pstd::span<uint8_t> vout) const;
     SPECULA_CPU_GPU Float to_float_linear(Float v) const;
+    SPECULA_CPU_GPU const Float *to_linear_table() const { return SRGB_TO_LINEAR_LUT; }
   };
 
   class GammaColorEncoding {
@@ -67,6 +65,7 @@ namespace specula {
     SPECULA_CPU_GPU void to_linear(pstd::span<const uint8_t> vin, pstd::span<Float> vout) const;
     SPECULA_CPU_GPU void from_linear(pstd::span<const Float> vin, pstd::span<uint8_t> vout) const;
     SPECULA_CPU_GPU Float to_float_linear(Float v) const;
+    SPECULA_CPU_GPU const Float *to_linear_table() const { return apply_lut.data(); }
 
   private:
     Float gamma;
@@ -93,6 +92,14 @@ namespace specula {
     return dispatch(to_float_linear_impl);
   }
 
+  SPECULA_CPU_GPU inline const Float *ColorEncoding::to_linear_table() const {
+    if (!ptr()) {
+      return nullptr;
+    }
+    auto to_linear_table_impl = [&](auto ptr) { return ptr->to_linear_table(); };
+    return dispatch(to_linear_table_impl);
+  }
+
   SPECULA_CPU_GPU inline Float linear_to_srgb(Float value) {
     if (value <= 0.0031308f) {
       return 12.92f * value;
@@ -113,9 +120,24 @@ namespace specula {
     } else if (value >= 1) {
       return 255;
     }
-    return clamp(pstd::round(255.0f * linear_to_srgb(value) + dither), 0, 255);
+    return clamp(pstd::round(fma(255.0f, linear_to_srgb(value), dither)), 0, 255);
   }
 
+  /**
+   * @brief Encode linear values to 8-bit sRGB, offsetting each by a dither value before rounding
+   *
+   * Gives the same result as `linear_to_srgb8` for every value, while counting the values that
+   * are clamped as part of the same pass.
+   *
+   * @param vin The linear values.
+   * @param dither The offsets added to the values scaled to \f$[0, 255]\f$, usually in
+   * \f$[-0.5, 0.5)\f$.
+   * @param vout The encoded values.
+   * @return The number of values outside of \f$[0, 1]\f$.
+   */
+  size_t linear_to_srgb8(pstd::span<const Float> vin, pstd::span<const Float> dither,
+                         pstd::span<uint8_t> vout);
+
   SPECULA_CPU_GPU inline Float srgb_to_linear(float value) {
     if (value <= 0.04045f) {
       return value * (1.0f / 12.92f);
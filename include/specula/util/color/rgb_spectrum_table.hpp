@@ -6,19 +6,36 @@
 #include "specula/specula.hpp"
 #include "specula/util/color/rgb.hpp"
 #include "specula/util/color/rgb_sigmoid_polynomial.hpp"
+#include "specula/util/pstd/array.hpp"
+#include "specula/util/pstd/span.hpp"
 
 namespace specula {
   class RgbToSpectrumTable {
   public:
     static constexpr int RES = 64;
 
+    /// Number of uniform buckets in the inverse lookup table for `z_nodes`
+    static constexpr int Z_INDEX_RES = 1024;
+
     using CoefficientArray = float[3][RES][RES][RES][3];
 
-    RgbToSpectrumTable(const float *z_nodes, const CoefficientArray *coeffs)
-        : z_nodes(z_nodes), coeffs(coeffs) {}
+    RgbToSpectrumTable(const float *z_nodes, const CoefficientArray *coeffs);
 
     SPECULA_CPU_GPU RgbSigmoidPolynomial operator()(Rgb rgb) const;
 
+    /**
+     * @brief Convert a batch of RGB values into their sigmoid polynomial coefficients
+     *
+     * This produces identical results to calling `operator()` for each value, but on CPUs
+     * supporting AVX2 it processes eight colors at a time. The data dependent branches of the
+     * single value lookup are replaced with masked selects, and the search over `z_nodes` uses a
+     * precomputed inverse table, so the cost is dominated by the coefficient gathers.
+     *
+     * @param rgb The RGB values to convert, each component must be in \f$[0, 1]\f$
+     * @param out The destination for the coefficients, must be the same size as `rgb`
+     */
+    void lookup(pstd::span<const Rgb> rgb, pstd::span<RgbSigmoidPolynomial> out) const;
+
     static void init(Allocator &alloc);
 
     static const RgbToSpectrumTable *SRGB;
@@ -30,6 +47,11 @@ namespace specula {
     const float *z_nodes;
     const CoefficientArray *coeffs;
 
+    /// For each bucket of `z`, the smallest interval index `find_interval` can return
+    pstd::array<uint8_t, Z_INDEX_RES> z_index_lo;
+    /// Number of binary search steps needed to refine any `z_index_lo` entry
+    int z_index_steps;
+
     friend struct fmt::formatter<RgbSigmoidPolynomial>;
   };
 } // namespace specula
@@ -1,6 +1,9 @@
 #ifndef INCLUDE_UTIL_FILE_HPP_
 #define INCLUDE_UTIL_FILE_HPP_
 
+#include <cstddef>
+#include <memory>
+#include <string>
 #include <string_view>
 #include <vector>
 
@@ -8,6 +11,43 @@
 
 namespace specula {
   std::vector<Float> read_float_file(std::string_view filename);
-}
+
+  /// Check if `filename` ends with `.extension`, ignoring case
+  bool has_extension(std::string_view filename, std::string_view extension);
+
+  /**
+   * @brief The contents of a file mapped into memory.
+   *
+   * The mapping is private, so the contents may be modified without affecting the file, and
+   * untouched pages are shared through the page cache with every other process mapping the same
+   * file. Where memory mapping is not supported the file is read into memory instead.
+   */
+  class MappedFile {
+  public:
+    /**
+     * @brief Map a file into memory
+     *
+     * @param filename The file to map.
+     * @return The mapped file, or `nullptr` if the file could not be opened.
+     */
+    static std::shared_ptr<MappedFile> open(const std::string &filename);
+
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    std::byte *data() const { return data_; }
+    size_t size() const { return size_; }
+
+  private:
+    MappedFile() = default;
+
+    std::byte *data_ = nullptr;
+    size_t size_ = 0;
+    /// Holds the contents when the file could not be mapped
+    std::unique_ptr<std::byte[]> buffer;
+  };
+} // namespace specula
 
 #endif // INCLUDE_UTIL_FILE_HPP_
@@ -185,6 +185,50 @@ namespace specula {
   template <typename... Args> SPECULA_CPU_GPU inline Float hash_float(Args... args) {
     return std::uint32_t(hash(args...)) * 0x1p-32f;
   }
+
+  /**
+   * @brief Element `i` of a random permutation of \f$[0, l)\f$ selected by `p`
+   *
+   * The permutation is computed by hashing `i` within the smallest power of two range that holds
+   * \f$l\f$ values, cycle walking until the result falls below \f$l\f$, so no table needs to be
+   * stored and any element can be evaluated on its own.
+   *
+   * @param i The index to permute, in \f$[0, l)\f$
+   * @param l The number of elements of the permutation
+   * @param p The seed selecting the permutation
+   * @return The permuted index
+   * @see Andrew Kensler, "Correlated Multi-Jittered Sampling", Pixar Technical Memo 13-01, 2013
+   */
+  SPECULA_CPU_GPU inline int permutation_element(std::uint32_t i, std::uint32_t l,
+                                                 std::uint32_t p) {
+    std::uint32_t w = l - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do {
+      i ^= p;
+      i *= 0xe170893d;
+      i ^= p >> 16;
+      i ^= (i & w) >> 4;
+      i ^= p >> 8;
+      i *= 0x0929eb3f;
+      i ^= p >> 23;
+      i ^= (i & w) >> 1;
+      i *= 1 | p >> 27;
+      i *= 0x6935fa69;
+      i ^= (i & w) >> 11;
+      i *= 0x74dcb303;
+      i ^= (i & w) >> 2;
+      i *= 0x9e501cc3;
+      i ^= (i & w) >> 2;
+      i *= 0xc860a3df;
+      i &= w;
+      i ^= i >> 5;
+    } while (i >= l);
+    return (i + p) % l;
+  }
 } // namespace specula
 
 #endif // INCLUDE_UTIL_HASH_HPP_
@@ -0,0 +1,164 @@
+/**
+ * @file exr.hpp
+ * @brief Reader and writer for OpenEXR scanline images
+ *
+ * Every scanline block is compressed independently, so the writer compresses a batch of blocks
+ * in parallel, appends them to the file in order, and moves on to the next batch, which bounds
+ * the memory used by large images. The offset table that precedes the blocks is reserved when
+ * the header is written and filled in once every block has been written. The reader decodes the
+ * blocks in parallel straight from the memory mapped file.
+ *
+ * Several images, such as the AOVs of a render, can be written to a single file either as layers
+ * of one part, by naming their channels `<layer>.<channel>`, or as separate parts of a multipart
+ * file.
+ *
+ * `ExrStreamWriter` writes an image that is handed over a piece at a time as it is rendered, so
+ * that writing the file overlaps with rendering and the whole image never has to be in memory.
+ */
+
+#ifndef INCLUDE_IMAGE_EXR_HPP_
+#define INCLUDE_IMAGE_EXR_HPP_
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "specula.hpp"
+#include "util/image/image.hpp"
+#include "util/pstd/span.hpp"
+
+namespace specula {
+  /// Compression of the scanline blocks, the values match those stored in the file
+  enum class ExrCompression : uint8_t { None = 0, Rle = 1 };
+
+  /// A single part of a multipart EXR file
+  struct ExrPart {
+    /// Name of the part, which must be unique when the file has more than one part
+    std::string name;
+    /// The pixels of the part, which may be a view of a region or some channels of an image
+    SubImage image;
+  };
+
+  /**
+   * @brief Write images to an EXR file
+   *
+   * `Float` images are stored as 32-bit floating point channels, and every other format as half
+   * precision channels. The metadata is stored in the header of every part.
+   *
+   * @param filename The file to write.
+   * @param parts The images to write, a single part is written as a regular single part file.
+   * Every part must have the same resolution.
+   * @param metadata The metadata of the images.
+   * @param compression The compression of the scanline blocks.
+   * @return false if the file could not be written.
+   */
+  bool exr_write(const std::string &filename, pstd::span<const ExrPart> parts,
+                 const ImageMetadata &metadata,
+                 ExrCompression compression = ExrCompression::Rle);
+
+  /**
+   * @brief Read a part of an EXR file
+   *
+   * The R, G, B and A channels come first in that order when they are present, followed by the
+   * remaining channels in the order they are stored in. The image is `Half` if every channel is
+   * stored at half precision, and `Float` otherwise.
+   *
+   * @param filename The file to read.
+   * @param alloc The allocator for the pixel storage.
+   * @param part The index of the part to read.
+   * @return The image, which is empty if the file could not be read.
+   */
+  ImageAndMetadata exr_read(const std::string &filename, Allocator alloc = {}, int part = 0);
+
+  /**
+   * @brief Writes an EXR file from tiles or bands of scanlines as they are completed
+   *
+   * Pixels are gathered into scanlines, and every scanline is handed to a dedicated I/O thread as
+   * soon as all of its pixels have been written, which compresses it and appends it to the file.
+   * Only scanlines that are partially written or waiting in the queue are held in memory, so
+   * images that are rendered in order of their rows never have to be resident in full. Scanlines
+   * are stored in the order they are completed, the offset table lets readers find them.
+   */
+  class ExrStreamWriter {
+  public:
+    /**
+     * @brief Create the file and start the I/O thread
+     *
+     * @param filename The file to write.
+     * @param resolution The resolution of the image.
+     * @param channels The names of the channels of the image.
+     * @param format The format the channels are stored with, `Float` or `Half`.
+     * @param metadata The metadata of the image.
+     * @param compression The compression of the scanline blocks.
+     * @param queue_depth The maximum number of completed scanlines waiting to be written,
+     * `write` blocks while the queue is full.
+     * @return The writer, or `nullptr` if the file could not be created.
+     */
+    static std::unique_ptr<ExrStreamWriter> open(const std::string &filename, Point2i resolution,
+                                                 pstd::span<const std::string> channels,
+                                                 PixelFormat format = PixelFormat::Half,
+                                                 const ImageMetadata &metadata = {},
+                                                 ExrCompression compression = ExrCompression::Rle,
+                                                 int queue_depth = 64);
+
+    /// Finishes the file if `finish` has not been called
+    ~ExrStreamWriter();
+
+    ExrStreamWriter(const ExrStreamWriter &) = delete;
+    ExrStreamWriter &operator=(const ExrStreamWriter &) = delete;
+
+    /**
+     * @brief Write a rectangle of pixels, may be called from several threads at once
+     *
+     * Every pixel of the image must be written exactly once.
+     *
+     * @param origin The position of the top left pixel of `tile` in the image.
+     * @param tile The pixels, with the same channels as the image.
+     */
+    void write(Point2i origin, const SubImage &tile);
+
+    /**
+     * @brief Wait for the queued scanlines to be written and complete the file
+     *
+     * @return false if any scanline was never completed, or the file could not be written.
+     */
+    bool finish();
+
+  private:
+    ExrStreamWriter() = default;
+
+    void io_loop();
+
+    std::string filename;
+    FILE *file = nullptr;
+    Point2i resolution;
+    int data_window_y = 0;
+    std::vector<int> order;
+    int32_t type = 0;
+    ExrCompression compression = ExrCompression::Rle;
+    size_t queue_depth = 0;
+
+    /// Scanlines that have been started, and the number of pixels written to each
+    std::vector<std::vector<float>> rows;
+    std::vector<int> row_pixels;
+    /// Completed scanlines, waiting to be written
+    std::deque<int> queue;
+    bool closed = false;
+    std::mutex mutex;
+    std::condition_variable queue_not_full, queue_not_empty;
+    std::thread io_thread;
+
+    // Only used by the I/O thread until it is joined
+    uint64_t table_offset = 0, offset = 0;
+    std::vector<uint64_t> offsets;
+    bool failed = false;
+  };
+} // namespace specula
+
+#endif // INCLUDE_IMAGE_EXR_HPP_
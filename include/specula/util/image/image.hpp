@@ -1,6 +1,7 @@
 #ifndef INCLUDE_IMAGE_IMAGE_HPP_
 #define INCLUDE_IMAGE_IMAGE_HPP_
 
+#include <memory>
 #include <string>
 
 #include "specula.hpp"
@@ -9,22 +10,35 @@
 #include "util/containers/array2d.hpp"
 #include "util/float.hpp"
 #include "util/image/image_channel.hpp"
+#include "util/image/image_layout.hpp"
+#include "util/image/image_view.hpp"
 #include "util/image/metadata.hpp"
 #include "util/image/pixel_format.hpp"
 #include "util/image/wrap_mode.hpp"
 #include "util/log.hpp"
+#include "util/parallel.hpp"
 #include "util/pstd/vector.hpp"
 #include "util/vecmath/bounds2.hpp"
 #include "util/vecmath/tuple2.hpp"
 
 namespace specula {
   struct ImageAndMetadata;
+  class MappedFile;
+  class SubImage;
 
   struct ResampleWeight {
     int first_pixel;
     Float weight[4];
   };
 
+  /// Pixels with a NaN or infinite channel, as found by `Image::find_non_finite_pixels`
+  struct NonFinitePixels {
+    /// Number of pixels with at least one NaN or infinite channel
+    int64_t count = 0;
+    /// Bounds of those pixels, with an exclusive maximum, empty if there are none
+    Bounds2i bounds;
+  };
+
   class Image {
   public:
     Image(Allocator alloc = {})
@@ -36,41 +50,107 @@ namespace specula {
     Image(pstd::vector<float> p32, Point2i resolution, pstd::span<const std::string> channels);
 
     Image(PixelFormat format, Point2i resolution, pstd::span<const std::string> channels,
-          ColorEncoding encoding = nullptr, Allocator alloc = {});
+          ColorEncoding encoding = nullptr, Allocator alloc = {},
+          ImageLayout layout = ImageLayout::Scanline);
 
     static pstd::vector<Image> generate_pyramid(Image image, WrapMode2D wrap_mode,
                                                 Allocator alloc = {});
 
+    /**
+     * @brief Generate the pyramid of an image, reusing it from an on-disk cache when possible
+     *
+     * Cache files are named after `pyramid_cache_key`, so an image whose pixels changed simply
+     * misses. On a hit the file is memory mapped and the levels use its pixels in place, otherwise
+     * the pyramid is generated and written to the cache for the next time. A cache file that
+     * cannot be read or written is reported, but never prevents the pyramid from being returned.
+     *
+     * Files are only ever added: the cache does not know which source an image came from, so the
+     * files of images that changed, or of options that are no longer used, stay in the directory.
+     * The caller owns the directory and is responsible for cleaning it up. Any of its files may be
+     * deleted while no pyramid mapped from that file is in use.
+     *
+     * @param image The base level of the pyramid.
+     * @param wrap_mode The wrap mode used when generating the pyramid.
+     * @param cache_directory The directory of the cache files, created if it does not exist.
+     * @param alloc The allocator used for the vector and for the levels that are generated.
+     * @return The levels of the pyramid.
+     */
+    static pstd::vector<Image> cached_pyramid(Image image, WrapMode2D wrap_mode,
+                                              const std::string &cache_directory,
+                                              Allocator alloc = {});
+
+    /**
+     * @brief Key of the pyramid of an image in the on-disk cache
+     *
+     * Combines `hash_buffer` of the pixels with the format, layout, resolution, channels and color
+     * encoding of the image, and the wrap mode the pyramid is generated with.
+     */
+    static uint64_t pyramid_cache_key(const Image &image, WrapMode2D wrap_mode);
+
     SPECULA_CPU_GPU PixelFormat format() const { return format_; }
     SPECULA_CPU_GPU Point2i resolution() const { return resolution_; }
+    SPECULA_CPU_GPU ImageLayout layout() const { return layout_; }
     SPECULA_CPU_GPU int n_channels() const { return channel_names_.size(); }
     std::vector<std::string> channel_names() const;
     std::vector<std::string> channel_names(const ImageChannelDesc &) const;
     const ColorEncoding encoding() const { return encoding_; }
 
     SPECULA_CPU_GPU size_t pixel_offset(Point2i p) const {
-      DASSERT(inside_exclusive(p, Bounds2i({0, 0}, resolution)));
-      return n_channels() * (p.y * resolution_.x + p.x);
+      DASSERT(inside_exclusive(p, Bounds2i({0, 0}, resolution_)));
+      if (layout_ == ImageLayout::Scanline) {
+        return n_channels() * (p.y * resolution_.x + p.x);
+      }
+      return n_channels() * layout_pixel_index(layout_, resolution_, p);
     }
 
-    SPECULA_CPU_GPU Float get_channel(Point2i p, int c,
-                                      WrapMode2D wrap_mode = WrapMode::Clamp) const {
-      if (!remap_pixel_coords(&p, resolution_, wrap_mode)) {
-        return 0;
+    /**
+     * @brief Create a view of the pixels with the pixel format resolved at compile time.
+     *
+     * The view is invalidated by any operation that reallocates the pixels of the image.
+     *
+     * @tparam Format Must match `format()`.
+     * @tparam NChannels Must match `n_channels()`, or be `DYNAMIC_CHANNELS`.
+     */
+    template <PixelFormat Format, int NChannels = DYNAMIC_CHANNELS>
+    SPECULA_CPU_GPU ImageView<Format, NChannels> view() const {
+      DASSERT(format_ == Format);
+      if constexpr (Format == PixelFormat::U256) {
+        return {p8.data(), resolution_, n_channels(), encoding_, layout_};
+      } else if constexpr (Format == PixelFormat::Half) {
+        return {p16.data(), resolution_, n_channels(), nullptr, layout_};
+      } else {
+        return {p32.data(), resolution_, n_channels(), nullptr, layout_};
       }
+    }
 
+    /**
+     * @brief Call `func` with the `ImageView` matching the format of the image.
+     *
+     * Images with one, three or four channels get a view with a fixed channel count, all others
+     * use `DYNAMIC_CHANNELS`. Resolving the view once and then looping inside of `func` avoids
+     * switching on the pixel format for every texel.
+     */
+    template <typename F> SPECULA_CPU_GPU decltype(auto) dispatch_view(F &&func) const {
       switch (format_) {
-      case PixelFormat::U256: {
-        Float r;
-        encoding_.to_linear({&p8[pixel_offset(p) + c], 1}, {&r, 1});
-        return r;
-      }
-      case PixelFormat::Half: {
-        return Float(p16[pixel_offset(p) + c]);
-      }
-      case PixelFormat::Float: {
-        return p32[pixel_offset(p) + c];
+      case PixelFormat::U256:
+        return dispatch_channels<PixelFormat::U256>(func);
+      case PixelFormat::Half:
+        return dispatch_channels<PixelFormat::Half>(func);
+      default:
+        ASSERT(format_ == PixelFormat::Float);
+        return dispatch_channels<PixelFormat::Float>(func);
       }
+    }
+
+    SPECULA_CPU_GPU Float get_channel(Point2i p, int c,
+                                      WrapMode2D wrap_mode = WrapMode::Clamp) const {
+      switch (format_) {
+      case PixelFormat::U256:
+        return view<PixelFormat::U256>().get_channel(p, c, wrap_mode);
+      case PixelFormat::Half:
+        return view<PixelFormat::Half>().get_channel(p, c, wrap_mode);
+      case PixelFormat::Float:
+        return view<PixelFormat::Float>().get_channel(p, c, wrap_mode);
       default:
         LOG_CRITICAL("Unhandled PixelFormat: {}", format_);
         return 0;
@@ -79,19 +159,17 @@ namespace specula {
 
     SPECULA_CPU_GPU Float bilerp_channel(Point2f p, int c,
                                          WrapMode2D wrap_mode = WrapMode::Clamp) const {
-      Float x = p[0] * resolution_.x - 0.5f, y = p[1] * resolution_.y - 0.05f;
-      int xi = pstd::floor(x), yi = pstd::floor(y);
-      Float dx = x - xi, dy = y - yi;
-
-      pstd::array<Float, 4> v = {
-          get_channel({xi, yi}, c, wrap_mode),
-          get_channel({xi + 1, yi}, c, wrap_mode),
-          get_channel({xi, yi + 1}, c, wrap_mode),
-          get_channel({xi + 1, yi + 1}, c, wrap_mode),
-      };
-
-      return ((1 - dx) * (1 - dy) * v[0] + dx * (1 - dy) * v[1] + (1 - dx) * dy * v[2] +
-              dx * dy * v[3]);
+      switch (format_) {
+      case PixelFormat::U256:
+        return view<PixelFormat::U256>().bilerp_channel(p, c, wrap_mode);
+      case PixelFormat::Half:
+        return view<PixelFormat::Half>().bilerp_channel(p, c, wrap_mode);
+      case PixelFormat::Float:
+        return view<PixelFormat::Float>().bilerp_channel(p, c, wrap_mode);
+      default:
+        LOG_CRITICAL("Unhandled PixelFormat: {}", format_);
+        return 0;
+      }
     }
 
     SPECULA_CPU_GPU inline void set_channel(Point2i p, int c, Float value) {
@@ -140,9 +218,31 @@ namespace specula {
 
     ImageChannelValues avarge(const ImageChannelDesc &desc) const;
 
+    /**
+     * @brief Check if any channel of any pixel is infinite or NaN
+     *
+     * The pixels are classified from the exponent and mantissa bits of their values, in chunks
+     * that are scanned in parallel. Once any thread finds a match the remaining chunks are skipped.
+     * 8-bit images never have non-finite values.
+     */
     bool has_any_infinite_pixels() const;
     bool has_any_nan_pixels() const;
 
+    /// Count and bound the pixels with a NaN or infinite channel, scanning every pixel
+    NonFinitePixels find_non_finite_pixels() const;
+
+    /**
+     * @brief Per channel mean error against `ref` of the channels `desc`
+     *
+     * `mae` averages the absolute error, `mse` the squared error, and `mrse` the squared error
+     * relative to \f$(r + 0.01)^2\f$. Pixels with an infinite error are excluded from the sum. The
+     * partial sums are combined in a fixed order, so the result is the same for any number of
+     * threads.
+     *
+     * @param desc The channels to compare.
+     * @param ref The reference image, which must have the same resolution and channel names.
+     * @param error_image If not null, set to a `Float` image of the per pixel error.
+     */
     ImageChannelValues mae(const ImageChannelDesc &desc, const Image &ref,
                            Image *error_image = nullptr) const;
     ImageChannelValues mse(const ImageChannelDesc &desc, const Image &ref,
@@ -152,37 +252,69 @@ namespace specula {
 
     Image gaussian_filter(const ImageChannelDesc &desc, int half_width, Float sigma) const;
 
+    /**
+     * @brief Tabulate the average of the channels of every pixel, scaled by `dxda`
+     *
+     * The result is meant for a `PiecewiseConstant2D`. Rows are converted in bulk and in
+     * parallel, so this stays fast for very large environment maps.
+     *
+     * @param dxda The Jacobian of the mapping from the domain to the sampled measure, evaluated at
+     * the center of every pixel.
+     * @param domain The domain the image covers.
+     * @param alloc The allocator of the result.
+     */
     template <typename F>
     Array2D<Float> get_sampling_distribution(F dxda,
                                              const Bounds2f &domain = Bounds2f(Point2f(0, 0),
                                                                                Point2f(1, 1)),
-                                             Allocator alloc = {}) {
+                                             Allocator alloc = {}) const {
       Array2D<Float> dist(resolution_[0], resolution_[1], alloc);
-      // TODO: Uncomment when parallel processing has been implemented
-      //
-      // parallel_for(0, resolution_[1], [&](int64_t y0, int64_t y1) {
-      //   for (int y = y0; y < y1; ++y) {
-      //     for (int x = 0; x < resolution_[0]; ++x) {
-      //       Float value = get_channels({x, y}).average();
-      //
-      //       Point2f p =
-      //           domain.lerp(Point2f((x + 0.5f) / resolution_[0], (y + 0.5f) / resolution_[1]));
-      //       dist(x, y) = value * dxda(p);
-      //     }
-      //   }
-      // });
+      int nc = n_channels();
+      parallel_for(0, resolution_[1], [&](int64_t y0, int64_t y1) {
+        std::vector<float> row(size_t(nc) * resolution_[0]);
+        for (int y = y0; y < y1; ++y) {
+          copy_rect_out(Bounds2i({0, y}, {resolution_[0], y + 1}), row);
+          for (int x = 0; x < resolution_[0]; ++x) {
+            // Same order of operations as `ImageChannelValues::average`
+            Float value = 0;
+            for (int c = 0; c < nc; ++c) {
+              value += row[size_t(nc) * x + c];
+            }
+            value /= nc;
+
+            Point2f p =
+                domain.lerp(Point2f((x + 0.5f) / resolution_[0], (y + 0.5f) / resolution_[1]));
+            dist(x, y) = value * dxda(p);
+          }
+        }
+      });
       return dist;
     }
 
-    Array2D<Float> get_sampling_distribution() {
+    Array2D<Float> get_sampling_distribution() const {
       return get_sampling_distribution([](Point2f) { return Float(1); });
     }
 
+    /**
+     * @brief Read an image file, selecting the format from the extension of `filename`
+     *
+     * Uncompressed formats are memory mapped. Files in the native raw format (`.simg`) store the
+     * pixels exactly as they are laid out in memory, so the mapping is used as the pixel storage
+     * directly instead of allocating from `alloc`. PFM files store their rows bottom to top, so
+     * they are flipped into storage from `alloc` while being read.
+     *
+     * @param filename The file to read.
+     * @param alloc The allocator for the pixel storage.
+     * @param encoding The color encoding of 8-bit images, defaults to sRGB where the file does not
+     * specify one.
+     * @return The image, which is empty if the file could not be read.
+     */
     static ImageAndMetadata read(std::string filename, Allocator alloc = {},
                                  ColorEncoding encoding = nullptr);
     bool write(std::string name, const ImageMetadata &metadata = {}) const;
 
     Image convert_to_format(PixelFormat format, ColorEncoding encoding = nullptr) const;
+    Image convert_to_layout(ImageLayout layout, Allocator alloc = {}) const;
 
     SPECULA_CPU_GPU Float lookup_nearest_channel(Point2f p, int c,
                                                  WrapMode2D wrap_mode = WrapMode::Clamp) const {
@@ -198,6 +330,47 @@ namespace specula {
     ImageChannelValues bilerp(Point2f p, const ImageChannelDesc &desc,
                               WrapMode2D wrap_mode = WrapMode::Clamp) const;
 
+    /**
+     * @brief Fixed channel count lookups, returning the values by value
+     *
+     * The pixel format is resolved once per lookup and the channel loops are unrolled, so for
+     * instance an RGB bilinear lookup only loads and blends the texels of the three channels.
+     */
+    template <int N>
+    SPECULA_CPU_GPU Channels<N> get_channels(Point2i p, const StaticChannelDesc<N> &desc,
+                                             WrapMode2D wrap_mode = WrapMode::Clamp) const {
+      return dispatch_format([&](auto view) { return view.get_channels(p, desc, wrap_mode); });
+    }
+    template <int N>
+    SPECULA_CPU_GPU Channels<N> lookup_nearest(Point2f p, const StaticChannelDesc<N> &desc,
+                                               WrapMode2D wrap_mode = WrapMode::Clamp) const {
+      return dispatch_format([&](auto view) { return view.lookup_nearest(p, desc, wrap_mode); });
+    }
+    template <int N>
+    SPECULA_CPU_GPU Channels<N> bilerp(Point2f p, const StaticChannelDesc<N> &desc,
+                                       WrapMode2D wrap_mode = WrapMode::Clamp) const {
+      return dispatch_format([&](auto view) { return view.bilerp(p, desc, wrap_mode); });
+    }
+
+    /// Lookups of the first `N` channels, usually all of the channels of the image
+    template <int N>
+    SPECULA_CPU_GPU Channels<N> get_channels(Point2i p,
+                                             WrapMode2D wrap_mode = WrapMode::Clamp) const {
+      DASSERT_LE(N, n_channels());
+      return get_channels(p, StaticChannelDesc<N>(), wrap_mode);
+    }
+    template <int N>
+    SPECULA_CPU_GPU Channels<N> lookup_nearest(Point2f p,
+                                               WrapMode2D wrap_mode = WrapMode::Clamp) const {
+      DASSERT_LE(N, n_channels());
+      return lookup_nearest(p, StaticChannelDesc<N>(), wrap_mode);
+    }
+    template <int N>
+    SPECULA_CPU_GPU Channels<N> bilerp(Point2f p, WrapMode2D wrap_mode = WrapMode::Clamp) const {
+      DASSERT_LE(N, n_channels());
+      return bilerp(p, StaticChannelDesc<N>(), wrap_mode);
+    }
+
     void set_channels(Point2i p, const ImageChannelValues &values);
     void set_channels(Point2i p, pstd::span<const Float> values);
     void set_channels(Point2i p, const ImageChannelDesc &desc, pstd::span<const Float> values);
@@ -232,17 +405,53 @@ namespace specula {
     SPECULA_CPU_GPU operator bool() const { return resolution_.x > 0 && resolution_.y > 0; }
 
   private:
+    /// Call `func` with a `DYNAMIC_CHANNELS` view, for lookups whose channels are already fixed
+    template <typename F> SPECULA_CPU_GPU decltype(auto) dispatch_format(F &&func) const {
+      switch (format_) {
+      case PixelFormat::U256:
+        return func(view<PixelFormat::U256>());
+      case PixelFormat::Half:
+        return func(view<PixelFormat::Half>());
+      default:
+        DASSERT(format_ == PixelFormat::Float);
+        return func(view<PixelFormat::Float>());
+      }
+    }
+
+    template <PixelFormat Format, typename F>
+    SPECULA_CPU_GPU decltype(auto) dispatch_channels(F &func) const {
+      switch (n_channels()) {
+      case 1:
+        return func(view<Format, 1>());
+      case 3:
+        return func(view<Format, 3>());
+      case 4:
+        return func(view<Format, 4>());
+      default:
+        return func(view<Format>());
+      }
+    }
+
     static std::vector<ResampleWeight> resample_weights(int old_res, int new_res);
 
-    bool write_exr(const std::string &name, const ImageMetadata &metadata) const;
-    bool write_pfm(const std::string &name, const ImageMetadata &metadata) const;
+    static ImageAndMetadata read_pfm(const std::string &filename, Allocator alloc);
+    static ImageAndMetadata read_qoi(const std::string &filename, Allocator alloc);
+    static ImageAndMetadata read_raw(const std::string &filename, ColorEncoding encoding);
+    static pstd::vector<Image> read_pyramid_cache(const std::string &filename, uint64_t key,
+                                                  ColorEncoding encoding, Allocator alloc);
+    static bool write_pyramid_cache(const std::string &filename, uint64_t key,
+                                    pstd::span<const Image> levels);
+
+    /// Use the pixels at `pixels` in place, keeping `file` mapped until they are released
+    void adopt_mapped_pixels(std::byte *pixels, std::shared_ptr<MappedFile> file);
+
     bool write_png(const std::string &name, const ImageMetadata &metadata) const;
-    bool write_qoi(const std::string &name, const ImageMetadata &metadata) const;
 
-    std::unique_ptr<uint8_t[]> quantize_pixels_to_u256(int *n_out_of_gamut) const;
+    friend class SubImage;
 
     PixelFormat format_;
     Point2i resolution_;
+    ImageLayout layout_ = ImageLayout::Scanline;
     pstd::vector<std::string> channel_names_;
     ColorEncoding encoding_ = nullptr;
 
@@ -251,6 +460,84 @@ namespace specula {
     pstd::vector<float> p32;
   };
 
+  /**
+   * @brief A rectangle and a subset of the channels of an `Image`, referenced without copying
+   *
+   * Channel `c` of pixel `p` of the view is channel `channels().offset[c]` of pixel
+   * `bounds().pmin + p` of the image, so consecutive pixels and rows of the view are a pixel and a
+   * row of the image apart. Tiles and crop windows can then be filtered, compared and written
+   * without first copying them into an image of their own. Views are cheap to copy and do not own
+   * the pixels, the image they are created from must outlive them.
+   */
+  class SubImage {
+  public:
+    SubImage() = default;
+    /// View of the whole image with all of its channels
+    explicit SubImage(const Image &image)
+        : image_(&image), bounds_({0, 0}, image.resolution()),
+          channels_(image.all_channels_desc()) {}
+    SubImage(const Image &image, const Bounds2i &bounds, const ImageChannelDesc &channels);
+
+    const Image &image() const { return *image_; }
+    const Bounds2i &bounds() const { return bounds_; }
+    const ImageChannelDesc &channels() const { return channels_; }
+
+    PixelFormat format() const { return image_->format(); }
+    Point2i resolution() const { return Point2i(bounds_.pmax - bounds_.pmin); }
+    int n_channels() const { return channels_.size(); }
+    std::vector<std::string> channel_names() const { return image_->channel_names(channels_); }
+
+    /// Whether the view covers every pixel and every channel of the image, in order
+    bool is_whole_image() const;
+
+    /// Find channels of the view by name, the offsets are relative to the channels of the view
+    ImageChannelDesc get_channel_desc(pstd::span<const std::string> channels) const;
+    ImageChannelDesc all_channels_desc() const;
+
+    Float get_channel(Point2i p, int c, WrapMode2D wrap_mode = WrapMode::Clamp) const {
+      if (!remap_pixel_coords(&p, resolution(), wrap_mode)) {
+        return 0;
+      }
+      return image_->get_channel(bounds_.pmin + Vector2i(p), channels_.offset[c]);
+    }
+
+    /// View of `bounds`, given in the pixel coordinates of this view
+    SubImage crop(const Bounds2i &bounds) const;
+    /// View of the channels `desc` of this view
+    SubImage select_channels(const ImageChannelDesc &desc) const;
+
+    void copy_rect_out(const Bounds2i &extent, pstd::span<float> buf,
+                       WrapMode2D wrap_mode = WrapMode::Clamp) const;
+
+    /// Copy the pixels of the view into a new image with the format and layout of the image
+    Image to_image(Allocator alloc = {}) const;
+
+    ImageChannelValues avarge() const;
+    /// The error metrics of `Image`, with `ref` matched to the channels of the view by position
+    ImageChannelValues mae(const SubImage &ref, Image *error_image = nullptr) const;
+    ImageChannelValues mse(const SubImage &ref, Image *error_image = nullptr) const;
+    ImageChannelValues mrse(const SubImage &ref, Image *error_image = nullptr) const;
+
+    Image gaussian_filter(int half_width, Float sigma) const;
+    Image joint_bilateral_filter(const ImageChannelDesc &to_filter, int half_width,
+                                 const Float xy_sigma[2], const ImageChannelDesc &joint,
+                                 const ImageChannelValues &joint_sigma) const;
+
+    bool write(const std::string &name, const ImageMetadata &metadata = {}) const;
+
+  private:
+    bool write_exr(const std::string &name, const ImageMetadata &metadata) const;
+    bool write_pfm(const std::string &name, const ImageMetadata &metadata) const;
+    bool write_qoi(const std::string &name, const ImageMetadata &metadata) const;
+    bool write_raw(const std::string &name, const ImageMetadata &metadata) const;
+
+    std::unique_ptr<uint8_t[]> quantize_pixels_to_u256(int *n_out_of_gamut) const;
+
+    const Image *image_ = nullptr;
+    Bounds2i bounds_;
+    ImageChannelDesc channels_;
+  };
+
   struct ImageAndMetadata {
     Image image;
     ImageMetadata metadata;
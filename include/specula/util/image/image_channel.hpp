@@ -54,6 +54,60 @@ namespace specula {
     }
   };
 
+  /**
+   * @brief Offsets of a number of channels known at compile time
+   *
+   * The fixed size counterpart of `ImageChannelDesc`. Lookups taking one return `Channels<N>`,
+   * so that the per-channel loops are unrolled and no `InlinedVector` is built per lookup.
+   */
+  template <int N> struct StaticChannelDesc {
+    StaticChannelDesc() {
+      for (int i = 0; i < N; ++i) {
+        offset[i] = i;
+      }
+    }
+    explicit StaticChannelDesc(const ImageChannelDesc &desc) {
+      ASSERT_EQ(N, desc.size());
+      for (int i = 0; i < N; ++i) {
+        offset[i] = desc.offset[i];
+      }
+    }
+
+    SPECULA_CPU_GPU static constexpr size_t size() { return N; }
+
+    pstd::array<int, N> offset;
+  };
+
+  /// Channel values returned by value from lookups with a `StaticChannelDesc`
+  template <int N> struct Channels : public pstd::array<Float, N> {
+    using pstd::array<Float, N>::array;
+
+    SPECULA_CPU_GPU Float max_value() const {
+      Float m = (*this)[0];
+      for (int i = 1; i < N; ++i) {
+        m = std::max(m, (*this)[i]);
+      }
+      return m;
+    }
+
+    SPECULA_CPU_GPU Float average() const {
+      Float sum = 0;
+      for (int i = 0; i < N; ++i) {
+        sum += (*this)[i];
+      }
+      return sum / N;
+    }
+
+    SPECULA_CPU_GPU operator Float() const
+      requires(N == 1)
+    {
+      return (*this)[0];
+    }
+  };
+
+  using ChannelsY = Channels<1>;
+  using ChannelsRGB = Channels<3>;
+  using ChannelsRGBA = Channels<4>;
 } // namespace specula
 
 #endif // INCLUDE_IMAGE_IMAGE_CHANNEL_HPP_
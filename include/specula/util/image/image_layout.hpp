@@ -0,0 +1,58 @@
+#ifndef INCLUDE_IMAGE_IMAGE_LAYOUT_HPP_
+#define INCLUDE_IMAGE_IMAGE_LAYOUT_HPP_
+
+#include "specula.hpp"
+#include "util/math/bit_operations.hpp"
+#include "util/vecmath/tuple2.hpp"
+
+namespace specula {
+  /**
+   * @brief Order in which the pixels of an image are stored.
+   *
+   * `Scanline` stores rows one after another. The tiled layouts split the image into square tiles
+   * that are stored one after another in scanline order, with the pixels inside of each tile in
+   * Morton (Z-curve) order. Neighboring pixels in either direction then usually share a cache line
+   * and a page, which is what bilinear and EWA filtering with arbitrary footprints need. Images
+   * with a tiled layout are padded up to a whole number of tiles.
+   */
+  enum class ImageLayout { Scanline, Tiled32, Tiled64 };
+
+  /// Base 2 logarithm of the tile size of `layout`, or 0 for `ImageLayout::Scanline`
+  SPECULA_CPU_GPU inline int tile_size_log2(ImageLayout layout) {
+    switch (layout) {
+    case ImageLayout::Tiled32:
+      return 5;
+    case ImageLayout::Tiled64:
+      return 6;
+    default:
+      return 0;
+    }
+  }
+
+  /// Number of pixels that need to be stored for an image, including tile padding
+  SPECULA_CPU_GPU inline size_t layout_pixel_count(ImageLayout layout, Point2i resolution) {
+    int log2 = tile_size_log2(layout);
+    if (log2 == 0) {
+      return size_t(resolution.x) * resolution.y;
+    }
+    // Rounded up in 64 bits, as resolutions near the largest int would overflow
+    int64_t mask = (int64_t(1) << log2) - 1;
+    size_t tiles_x = (resolution.x + mask) >> log2, tiles_y = (resolution.y + mask) >> log2;
+    return (tiles_x * tiles_y) << (2 * log2);
+  }
+
+  /// Index of the pixel `p` in the storage of an image, which must be multiplied by the channels
+  SPECULA_CPU_GPU inline size_t layout_pixel_index(ImageLayout layout, Point2i resolution,
+                                                   Point2i p) {
+    int log2 = tile_size_log2(layout);
+    if (log2 == 0) {
+      return size_t(p.y) * resolution.x + p.x;
+    }
+    int mask = (1 << log2) - 1;
+    size_t tiles_x = (resolution.x + int64_t(mask)) >> log2;
+    size_t tile = size_t(p.y >> log2) * tiles_x + (p.x >> log2);
+    return (tile << (2 * log2)) + encode_morton2(p.x & mask, p.y & mask);
+  }
+} // namespace specula
+
+#endif // INCLUDE_IMAGE_IMAGE_LAYOUT_HPP_
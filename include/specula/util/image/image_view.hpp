@@ -0,0 +1,226 @@
+#ifndef INCLUDE_IMAGE_IMAGE_VIEW_HPP_
+#define INCLUDE_IMAGE_IMAGE_VIEW_HPP_
+
+#include <type_traits>
+
+#include "specula.hpp"
+#include "util/check.hpp"
+#include "util/color/color_encoding.hpp"
+#include "util/float.hpp"
+#include "util/image/image_channel.hpp"
+#include "util/image/image_layout.hpp"
+#include "util/image/pixel_format.hpp"
+#include "util/image/wrap_mode.hpp"
+#include "util/pstd/array.hpp"
+#include "util/pstd/span.hpp"
+#include "util/vecmath/bounds2.hpp"
+#include "util/vecmath/tuple2.hpp"
+
+namespace specula {
+  /// Channel count of an `ImageView` whose number of channels is only known at runtime
+  inline constexpr int DYNAMIC_CHANNELS = 0;
+
+  template <PixelFormat Format> struct PixelStorage;
+  template <> struct PixelStorage<PixelFormat::U256> {
+    using type = uint8_t;
+  };
+  template <> struct PixelStorage<PixelFormat::Half> {
+    using type = Half;
+  };
+  template <> struct PixelStorage<PixelFormat::Float> {
+    using type = float;
+  };
+
+  /**
+   * @brief Read-only access to the texels of an image with a fixed pixel format.
+   *
+   * `Image` resolves the pixel format of every texel it reads, an `ImageView` resolves it once when
+   * it is created, so that texel fetches and bilinear lookups compile down to a load and a
+   * conversion. When `NChannels` is known at compile time the per-pixel channel loops are unrolled
+   * as well. Views are cheap to copy and do not own the pixels, the image they are created from
+   * must outlive them.
+   *
+   * @tparam Format The pixel format of the image.
+   * @tparam NChannels The number of channels of the image, or `DYNAMIC_CHANNELS`.
+   */
+  template <PixelFormat Format, int NChannels = DYNAMIC_CHANNELS> class ImageView {
+  public:
+    using value_type = typename PixelStorage<Format>::type;
+
+    ImageView() = default;
+    SPECULA_CPU_GPU ImageView(const value_type *data, Point2i resolution, int n_channels,
+                              ColorEncoding encoding = nullptr,
+                              ImageLayout layout = ImageLayout::Scanline)
+        : data_(data), resolution_(resolution), n_channels_(n_channels), layout_(layout) {
+      DASSERT(NChannels == DYNAMIC_CHANNELS || n_channels == NChannels);
+      if constexpr (Format == PixelFormat::U256) {
+        to_linear_table_ = encoding.to_linear_table();
+      }
+    }
+
+    SPECULA_CPU_GPU Point2i resolution() const { return resolution_; }
+    SPECULA_CPU_GPU ImageLayout layout() const { return layout_; }
+    SPECULA_CPU_GPU int n_channels() const {
+      if constexpr (NChannels != DYNAMIC_CHANNELS) {
+        return NChannels;
+      } else {
+        return n_channels_;
+      }
+    }
+
+    SPECULA_CPU_GPU size_t pixel_offset(Point2i p) const {
+      DASSERT(inside_exclusive(p, Bounds2i({0, 0}, resolution_)));
+      if (layout_ == ImageLayout::Scanline) {
+        return size_t(n_channels()) * (p.y * resolution_.x + p.x);
+      }
+      return size_t(n_channels()) * layout_pixel_index(layout_, resolution_, p);
+    }
+
+    /// Linear value of the texel at `offset` into the pixel data
+    SPECULA_CPU_GPU Float texel(size_t offset) const {
+      if constexpr (Format == PixelFormat::U256) {
+        return to_linear_table_ ? to_linear_table_[data_[offset]] : data_[offset] / 255.0f;
+      } else {
+        return Float(data_[offset]);
+      }
+    }
+
+    SPECULA_CPU_GPU Float get_channel(Point2i p, int c,
+                                      WrapMode2D wrap_mode = WrapMode::Clamp) const {
+      if (!remap_pixel_coords(&p, resolution_, wrap_mode)) {
+        return 0;
+      }
+      return texel(pixel_offset(p) + c);
+    }
+
+    SPECULA_CPU_GPU void get_channels(Point2i p, pstd::span<Float> values,
+                                      WrapMode2D wrap_mode = WrapMode::Clamp) const {
+      DASSERT_EQ(values.size(), n_channels());
+      if (!remap_pixel_coords(&p, resolution_, wrap_mode)) {
+        for (int c = 0; c < n_channels(); ++c) {
+          values[c] = 0;
+        }
+        return;
+      }
+      size_t offset = pixel_offset(p);
+      for (int c = 0; c < n_channels(); ++c) {
+        values[c] = texel(offset + c);
+      }
+    }
+
+    SPECULA_CPU_GPU Float lookup_nearest_channel(Point2f p, int c,
+                                                 WrapMode2D wrap_mode = WrapMode::Clamp) const {
+      Point2i pi(p.x * resolution_.x, p.y * resolution_.y);
+      return get_channel(pi, c, wrap_mode);
+    }
+
+    SPECULA_CPU_GPU Float bilerp_channel(Point2f p, int c,
+                                         WrapMode2D wrap_mode = WrapMode::Clamp) const {
+      Footprint fp = footprint(p, wrap_mode);
+      Float v[4];
+      for (int i = 0; i < 4; ++i) {
+        v[i] = fp.offset[i] < 0 ? Float(0) : texel(fp.offset[i] + c);
+      }
+      return fp.weight[0] * v[0] + fp.weight[1] * v[1] + fp.weight[2] * v[2] +
+             fp.weight[3] * v[3];
+    }
+
+    /// Bilinearly interpolate all channels, computing the footprint only once
+    SPECULA_CPU_GPU void bilerp(Point2f p, pstd::span<Float> values,
+                                WrapMode2D wrap_mode = WrapMode::Clamp) const {
+      DASSERT_EQ(values.size(), n_channels());
+      Footprint fp = footprint(p, wrap_mode);
+      for (int c = 0; c < n_channels(); ++c) {
+        Float v[4];
+        for (int i = 0; i < 4; ++i) {
+          v[i] = fp.offset[i] < 0 ? Float(0) : texel(fp.offset[i] + c);
+        }
+        values[c] = fp.weight[0] * v[0] + fp.weight[1] * v[1] + fp.weight[2] * v[2] +
+                    fp.weight[3] * v[3];
+      }
+    }
+
+    template <int N>
+    SPECULA_CPU_GPU Channels<N> get_channels(Point2i p, const StaticChannelDesc<N> &desc,
+                                             WrapMode2D wrap_mode = WrapMode::Clamp) const {
+      Channels<N> values{};
+      if (!remap_pixel_coords(&p, resolution_, wrap_mode)) {
+        return values;
+      }
+      size_t offset = pixel_offset(p);
+      for (int c = 0; c < N; ++c) {
+        values[c] = texel(offset + desc.offset[c]);
+      }
+      return values;
+    }
+
+    template <int N>
+    SPECULA_CPU_GPU Channels<N> lookup_nearest(Point2f p, const StaticChannelDesc<N> &desc,
+                                               WrapMode2D wrap_mode = WrapMode::Clamp) const {
+      Point2i pi(p.x * resolution_.x, p.y * resolution_.y);
+      return get_channels(pi, desc, wrap_mode);
+    }
+
+    /// Bilinearly interpolate the channels of `desc`, computing the footprint only once
+    template <int N>
+    SPECULA_CPU_GPU Channels<N> bilerp(Point2f p, const StaticChannelDesc<N> &desc,
+                                       WrapMode2D wrap_mode = WrapMode::Clamp) const {
+      Footprint fp = footprint(p, wrap_mode);
+      Channels<N> values;
+      for (int c = 0; c < N; ++c) {
+        Float v[4];
+        for (int i = 0; i < 4; ++i) {
+          v[i] = fp.offset[i] < 0 ? Float(0) : texel(fp.offset[i] + desc.offset[c]);
+        }
+        values[c] = fp.weight[0] * v[0] + fp.weight[1] * v[1] + fp.weight[2] * v[2] +
+                    fp.weight[3] * v[3];
+      }
+      return values;
+    }
+
+  private:
+    /// Offsets of the four texels of a bilinear lookup, -1 for texels outside of a black border
+    struct Footprint {
+      pstd::array<int64_t, 4> offset;
+      pstd::array<Float, 4> weight;
+    };
+
+    SPECULA_CPU_GPU Footprint footprint(Point2f p, WrapMode2D wrap_mode) const {
+      Float x = p[0] * resolution_.x - 0.5f, y = p[1] * resolution_.y - 0.5f;
+      int xi = pstd::floor(x), yi = pstd::floor(y);
+      Float dx = x - xi, dy = y - yi;
+
+      Footprint fp;
+      fp.weight = {(1 - dx) * (1 - dy), dx * (1 - dy), (1 - dx) * dy, dx * dy};
+
+      if (xi >= 0 && yi >= 0 && xi + 1 < resolution_.x && yi + 1 < resolution_.y) {
+        // Interior fast path, the texels are known to be in bounds so no wrapping is required
+        if (layout_ == ImageLayout::Scanline) {
+          int64_t offset = pixel_offset({xi, yi});
+          int64_t row = int64_t(n_channels()) * resolution_.x;
+          fp.offset = {offset, offset + n_channels(), offset + row, offset + row + n_channels()};
+        } else {
+          fp.offset = {int64_t(pixel_offset({xi, yi})), int64_t(pixel_offset({xi + 1, yi})),
+                       int64_t(pixel_offset({xi, yi + 1})),
+                       int64_t(pixel_offset({xi + 1, yi + 1}))};
+        }
+        return fp;
+      }
+
+      const Point2i corners[4] = {{xi, yi}, {xi + 1, yi}, {xi, yi + 1}, {xi + 1, yi + 1}};
+      for (int i = 0; i < 4; ++i) {
+        Point2i pi = corners[i];
+        fp.offset[i] = remap_pixel_coords(&pi, resolution_, wrap_mode) ? pixel_offset(pi) : -1;
+      }
+      return fp;
+    }
+
+    const value_type *data_ = nullptr;
+    Point2i resolution_;
+    int n_channels_ = NChannels;
+    ImageLayout layout_ = ImageLayout::Scanline;
+    const Float *to_linear_table_ = nullptr;
+  };
+} // namespace specula
+
+#endif // INCLUDE_IMAGE_IMAGE_VIEW_HPP_
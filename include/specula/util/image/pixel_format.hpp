@@ -4,6 +4,8 @@
 #include <string_view>
 
 #include "specula.hpp"
+#include "util/float.hpp"
+#include "util/pstd/span.hpp"
 
 namespace specula {
   enum class PixelFormat { U256, Half, Float };
@@ -13,6 +15,28 @@ namespace specula {
   SPECULA_CPU_GPU inline bool is_32bit(PixelFormat format) { return format == PixelFormat::Float; }
 
   SPECULA_CPU_GPU int texel_bytes(PixelFormat format);
+
+  /**
+   * @brief Convert a buffer of half precision values to `Float`
+   *
+   * On CPUs with F16C support the conversion is done eight values at a time using `vcvtph2ps`,
+   * otherwise it falls back to the software conversion of `Half`. Both produce identical results.
+   *
+   * @param vin The values to convert
+   * @param vout The destination for the converted values, must be the same size as `vin`
+   */
+  void half_to_float(pstd::span<const Half> vin, pstd::span<Float> vout);
+
+  /**
+   * @brief Convert a buffer of `Float` values to half precision, rounding to the nearest value
+   *
+   * On CPUs with F16C support the conversion is done eight values at a time using `vcvtps2ph`,
+   * otherwise it falls back to the software conversion of `Half`.
+   *
+   * @param vin The values to convert
+   * @param vout The destination for the converted values, must be the same size as `vin`
+   */
+  void float_to_half(pstd::span<const Float> vin, pstd::span<Half> vout);
 } // namespace specula
 
 template <> struct fmt::formatter<specula::PixelFormat> : formatter<std::string_view> {
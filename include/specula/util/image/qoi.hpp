@@ -0,0 +1,71 @@
+/**
+ * @file qoi.hpp
+ * @brief Encoder and decoder for the "Quite OK Image" format
+ *
+ * QOI is a sequential format, every pixel is coded relative to the pixels before it. To code
+ * large images in parallel the pixels are split into strips of rows, and each strip is coded
+ * independently starting from the initial coder state. The first strip is coded exactly as the
+ * reference encoder codes it. The first pixel of every later strip is stored as a literal, and
+ * only index entries written within the same strip are referenced, so the concatenated strips
+ * still form a single standard QOI stream that any decoder can read.
+ *
+ * A table of the byte offset of every strip is appended after the end marker, where standard
+ * decoders ignore it. Decoders that find the table decode the strips in parallel, and fall back
+ * to a sequential decode of the whole stream otherwise. Images small enough to fit in a single
+ * strip are written without a table, exactly as the reference encoder would.
+ */
+
+#ifndef INCLUDE_IMAGE_QOI_HPP_
+#define INCLUDE_IMAGE_QOI_HPP_
+
+#include <cstdint>
+#include <vector>
+
+#include "specula.hpp"
+#include "util/pstd/span.hpp"
+
+namespace specula {
+  /// Size and interpretation of the pixels of a QOI image
+  struct QoiDesc {
+    int width = 0, height = 0;
+    /// Either 3 for RGB or 4 for RGBA pixels
+    int channels = 0;
+    /// If the color channels are linear, otherwise they are sRGB encoded
+    bool linear = false;
+  };
+
+  /// Number of pixels that are coded together as a single strip
+  static constexpr int QOI_STRIP_PIXELS = 1 << 16;
+
+  /**
+   * @brief Encode 8-bit pixels as a QOI file
+   *
+   * @param pixels The `desc.channels` interleaved channels of every pixel, in scanline order.
+   * @param desc The size of the image.
+   * @param strips If the pixels are split into independently coded strips, otherwise the image is
+   * coded as a single strip.
+   * @return The contents of the file.
+   */
+  std::vector<uint8_t> qoi_encode(pstd::span<const uint8_t> pixels, const QoiDesc &desc,
+                                  bool strips = true);
+
+  /**
+   * @brief Read the header of a QOI file
+   *
+   * @return false if `data` does not start with a valid QOI header.
+   */
+  bool qoi_read_header(pstd::span<const std::byte> data, QoiDesc *desc);
+
+  /**
+   * @brief Decode the pixels of a QOI file
+   *
+   * @param data The contents of the file.
+   * @param desc The header of the file, as returned by `qoi_read_header`.
+   * @param pixels Receives the `desc.channels` interleaved channels of every pixel.
+   * @return false if the file is truncated or corrupt.
+   */
+  bool qoi_decode(pstd::span<const std::byte> data, const QoiDesc &desc,
+                  pstd::span<uint8_t> pixels);
+} // namespace specula
+
+#endif // INCLUDE_IMAGE_QOI_HPP_
@@ -0,0 +1,200 @@
+#ifndef INCLUDE_IMAGE_TILE_CACHE_HPP_
+#define INCLUDE_IMAGE_TILE_CACHE_HPP_
+
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "specula.hpp"
+#include "util/color/color_encoding.hpp"
+#include "util/image/image_layout.hpp"
+#include "util/image/pixel_format.hpp"
+#include "util/image/wrap_mode.hpp"
+#include "util/pstd/span.hpp"
+#include "util/vecmath/tuple2.hpp"
+
+namespace specula {
+  class Image;
+  class TiledImagePyramid;
+
+  /// A single tile sized slot of a `TileCache`, padded to a cache line to avoid false sharing
+  struct alignas(64) TileCacheSlot {
+    /// The key of the tile in the slot
+    std::atomic<uint64_t> key;
+    /// Number of `TileCache::Tile` handles pinning the slot, or -1 while it is being (re)loaded
+    std::atomic<int32_t> pins = 0;
+    /// Set on every access and cleared by the clock hand, evicted when already clear
+    std::atomic<bool> referenced = false;
+    /// Number of bytes of `data` used by the tile
+    size_t bytes = 0;
+    std::byte *data = nullptr;
+  };
+
+  /**
+   * @brief Fixed budget cache of image tiles that are loaded from disk on demand.
+   *
+   * The cache owns a fixed number of equally sized slots, each of which holds a single tile. Tiles
+   * are found through a shared open addressing table that is read without locking, in front of
+   * which every thread keeps a small direct mapped cache of the tiles it used most recently.
+   * Looking a tile up pins its slot, which keeps it from being evicted until the returned `Tile` is
+   * destroyed. Misses take a lock to pick a victim slot with the clock (second chance) policy, but
+   * the disk read itself happens outside of that lock.
+   *
+   * The hit rate and the number of bytes resident in the cache are reported through the
+   * statistics system.
+   */
+  class TileCache {
+  public:
+    /// Number of entries in the per-thread front cache
+    static constexpr int FRONT_CACHE_SIZE = 64;
+
+    /**
+     * @brief Construct a new tile cache
+     *
+     * @param max_bytes The total number of bytes that tiles may occupy.
+     * @param tile_bytes The size of a single slot, this is the largest tile the cache can hold.
+     * @param alloc The allocator used for the tile storage.
+     */
+    TileCache(size_t max_bytes, size_t tile_bytes, Allocator alloc = {});
+    ~TileCache();
+
+    TileCache(const TileCache &) = delete;
+    TileCache &operator=(const TileCache &) = delete;
+
+    size_t tile_bytes() const { return slot_bytes; }
+    size_t n_slots() const { return slot_count; }
+
+    /// A pinned tile, its data is valid and will not be evicted for the lifetime of the handle
+    class Tile {
+    public:
+      Tile() = default;
+      Tile(Tile &&other) : slot(other.slot) { other.slot = nullptr; }
+      Tile &operator=(Tile &&other) {
+        std::swap(slot, other.slot);
+        return *this;
+      }
+      ~Tile() { release(); }
+
+      const std::byte *data() const { return slot->data; }
+      explicit operator bool() const { return slot != nullptr; }
+
+      void release();
+
+    private:
+      friend class TileCache;
+      explicit Tile(TileCacheSlot *slot) : slot(slot) {}
+
+      TileCacheSlot *slot = nullptr;
+    };
+
+    /**
+     * @brief Find a tile of an image, loading it from disk if it is not resident
+     *
+     * @param image The image the tile belongs to.
+     * @param tile The index of the tile in the image file.
+     * @return The pinned tile.
+     */
+    Tile lookup(const TiledImagePyramid &image, uint64_t tile) const;
+
+    /// Length of the longest run of occupied hash table entries, which bounds every lookup
+    size_t longest_cluster() const;
+
+  private:
+    friend class TiledImagePyramid;
+
+    uint32_t register_image() { return next_image_id.fetch_add(1, std::memory_order_relaxed); }
+
+    int find(uint64_t key) const;
+    void insert(uint64_t key, int slot) const;
+    void remove(uint64_t key, int slot) const;
+    int evict() const;
+    Tile load(const TiledImagePyramid &image, uint64_t tile, uint64_t key) const;
+
+    Allocator alloc;
+    size_t slot_bytes, slot_count;
+    std::byte *storage = nullptr;
+    std::unique_ptr<TileCacheSlot[]> slots;
+    /// Slot index plus one of every resident tile, indexed by the hash of its key
+    std::unique_ptr<std::atomic<uint32_t>[]> table;
+    size_t table_mask;
+
+    /// Unique id of the cache, used to invalidate the front cache of threads that switch caches
+    uint32_t id;
+    std::atomic<uint32_t> next_image_id = 1;
+    mutable std::mutex mutex;
+    mutable size_t hand = 0;
+  };
+
+  /**
+   * @brief Image pyramid stored in a tiled file on disk, whose tiles are read through a `TileCache`
+   *
+   * The file stores every level with one of the tiled `ImageLayout`s, so a tile on disk is exactly
+   * a tile of an in-memory `Image` with the same layout.
+   */
+  class TiledImagePyramid {
+  public:
+    /**
+     * @brief Write the levels of an image pyramid to a tiled image file
+     *
+     * @param filename The file to write.
+     * @param levels The levels of the pyramid, which must all have the same format and channels.
+     * @param layout The tiled layout to store the levels with.
+     * @return true if the file was written successfully
+     */
+    static bool write(const std::string &filename, pstd::span<const Image> levels,
+                      ImageLayout layout = ImageLayout::Tiled64);
+
+    /**
+     * @brief Open a tiled image file for reading
+     *
+     * @param filename The file to open.
+     * @param cache The cache the tiles of the image are read through.
+     * @param encoding The color encoding of the pixels, required for `PixelFormat::U256` images.
+     * @return The image, or `nullptr` if the file could not be opened.
+     */
+    static std::unique_ptr<TiledImagePyramid> open(const std::string &filename, TileCache *cache,
+                                                   ColorEncoding encoding = nullptr);
+
+    ~TiledImagePyramid();
+
+    PixelFormat format() const { return format_; }
+    int n_channels() const { return n_channels_; }
+    int n_levels() const { return level_resolution_.size(); }
+    Point2i level_resolution(int level) const { return level_resolution_[level]; }
+
+    Float get_channel(int level, Point2i p, int c, WrapMode2D wrap_mode = WrapMode::Clamp) const;
+    Float bilerp_channel(int level, Point2f p, int c,
+                         WrapMode2D wrap_mode = WrapMode::Clamp) const;
+
+  private:
+    friend class TileCache;
+
+    TiledImagePyramid() = default;
+
+    void read_tile(uint64_t tile, std::byte *dst) const;
+    Float texel(const std::byte *data, size_t offset) const;
+
+    std::string filename;
+    TileCache *cache = nullptr;
+    uint32_t id = 0;
+
+    PixelFormat format_;
+    int n_channels_ = 0;
+    ColorEncoding encoding;
+    int tile_log2 = 0;
+    size_t tile_bytes = 0;
+    size_t data_offset = 0;
+    std::vector<Point2i> level_resolution_;
+    std::vector<uint64_t> level_first_tile;
+
+    // Tiles are read with `pread` where it is available, otherwise through a shared `FILE`
+    int fd = -1;
+    FILE *file = nullptr;
+    mutable std::mutex file_mutex;
+  };
+} // namespace specula
+
+#endif // INCLUDE_IMAGE_TILE_CACHE_HPP_
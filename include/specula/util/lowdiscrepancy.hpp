@@ -0,0 +1,355 @@
+/**
+ * @file lowdiscrepancy.hpp
+ * @brief Low-discrepancy sequences and their randomization
+ *
+ * Radical inverses in prime bases generate the points of the Halton sequence, which cover the
+ * sample domain much more evenly than independent random values do. Each dimension uses the next
+ * prime of `PRIMES` as its base. Randomizing the points, by permuting their digits or with Owen
+ * scrambling, removes the structure that the unscrambled sequence shows between dimensions while
+ * keeping its good distribution.
+ *
+ * The Sobol sequence is the base 2 counterpart, generated with one binary matrix per dimension.
+ * Its points are computed with bit operations only, and are randomized with the scramblers below.
+ * Tables of progressive multi-jittered (0, 2) points are generated from it ahead of time.
+ */
+
+#ifndef INCLUDE_UTIL_LOWDISCREPANCY_HPP_
+#define INCLUDE_UTIL_LOWDISCREPANCY_HPP_
+
+#include <algorithm>
+#include <memory>
+#include <string>
+
+#include "specula.hpp"
+#include "util/check.hpp"
+#include "util/file.hpp"
+#include "util/float.hpp"
+#include "util/hash.hpp"
+#include "util/math.hpp"
+#include "util/primes.hpp"
+#include "util/pstd/span.hpp"
+#include "util/pstd/vector.hpp"
+#include "util/vecmath/tuple2.hpp"
+
+namespace specula {
+  /// How the points of a low-discrepancy sequence are randomized
+  enum class RandomizeStrategy { None, PermuteDigits, FastOwen, Owen };
+
+  /**
+   * @brief Radical inverse of `a` in the base `PRIMES[base_index]`
+   *
+   * The digits of `a` are mirrored around the radix point, so that \f$a = \sum_i d_i b^i\f$ maps
+   * to \f$\sum_i d_i b^{-i-1}\f$.
+   *
+   * @param base_index The index of the base in `PRIMES`.
+   * @param a The index of the point.
+   * @return The radical inverse, in \f$[0, 1)\f$.
+   */
+  SPECULA_CPU_GPU inline Float radical_inverse(int base_index, uint64_t a) {
+    unsigned int base = PRIMES[base_index];
+    // Digits past the point where the reversed value could overflow are too small to matter
+    uint64_t limit = ~0ull / base - base;
+    Float inv_base = Float(1) / Float(base), inv_base_m = 1;
+    uint64_t reversed_digits = 0;
+    while (a && reversed_digits < limit) {
+      uint64_t next = a / base;
+      uint64_t digit = a - next * base;
+      reversed_digits = reversed_digits * base + digit;
+      inv_base_m *= inv_base;
+      a = next;
+    }
+    return std::min(reversed_digits * inv_base_m, OneMinusEpsilon);
+  }
+
+  /**
+   * @brief Inverse of the radical inverse, given the reversed digits as an integer
+   *
+   * @param inverse The first `n_digits` digits of a radical inverse, as an integer.
+   * @param base The base of the digits.
+   * @param n_digits The number of digits.
+   * @return The index whose radical inverse starts with those digits.
+   */
+  SPECULA_CPU_GPU inline uint64_t inverse_radical_inverse(uint64_t inverse, int base,
+                                                         int n_digits) {
+    uint64_t index = 0;
+    for (int i = 0; i < n_digits; ++i) {
+      uint64_t digit = inverse % base;
+      inverse /= base;
+      index = index * base + digit;
+    }
+    return index;
+  }
+
+  /**
+   * @brief Random permutation of the digits of a base, one per digit position
+   *
+   * A view into the storage of a `DigitPermutations` table, which must outlive it.
+   */
+  class DigitPermutation {
+  public:
+    DigitPermutation() = default;
+    SPECULA_CPU_GPU DigitPermutation(int base, const uint16_t *permutations)
+        : base(base), permutations(permutations) {}
+
+    /// Number of digits in the base that contribute to a `Float` radical inverse
+    static int digit_count(int base);
+
+    /// Fill the `digit_count(base) * base` values of the permutations of `base` for `seed`
+    static void fill(int base, uint32_t seed, pstd::span<uint16_t> permutations);
+
+    SPECULA_CPU_GPU int permute(int digit_index, int digit_value) const {
+      DASSERT_LT(digit_value, base);
+      return permutations[digit_index * base + digit_value];
+    }
+
+  private:
+    int base = 0;
+    const uint16_t *permutations = nullptr;
+  };
+
+  /**
+   * @brief The digit permutations of the first bases of `PRIMES`
+   *
+   * The permutations of all bases are stored in a single allocation and filled in parallel, so
+   * that they are computed once up front rather than in the sampling hot path. Their size grows
+   * with the sum of the bases, a few megabytes for the first thousand primes.
+   */
+  class DigitPermutations {
+  public:
+    DigitPermutations(Allocator alloc = {}) : offsets(alloc), table(alloc) {}
+    DigitPermutations(int n_bases, uint32_t seed, Allocator alloc = {});
+
+    SPECULA_CPU_GPU size_t size() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+    SPECULA_CPU_GPU DigitPermutation operator[](int base_index) const {
+      DASSERT_LT(base_index, size());
+      return DigitPermutation(PRIMES[base_index], table.data() + offsets[base_index]);
+    }
+
+  private:
+    pstd::vector<size_t> offsets;
+    pstd::vector<uint16_t> table;
+  };
+
+  /**
+   * @brief Radical inverse of `a` with the digits permuted by `perm`
+   *
+   * All digits that contribute to the result are permuted, including the zero digits past the
+   * last nonzero digit of `a`, so the points fill \f$[0, 1)\f$ rather than collapsing towards zero.
+   */
+  SPECULA_CPU_GPU inline Float scrambled_radical_inverse(int base_index, uint64_t a,
+                                                         const DigitPermutation &perm) {
+    unsigned int base = PRIMES[base_index];
+    uint64_t limit = ~0ull / base - base;
+    Float inv_base = Float(1) / Float(base), inv_base_m = 1;
+    uint64_t reversed_digits = 0;
+    int digit_index = 0;
+    while (1 - (base - 1) * inv_base_m < 1 && reversed_digits < limit) {
+      uint64_t next = a / base;
+      int digit_value = a - next * base;
+      reversed_digits = reversed_digits * base + perm.permute(digit_index, digit_value);
+      inv_base_m *= inv_base;
+      ++digit_index;
+      a = next;
+    }
+    return std::min(inv_base_m * reversed_digits, OneMinusEpsilon);
+  }
+
+  /**
+   * @brief Radical inverse of `a` with Owen scrambling
+   *
+   * Each digit is permuted depending on all the digits before it, with the permutation selected
+   * by hashing them together with `hash`. Unlike `scrambled_radical_inverse`, this needs no tables.
+   */
+  SPECULA_CPU_GPU inline Float owen_scrambled_radical_inverse(int base_index, uint64_t a,
+                                                              uint32_t hash) {
+    unsigned int base = PRIMES[base_index];
+    uint64_t limit = ~0ull / base - base;
+    Float inv_base = Float(1) / Float(base), inv_base_m = 1;
+    uint64_t reversed_digits = 0;
+    while (1 - inv_base_m < 1 && reversed_digits < limit) {
+      uint64_t next = a / base;
+      int digit_value = a - next * base;
+      uint32_t digit_hash = mix_bits(hash ^ reversed_digits);
+      digit_value = permutation_element(digit_value, base, digit_hash);
+      reversed_digits = reversed_digits * base + digit_value;
+      inv_base_m *= inv_base;
+      a = next;
+    }
+    return std::min(inv_base_m * reversed_digits, OneMinusEpsilon);
+  }
+
+  /// Number of dimensions of the Sobol generator matrices
+  static constexpr int N_SOBOL_DIMENSIONS = 1024;
+  /// Number of columns of each Sobol generator matrix, and so of bits of a sample index
+  static constexpr int SOBOL_MATRIX_SIZE = 52;
+
+  /**
+   * @brief The Sobol generator matrices, `SOBOL_MATRIX_SIZE` columns per dimension
+   *
+   * Column \f$j\f$ of a dimension holds the 32 most significant bits of the point of index
+   * \f$2^j\f$. The first dimension is the van der Corput sequence, the others use the primitive
+   * polynomials over \f$\mathbb{F}_2\f$ in increasing order, with initial direction numbers
+   * derived from a hash of the dimension. The table is generated on first use.
+   */
+  const uint32_t *sobol_matrices_32();
+
+  /// Sobol points without randomization
+  struct NoRandomizer {
+    SPECULA_CPU_GPU NoRandomizer(uint32_t = 0) {}
+    SPECULA_CPU_GPU uint32_t operator()(uint32_t v) const { return v; }
+  };
+
+  /// Random binary digital shift, which flips the same bits of every point
+  struct BinaryPermuteScrambler {
+    SPECULA_CPU_GPU BinaryPermuteScrambler(uint32_t permutation) : permutation(permutation) {}
+    SPECULA_CPU_GPU uint32_t operator()(uint32_t v) const { return permutation ^ v; }
+
+    uint32_t permutation;
+  };
+
+  /**
+   * @brief Owen scrambling approximated with a hash of the reversed bits
+   *
+   * A nested uniform scramble flips each bit depending on the bits above it. Hashing the reversed
+   * value with a function in which each bit only affects the bits above it gives the same
+   * structure at the cost of a few multiplications.
+   *
+   * @see Brent Burley, "Practical Hash-based Owen Scrambling", JCGT 9(4), 2020
+   */
+  struct FastOwenScrambler {
+    SPECULA_CPU_GPU FastOwenScrambler(uint32_t seed) : seed(seed) {}
+
+    SPECULA_CPU_GPU uint32_t operator()(uint32_t v) const {
+      v = reverse_bits_32(v);
+      v ^= v * 0x3d20adea;
+      v += seed;
+      v *= (seed >> 16) | 1;
+      v ^= v * 0x05526c56;
+      v ^= v * 0x53a22864;
+      return reverse_bits_32(v);
+    }
+
+    uint32_t seed;
+  };
+
+  /// Owen scrambling, flipping each bit with a hash of the bits above it and the seed
+  struct OwenScrambler {
+    SPECULA_CPU_GPU OwenScrambler(uint32_t seed) : seed(seed) {}
+
+    SPECULA_CPU_GPU uint32_t operator()(uint32_t v) const {
+      v ^= (seed & 1) << 31;
+      for (int b = 1; b < 32; ++b) {
+        uint32_t mask = (~0u) << (32 - b);
+        uint32_t flip = (uint32_t(mix_bits((v & mask) ^ seed)) >> b) & 1;
+        v ^= flip << (31 - b);
+      }
+      return v;
+    }
+
+    uint32_t seed;
+  };
+
+  /**
+   * @brief The bits of the Sobol point of index `a` in `dimension`
+   *
+   * The product of the generator matrix with the bits of the index, computed without branches by
+   * masking each column with the corresponding bit.
+   */
+  SPECULA_CPU_GPU inline uint32_t sobol_bits(uint64_t a, int dimension) {
+    DASSERT_LT(dimension, N_SOBOL_DIMENSIONS);
+    DASSERT_LT(a, uint64_t(1) << SOBOL_MATRIX_SIZE);
+    const uint32_t *matrix = sobol_matrices_32() + dimension * SOBOL_MATRIX_SIZE;
+    uint32_t v = 0;
+    for (int i = 0; a != 0; a >>= 1, ++i) {
+      v ^= matrix[i] & (0u - uint32_t(a & 1));
+    }
+    return v;
+  }
+
+  /**
+   * @brief The Sobol point of index `a` in `dimension`, randomized with `randomizer`
+   *
+   * @param a The index of the point.
+   * @param dimension The dimension, less than `N_SOBOL_DIMENSIONS`.
+   * @param randomizer The scrambler applied to the bits of the point.
+   * @return The point, in \f$[0, 1)\f$.
+   */
+  template <typename R>
+  SPECULA_CPU_GPU inline Float sobol_sample(uint64_t a, int dimension, R randomizer) {
+    uint32_t v = randomizer(sobol_bits(a, dimension));
+    return std::min(v * 0x1p-32f, OneMinusEpsilon);
+  }
+
+  /**
+   * @brief Sets of progressive multi-jittered (0, 2) points
+   *
+   * Every prefix of \f$2^k\f$ points of a set has exactly one point in each elementary interval
+   * of area \f$2^{-k}\f$, so any power of two number of samples per pixel is well stratified in
+   * both dimensions and in each of them on its own. Generating such points is too slow for the
+   * sampling hot path, so the sets are generated once, written to a file, and mapped into memory
+   * when rendering. Coordinates are stored as 32-bit fixed point fractions.
+   */
+  class PMJ02Table {
+  public:
+    PMJ02Table(Allocator alloc = {}) : storage(alloc) {}
+
+    /**
+     * @brief Generate the point sets, in parallel
+     *
+     * Each set is the (0, 2)-sequence of the first two Sobol dimensions with its own Owen
+     * scrambling, which has the same distribution as the sequences of the pmj02 algorithm.
+     *
+     * @param n_sets The number of independent sets.
+     * @param n_samples The number of points of each set, a power of two.
+     * @param seed The seed of the scrambling.
+     * @param alloc The allocator of the points.
+     */
+    static PMJ02Table generate(int n_sets, int n_samples, uint32_t seed, Allocator alloc = {});
+
+    /**
+     * @brief Map a table written by `write` into memory
+     *
+     * @return The table, empty if the file is missing or invalid.
+     */
+    static PMJ02Table open(const std::string &filename);
+
+    /// Write the table to `filename`, atomically replacing any existing file
+    bool write(const std::string &filename) const;
+
+    SPECULA_CPU_GPU bool empty() const { return n_sets_ == 0; }
+    SPECULA_CPU_GPU int n_sets() const { return n_sets_; }
+    SPECULA_CPU_GPU int n_samples() const { return n_samples_; }
+
+    /**
+     * @brief Point `index` of `set`, with its bits flipped by a random digital shift
+     *
+     * A digital shift keeps the stratification of the points, which makes it suitable to
+     * decorrelate the pixels sharing the same set.
+     *
+     * @param set The set, less than `n_sets()`.
+     * @param index The index of the point, less than `n_samples()`.
+     * @param shift The bits to flip, the low 32 of the first coordinate, the high 32 of the second.
+     */
+    SPECULA_CPU_GPU Point2f sample(int set, int index, uint64_t shift = 0) const {
+      DASSERT(set >= 0 && set < n_sets_);
+      DASSERT(index >= 0 && index < n_samples_);
+      const uint32_t *p = points() + 2 * (size_t(set) * n_samples_ + index);
+      return {std::min((p[0] ^ uint32_t(shift)) * 0x1p-32f, OneMinusEpsilon),
+              std::min((p[1] ^ uint32_t(shift >> 32)) * 0x1p-32f, OneMinusEpsilon)};
+    }
+
+  private:
+    SPECULA_CPU_GPU const uint32_t *points() const {
+      return file ? mapped_points : storage.data();
+    }
+
+    int n_sets_ = 0, n_samples_ = 0;
+    /// Points of generated tables
+    pstd::vector<uint32_t> storage;
+    /// Points of tables mapped from a file, which the mapping keeps alive
+    std::shared_ptr<MappedFile> file;
+    const uint32_t *mapped_points = nullptr;
+  };
+} // namespace specula
+
+#endif // INCLUDE_UTIL_LOWDISCREPANCY_HPP_
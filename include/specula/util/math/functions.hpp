@@ -52,6 +52,30 @@ namespace specula {
   }
   template <> inline SPECULA_CPU_GPU Float mod(Float a, Float b) { return std::fmod(a, b); }
 
+  /**
+   * @brief Find \f$x\f$ and \f$y\f$ such that \f$ax + by = \gcd(a, b)\f$
+   *
+   * @see https://en.wikipedia.org/wiki/Extended_Euclidean_algorithm
+   */
+  inline SPECULA_CPU_GPU void extended_gcd(uint64_t a, uint64_t b, int64_t *x, int64_t *y) {
+    if (b == 0) {
+      *x = 1;
+      *y = 0;
+      return;
+    }
+    int64_t d = a / b, xp, yp;
+    extended_gcd(b, a % b, &xp, &yp);
+    *x = yp;
+    *y = xp - (d * yp);
+  }
+
+  /// The inverse of `a` modulo `n`, which must be coprime with it
+  inline SPECULA_CPU_GPU uint64_t multiplicative_inverse(int64_t a, int64_t n) {
+    int64_t x, y;
+    extended_gcd(a, n, &x, &y);
+    return mod(x, n);
+  }
+
   inline SPECULA_CPU_GPU Float radians(Float deg) { return (Pi / 180) * deg; }
   inline SPECULA_CPU_GPU Float degrees(Float rad) { return (180 / Pi) * rad; }
 
@@ -0,0 +1,64 @@
+/**
+ * @file parallel.hpp
+ * @brief Parallel loops over a shared pool of worker threads
+ *
+ * The worker threads are started the first time a parallel loop is run, or explicitly by calling
+ * `parallel_init`. Loops are split into chunks that are claimed by the workers and the calling
+ * thread alike, so the caller always contributes to its own loop. Loops started from inside of
+ * another parallel loop run serially on the calling thread.
+ */
+
+#ifndef INCLUDE_UTIL_PARALLEL_HPP_
+#define INCLUDE_UTIL_PARALLEL_HPP_
+
+#include <functional>
+
+#include "specula.hpp"
+#include "util/vecmath/bounds2.hpp"
+
+namespace specula {
+  /**
+   * @brief Start the worker threads
+   *
+   * @param n_threads The total number of threads to use, including the calling thread, or 0 to
+   * use one thread per available core.
+   */
+  void parallel_init(int n_threads = 0);
+
+  /// Stop and join the worker threads, they will be restarted by the next parallel loop
+  void parallel_cleanup();
+
+  /// Number of cores available to the process
+  int available_cores();
+
+  /// Number of threads that run parallel loops, including the calling thread
+  int running_threads();
+
+  /**
+   * @brief Run `func` over the range \f$[start, end)\f$ in parallel, in contiguous chunks
+   *
+   * @param start The first index of the range
+   * @param end One past the last index of the range
+   * @param func Called with the bounds \f$[begin, end)\f$ of each chunk
+   */
+  void parallel_for(int64_t start, int64_t end, std::function<void(int64_t, int64_t)> func);
+
+  /**
+   * @brief Run `func` for every index in the range \f$[start, end)\f$ in parallel
+   *
+   * @param start The first index of the range
+   * @param end One past the last index of the range
+   * @param func Called once with each index
+   */
+  void parallel_for(int64_t start, int64_t end, std::function<void(int64_t)> func);
+
+  /**
+   * @brief Run `func` over the tiles of `extent` in parallel
+   *
+   * @param extent The region to cover
+   * @param func Called with each tile, the tiles do not overlap and together cover `extent`
+   */
+  void parallel_for_2d(const Bounds2i &extent, std::function<void(Bounds2i)> func);
+} // namespace specula
+
+#endif // INCLUDE_UTIL_PARALLEL_HPP_
@@ -12,7 +12,10 @@
 #define SPECULA_UTIL_PSTD_PMR_HPP_
 
 #include <cstddef>
+#include <memory>
+#include <mutex>
 #include <thread>
+#include <unordered_map>
 
 /**
  * @brief Namespace for Polymorphic Memory Resource (PMR) classes, derived from the `std::pmr`
@@ -191,6 +194,55 @@ namespace specula::pstd::pmr {
     block *block_list = nullptr;
   };
 
+  /**
+   * @class unowned_buffer_resource
+   * @brief A `memory_resource` for containers that adopt storage they do not own.
+   *
+   * Buffers registered with `adopt` belong to someone else, such as a memory mapped file, so
+   * deallocating them never frees the memory. Instead the resource holds on to the owner of each
+   * buffer until the container deallocates it, which keeps the buffer valid for as long as the
+   * container uses it. All other allocations are forwarded to the upstream resource, so a
+   * container that adopted a buffer can still grow or be assigned to.
+   */
+  class unowned_buffer_resource : public memory_resource {
+  public:
+    explicit unowned_buffer_resource(memory_resource *upstream) : upstream(upstream) {}
+    unowned_buffer_resource() : unowned_buffer_resource(get_default_resource()) {}
+
+    unowned_buffer_resource(const unowned_buffer_resource &) = delete;
+    unowned_buffer_resource &operator=(const unowned_buffer_resource &) = delete;
+
+    /**
+     * @brief Register a buffer, so that deallocating it releases `owner` instead of the memory
+     *
+     * @param p The start of the buffer.
+     * @param owner Kept alive until `p` is deallocated, may be `nullptr` if the buffer outlives
+     * every container using it.
+     */
+    void adopt(void *p, std::shared_ptr<const void> owner = nullptr) {
+      std::lock_guard<std::mutex> lock(mutex);
+      buffers.emplace(p, std::move(owner));
+    }
+
+    memory_resource *upstream_resource() const { return upstream; }
+
+  protected:
+    void *do_allocate(size_t bytes, size_t align) override {
+      return upstream->allocate(bytes, align);
+    }
+
+    void do_deallocate(void *p, size_t bytes, size_t alignment) override;
+
+    bool do_is_equal(const memory_resource &other) const noexcept override {
+      return this == &other;
+    }
+
+  private:
+    memory_resource *upstream;
+    std::mutex mutex;
+    std::unordered_multimap<void *, std::shared_ptr<const void>> buffers;
+  };
+
   /**
    * @brief An allocator that supports run-time polymorphism based on the `memory_resource` it is
    * constructed with.
@@ -4,6 +4,7 @@
 #include <cstddef>
 #include <initializer_list>
 #include <iterator>
+#include <type_traits>
 
 #include "specula/specula.hpp"
 #include "specula/util/check.hpp"
@@ -151,6 +152,22 @@ namespace specula::pstd {
       ptr = ra;
     }
 
+    /**
+     * @brief Take over `count` existing elements at `p`, instead of allocating new storage
+     *
+     * The elements are not constructed, so they must already hold valid values. The storage is
+     * released through the allocator like any other, so its resource must accept `p`, see
+     * `pmr::unowned_buffer_resource`.
+     */
+    void adopt(T *p, size_t count) {
+      static_assert(std::is_trivially_copyable_v<T>,
+                    "Only trivially copyable elements can be adopted");
+      clear();
+      alloc.deallocate_object(ptr, n_alloc);
+      ptr = p;
+      n_alloc = n_stored = count;
+    }
+
     void clear() {
       for (size_t i = 0; i < n_stored; ++i)
         alloc.destroy(&ptr[i]);
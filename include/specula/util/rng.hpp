@@ -17,6 +17,8 @@
 #include "specula/util/check.hpp"
 #include "specula/util/float.hpp"
 #include "specula/util/hash.hpp"
+#include "specula/util/pstd/array.hpp"
+#include "specula/util/pstd/span.hpp"
 
 namespace specula {
 
@@ -188,6 +190,8 @@ namespace specula {
     }
 
   private:
+    friend class RngX8;
+
     std::uint64_t state, inc;
   };
 
@@ -291,6 +295,112 @@ namespace specula {
     uniform<std::uint32_t>();
   }
 
+  /**
+   * @class RngX8
+   * @brief Eight independent PCG32 generators advanced together
+   *
+   * Each lane holds the state of a scalar `Rng` and produces exactly the same sequence of values,
+   * so code that consumes random numbers in bulk can switch between the two without changing its
+   * results. The bulk fills step all lanes at once with AVX2 when the CPU supports it.
+   *
+   * Values are interleaved between the lanes: element \f$8k + l\f$ of a fill is the \f$k\f$-th
+   * value of lane \f$l\f$. A fill whose size is not a multiple of eight still advances every lane
+   * by the same number of steps, discarding the values that do not fit, so the lanes stay in
+   * lockstep.
+   */
+  class RngX8 {
+  public:
+    /// Number of lanes
+    static constexpr int WIDTH = 8;
+
+    /// Initialize every lane with the default state and stream of `Rng`
+    RngX8() {
+      state.fill(PCG32_DEFAULT_STATE);
+      inc.fill(PCG32_DEFAULT_STREAM);
+    }
+
+    /**
+     * @brief Constructs the generators with a sequence index and offset per lane.
+     *
+     * @param seq_index Sequence index of each lane.
+     * @param offset Offset of each lane.
+     */
+    RngX8(pstd::span<const std::uint64_t> seq_index, pstd::span<const std::uint64_t> offset) {
+      set_sequence(seq_index, offset);
+    }
+
+    /**
+     * @brief Constructs the generators with a sequence index per lane.
+     *
+     * @param seq_index Sequence index of each lane.
+     */
+    RngX8(pstd::span<const std::uint64_t> seq_index) { set_sequence(seq_index); }
+
+    /// Set the sequence of each lane, as `Rng::set_sequence(seq_index[l], offset[l])` would
+    void set_sequence(pstd::span<const std::uint64_t> seq_index,
+                      pstd::span<const std::uint64_t> offset) {
+      ASSERT_EQ(seq_index.size(), WIDTH);
+      ASSERT_EQ(offset.size(), WIDTH);
+      for (int l = 0; l < WIDTH; ++l) {
+        set_lane(l, Rng(seq_index[l], offset[l]));
+      }
+    }
+
+    /// Set the sequence of each lane, as `Rng::set_sequence(seq_index[l])` would
+    void set_sequence(pstd::span<const std::uint64_t> seq_index) {
+      ASSERT_EQ(seq_index.size(), WIDTH);
+      for (int l = 0; l < WIDTH; ++l) {
+        set_lane(l, Rng(seq_index[l]));
+      }
+    }
+
+    /// The scalar generator of lane `l`, in its current state
+    Rng lane(int l) const {
+      DASSERT(l >= 0 && l < WIDTH);
+      Rng rng;
+      rng.state = state[l];
+      rng.inc = inc[l];
+      return rng;
+    }
+
+    /// Replace lane `l` with the scalar generator `rng`
+    void set_lane(int l, const Rng &rng) {
+      DASSERT(l >= 0 && l < WIDTH);
+      state[l] = rng.state;
+      inc[l] = rng.inc;
+    }
+
+    /// Advance every lane by `idelta` steps, see `Rng::advance`
+    void advance(std::int64_t idelta) {
+      for (int l = 0; l < WIDTH; ++l) {
+        Rng rng = lane(l);
+        rng.advance(idelta);
+        set_lane(l, rng);
+      }
+    }
+
+    /**
+     * @brief Fill `values` with random values of type T.
+     *
+     * Only `std::uint32_t` and `float` are supported, matching `Rng::uniform<T>()` for each lane.
+     *
+     * @tparam T Type of the random values to generate.
+     * @param values The values to fill, interleaved between the lanes.
+     */
+    template <typename T> void uniform(pstd::span<T> values);
+
+  private:
+    alignas(32) pstd::array<std::uint64_t, WIDTH> state;
+    alignas(32) pstd::array<std::uint64_t, WIDTH> inc;
+  };
+
+  template <typename T> inline void RngX8::uniform(pstd::span<T> values) {
+    static_assert(sizeof(T) == 0, "RngX8 only generates std::uint32_t and float values");
+  }
+
+  template <> void RngX8::uniform<std::uint32_t>(pstd::span<std::uint32_t> values);
+  template <> void RngX8::uniform<float>(pstd::span<float> values);
+
 } // namespace specula
 
 #endif // SPECULA_UTIL_RNG_HPP_
@@ -0,0 +1,347 @@
+/**
+ * @file samplers.hpp
+ * @brief Samplers generating the sample values of each pixel
+ *
+ * A sampler is positioned at a sample of a pixel with `start_pixel_sample`, after which each call
+ * to `get_1d` or `get_2d` returns the values of the next dimensions of that sample. The values of
+ * a given pixel, sample index and dimension are always the same, whichever thread asks for them
+ * and in whatever order the pixels are visited.
+ */
+
+#ifndef INCLUDE_UTIL_SAMPLERS_HPP_
+#define INCLUDE_UTIL_SAMPLERS_HPP_
+
+#include <algorithm>
+#include <bit>
+
+#include "specula.hpp"
+#include "util/check.hpp"
+#include "util/float.hpp"
+#include "util/lowdiscrepancy.hpp"
+#include "util/math.hpp"
+#include "util/pstd/span.hpp"
+#include "util/pstd/vector.hpp"
+#include "util/rng.hpp"
+#include "util/vecmath/tuple2.hpp"
+
+namespace specula {
+  /**
+   * @brief Sampler returning independent uniform random values
+   *
+   * Every pixel has its own PCG32 sequence, selected by a hash of the pixel and the seed, and each
+   * sample of the pixel starts at a fixed offset in that sequence, reached in logarithmic time
+   * with `Rng::advance`. A sample therefore only depends on the pixel, sample index and dimension,
+   * so tiles can be rendered by any thread or process, in any order, or resumed from a checkpoint,
+   * with bit-identical results and without sharing any state.
+   */
+  class IndependentSampler {
+  public:
+    /// Offset between the starts of consecutive samples of a pixel, bounding their dimensions
+    static constexpr uint64_t DIMENSIONS_PER_SAMPLE = 65536;
+
+    IndependentSampler(int samples_per_pixel, int seed = 0)
+        : samples_per_pixel_(samples_per_pixel), seed(seed) {}
+
+    SPECULA_CPU_GPU int samples_per_pixel() const { return samples_per_pixel_; }
+
+    SPECULA_CPU_GPU void start_pixel_sample(Point2i p, int index, int dim = 0) {
+      DASSERT(index >= 0 && dim >= 0 && uint64_t(dim) < DIMENSIONS_PER_SAMPLE);
+      rng.set_sequence(hash(p, seed));
+      rng.advance(int64_t(index) * DIMENSIONS_PER_SAMPLE + dim);
+    }
+
+    // Values are drawn as float so that each dimension consumes exactly one 32-bit draw of the
+    // sequence, keeping `start_pixel_sample` offsets valid when Float is double
+    SPECULA_CPU_GPU Float get_1d() { return rng.uniform<float>(); }
+
+    SPECULA_CPU_GPU Point2f get_2d() {
+      Float x = rng.uniform<float>();
+      return {x, rng.uniform<float>()};
+    }
+
+    SPECULA_CPU_GPU Point2f get_pixel_2d() { return get_2d(); }
+
+  private:
+    int samples_per_pixel_, seed;
+    Rng rng;
+  };
+
+  /**
+   * @brief Sampler based on the Halton sequence
+   *
+   * The first two dimensions of the sequence, in bases 2 and 3, are scaled so that every pixel of
+   * a tile of up to \f$128 \times 128\f$ pixels gets its own set of points, and the following
+   * dimensions use the next primes as bases. Finding the index of the sample of a pixel requires
+   * the inverse of the radical inverse of its coordinates, which only depends on the pixel modulo
+   * the tile size, so it is precomputed for every column and row of the tile and a sample index is
+   * then found in constant time.
+   *
+   * Owen scrambling is used for both `RandomizeStrategy::FastOwen` and `RandomizeStrategy::Owen`,
+   * as the fast variant only applies to base 2.
+   */
+  class HaltonSampler {
+  public:
+    /// Pixel coordinates repeat with this period, bounding the stride between samples of a pixel
+    static constexpr int MAX_HALTON_RESOLUTION = 128;
+    /// Dimensions wrap back to the first one after the pixel ones past this number of bases
+    static constexpr int MAX_DIMENSION = 1000;
+
+    HaltonSampler(int samples_per_pixel, Point2i full_resolution,
+                  RandomizeStrategy randomize = RandomizeStrategy::PermuteDigits, int seed = 0,
+                  Allocator alloc = {});
+
+    SPECULA_CPU_GPU int samples_per_pixel() const { return samples_per_pixel_; }
+    SPECULA_CPU_GPU RandomizeStrategy randomize_strategy() const { return randomize; }
+
+    /// Index of the current sample in the Halton sequence
+    SPECULA_CPU_GPU uint64_t sample_index() const { return halton_index; }
+
+    /**
+     * @brief Position the sampler at a sample of a pixel
+     *
+     * @param p The pixel.
+     * @param index The index of the sample within the pixel.
+     * @param dim The first dimension to return, at least 2 as the first two are those of the pixel.
+     */
+    SPECULA_CPU_GPU void start_pixel_sample(Point2i p, int index, int dim = 0) {
+      uint64_t offset = pixel_offset_x[mod(p.x, MAX_HALTON_RESOLUTION)] +
+                        pixel_offset_y[mod(p.y, MAX_HALTON_RESOLUTION)];
+      halton_index = offset % sample_stride + uint64_t(index) * sample_stride;
+      dimension = std::max(2, dim);
+    }
+
+    SPECULA_CPU_GPU Float get_1d() {
+      if (dimension >= MAX_DIMENSION) {
+        dimension = 2;
+      }
+      return sample_dimension(dimension++);
+    }
+
+    SPECULA_CPU_GPU Point2f get_2d() {
+      if (dimension + 1 >= MAX_DIMENSION) {
+        dimension = 2;
+      }
+      int dim = dimension;
+      dimension += 2;
+      return {sample_dimension(dim), sample_dimension(dim + 1)};
+    }
+
+    /// Position of the sample within its pixel
+    SPECULA_CPU_GPU Point2f get_pixel_2d() {
+      return {radical_inverse(0, halton_index >> base_exponents[0]),
+              radical_inverse(1, halton_index / base_scales[1])};
+    }
+
+  private:
+    SPECULA_CPU_GPU Float sample_dimension(int dim) const {
+      switch (randomize) {
+      case RandomizeStrategy::None:
+        return radical_inverse(dim, halton_index);
+      case RandomizeStrategy::PermuteDigits:
+        return scrambled_radical_inverse(dim, halton_index, digit_permutations[dim]);
+      default:
+        return owen_scrambled_radical_inverse(dim, halton_index, mix_bits(hash(dim, seed)));
+      }
+    }
+
+    int samples_per_pixel_;
+    RandomizeStrategy randomize;
+    int seed;
+    DigitPermutations digit_permutations;
+    /// Scale of the first two dimensions, \f$2^j\f$ and \f$3^k\f$, and the exponents
+    Point2i base_scales, base_exponents;
+    uint64_t sample_stride;
+    /// Offset of the first sample of each column and row of the tile, modulo the stride
+    pstd::vector<uint64_t> pixel_offset_x, pixel_offset_y;
+
+    uint64_t halton_index = 0;
+    int dimension = 0;
+  };
+
+  /**
+   * @brief Sobol sampler distributing the error as blue noise over the pixels
+   *
+   * The samples of all pixels are consecutive points of the first two Sobol dimensions, ordered
+   * by the Morton index of the pixel followed by the index of the sample, so that neighboring
+   * pixels get well stratified points. The base 4 digits of that index are shuffled with a random
+   * permutation of the four quadrants that depends on the digits above them and on the dimension,
+   * which keeps the stratification while decorrelating the dimensions, and the points are then
+   * scrambled.
+   *
+   * @see Ahmed and Wonka, "Screen-Space Blue-Noise Diffusion of Monte Carlo Sampling Error via
+   * Hierarchical Ordering of Pixels", ACM Transactions on Graphics 39(6), 2020
+   */
+  class ZSobolSampler {
+  public:
+    /**
+     * @brief Create the sampler of an image
+     *
+     * @param samples_per_pixel The number of samples per pixel, rounded up to a power of two.
+     * @param full_resolution The resolution of the image.
+     * @param randomize How the points are scrambled.
+     * @param seed The seed of the shuffling and scrambling.
+     */
+    ZSobolSampler(int samples_per_pixel, Point2i full_resolution,
+                  RandomizeStrategy randomize = RandomizeStrategy::FastOwen, int seed = 0);
+
+    SPECULA_CPU_GPU int samples_per_pixel() const { return 1 << log2_samples_per_pixel; }
+    SPECULA_CPU_GPU RandomizeStrategy randomize_strategy() const { return randomize; }
+
+    SPECULA_CPU_GPU void start_pixel_sample(Point2i p, int index, int dim = 0) {
+      dimension = dim;
+      morton_index = morton_sample_index(p, index);
+    }
+
+    SPECULA_CPU_GPU Float get_1d() {
+      int dim = dimension++;
+      return dispatch([&](auto r) { return sample_1d<decltype(r)>(morton_index, dim); });
+    }
+
+    SPECULA_CPU_GPU Point2f get_2d() {
+      int dim = dimension;
+      dimension += 2;
+      return dispatch([&](auto r) { return sample_2d<decltype(r)>(morton_index, dim); });
+    }
+
+    SPECULA_CPU_GPU Point2f get_pixel_2d() { return get_2d(); }
+
+    /**
+     * @brief The values of a dimension for a sample of many pixels at once
+     *
+     * Equivalent to `start_pixel_sample(pixels[i], index, dim)` followed by `get_1d()` for each
+     * pixel, without changing the state of the sampler, for wavefront stages that process all the
+     * pixels of a tile at the same dimension.
+     */
+    void get_1d(pstd::span<const Point2i> pixels, int index, int dim, pstd::span<Float> u) const;
+
+    /// Batched `get_2d`, see the batched `get_1d`
+    void get_2d(pstd::span<const Point2i> pixels, int index, int dim, pstd::span<Point2f> u) const;
+
+  private:
+    SPECULA_CPU_GPU uint64_t morton_sample_index(Point2i p, int index) const {
+      return (encode_morton2(p.x, p.y) << log2_samples_per_pixel) | index;
+    }
+
+    /// Index of the Sobol point of a sample, with its base 4 digits shuffled for `dim`
+    SPECULA_CPU_GPU uint64_t sample_index(uint64_t morton, int dim) const {
+      // The 24 permutations of the four quadrants of a base 4 digit
+      static constexpr uint8_t permutations[24][4] = {
+          {0, 1, 2, 3}, {0, 1, 3, 2}, {0, 2, 1, 3}, {0, 2, 3, 1}, {0, 3, 2, 1}, {0, 3, 1, 2},
+          {1, 0, 2, 3}, {1, 0, 3, 2}, {1, 2, 0, 3}, {1, 2, 3, 0}, {1, 3, 2, 0}, {1, 3, 0, 2},
+          {2, 1, 0, 3}, {2, 1, 3, 0}, {2, 0, 1, 3}, {2, 0, 3, 1}, {2, 3, 0, 1}, {2, 3, 1, 0},
+          {3, 1, 2, 0}, {3, 1, 0, 2}, {3, 2, 1, 0}, {3, 2, 0, 1}, {3, 0, 2, 1}, {3, 0, 1, 2}};
+
+      uint64_t index = 0;
+      // With an odd power of two samples per pixel, the last digit is a base 2 one
+      int odd = log2_samples_per_pixel & 1;
+      uint64_t dim_hash = 0x55555555u * uint64_t(dim);
+      for (int i = n_base4_digits - 1; i >= odd; --i) {
+        int digit_shift = 2 * i - odd;
+        int digit = (morton >> digit_shift) & 3;
+        uint64_t higher_digits = morton >> (digit_shift + 2);
+        int p = (mix_bits(higher_digits ^ dim_hash) >> 24) % 24;
+        index |= uint64_t(permutations[p][digit]) << digit_shift;
+      }
+      if (odd) {
+        index |= (morton & 1) ^ (mix_bits((morton >> 1) ^ dim_hash) & 1);
+      }
+      return index;
+    }
+
+    /// Call `func` with a default constructed scrambler of the type selected by `randomize`
+    template <typename F>
+    SPECULA_CPU_GPU auto dispatch(F func) const -> decltype(func(NoRandomizer())) {
+      switch (randomize) {
+      case RandomizeStrategy::None:
+        return func(NoRandomizer());
+      case RandomizeStrategy::PermuteDigits:
+        return func(BinaryPermuteScrambler(0));
+      case RandomizeStrategy::FastOwen:
+        return func(FastOwenScrambler(0));
+      default:
+        return func(OwenScrambler(0));
+      }
+    }
+
+    template <typename R> SPECULA_CPU_GPU Float sample_1d(uint64_t morton, int dim) const {
+      uint64_t index = sample_index(morton, dim);
+      return sobol_sample(index, 0, R(uint32_t(hash(dim, seed))));
+    }
+
+    template <typename R> SPECULA_CPU_GPU Point2f sample_2d(uint64_t morton, int dim) const {
+      uint64_t index = sample_index(morton, dim);
+      uint64_t bits = hash(dim, seed);
+      return {sobol_sample(index, 0, R(uint32_t(bits))),
+              sobol_sample(index, 1, R(uint32_t(bits >> 32)))};
+    }
+
+    RandomizeStrategy randomize;
+    int seed, log2_samples_per_pixel, n_base4_digits;
+
+    uint64_t morton_index = 0;
+    int dimension = 0;
+  };
+
+  /**
+   * @brief Sampler drawing each pair of dimensions from a table of pmj02 point sets
+   *
+   * Pair \f$d\f$ of dimensions uses set \f$d\f$ of the table. The pixels share the sets and
+   * visit their points in the same order, each pixel applying its own digital shift, which
+   * decorrelates the pixels while keeping every power of two prefix of the samples stratified.
+   * Once the table runs out of sets a hashed set is used instead, with the sample indices permuted
+   * per pixel so that the pairs sharing a set do not get the same points.
+   *
+   * `get_1d` takes the first coordinate of a pair and uses up both of its dimensions, so that
+   * every call starts on a pair of its own.
+   */
+  class PMJ02Sampler {
+  public:
+    /**
+     * @brief Create a sampler reading from `table`, which must outlive it
+     *
+     * @param samples_per_pixel The number of samples per pixel, at most the size of the sets.
+     * @param table The point sets.
+     * @param seed The seed of the per-pixel randomization.
+     */
+    PMJ02Sampler(int samples_per_pixel, const PMJ02Table *table, int seed = 0)
+        : samples_per_pixel_(samples_per_pixel), table(table), seed(seed) {
+      ASSERT(table != nullptr && !table->empty());
+      ASSERT(samples_per_pixel > 0 && samples_per_pixel <= table->n_samples());
+    }
+
+    SPECULA_CPU_GPU int samples_per_pixel() const { return samples_per_pixel_; }
+
+    SPECULA_CPU_GPU void start_pixel_sample(Point2i p, int index, int dim = 0) {
+      pixel = p;
+      sample_index = index;
+      dimension = dim;
+    }
+
+    /// The first coordinate of the next pair of dimensions, using up both of them
+    SPECULA_CPU_GPU Float get_1d() { return get_2d().x; }
+
+    SPECULA_CPU_GPU Point2f get_2d() {
+      uint64_t bits = hash(pixel, dimension, seed);
+      int pair = dimension / 2, set = pair, index = sample_index;
+      if (pair >= table->n_sets()) {
+        set = int((bits >> 32) % table->n_sets());
+        index = permutation_element(sample_index, samples_per_pixel_, uint32_t(bits));
+      }
+      dimension += 2;
+      return table->sample(set, index, mix_bits(bits));
+    }
+
+    SPECULA_CPU_GPU Point2f get_pixel_2d() { return get_2d(); }
+
+  private:
+    int samples_per_pixel_;
+    const PMJ02Table *table;
+    int seed;
+
+    Point2i pixel;
+    int sample_index = 0;
+    int dimension = 0;
+  };
+} // namespace specula
+
+#endif // INCLUDE_UTIL_SAMPLERS_HPP_
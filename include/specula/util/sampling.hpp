@@ -0,0 +1,349 @@
+/**
+ * @file sampling.hpp
+ * @brief Sampling of tabulated distributions
+ *
+ * Discrete and piecewise constant distributions built from tabulated values, such as the pixels of
+ * an environment map or the powers of the lights in a scene. Building them is done once up front
+ * and may be parallel, sampling them is cheap and takes a single uniform value per dimension.
+ */
+
+#ifndef INCLUDE_UTIL_SAMPLING_HPP_
+#define INCLUDE_UTIL_SAMPLING_HPP_
+
+#include <algorithm>
+#include <bit>
+
+#include "specula.hpp"
+#include "util/check.hpp"
+#include "util/containers/array2d.hpp"
+#include "util/float.hpp"
+#include "util/math.hpp"
+#include "util/pstd/span.hpp"
+#include "util/pstd/vector.hpp"
+#include "util/vecmath/bounds2.hpp"
+#include "util/vecmath/tuple2.hpp"
+
+namespace specula {
+  /**
+   * @brief Discrete distribution sampled in constant time with Vose's alias method
+   *
+   * Every one of the \f$n\f$ entries is picked with probability \f$1 / n\f$, and then either
+   * keeps its own index, with probability \f$q\f$, or returns its alias. A sample costs one table
+   * lookup regardless of the number of weights.
+   *
+   * Each entry is packed into 32 bits, the alias index in the low `index_bits(n)` bits and
+   * \f$q\f$ as a fixed point fraction in the bits above, so that tables with millions of entries
+   * stay compact. The probabilities returned by `pmf` are those of the quantized table, and
+   * therefore exactly match how often `sample_bits` returns each index. A `Float` sample only has
+   * 24 bits, of which about \f$\log_2 n\f$ select the entry, which leaves too few to choose
+   * between an entry and its alias once tables have more than a few thousand entries, so large
+   * tables should be sampled from 64 uniform bits. Large tables are built in parallel, with a
+   * result that does not depend on the number of threads.
+   */
+  class AliasTable {
+  public:
+    /// Largest number of weights, which leaves at least 8 bits for \f$q\f$
+    static constexpr size_t MAX_SIZE = size_t(1) << 24;
+
+    AliasTable(Allocator alloc = {}) : entries(alloc), pmfs(alloc) {}
+    AliasTable(pstd::span<const Float> weights, Allocator alloc = {});
+
+    /// Number of bits of an entry of a table with `n` entries that hold the alias index
+    SPECULA_CPU_GPU static int index_bits(size_t n) {
+      return std::max(1, int(std::bit_width(n - 1)));
+    }
+
+    /**
+     * @brief Fill `entries` and `pmf` with the alias table of `weights`
+     *
+     * Weights that sum to zero give a uniform distribution.
+     *
+     * @param weights The non-negative weights of the distribution.
+     * @param entries The packed entries, one per weight.
+     * @param pmf The probability of each index, one per weight.
+     * @return The sum of the weights.
+     */
+    static double build(pstd::span<const Float> weights, pstd::span<uint32_t> entries,
+                        pstd::span<Float> pmf);
+
+    /**
+     * @brief Sample an index from a table filled by `build`
+     *
+     * @param entries The packed entries of the table.
+     * @param pmfs The probabilities of the table.
+     * @param u The uniform sample.
+     * @param pmf Set to the probability of the sampled index, if not `nullptr`.
+     * @param u_remapped Set to a new uniform sample in \f$[0, 1)\f$ derived from `u`, if not
+     * `nullptr`.
+     * @return The sampled index.
+     */
+    SPECULA_CPU_GPU static int sample(pstd::span<const uint32_t> entries,
+                                      pstd::span<const Float> pmfs, Float u, Float *pmf = nullptr,
+                                      Float *u_remapped = nullptr) {
+      int n = entries.size(), bits = index_bits(n);
+      int offset = std::min<int>(u * n, n - 1);
+      Float up = std::min<Float>(u * n - offset, OneMinusEpsilon);
+      uint32_t entry = entries[offset];
+      Float q = Float(entry >> bits) * quantization_scale(bits);
+      int index = up < q ? offset : int(entry & ((uint32_t(1) << bits) - 1));
+
+      if (pmf) {
+        *pmf = pmfs[index];
+      }
+      if (u_remapped) {
+        if (index != offset) {
+          *u_remapped = std::min<Float>((up - q) / (1 - q), OneMinusEpsilon);
+        } else if (up < q) {
+          *u_remapped = std::min<Float>(up / q, OneMinusEpsilon);
+        } else {
+          // The alias of the entry is the entry itself
+          *u_remapped = up;
+        }
+      }
+      return index;
+    }
+
+    SPECULA_CPU_GPU int sample(Float u, Float *pmf = nullptr, Float *u_remapped = nullptr) const {
+      return sample(entries, pmfs, u, pmf, u_remapped);
+    }
+
+    /**
+     * @brief Sample an index from 64 uniform random bits, with the exact probabilities of `pmfs`
+     *
+     * The entry and the fraction compared to its \f$q\f$ are the integer and fractional parts of
+     * \f$u n / 2^{64}\f$, so the fraction keeps about \f$64 - \log_2 n\f$ bits whatever the size
+     * of the table.
+     *
+     * @param entries The packed entries of the table.
+     * @param pmfs The probabilities of the table.
+     * @param u The uniform random bits.
+     * @param pmf Set to the probability of the sampled index, if not `nullptr`.
+     * @param u_remapped Set to a new uniform sample in \f$[0, 1)\f$ derived from `u`, if not
+     * `nullptr`.
+     * @return The sampled index.
+     */
+    SPECULA_CPU_GPU static int sample_bits(pstd::span<const uint32_t> entries,
+                                           pstd::span<const Float> pmfs, uint64_t u,
+                                           Float *pmf = nullptr, Float *u_remapped = nullptr) {
+      uint64_t n = entries.size();
+      int bits = index_bits(n), fraction = fraction_bits(bits);
+      // High and low 64 bits of the 88-bit product u * n, as n is at most 2^24
+      int offset = int(((u >> 32) * n + ((u & 0xffffffff) * n >> 32)) >> 32);
+      uint64_t up_bits = u * n;
+      uint32_t entry = entries[offset];
+      uint32_t q_fixed = entry >> bits;
+      bool keep = (up_bits >> (64 - fraction)) < q_fixed;
+      int index = keep ? offset : int(entry & ((uint32_t(1) << bits) - 1));
+
+      if (pmf) {
+        *pmf = pmfs[index];
+      }
+      if (u_remapped) {
+        Float up = Float(up_bits >> 40) * 0x1p-24f;
+        Float q = Float(q_fixed) * quantization_scale(bits);
+        if (index != offset) {
+          *u_remapped = std::min<Float>((up - q) / (1 - q), OneMinusEpsilon);
+        } else if (up < q) {
+          *u_remapped = std::min<Float>(up / q, OneMinusEpsilon);
+        } else {
+          *u_remapped = up;
+        }
+      }
+      return index;
+    }
+
+    SPECULA_CPU_GPU int sample_bits(uint64_t u, Float *pmf = nullptr,
+                                    Float *u_remapped = nullptr) const {
+      return sample_bits(entries, pmfs, u, pmf, u_remapped);
+    }
+
+    /**
+     * @brief Sample an index for each of the uniform samples `u`
+     *
+     * @param u The uniform samples.
+     * @param indices Set to the sampled indices, one per sample.
+     * @param pmf Set to the probabilities of the sampled indices, if not empty.
+     */
+    void sample(pstd::span<const Float> u, pstd::span<int> indices,
+                pstd::span<Float> pmf = {}) const;
+
+    /// Batched `sample_bits`, see the batched `sample`
+    void sample_bits(pstd::span<const uint64_t> u, pstd::span<int> indices,
+                     pstd::span<Float> pmf = {}) const;
+
+    SPECULA_CPU_GPU size_t size() const { return entries.size(); }
+    SPECULA_CPU_GPU Float pmf(int index) const { return pmfs[index]; }
+
+    /// Number of bits of \f$q\f$, at most 24 so that it converts to `float` exactly
+    SPECULA_CPU_GPU static int fraction_bits(int index_bits) {
+      return std::min(24, 32 - index_bits);
+    }
+
+    /// Scale from the fixed point \f$q\f$ of an entry to a probability
+    SPECULA_CPU_GPU static Float quantization_scale(int index_bits) {
+      return Float(1) / Float(uint32_t(1) << fraction_bits(index_bits));
+    }
+
+  private:
+    pstd::vector<uint32_t> entries;
+    pstd::vector<Float> pmfs;
+  };
+
+  /// Piecewise constant distribution over \f$[min, max]\f$, sampled by inverting its CDF
+  class PiecewiseConstant1D {
+  public:
+    PiecewiseConstant1D(Allocator alloc = {}) : func(alloc), cdf(alloc) {}
+    PiecewiseConstant1D(pstd::span<const Float> f, Float min = 0, Float max = 1,
+                        Allocator alloc = {});
+
+    SPECULA_CPU_GPU size_t size() const { return func.size(); }
+    SPECULA_CPU_GPU Float integral() const { return func_int; }
+    /// Density of the samples that fall in the piece at `offset`
+    SPECULA_CPU_GPU Float pdf(int offset) const {
+      return func_int > 0 ? func[offset] / func_int : 0;
+    }
+
+    /**
+     * @brief Sample the distribution
+     *
+     * @param u The uniform sample.
+     * @param pdf Set to the density of the sample, if not `nullptr`.
+     * @param offset Set to the index of the piece the sample is in, if not `nullptr`.
+     * @return The sample, in \f$[min, max]\f$.
+     */
+    SPECULA_CPU_GPU Float sample(Float u, Float *pdf = nullptr, int *offset = nullptr) const {
+      int o = find_interval(cdf.size(), [&](size_t index) { return cdf[index] <= u; });
+      if (offset) {
+        *offset = o;
+      }
+
+      Float du = u - cdf[o];
+      if (cdf[o + 1] - cdf[o] > 0) {
+        du /= cdf[o + 1] - cdf[o];
+      }
+      DASSERT(!isnan(du));
+
+      if (pdf) {
+        *pdf = this->pdf(o);
+      }
+      return lerp((o + du) / size(), min, max);
+    }
+
+  private:
+    pstd::vector<Float> func, cdf;
+    Float min = 0, max = 1;
+    Float func_int = 0;
+  };
+
+  /**
+   * @brief Piecewise constant distribution over a 2D domain, such as the pixels of an image
+   *
+   * The rows are picked by inverting the CDF of their integrals, which keeps the stratification of
+   * the second sample dimension, and a position within the row is then picked in constant time
+   * with the alias table of the row. The alias tables of all rows are stored contiguously and built
+   * in parallel. Rows are sampled from 64 uniform bits, as a `Float` sample leaves too few bits to
+   * match the probabilities of rows more than a few thousand pixels wide, such as those of large
+   * environment maps, so the densities are exact when the bits are given directly.
+   *
+   * For environment maps, `Image::get_sampling_distribution` provides the values. Images that use
+   * the `WrapMode::OctahedralSphere` equal area parameterization need no Jacobian term, as every
+   * pixel subtends the same solid angle.
+   */
+  class PiecewiseConstant2D {
+  public:
+    PiecewiseConstant2D(Allocator alloc = {})
+        : conditional(alloc), conditional_pmf(alloc), marginal(alloc) {}
+    PiecewiseConstant2D(pstd::span<const Float> f, int nu, int nv,
+                        const Bounds2f &domain = Bounds2f(Point2f(0, 0), Point2f(1, 1)),
+                        Allocator alloc = {});
+    PiecewiseConstant2D(const Array2D<Float> &f,
+                        const Bounds2f &domain = Bounds2f(Point2f(0, 0), Point2f(1, 1)),
+                        Allocator alloc = {})
+        : PiecewiseConstant2D(f, f.xsize(), f.ysize(), domain, alloc) {}
+
+    /**
+     * @brief Build the distribution of `f` minus its average, clamped to zero
+     *
+     * When the sampled values are combined with BSDF sampling by multiple importance sampling, the
+     * BSDF samples already cover the regions close to the average well, so values below it get no
+     * samples at all and the rest are sampled proportionally to how far above it they are. A
+     * constant `f` falls back to uniform sampling.
+     */
+    static PiecewiseConstant2D compensated(const Array2D<Float> &f,
+                                           const Bounds2f &domain = Bounds2f(Point2f(0, 0),
+                                                                             Point2f(1, 1)),
+                                           Allocator alloc = {});
+
+    SPECULA_CPU_GPU Point2i resolution() const { return {nu, nv}; }
+    SPECULA_CPU_GPU const Bounds2f &domain() const { return domain_; }
+    SPECULA_CPU_GPU Float integral() const { return marginal.integral(); }
+
+    /**
+     * @brief Sample the distribution
+     *
+     * @param u_v The uniform sample of the row.
+     * @param u_u The uniform random bits of the position within the row.
+     * @param pdf Set to the density of the sample with respect to area in the domain, if not
+     * `nullptr`.
+     * @param offset Set to the cell the sample is in, if not `nullptr`.
+     * @return The sample, inside the domain.
+     */
+    SPECULA_CPU_GPU Point2f sample(Float u_v, uint64_t u_u, Float *pdf = nullptr,
+                                   Point2i *offset = nullptr) const {
+      Float pdf_v;
+      int v;
+      Float y = marginal.sample(u_v, &pdf_v, &v);
+
+      Float pmf, u_remapped;
+      size_t row = size_t(v) * nu;
+      int x = AliasTable::sample_bits({conditional.data() + row, size_t(nu)},
+                                      {conditional_pmf.data() + row, size_t(nu)}, u_u, &pmf,
+                                      &u_remapped);
+      if (pdf) {
+        *pdf = pdf_v * pmf * nu / (domain_.pmax.x - domain_.pmin.x);
+      }
+      if (offset) {
+        *offset = Point2i(x, v);
+      }
+      return Point2f(lerp((x + u_remapped) / nu, domain_.pmin.x, domain_.pmax.x), y);
+    }
+
+    /**
+     * @brief Sample the distribution from a `Float` sample
+     *
+     * `u[0]` is scaled to 64 bits exactly, but only has the precision of a `Float`, so the
+     * frequencies of pixels with very small values in wide rows may differ from their density.
+     * Estimators that must stay unbiased for such rows should pass 64 random bits instead.
+     *
+     * @param u The uniform sample.
+     * @param pdf Set to the density of the sample with respect to area in the domain, if not
+     * `nullptr`.
+     * @param offset Set to the cell the sample is in, if not `nullptr`.
+     * @return The sample, inside the domain.
+     */
+    SPECULA_CPU_GPU Point2f sample(Point2f u, Float *pdf = nullptr,
+                                   Point2i *offset = nullptr) const {
+      double u_u = std::min(u[0], OneMinusEpsilon);
+      return sample(u[1], uint64_t(u_u * 0x1p64), pdf, offset);
+    }
+
+    /// Density of the distribution at `p`, with respect to area in the domain
+    SPECULA_CPU_GPU Float pdf(Point2f p) const {
+      Point2f po = Point2f(domain_.offset(p));
+      int iu = clamp(int(po[0] * nu), 0, nu - 1);
+      int iv = clamp(int(po[1] * nv), 0, nv - 1);
+      return marginal.pdf(iv) * conditional_pmf[size_t(iv) * nu + iu] * nu /
+             (domain_.pmax.x - domain_.pmin.x);
+    }
+
+  private:
+    Bounds2f domain_;
+    int nu = 0, nv = 0;
+    /// The alias tables of the rows, one after the other
+    pstd::vector<uint32_t> conditional;
+    pstd::vector<Float> conditional_pmf;
+    PiecewiseConstant1D marginal;
+  };
+} // namespace specula
+
+#endif // INCLUDE_UTIL_SAMPLING_HPP_
@@ -0,0 +1,123 @@
+/**
+ * @file simd.hpp
+ * @brief Runtime dispatch helpers for SIMD kernels
+ *
+ * The renderer is compiled for the baseline instruction set of the target platform, so vectorized
+ * kernels are compiled separately with a function level target attribute and selected at runtime
+ * depending on what the executing CPU supports. This keeps a single binary portable, while still
+ * allowing the bulk conversion and lookup routines to make use of wider instruction sets.
+ *
+ * The `SPECULA_HAVE_AVX2` definition is only provided when compiling the renderer library itself,
+ * so the kernels are never visible to, or compiled by, code that only consumes the public headers.
+ */
+
+#ifndef SPECULA_UTIL_SIMD_HPP_
+#define SPECULA_UTIL_SIMD_HPP_
+
+#include "specula/specula.hpp"
+
+#if defined(SPECULA_HAVE_AVX2) && !defined(SPECULA_IS_GPU_CODE)
+#  include <immintrin.h>
+
+/**
+ * @brief Function attribute enabling AVX2 and F16C code generation for a single function.
+ *
+ * FMA is intentionally not enabled, so that the compiler is never allowed to contract a separate
+ * multiply and add into a fused operation. This keeps the vectorized kernels bit-identical to the
+ * scalar implementations they replace.
+ */
+#  define SPECULA_TARGET_AVX2 __attribute__((target("avx2,f16c")))
+
+/**
+ * @brief Function attribute enabling AVX2, F16C and FMA code generation for a single function.
+ *
+ * Only for kernels that mirror scalar code built on `fma`, such as `evaluate_polynomial`.
+ */
+#  define SPECULA_TARGET_AVX2_FMA __attribute__((target("avx2,fma,f16c")))
+
+#  if !defined(SPECULA_FLOAT_AS_DOUBLE)
+/// Defined when `Float` based kernels can be dispatched to their AVX2 implementation
+#    define SPECULA_USE_AVX2
+#  endif
+#endif
+
+namespace specula::simd {
+  /**
+   * @brief Check if the executing CPU supports the AVX2, FMA and F16C instruction sets
+   *
+   * The result is computed once and cached, so this is cheap enough to call at the start of every
+   * bulk operation.
+   *
+   * @return true if the AVX2 kernels can be used
+   */
+  bool has_avx2();
+
+#if defined(SPECULA_TARGET_AVX2)
+  /// Linear interpolation matching the scalar `lerp`, computed as \f$(1 - t) a + t b\f$
+  SPECULA_TARGET_AVX2 inline __m256 lerp(__m256 t, __m256 a, __m256 b) {
+    return _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), t), a),
+                         _mm256_mul_ps(t, b));
+  }
+
+  /// Per lane `mask ? a : b`, where `mask` is the result of a comparison
+  SPECULA_TARGET_AVX2 inline __m256 select(__m256 mask, __m256 a, __m256 b) {
+    return _mm256_blendv_ps(b, a, mask);
+  }
+
+  /// Load eight bytes, zero extending each of them into a 32-bit lane
+  SPECULA_TARGET_AVX2 inline __m256i load_u8(const uint8_t *ptr) {
+    return _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(ptr)));
+  }
+
+  /// Store the low byte of each 32-bit lane, all lanes must already be in \f$[0, 255]\f$
+  SPECULA_TARGET_AVX2 inline void store_u8(uint8_t *ptr, __m256i v) {
+    __m128i v16 = _mm_packus_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(ptr), _mm_packus_epi16(v16, v16));
+  }
+
+  /// Rounding to the nearest integer with halfway cases away from zero, matching `std::round`
+  SPECULA_TARGET_AVX2 inline __m256 round(__m256 v) {
+    const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+    __m256 a = _mm256_andnot_ps(sign_mask, v);
+    __m256 t = _mm256_round_ps(a, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+    __m256 up = _mm256_cmp_ps(_mm256_sub_ps(a, t), _mm256_set1_ps(0.5f), _CMP_GE_OQ);
+    t = _mm256_add_ps(t, _mm256_and_ps(up, _mm256_set1_ps(1.0f)));
+    return _mm256_or_ps(t, _mm256_and_ps(sign_mask, v));
+  }
+
+  /**
+   * @brief Approximate \f$e^x\f$ matching the scalar `fast_exp` exactly
+   *
+   * As with the scalar version, the magnitude of the lanes must be small enough for their base 2
+   * exponent to be converted to an integer.
+   */
+  SPECULA_TARGET_AVX2_FMA inline __m256 fast_exp(__m256 x) {
+    __m256 xp = _mm256_mul_ps(x, _mm256_set1_ps(1.442695041f));
+    __m256 fxp = _mm256_floor_ps(xp);
+    __m256 f = _mm256_sub_ps(xp, fxp);
+    __m256i i = _mm256_cvttps_epi32(fxp);
+
+    // Same Horner evaluation order as `evaluate_polynomial`
+    __m256 two_to_f = _mm256_fmadd_ps(f, _mm256_set1_ps(0.0781455737f),
+                                      _mm256_set1_ps(0.226173572f));
+    two_to_f = _mm256_fmadd_ps(f, two_to_f, _mm256_set1_ps(0.695556856f));
+    two_to_f = _mm256_fmadd_ps(f, two_to_f, _mm256_set1_ps(1.0f));
+
+    __m256i bits = _mm256_castps_si256(two_to_f);
+    __m256i exponent =
+        _mm256_add_epi32(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127)), i);
+    bits = _mm256_and_si256(bits, _mm256_set1_epi32(int(0b10000000011111111111111111111111u)));
+    __m256i biased = _mm256_add_epi32(exponent, _mm256_set1_epi32(127));
+    bits = _mm256_or_si256(bits, _mm256_slli_epi32(biased, 23));
+
+    __m256 result = _mm256_castsi256_ps(bits);
+    __m256i underflow = _mm256_cmpgt_epi32(_mm256_set1_epi32(-126), exponent);
+    __m256i overflow = _mm256_cmpgt_epi32(exponent, _mm256_set1_epi32(127));
+    result = _mm256_andnot_ps(_mm256_castsi256_ps(underflow), result);
+    __m256 infinity = _mm256_castsi256_ps(_mm256_set1_epi32(0x7f800000));
+    return select(_mm256_castsi256_ps(overflow), infinity, result);
+  }
+#endif
+} // namespace specula::simd
+
+#endif // SPECULA_UTIL_SIMD_HPP_
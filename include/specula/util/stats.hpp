@@ -35,6 +35,39 @@ namespace specula {
     var = 0;                                                                                       \
   });
 
+/**
+ * @brief Macro for registering a memory counter statistic
+ *
+ * A counter of a number of bytes, reported in kilobytes, megabytes, or gigabytes as appropriate.
+ * The counter variable `var` can be updated as if it was a regular integer variable.
+ *
+ * @param title The title of the statistic
+ * @param var The variable name to use for the counter
+ */
+#define STAT_MEMORY_COUNTER(title, var)                                                            \
+  static thread_local int64_t var = 0;                                                             \
+  static StatRegisterer STAT_REG##var([](StatsAccumulator &accum) {                                \
+    accum.report_memory_counter(title, var);                                                       \
+    var = 0;                                                                                       \
+  });
+
+/**
+ * @brief Macro for registering a percentage statistic
+ *
+ * Tracks how often an event happens, `num` should be incremented every time it happens, and
+ * `denom` every time it could have happened.
+ *
+ * @param title The title of the statistic
+ * @param num The variable name to use for the numerator
+ * @param denom The variable name to use for the denominator
+ */
+#define STAT_PERCENT(title, num, denom)                                                            \
+  static thread_local int64_t num = 0, denom = 0;                                                  \
+  static StatRegisterer STAT_PERCENT_REG##num([](StatsAccumulator &accum) {                        \
+    accum.report_percentage(title, num, denom);                                                    \
+    num = denom = 0;                                                                               \
+  });
+
   class StatsAccumulator;
 
   /**
@@ -10,6 +10,7 @@ namespace specula {
 
   bool atof(std::string_view str, float *ptr);
   bool atof(std::string_view str, double *ptr);
+  bool atoi(std::string_view str, int *ptr);
 } // namespace specula
 
 #endif // INCLUDE_UTIL_STRING_HPP_
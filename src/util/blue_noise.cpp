@@ -0,0 +1,130 @@
+#include "util/blue_noise.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "util/hash.hpp"
+
+namespace specula {
+  /// Standard deviation of the Gaussian that measures how clustered the set pixels are
+  static constexpr double BLUE_NOISE_SIGMA = 1.5;
+
+  /**
+   * A binary pattern on the torus, along with the energy of every pixel: the sum over the set
+   * pixels of a Gaussian of their wrapped distance to it.
+   */
+  class VoidAndCluster {
+  public:
+    static constexpr int n = BLUE_NOISE_RESOLUTION * BLUE_NOISE_RESOLUTION;
+
+    VoidAndCluster() : pattern(n, false), energy(n, 0.0), kernel(n) {
+      for (int y = 0; y < BLUE_NOISE_RESOLUTION; ++y) {
+        for (int x = 0; x < BLUE_NOISE_RESOLUTION; ++x) {
+          int dx = std::min(x, BLUE_NOISE_RESOLUTION - x);
+          int dy = std::min(y, BLUE_NOISE_RESOLUTION - y);
+          kernel[y * BLUE_NOISE_RESOLUTION + x] =
+              std::exp(-(dx * dx + dy * dy) / (2 * BLUE_NOISE_SIGMA * BLUE_NOISE_SIGMA));
+        }
+      }
+    }
+
+    void set(int p, bool value) {
+      constexpr int mask = BLUE_NOISE_RESOLUTION - 1;
+      pattern[p] = value;
+      count += value ? 1 : -1;
+      double sign = value ? 1 : -1;
+      int px = p % BLUE_NOISE_RESOLUTION, py = p / BLUE_NOISE_RESOLUTION;
+      for (int y = 0; y < BLUE_NOISE_RESOLUTION; ++y) {
+        const double *row = &kernel[((y - py) & mask) * BLUE_NOISE_RESOLUTION];
+        double *e = &energy[y * BLUE_NOISE_RESOLUTION];
+        for (int x = 0; x < BLUE_NOISE_RESOLUTION; ++x) {
+          e[x] += sign * row[(x - px) & mask];
+        }
+      }
+    }
+
+    /// The set pixel with the highest energy, ties going to the first
+    int tightest_cluster() const {
+      int best = -1;
+      for (int p = 0; p < n; ++p) {
+        if (pattern[p] && (best < 0 || energy[p] > energy[best])) {
+          best = p;
+        }
+      }
+      return best;
+    }
+
+    /// The unset pixel with the lowest energy, ties going to the first
+    int largest_void() const {
+      int best = -1;
+      for (int p = 0; p < n; ++p) {
+        if (!pattern[p] && (best < 0 || energy[p] < energy[best])) {
+          best = p;
+        }
+      }
+      return best;
+    }
+
+    std::vector<bool> pattern;
+    std::vector<double> energy;
+    int count = 0;
+
+  private:
+    std::vector<double> kernel;
+  };
+
+  /// Rank every pixel with Ulichney's void and cluster method
+  static std::vector<Float> generate_blue_noise() {
+    constexpr int n = VoidAndCluster::n;
+
+    // Start from a sparse random pattern, and move the pixel of its tightest cluster into its
+    // largest void until that pixel is the one that would be moved back
+    VoidAndCluster initial;
+    int n_initial = n / 10;
+    for (uint64_t i = 0; initial.count < n_initial; ++i) {
+      int p = hash(i) % n;
+      if (!initial.pattern[p]) {
+        initial.set(p, true);
+      }
+    }
+    for (int i = 0; i < n; ++i) {
+      int cluster = initial.tightest_cluster();
+      initial.set(cluster, false);
+      int largest_void = initial.largest_void();
+      initial.set(largest_void, true);
+      if (largest_void == cluster) {
+        break;
+      }
+    }
+
+    // The pixels of the initial pattern are ranked by removing its tightest clusters one at a
+    // time. The rest are ranked by filling the largest voids, which once the unset pixels are the
+    // minority is also the tightest cluster of unset pixels, as the energies due to the set and
+    // unset pixels sum to the same constant everywhere.
+    std::vector<int> rank(n);
+    VoidAndCluster vc = initial;
+    for (int r = n_initial - 1; r >= 0; --r) {
+      int p = vc.tightest_cluster();
+      vc.set(p, false);
+      rank[p] = r;
+    }
+    vc = initial;
+    for (int r = n_initial; r < n; ++r) {
+      int p = vc.largest_void();
+      vc.set(p, true);
+      rank[p] = r;
+    }
+
+    std::vector<Float> mask(n);
+    for (int p = 0; p < n; ++p) {
+      mask[p] = (rank[p] + 0.5f) / n;
+    }
+    return mask;
+  }
+} // namespace specula
+
+const specula::Float *specula::blue_noise_mask() {
+  static const std::vector<Float> mask = generate_blue_noise();
+  return mask.data();
+}
@@ -1,8 +1,10 @@
 #include "util/color/color_encoding.hpp"
 
+#include <bit>
 #include <cstdlib>
 #include <map>
 
+#include "util/simd.hpp"
 #include "util/string.hpp"
 
 SPECULA_CONST specula::Float specula::SRGB_TO_LINEAR_LUT[256] = {
@@ -94,11 +96,142 @@ const specula::ColorEncoding specula::ColorEncoding::get(const std::string &name
   }
 }
 
+#if defined(SPECULA_USE_AVX2)
+namespace specula {
+  SPECULA_TARGET_AVX2 static void lut_to_linear_avx2(const Float *lut, const uint8_t *vin,
+                                                     Float *vout, size_t n) {
+    for (size_t i = 0; i < n; i += 8) {
+      _mm256_storeu_ps(vout + i, _mm256_i32gather_ps(lut, simd::load_u8(vin + i), 4));
+    }
+  }
+
+  SPECULA_TARGET_AVX2 static void linear_to_linear_avx2(const uint8_t *vin, Float *vout,
+                                                        size_t n) {
+    const __m256 scale = _mm256_set1_ps(255.0f);
+    for (size_t i = 0; i < n; i += 8) {
+      __m256 v = _mm256_cvtepi32_ps(simd::load_u8(vin + i));
+      _mm256_storeu_ps(vout + i, _mm256_div_ps(v, scale));
+    }
+  }
+
+  SPECULA_TARGET_AVX2 static void linear_from_linear_avx2(const Float *vin, uint8_t *vout,
+                                                          size_t n) {
+    for (size_t i = 0; i < n; i += 8) {
+      __m256 v = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(vin + i), _mm256_set1_ps(255.0f)),
+                               _mm256_set1_ps(0.5f));
+      // The order of the operands maps NaN to zero
+      v = _mm256_min_ps(_mm256_max_ps(v, _mm256_setzero_ps()), _mm256_set1_ps(255.0f));
+      simd::store_u8(vout + i, _mm256_cvttps_epi32(v));
+    }
+  }
+
+  /// Horner evaluation with fused multiply-adds, in the same order as `evaluate_polynomial`
+  template <size_t N>
+  SPECULA_TARGET_AVX2_FMA static __m256 evaluate_polynomial_avx2(__m256 t, const float (&c)[N]) {
+    __m256 r = _mm256_set1_ps(c[N - 1]);
+    for (size_t i = N - 1; i > 0; --i) {
+      r = _mm256_fmadd_ps(t, r, _mm256_set1_ps(c[i - 1]));
+    }
+    return r;
+  }
+
+  /**
+   * Encode to sRGB, adding `dither` (if not null) before rounding, and return the number of values
+   * outside of \f$[0, 1]\f$
+   */
+  SPECULA_TARGET_AVX2_FMA static size_t srgb_from_linear_avx2(const Float *vin,
+                                                              const Float *dither, uint8_t *vout,
+                                                              size_t n) {
+    static constexpr float p_coeffs[] = {-0.0016829072605308378f, 0.03453868659826638f,
+                                         0.7642611304733891f,     2.0041169284241644f,
+                                         0.7551545191665577f,     -0.016202083165206348f};
+    static constexpr float q_coeffs[] = {4.178892964897981e-7f, -0.00004375359692957097f,
+                                         0.03467195408529984f,  0.6085338522168684f,
+                                         1.8970238036421054f,   1.f};
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 max_value = _mm256_set1_ps(255.0f);
+
+    size_t out_of_gamut = 0;
+    for (size_t i = 0; i < n; i += 8) {
+      __m256 v = _mm256_loadu_ps(vin + i);
+      __m256 below = _mm256_cmp_ps(v, zero, _CMP_LT_OQ), above = _mm256_cmp_ps(v, one, _CMP_GT_OQ);
+      out_of_gamut += std::popcount(unsigned(_mm256_movemask_ps(_mm256_or_ps(below, above))));
+
+      __m256 sqrt_v = _mm256_sqrt_ps(_mm256_max_ps(v, zero));
+      __m256 p = evaluate_polynomial_avx2(sqrt_v, p_coeffs);
+      __m256 q = evaluate_polynomial_avx2(sqrt_v, q_coeffs);
+      __m256 curve = _mm256_mul_ps(_mm256_div_ps(p, q), v);
+      __m256 linear = _mm256_mul_ps(_mm256_set1_ps(12.92f), v);
+      __m256 s = simd::select(_mm256_cmp_ps(v, _mm256_set1_ps(0.0031308f), _CMP_LE_OQ), linear,
+                              curve);
+
+      __m256 d = dither ? _mm256_loadu_ps(dither + i) : zero;
+      __m256 r = simd::round(_mm256_fmadd_ps(max_value, s, d));
+      r = _mm256_min_ps(_mm256_max_ps(r, zero), max_value);
+      r = simd::select(_mm256_cmp_ps(v, one, _CMP_GE_OQ), max_value, r);
+      r = simd::select(_mm256_cmp_ps(v, zero, _CMP_LE_OQ), zero, r);
+      simd::store_u8(vout + i, _mm256_cvttps_epi32(r));
+    }
+    return out_of_gamut;
+  }
+
+  SPECULA_TARGET_AVX2 static void gamma_from_linear_avx2(const Float *inverse_lut, int lut_size,
+                                                         const Float *vin, uint8_t *vout,
+                                                         size_t n) {
+    const __m256 max_index = _mm256_set1_ps(Float(lut_size - 1));
+    for (size_t i = 0; i < n; i += 8) {
+      __m256 v = _mm256_mul_ps(_mm256_loadu_ps(vin + i), max_index);
+      v = _mm256_min_ps(_mm256_max_ps(v, _mm256_setzero_ps()), max_index);
+      __m256 value = _mm256_i32gather_ps(inverse_lut, _mm256_cvttps_epi32(v), 4);
+      simd::store_u8(vout + i, _mm256_cvttps_epi32(value));
+    }
+  }
+} // namespace specula
+#endif
+
+SPECULA_CPU_GPU void specula::LinearColorEncoding::to_linear(pstd::span<const uint8_t> vin,
+                                                             pstd::span<Float> vout) const {
+  DASSERT_EQ(vin.size(), vout.size());
+  size_t i = 0;
+#if defined(SPECULA_USE_AVX2)
+  if (simd::has_avx2()) {
+    i = vin.size() & ~size_t(7);
+    linear_to_linear_avx2(vin.data(), vout.data(), i);
+  }
+#endif
+  for (; i < vin.size(); ++i) {
+    vout[i] = vin[i] / 255.0f;
+  }
+}
+
+SPECULA_CPU_GPU void specula::LinearColorEncoding::from_linear(pstd::span<const Float> vin,
+                                                               pstd::span<uint8_t> vout) const {
+  DASSERT_EQ(vin.size(), vout.size());
+  size_t i = 0;
+#if defined(SPECULA_USE_AVX2)
+  if (simd::has_avx2()) {
+    i = vin.size() & ~size_t(7);
+    linear_from_linear_avx2(vin.data(), vout.data(), i);
+  }
+#endif
+  for (; i < vin.size(); ++i) {
+    vout[i] = static_cast<uint8_t>(std::clamp(vin[i] * 255.0f + 0.5f, 0.0f, 255.0f));
+  }
+}
+
 SPECULA_CPU_GPU void specula::sRgbColorEncoding::to_linear(pstd::span<const uint8_t> vin,
                                                            pstd::span<Float> vout) const {
 
   DASSERT_EQ(vin.size(), vout.size());
-  for (size_t i = 0; i < vin.size(); ++i) {
+  size_t i = 0;
+#if defined(SPECULA_USE_AVX2)
+  if (simd::has_avx2()) {
+    i = vin.size() & ~size_t(7);
+    lut_to_linear_avx2(SRGB_TO_LINEAR_LUT, vin.data(), vout.data(), i);
+  }
+#endif
+  for (; i < vin.size(); ++i) {
     vout[i] = srgb8_to_linear(vin[i]);
   }
 }
@@ -106,11 +239,36 @@ SPECULA_CPU_GPU void specula::sRgbColorEncoding::to_linear(pstd::span<const uint
 SPECULA_CPU_GPU void specula::sRgbColorEncoding::from_linear(pstd::span<const Float> vin,
                                                              pstd::span<uint8_t> vout) const {
   DASSERT_EQ(vin.size(), vout.size());
-  for (size_t i = 0; i < vin.size(); ++i) {
+  size_t i = 0;
+#if defined(SPECULA_USE_AVX2)
+  if (simd::has_avx2()) {
+    i = vin.size() & ~size_t(7);
+    srgb_from_linear_avx2(vin.data(), nullptr, vout.data(), i);
+  }
+#endif
+  for (; i < vin.size(); ++i) {
     vout[i] = linear_to_srgb8(vin[i]);
   }
 }
 
+size_t specula::linear_to_srgb8(pstd::span<const Float> vin, pstd::span<const Float> dither,
+                                pstd::span<uint8_t> vout) {
+  DASSERT_EQ(vin.size(), vout.size());
+  DASSERT_EQ(vin.size(), dither.size());
+  size_t i = 0, out_of_gamut = 0;
+#if defined(SPECULA_USE_AVX2)
+  if (simd::has_avx2()) {
+    i = vin.size() & ~size_t(7);
+    out_of_gamut = srgb_from_linear_avx2(vin.data(), dither.data(), vout.data(), i);
+  }
+#endif
+  for (; i < vin.size(); ++i) {
+    out_of_gamut += vin[i] < 0 || vin[i] > 1;
+    vout[i] = linear_to_srgb8(vin[i], dither[i]);
+  }
+  return out_of_gamut;
+}
+
 SPECULA_CPU_GPU specula::Float specula::sRgbColorEncoding::to_float_linear(Float v) const {
   return srgb_to_linear(v);
 }
@@ -131,7 +289,14 @@ SPECULA_CPU_GPU void specula::GammaColorEncoding::to_linear(pstd::span<const uin
                                                             pstd::span<Float> vout) const {
 
   DASSERT_EQ(vin.size(), vout.size());
-  for (size_t i = 0; i < vin.size(); ++i) {
+  size_t i = 0;
+#if defined(SPECULA_USE_AVX2)
+  if (simd::has_avx2()) {
+    i = vin.size() & ~size_t(7);
+    lut_to_linear_avx2(apply_lut.data(), vin.data(), vout.data(), i);
+  }
+#endif
+  for (; i < vin.size(); ++i) {
     vout[i] = apply_lut[vin[i]];
   }
 }
@@ -139,7 +304,15 @@ SPECULA_CPU_GPU void specula::GammaColorEncoding::to_linear(pstd::span<const uin
 SPECULA_CPU_GPU void specula::GammaColorEncoding::from_linear(pstd::span<const Float> vin,
                                                               pstd::span<uint8_t> vout) const {
   DASSERT_EQ(vin.size(), vout.size());
-  for (size_t i = 0; i < vin.size(); ++i) {
+  size_t i = 0;
+#if defined(SPECULA_USE_AVX2)
+  if (simd::has_avx2()) {
+    i = vin.size() & ~size_t(7);
+    gamma_from_linear_avx2(inverse_lut.data(), int(inverse_lut.size()), vin.data(), vout.data(),
+                           i);
+  }
+#endif
+  for (; i < vin.size(); ++i) {
     vout[i] = inverse_lut[clamp(vin[i] * (inverse_lut.size() - 1), 0, inverse_lut.size() - 1)];
   }
 }
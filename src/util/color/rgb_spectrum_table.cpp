@@ -1,8 +1,11 @@
 #include "util/color/rgb_spectrum_table.hpp"
 
+#include <algorithm>
+
 #include "util/color/rgb_sigmoid_polynomial.hpp"
 #include "util/math.hpp"
 #include "util/pstd/array.hpp"
+#include "util/simd.hpp"
 
 namespace specula {
   extern const int sRGBToSpectrumTable_Res;
@@ -30,6 +33,33 @@ namespace specula {
   const RgbToSpectrumTable *RgbToSpectrumTable::ACES2065_1;
 } // namespace specula
 
+specula::RgbToSpectrumTable::RgbToSpectrumTable(const float *z_nodes,
+                                                const CoefficientArray *coeffs)
+    : z_nodes(z_nodes), coeffs(coeffs) {
+  // Both bounds of each bucket are mapped through the same predicate as `find_interval`, the
+  // widest bucket then determines how many refinement steps a lookup needs.
+  auto count_below = [&](float z, bool inclusive) {
+    int n = 0;
+    for (int i = 1; i < RES - 1; ++i) {
+      n += inclusive ? (z_nodes[i] <= z) : (z_nodes[i] < z);
+    }
+    return n;
+  };
+
+  int max_span = 0;
+  for (int b = 0; b < Z_INDEX_RES; ++b) {
+    int lo = count_below(float(b) / Z_INDEX_RES, false);
+    int hi = count_below(float(b + 1) / Z_INDEX_RES, true);
+    z_index_lo[b] = lo;
+    max_span = std::max(max_span, hi - lo);
+  }
+
+  z_index_steps = 0;
+  while ((1 << z_index_steps) - 1 < max_span) {
+    ++z_index_steps;
+  }
+}
+
 SPECULA_CPU_GPU specula::RgbSigmoidPolynomial
 specula::RgbToSpectrumTable::operator()(specula::Rgb rgb) const {
   DASSERT(rgb[0] >= 0.0f && rgb[1] >= 0.0f && rgb[2] >= 0.0f && rgb[0] <= 1.0f && rgb[1] <= 1.0f &&
@@ -62,6 +92,141 @@ specula::RgbToSpectrumTable::operator()(specula::Rgb rgb) const {
   return RgbSigmoidPolynomial(c[0], c[1], c[2]);
 }
 
+#if defined(SPECULA_USE_AVX2)
+namespace specula {
+  SPECULA_TARGET_AVX2 static void rgb_to_spectrum_lookup_avx2(
+      const float *z_nodes, const RgbToSpectrumTable::CoefficientArray *coeffs,
+      const uint8_t *z_index_lo, int z_index_steps, const Rgb *rgb, RgbSigmoidPolynomial *out,
+      size_t n) {
+    static_assert(sizeof(Rgb) == 3 * sizeof(float));
+    constexpr int RES = RgbToSpectrumTable::RES;
+    const float *data = &(*coeffs)[0][0][0][0][0];
+
+    const __m256i stride = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+    const __m256 one = _mm256_set1_ps(1.0f), half = _mm256_set1_ps(0.5f);
+    const __m256 res_m1 = _mm256_set1_ps(float(RES - 1));
+    const __m256i zero = _mm256_setzero_si256(), max_xy = _mm256_set1_epi32(RES - 2);
+    using simd::lerp, simd::select;
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+      const float *base = &rgb[i].r;
+      __m256 r = _mm256_i32gather_ps(base, stride, 4);
+      __m256 g = _mm256_i32gather_ps(base + 1, stride, 4);
+      __m256 b = _mm256_i32gather_ps(base + 2, stride, 4);
+
+      // Select the maximum component, and the two following it in cyclic order
+      __m256 rg = _mm256_cmp_ps(r, g, _CMP_GT_OQ);
+      __m256 rb = _mm256_cmp_ps(r, b, _CMP_GT_OQ);
+      __m256 gb = _mm256_cmp_ps(g, b, _CMP_GT_OQ);
+      __m256 is_r = _mm256_and_ps(rg, rb);
+      __m256 is_g = _mm256_andnot_ps(rg, gb);
+
+      __m256 z = select(is_r, r, select(is_g, g, b));
+      __m256 xc = select(is_r, g, select(is_g, b, r));
+      __m256 yc = select(is_r, b, select(is_g, r, g));
+      __m256i maxc = _mm256_sub_epi32(
+          _mm256_set1_epi32(2),
+          _mm256_add_epi32(_mm256_and_si256(_mm256_castps_si256(is_r), _mm256_set1_epi32(2)),
+                           _mm256_and_si256(_mm256_castps_si256(is_g), _mm256_set1_epi32(1))));
+
+      __m256 x = _mm256_div_ps(_mm256_mul_ps(xc, res_m1), z);
+      __m256 y = _mm256_div_ps(_mm256_mul_ps(yc, res_m1), z);
+      // Gray lanes may produce NaN here, clamping keeps their (unused) gathers in bounds
+      __m256i xi = _mm256_max_epi32(_mm256_min_epi32(_mm256_cvttps_epi32(x), max_xy), zero);
+      __m256i yi = _mm256_max_epi32(_mm256_min_epi32(_mm256_cvttps_epi32(y), max_xy), zero);
+
+      // Start from the lower bound of the z bucket, then refine with a branchless binary search
+      __m256i bucket = _mm256_min_epi32(
+          _mm256_cvttps_epi32(_mm256_mul_ps(z, _mm256_set1_ps(RgbToSpectrumTable::Z_INDEX_RES))),
+          _mm256_set1_epi32(RgbToSpectrumTable::Z_INDEX_RES - 1));
+      bucket = _mm256_max_epi32(bucket, zero);
+      alignas(32) int32_t buckets[8], lo[8];
+      _mm256_store_si256((__m256i *)buckets, bucket);
+      for (int k = 0; k < 8; ++k) {
+        lo[k] = z_index_lo[buckets[k]];
+      }
+      __m256i zi = _mm256_load_si256((const __m256i *)lo);
+      for (int step = (1 << z_index_steps) >> 1; step > 0; step >>= 1) {
+        __m256i candidate = _mm256_add_epi32(zi, _mm256_set1_epi32(step));
+        __m256i in_range = _mm256_cmpgt_epi32(_mm256_set1_epi32(RES - 1), candidate);
+        __m256i clamped = _mm256_min_epi32(candidate, max_xy);
+        __m256 node = _mm256_i32gather_ps(z_nodes, clamped, 4);
+        __m256i below = _mm256_and_si256(
+            in_range, _mm256_castps_si256(_mm256_cmp_ps(node, z, _CMP_LT_OQ)));
+        zi = _mm256_blendv_epi8(zi, candidate, below);
+      }
+
+      __m256 z0 = _mm256_i32gather_ps(z_nodes, zi, 4);
+      __m256 z1 = _mm256_i32gather_ps(z_nodes, _mm256_add_epi32(zi, _mm256_set1_epi32(1)), 4);
+      __m256 dx = _mm256_sub_ps(x, _mm256_cvtepi32_ps(xi));
+      __m256 dy = _mm256_sub_ps(y, _mm256_cvtepi32_ps(yi));
+      __m256 dz = _mm256_div_ps(_mm256_sub_ps(z, z0), _mm256_sub_ps(z1, z0));
+
+      // Offset of the (0, 0, 0) corner, as a float index into the coefficient array
+      __m256i res = _mm256_set1_epi32(RES);
+      __m256i offset = _mm256_add_epi32(_mm256_mullo_epi32(maxc, res), zi);
+      offset = _mm256_add_epi32(_mm256_mullo_epi32(offset, res), yi);
+      offset = _mm256_add_epi32(_mm256_mullo_epi32(offset, res), xi);
+      offset = _mm256_mullo_epi32(offset, _mm256_set1_epi32(3));
+
+      __m256 c[3];
+      for (int j = 0; j < 3; ++j) {
+        // Corners are indexed as co[dz][dy][dx]
+        __m256 co[2][2][2];
+        for (int oz = 0; oz < 2; ++oz) {
+          for (int oy = 0; oy < 2; ++oy) {
+            for (int ox = 0; ox < 2; ++ox) {
+              int delta = ((oz * RES + oy) * RES + ox) * 3 + j;
+              co[oz][oy][ox] = _mm256_i32gather_ps(
+                  data, _mm256_add_epi32(offset, _mm256_set1_epi32(delta)), 4);
+            }
+          }
+        }
+
+        c[j] = lerp(dz,
+                    lerp(dy, lerp(dx, co[0][0][0], co[0][0][1]),
+                         lerp(dx, co[0][1][0], co[0][1][1])),
+                    lerp(dy, lerp(dx, co[1][0][0], co[1][0][1]),
+                         lerp(dx, co[1][1][0], co[1][1][1])));
+      }
+
+      // Gray values bypass the table entirely
+      __m256 gray = _mm256_and_ps(_mm256_cmp_ps(r, g, _CMP_EQ_OQ), _mm256_cmp_ps(g, b, _CMP_EQ_OQ));
+      __m256 gray_c2 = _mm256_div_ps(_mm256_sub_ps(r, half),
+                                     _mm256_sqrt_ps(_mm256_mul_ps(r, _mm256_sub_ps(one, r))));
+      c[0] = _mm256_andnot_ps(gray, c[0]);
+      c[1] = _mm256_andnot_ps(gray, c[1]);
+      c[2] = select(gray, gray_c2, c[2]);
+
+      alignas(32) float c0[8], c1[8], c2[8];
+      _mm256_store_ps(c0, c[0]);
+      _mm256_store_ps(c1, c[1]);
+      _mm256_store_ps(c2, c[2]);
+      for (int k = 0; k < 8; ++k) {
+        out[i + k] = RgbSigmoidPolynomial(c0[k], c1[k], c2[k]);
+      }
+    }
+  }
+} // namespace specula
+#endif
+
+void specula::RgbToSpectrumTable::lookup(pstd::span<const Rgb> rgb,
+                                         pstd::span<RgbSigmoidPolynomial> out) const {
+  DASSERT_EQ(rgb.size(), out.size());
+  size_t i = 0;
+#if defined(SPECULA_USE_AVX2)
+  if (simd::has_avx2()) {
+    i = rgb.size() & ~size_t(7);
+    rgb_to_spectrum_lookup_avx2(z_nodes, coeffs, z_index_lo.data(), z_index_steps, rgb.data(),
+                                out.data(), i);
+  }
+#endif
+  for (; i < rgb.size(); ++i) {
+    out[i] = (*this)(rgb[i]);
+  }
+}
+
 void specula::RgbToSpectrumTable::init(Allocator &alloc) {
 #if defined(SPECULA_BUILD_GPU_RENDERER)
   // TODO: Implement GPU initialization
@@ -6,6 +6,13 @@
 #include <string_view>
 #include <vector>
 
+#if defined(SPECULA_HAVE_MMAP)
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
 #include "util/check.hpp"
 #include "util/log.hpp"
 #include "util/string.hpp"
@@ -69,3 +76,77 @@ std::vector<specula::Float> specula::read_float_file(std::string_view filename)
   fclose(f);
   return values;
 }
+
+bool specula::has_extension(std::string_view filename, std::string_view extension) {
+  if (filename.size() <= extension.size() ||
+      filename[filename.size() - extension.size() - 1] != '.') {
+    return false;
+  }
+  std::string_view suffix = filename.substr(filename.size() - extension.size());
+  for (size_t i = 0; i < extension.size(); ++i) {
+    if (std::tolower(suffix[i]) != std::tolower(extension[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::shared_ptr<specula::MappedFile> specula::MappedFile::open(const std::string &filename) {
+  std::shared_ptr<MappedFile> file(new MappedFile());
+
+#if defined(SPECULA_HAVE_MMAP)
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOG_ERROR("Unable to open file {}", filename);
+    return nullptr;
+  }
+
+  struct stat s;
+  if (fstat(fd, &s) != 0) {
+    LOG_ERROR("Unable to stat file {}", filename);
+    close(fd);
+    return nullptr;
+  }
+
+  file->size_ = s.st_size;
+  if (file->size_ > 0) {
+    void *ptr = mmap(nullptr, file->size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (ptr == MAP_FAILED) {
+      LOG_ERROR("Unable to map file {}", filename);
+      close(fd);
+      return nullptr;
+    }
+    file->data_ = static_cast<std::byte *>(ptr);
+  }
+  // The mapping stays valid after the descriptor is closed
+  close(fd);
+#else
+  FILE *f = fopen_read(filename);
+  if (f == nullptr) {
+    LOG_ERROR("Unable to open file {}", filename);
+    return nullptr;
+  }
+
+  fseek(f, 0, SEEK_END);
+  file->size_ = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  file->buffer = std::make_unique<std::byte[]>(file->size_);
+  file->data_ = file->buffer.get();
+  if (fread(file->data_, 1, file->size_, f) != file->size_) {
+    LOG_ERROR("Unable to read file {}", filename);
+    fclose(f);
+    return nullptr;
+  }
+  fclose(f);
+#endif
+
+  return file;
+}
+
+specula::MappedFile::~MappedFile() {
+#if defined(SPECULA_HAVE_MMAP)
+  if (data_ != nullptr) {
+    munmap(data_, size_);
+  }
+#endif
+}
@@ -0,0 +1,975 @@
+#include "util/image/exr.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <set>
+#include <string_view>
+#include <vector>
+
+#include "util/check.hpp"
+#include "util/file.hpp"
+#include "util/log.hpp"
+#include "util/parallel.hpp"
+
+namespace specula {
+  static constexpr uint8_t EXR_MAGIC[4] = {0x76, 0x2f, 0x31, 0x01};
+  static constexpr uint32_t EXR_VERSION = 2;
+  static constexpr uint32_t EXR_TILED_FLAG = 0x200;
+  static constexpr uint32_t EXR_LONG_NAMES_FLAG = 0x400;
+  static constexpr uint32_t EXR_NON_IMAGE_FLAG = 0x800;
+  static constexpr uint32_t EXR_MULTIPART_FLAG = 0x1000;
+  /// Attribute and channel names longer than this require the long names flag
+  static constexpr size_t EXR_SHORT_NAME_LENGTH = 31;
+
+  static constexpr int32_t EXR_UINT = 0;
+  static constexpr int32_t EXR_HALF = 1;
+  static constexpr int32_t EXR_FLOAT = 2;
+
+  /// Blocks stored in order of increasing y
+  static constexpr uint8_t EXR_INCREASING_Y = 0;
+  /// Blocks stored in any order, readers find them through the offset table
+  static constexpr uint8_t EXR_RANDOM_Y = 2;
+
+  /// Number of scanline blocks compressed per thread before they are written out
+  static constexpr int EXR_BLOCKS_PER_THREAD = 16;
+
+  static constexpr int EXR_MIN_RUN_LENGTH = 3;
+  static constexpr int EXR_MAX_RUN_LENGTH = 127;
+
+  /// Number of scanlines in each block, for every compression method defined by the format
+  static int exr_lines_per_block(int compression) {
+    switch (compression) {
+    case 0: // NONE
+    case 1: // RLE
+    case 2: // ZIPS
+      return 1;
+    case 3: // ZIP
+    case 5: // PXR24
+      return 16;
+    case 4: // PIZ
+    case 6: // B44
+    case 7: // B44A
+    case 8: // DWAA
+      return 32;
+    case 9: // DWAB
+      return 256;
+    default:
+      return 0;
+    }
+  }
+
+  // Every value in the file is little endian
+  static void put_u32(std::vector<uint8_t> &out, uint32_t v) {
+    for (int shift = 0; shift < 32; shift += 8) {
+      out.push_back(uint8_t(v >> shift));
+    }
+  }
+
+  static void put_u64(std::vector<uint8_t> &out, uint64_t v) {
+    put_u32(out, uint32_t(v));
+    put_u32(out, uint32_t(v >> 32));
+  }
+
+  static void put_f32(std::vector<uint8_t> &out, float v) {
+    put_u32(out, std::bit_cast<uint32_t>(v));
+  }
+
+  static void put_string(std::vector<uint8_t> &out, std::string_view s) {
+    out.insert(out.end(), s.begin(), s.end());
+    out.push_back('\0');
+  }
+
+  static void put_box(std::vector<uint8_t> &out, const Bounds2i &box) {
+    // The maximum is inclusive
+    put_u32(out, box.pmin.x);
+    put_u32(out, box.pmin.y);
+    put_u32(out, box.pmax.x - 1);
+    put_u32(out, box.pmax.y - 1);
+  }
+
+  /// Append an attribute whose value is appended by `value`, and fill in its size afterwards
+  template <typename F>
+  static void put_attribute(std::vector<uint8_t> &out, std::string_view name,
+                            std::string_view type, F &&value) {
+    put_string(out, name);
+    put_string(out, type);
+    size_t size_offset = out.size();
+    put_u32(out, 0);
+    value();
+    uint32_t size = out.size() - size_offset - sizeof(uint32_t);
+    for (int i = 0; i < 4; ++i) {
+      out[size_offset + i] = uint8_t(size >> (8 * i));
+    }
+  }
+
+  /// Reads values from a buffer, every read past its end fails and leaves the reader failed
+  class ExrReader {
+  public:
+    ExrReader(const uint8_t *data, size_t size) : data(data), size(size) {}
+
+    bool ok() const { return !failed; }
+    size_t remaining() const { return size - pos; }
+    const uint8_t *current() const { return data + pos; }
+
+    const uint8_t *take(size_t n) {
+      if (failed || n > size - pos) {
+        failed = true;
+        return nullptr;
+      }
+      pos += n;
+      return data + pos - n;
+    }
+
+    uint8_t u8() {
+      const uint8_t *p = take(1);
+      return p ? p[0] : 0;
+    }
+
+    uint32_t u32() {
+      const uint8_t *p = take(4);
+      return p ? uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) |
+                     (uint32_t(p[3]) << 24)
+               : 0;
+    }
+
+    int32_t i32() { return int32_t(u32()); }
+
+    uint64_t u64() {
+      uint64_t low = u32();
+      return low | (uint64_t(u32()) << 32);
+    }
+
+    float f32() { return std::bit_cast<float>(u32()); }
+
+    std::string bytes(size_t n) {
+      const uint8_t *p = take(n);
+      return p ? std::string(reinterpret_cast<const char *>(p), n) : std::string();
+    }
+
+    /// Read a NUL terminated string
+    std::string string() {
+      const void *end = failed ? nullptr : std::memchr(data + pos, '\0', size - pos);
+      if (end == nullptr) {
+        failed = true;
+        return {};
+      }
+      std::string s = bytes(static_cast<const uint8_t *>(end) - (data + pos));
+      ++pos;
+      return s;
+    }
+
+  private:
+    const uint8_t *data;
+    size_t size, pos = 0;
+    bool failed = false;
+  };
+
+  struct ExrChannel {
+    std::string name;
+    int32_t type;
+  };
+
+  /// The attributes of a part that are needed to read it
+  struct ExrHeader {
+    std::vector<ExrChannel> channels;
+    int compression = -1;
+    Bounds2i data_window, display_window;
+    int chunk_count = -1;
+    bool subsampled = false;
+    ImageMetadata metadata;
+  };
+
+  /**
+   * Split the bytes of a block into the even and the odd ones, and replace every byte with its
+   * difference to the previous one. Both the RLE and ZIP compression methods apply this to the
+   * block first, since neighboring pixels tend to share their high bytes.
+   */
+  static void exr_predict(const uint8_t *in, size_t n, uint8_t *out) {
+    uint8_t *even = out, *odd = out + (n + 1) / 2;
+    for (size_t i = 0; i < n; ++i) {
+      *(i % 2 == 0 ? even++ : odd++) = in[i];
+    }
+    for (size_t i = n; i-- > 1;) {
+      out[i] = uint8_t(int(out[i]) - out[i - 1] + 128);
+    }
+  }
+
+  /// Undo `exr_predict`, the contents of `in` are modified in the process
+  static void exr_unpredict(uint8_t *in, size_t n, uint8_t *out) {
+    for (size_t i = 1; i < n; ++i) {
+      in[i] = uint8_t(int(in[i - 1]) + in[i] - 128);
+    }
+    const uint8_t *even = in, *odd = in + (n + 1) / 2;
+    for (size_t i = 0; i < n; ++i) {
+      out[i] = i % 2 == 0 ? *even++ : *odd++;
+    }
+  }
+
+  /**
+   * Code runs of at least `EXR_MIN_RUN_LENGTH` equal bytes as their length minus one followed by
+   * the byte, and everything else as the negated number of literal bytes followed by them.
+   */
+  static void exr_rle_compress(const uint8_t *in, size_t n, std::vector<uint8_t> &out) {
+    size_t run_start = 0, run_end = 1;
+    while (run_start < n) {
+      while (run_end < n && in[run_start] == in[run_end] &&
+             run_end - run_start - 1 < EXR_MAX_RUN_LENGTH) {
+        ++run_end;
+      }
+
+      if (run_end - run_start >= EXR_MIN_RUN_LENGTH) {
+        out.push_back(uint8_t(run_end - run_start - 1));
+        out.push_back(in[run_start]);
+      } else {
+        // Extend the literal run up to the start of the next run of three equal bytes
+        while (run_end < n &&
+               (run_end + 2 >= n || in[run_end] != in[run_end + 1] ||
+                in[run_end + 1] != in[run_end + 2]) &&
+               run_end - run_start < EXR_MAX_RUN_LENGTH) {
+          ++run_end;
+        }
+        out.push_back(uint8_t(-int(run_end - run_start)));
+        out.insert(out.end(), in + run_start, in + run_end);
+      }
+      run_start = run_end++;
+    }
+  }
+
+  /// Decode `in` into exactly `n_out` bytes, returns false if it does not decode to that size
+  static bool exr_rle_uncompress(const uint8_t *in, size_t n, uint8_t *out, size_t n_out) {
+    size_t i = 0, o = 0;
+    while (i < n) {
+      int count = int8_t(in[i++]);
+      if (count < 0) {
+        if (i - count > n || o - count > n_out) {
+          return false;
+        }
+        std::memcpy(out + o, in + i, -count);
+        i -= count;
+        o -= count;
+      } else {
+        if (i >= n || o + count + 1 > n_out) {
+          return false;
+        }
+        std::memset(out + o, in[i++], count + 1);
+        o += count + 1;
+      }
+    }
+    return o == n_out;
+  }
+
+  /// Code a scanline of interleaved channels, with its channels in the order given by `order`
+  static void exr_encode_row(pstd::span<const float> row, const std::vector<int> &order,
+                             int32_t type, ExrCompression compression,
+                             std::vector<uint8_t> &out) {
+    size_t nc = order.size(), width = row.size() / nc;
+
+    // Each channel of the scanline is stored contiguously
+    std::vector<uint8_t> raw;
+    raw.reserve(row.size() * (type == EXR_HALF ? sizeof(Half) : sizeof(float)));
+    for (int c : order) {
+      for (size_t x = 0; x < width; ++x) {
+        float v = row[x * nc + c];
+        if (type == EXR_HALF) {
+          uint16_t bits = Half(v).bits();
+          raw.push_back(uint8_t(bits));
+          raw.push_back(uint8_t(bits >> 8));
+        } else {
+          put_f32(raw, v);
+        }
+      }
+    }
+
+    // Blocks that do not get any smaller are stored uncompressed, which readers recognize by
+    // their size
+    out.clear();
+    if (compression == ExrCompression::Rle && !raw.empty()) {
+      std::vector<uint8_t> predicted(raw.size());
+      exr_predict(raw.data(), raw.size(), predicted.data());
+      exr_rle_compress(predicted.data(), predicted.size(), out);
+      if (out.size() < raw.size()) {
+        return;
+      }
+    }
+    out = std::move(raw);
+  }
+
+  /// The channels of every part are stored sorted by name
+  static std::vector<int> exr_channel_order(const std::vector<std::string> &names) {
+    std::vector<int> order(names.size());
+    for (size_t c = 0; c < names.size(); ++c) {
+      order[c] = c;
+    }
+    std::sort(order.begin(), order.end(), [&](int a, int b) { return names[a] < names[b]; });
+    return order;
+  }
+
+  static bool exr_long_names(const std::vector<std::string> &names,
+                             const ImageMetadata &metadata) {
+    bool long_names = false;
+    for (const std::string &name : names) {
+      long_names |= name.size() > EXR_SHORT_NAME_LENGTH;
+    }
+    for (const auto &[name, value] : metadata.strings) {
+      long_names |= name.size() > EXR_SHORT_NAME_LENGTH;
+    }
+    for (const auto &[name, values] : metadata.string_vectors) {
+      long_names |= name.size() > EXR_SHORT_NAME_LENGTH;
+    }
+    return long_names;
+  }
+
+  /// Find the windows of an image from its metadata, returns false if they do not match
+  static bool exr_windows(const ImageMetadata &metadata, Point2i resolution,
+                          Bounds2i *data_window, Bounds2i *display_window) {
+    *data_window = *display_window = Bounds2i({0, 0}, resolution);
+    if (metadata.full_resolution) {
+      *display_window = Bounds2i({0, 0}, *metadata.full_resolution);
+    }
+    if (metadata.pixel_bounds) {
+      const Bounds2i &bounds = *metadata.pixel_bounds;
+      if (bounds.pmax.x - bounds.pmin.x != resolution.x ||
+          bounds.pmax.y - bounds.pmin.y != resolution.y) {
+        return false;
+      }
+      *data_window = bounds;
+    }
+    return true;
+  }
+
+  /// Write a block at `*offset`, preceded by its part number in multipart files
+  static bool exr_write_chunk(FILE *f, int part, int y, const std::vector<uint8_t> &block,
+                              uint64_t *offset) {
+    std::vector<uint8_t> prefix;
+    if (part >= 0) {
+      put_u32(prefix, part);
+    }
+    put_u32(prefix, y);
+    put_u32(prefix, block.size());
+    *offset += prefix.size() + block.size();
+    return fwrite(prefix.data(), 1, prefix.size(), f) == prefix.size() &&
+           fwrite(block.data(), 1, block.size(), f) == block.size();
+  }
+
+  /// Fill in the offset table reserved after the header
+  static bool exr_write_table(FILE *f, uint64_t table_offset,
+                              const std::vector<uint64_t> &offsets) {
+    std::vector<uint8_t> table;
+    for (uint64_t offset : offsets) {
+      put_u64(table, offset);
+    }
+    return fseek(f, long(table_offset), SEEK_SET) == 0 &&
+           fwrite(table.data(), 1, table.size(), f) == table.size();
+  }
+
+  static void exr_put_header(std::vector<uint8_t> &out, const std::vector<std::string> &names,
+                             const std::string &part_name, const std::vector<int> &order,
+                             int32_t type, ExrCompression compression, const Bounds2i &data_window,
+                             const Bounds2i &display_window, const ImageMetadata &metadata,
+                             uint8_t line_order, bool multipart) {
+    put_attribute(out, "channels", "chlist", [&]() {
+      for (int c : order) {
+        put_string(out, names[c]);
+        put_u32(out, type);
+        // pLinear and reserved bytes, then the x and y sampling
+        out.insert(out.end(), {0, 0, 0, 0});
+        put_u32(out, 1);
+        put_u32(out, 1);
+      }
+      out.push_back('\0');
+    });
+    put_attribute(out, "compression", "compression",
+                  [&]() { out.push_back(uint8_t(compression)); });
+    put_attribute(out, "dataWindow", "box2i", [&]() { put_box(out, data_window); });
+    put_attribute(out, "displayWindow", "box2i", [&]() { put_box(out, display_window); });
+    put_attribute(out, "lineOrder", "lineOrder", [&]() { out.push_back(line_order); });
+    put_attribute(out, "pixelAspectRatio", "float", [&]() { put_f32(out, 1.f); });
+    put_attribute(out, "screenWindowCenter", "v2f", [&]() {
+      put_f32(out, 0.f);
+      put_f32(out, 0.f);
+    });
+    put_attribute(out, "screenWindowWidth", "float", [&]() { put_f32(out, 1.f); });
+
+    if (!part_name.empty()) {
+      put_attribute(out, "name", "string",
+                    [&]() { out.insert(out.end(), part_name.begin(), part_name.end()); });
+    }
+    if (multipart) {
+      std::string_view type = "scanlineimage";
+      put_attribute(out, "type", "string",
+                    [&]() { out.insert(out.end(), type.begin(), type.end()); });
+      put_attribute(out, "chunkCount", "int",
+                    [&]() { put_u32(out, data_window.pmax.y - data_window.pmin.y); });
+    }
+
+    if (metadata.render_time_seconds) {
+      put_attribute(out, "renderTimeSeconds", "float",
+                    [&]() { put_f32(out, *metadata.render_time_seconds); });
+    }
+    for (auto [name, matrix] : {std::make_pair("worldToCamera", &metadata.camera_from_world),
+                                std::make_pair("worldToNDC", &metadata.ndc_from_world)}) {
+      if (*matrix) {
+        put_attribute(out, name, "m44f", [&]() {
+          for (int i = 0; i < 4; ++i) {
+            for (int j = 0; j < 4; ++j) {
+              put_f32(out, (**matrix)[i][j]);
+            }
+          }
+        });
+      }
+    }
+    if (metadata.samples_per_pixel) {
+      put_attribute(out, "samplesPerPixel", "int",
+                    [&]() { put_u32(out, *metadata.samples_per_pixel); });
+    }
+    if (metadata.mse) {
+      put_attribute(out, "MSE", "float", [&]() { put_f32(out, *metadata.mse); });
+    }
+    if (metadata.color_space && *metadata.color_space) {
+      const RgbColorSpace *cs = *metadata.color_space;
+      put_attribute(out, "chromaticities", "chromaticities", [&]() {
+        for (Point2f p : {cs->r, cs->g, cs->b, cs->w}) {
+          put_f32(out, p.x);
+          put_f32(out, p.y);
+        }
+      });
+    }
+    for (const auto &[name, value] : metadata.strings) {
+      put_attribute(out, name, "string",
+                    [&]() { out.insert(out.end(), value.begin(), value.end()); });
+    }
+    for (const auto &[name, values] : metadata.string_vectors) {
+      put_attribute(out, name, "stringvector", [&]() {
+        for (const std::string &value : values) {
+          put_u32(out, value.size());
+          out.insert(out.end(), value.begin(), value.end());
+        }
+      });
+    }
+    out.push_back('\0');
+  }
+
+  /// Read the attributes of a part, returns false if the header is malformed or incomplete
+  static bool exr_read_header(ExrReader &in, ExrHeader *header) {
+    bool has_data_window = false, has_display_window = false;
+    Point2f chromaticities[4];
+    bool has_chromaticities = false;
+
+    while (true) {
+      std::string name = in.string();
+      if (!in.ok() || name.empty()) {
+        break;
+      }
+      std::string type = in.string();
+      uint32_t size = in.u32();
+      const uint8_t *data = in.take(size);
+      if (!in.ok()) {
+        break;
+      }
+
+      ExrReader value(data, size);
+      if (name == "channels" && type == "chlist") {
+        for (std::string channel = value.string(); value.ok() && !channel.empty();
+             channel = value.string()) {
+          int32_t pixel_type = value.i32();
+          value.take(4);
+          int x_sampling = value.i32(), y_sampling = value.i32();
+          header->subsampled |= x_sampling != 1 || y_sampling != 1;
+          header->channels.push_back({channel, pixel_type});
+        }
+      } else if (name == "compression" && type == "compression") {
+        header->compression = value.u8();
+      } else if ((name == "dataWindow" || name == "displayWindow") && type == "box2i") {
+        int x_min = value.i32(), y_min = value.i32(), x_max = value.i32(), y_max = value.i32();
+        // The windows are inclusive, so their exclusive bounds must still fit in an int
+        constexpr int max_bound = std::numeric_limits<int>::max();
+        if (x_max == max_bound || y_max == max_bound) {
+          continue;
+        }
+        Bounds2i window({x_min, y_min}, {x_max + 1, y_max + 1});
+        if (name == "dataWindow") {
+          header->data_window = window;
+          has_data_window = value.ok();
+        } else {
+          header->display_window = window;
+          has_display_window = value.ok();
+        }
+      } else if (name == "chunkCount" && type == "int") {
+        header->chunk_count = value.i32();
+      } else if (name == "renderTimeSeconds" && type == "float") {
+        header->metadata.render_time_seconds = value.f32();
+      } else if ((name == "worldToCamera" || name == "worldToNDC") && type == "m44f") {
+        SquareMatrix<4> m;
+        for (int i = 0; i < 4; ++i) {
+          for (int j = 0; j < 4; ++j) {
+            m[i][j] = value.f32();
+          }
+        }
+        (name == "worldToCamera" ? header->metadata.camera_from_world
+                                 : header->metadata.ndc_from_world) = m;
+      } else if (name == "samplesPerPixel" && type == "int") {
+        header->metadata.samples_per_pixel = value.i32();
+      } else if (name == "MSE" && type == "float") {
+        header->metadata.mse = value.f32();
+      } else if (name == "chromaticities" && type == "chromaticities") {
+        for (Point2f &p : chromaticities) {
+          p.x = value.f32();
+          p.y = value.f32();
+        }
+        has_chromaticities = value.ok();
+      } else if (type == "string" && name != "name" && name != "type") {
+        header->metadata.strings[name] = value.bytes(size);
+      } else if (type == "stringvector") {
+        std::vector<std::string> &values = header->metadata.string_vectors[name];
+        while (value.ok() && value.remaining() > 0) {
+          values.push_back(value.bytes(value.u32()));
+        }
+      }
+    }
+
+    // The named color spaces are only available once they have been initialized
+    if (has_chromaticities && RgbColorSpace::SRGB != nullptr) {
+      header->metadata.color_space =
+          RgbColorSpace::lookup(chromaticities[0], chromaticities[1], chromaticities[2],
+                                chromaticities[3]);
+    }
+
+    if (!in.ok() || header->channels.empty() || header->compression < 0 || !has_data_window ||
+        !has_display_window || header->data_window.is_empty()) {
+      return false;
+    }
+
+    // Reject data windows whose resolution or image size do not fit in the types used to
+    // allocate the image, before anything is allocated for them
+    const Bounds2i &window = header->data_window;
+    int64_t width = int64_t(window.pmax.x) - window.pmin.x;
+    int64_t height = int64_t(window.pmax.y) - window.pmin.y;
+    size_t max_pixels = size_t(std::numeric_limits<ptrdiff_t>::max()) /
+                        (header->channels.size() * sizeof(float));
+    if (width > std::numeric_limits<int>::max() || height > std::numeric_limits<int>::max() ||
+        size_t(width) * size_t(height) > max_pixels) {
+      return false;
+    }
+
+    if (header->chunk_count < 0) {
+      int lines = exr_lines_per_block(header->compression);
+      header->chunk_count = lines > 0 ? int((height + lines - 1) / lines) : -1;
+    }
+    return header->chunk_count >= 0;
+  }
+} // namespace specula
+
+bool specula::exr_write(const std::string &filename, pstd::span<const ExrPart> parts,
+                        const ImageMetadata &metadata, ExrCompression compression) {
+  if (parts.empty()) {
+    LOG_ERROR("Unable to write EXR {}, no images were given", filename);
+    return false;
+  }
+
+  bool multipart = parts.size() > 1;
+  Point2i resolution = parts[0].image.resolution();
+  std::set<std::string> part_names;
+  for (const ExrPart &part : parts) {
+    if (part.image.resolution() != resolution) {
+      LOG_ERROR("Unable to write EXR {}, the parts have different resolutions", filename);
+      return false;
+    }
+    if (multipart && (part.name.empty() || !part_names.insert(part.name).second)) {
+      LOG_ERROR("Unable to write EXR {}, the parts need unique names", filename);
+      return false;
+    }
+  }
+
+  Bounds2i data_window, display_window;
+  if (!exr_windows(metadata, resolution, &data_window, &display_window)) {
+    LOG_ERROR("Unable to write EXR {}, the pixel bounds do not match the resolution", filename);
+    return false;
+  }
+
+  std::vector<std::vector<std::string>> names(parts.size());
+  std::vector<std::vector<int>> orders(parts.size());
+  std::vector<int32_t> types(parts.size());
+  bool long_names = false;
+  for (size_t i = 0; i < parts.size(); ++i) {
+    names[i] = parts[i].image.channel_names();
+    orders[i] = exr_channel_order(names[i]);
+    types[i] = parts[i].image.format() == PixelFormat::Float ? EXR_FLOAT : EXR_HALF;
+    long_names |= exr_long_names(names[i], metadata);
+  }
+
+  std::vector<uint8_t> header(std::begin(EXR_MAGIC), std::end(EXR_MAGIC));
+  put_u32(header, EXR_VERSION | (long_names ? EXR_LONG_NAMES_FLAG : 0) |
+                      (multipart ? EXR_MULTIPART_FLAG : 0));
+  for (size_t i = 0; i < parts.size(); ++i) {
+    exr_put_header(header, names[i], parts[i].name, orders[i], types[i], compression,
+                   data_window, display_window, metadata, EXR_INCREASING_Y, multipart);
+  }
+  if (multipart) {
+    header.push_back('\0');
+  }
+
+  FILE *f = fopen(filename.c_str(), "wb");
+  if (f == nullptr) {
+    LOG_ERROR("Unable to open {} for writing", filename);
+    return false;
+  }
+
+  // Space for the offset table, which is filled in once the position of every block is known
+  std::vector<uint64_t> offsets(parts.size() * resolution.y);
+  std::vector<uint8_t> table(offsets.size() * sizeof(uint64_t));
+  bool success = fwrite(header.data(), 1, header.size(), f) == header.size() &&
+                 fwrite(table.data(), 1, table.size(), f) == table.size();
+  uint64_t offset = header.size() + table.size();
+
+  int batch_size = EXR_BLOCKS_PER_THREAD * running_threads();
+  std::vector<std::vector<uint8_t>> blocks(batch_size);
+  size_t chunk = 0;
+  for (size_t i = 0; i < parts.size() && success; ++i) {
+    const SubImage &image = parts[i].image;
+    for (int y0 = 0; y0 < resolution.y && success; y0 += batch_size) {
+      int y1 = std::min(resolution.y, y0 + batch_size);
+      parallel_for(y0, y1, [&](int64_t begin, int64_t end) {
+        std::vector<float> row(size_t(resolution.x) * image.n_channels());
+        for (int64_t y = begin; y < end; ++y) {
+          image.copy_rect_out(Bounds2i({0, int(y)}, {resolution.x, int(y) + 1}), row);
+          exr_encode_row(row, orders[i], types[i], compression, blocks[y - y0]);
+        }
+      });
+
+      for (int y = y0; y < y1 && success; ++y) {
+        offsets[chunk++] = offset;
+        success = exr_write_chunk(f, multipart ? int(i) : -1, data_window.pmin.y + y,
+                                  blocks[y - y0], &offset);
+      }
+    }
+  }
+  success = success && exr_write_table(f, header.size(), offsets);
+
+  if (fclose(f) != 0 || !success) {
+    LOG_ERROR("Unable to write EXR {}", filename);
+    return false;
+  }
+  return true;
+}
+
+specula::ImageAndMetadata specula::exr_read(const std::string &filename, Allocator alloc,
+                                            int part) {
+  std::shared_ptr<MappedFile> file = MappedFile::open(filename);
+  if (!file) {
+    return {};
+  }
+
+  const uint8_t *data = reinterpret_cast<const uint8_t *>(file->data());
+  ExrReader in(data, file->size());
+  const uint8_t *magic = in.take(sizeof(EXR_MAGIC));
+  uint32_t version = in.u32();
+  if (!in.ok() || std::memcmp(magic, EXR_MAGIC, sizeof(EXR_MAGIC)) != 0 ||
+      (version & 0xff) != EXR_VERSION) {
+    LOG_ERROR("Invalid EXR header in {}", filename);
+    return {};
+  }
+  if (version & (EXR_TILED_FLAG | EXR_NON_IMAGE_FLAG)) {
+    LOG_ERROR("Unable to read EXR {}, only scanline images are supported", filename);
+    return {};
+  }
+
+  // Multipart files have a header per part, followed by an empty header
+  bool multipart = version & EXR_MULTIPART_FLAG;
+  std::vector<ExrHeader> headers;
+  bool valid = true;
+  do {
+    valid = exr_read_header(in, &headers.emplace_back());
+  } while (valid && multipart && in.remaining() > 0 && *in.current() != '\0');
+  if (multipart) {
+    in.take(1);
+  }
+  if (!valid || !in.ok()) {
+    LOG_ERROR("Invalid EXR header in {}", filename);
+    return {};
+  }
+  if (part < 0 || part >= int(headers.size())) {
+    LOG_ERROR("Unable to read EXR {}, it has no part {}", filename, part);
+    return {};
+  }
+
+  // The offset tables of every part follow the headers in order, and must fit in the rest of the
+  // file before any memory is allocated for them
+  for (int i = 0; i <= part; ++i) {
+    if (size_t(headers[i].chunk_count) > in.remaining() / sizeof(uint64_t)) {
+      LOG_ERROR("Premature end of file in EXR {}", filename);
+      return {};
+    }
+    if (i < part) {
+      in.take(size_t(headers[i].chunk_count) * sizeof(uint64_t));
+    }
+  }
+  const ExrHeader &header = headers[part];
+  std::vector<uint64_t> offsets(header.chunk_count);
+  for (uint64_t &offset : offsets) {
+    offset = in.u64();
+  }
+  if (!in.ok()) {
+    LOG_ERROR("Premature end of file in EXR {}", filename);
+    return {};
+  }
+
+  ExrCompression compression = ExrCompression(header.compression);
+  if (compression != ExrCompression::None && compression != ExrCompression::Rle) {
+    LOG_ERROR("Unable to read EXR {}, unsupported compression {}", filename, header.compression);
+    return {};
+  }
+  if (header.subsampled) {
+    LOG_ERROR("Unable to read EXR {}, subsampled channels are not supported", filename);
+    return {};
+  }
+
+  // Put the color channels first, followed by the rest in the order they are stored in
+  size_t nc = header.channels.size();
+  std::vector<int> channel_index(nc, -1);
+  std::vector<std::string> names;
+  for (std::string_view color : {"R", "G", "B", "A"}) {
+    for (size_t c = 0; c < nc; ++c) {
+      if (header.channels[c].name == color) {
+        channel_index[c] = names.size();
+        names.push_back(header.channels[c].name);
+      }
+    }
+  }
+  for (size_t c = 0; c < nc; ++c) {
+    if (channel_index[c] < 0) {
+      channel_index[c] = names.size();
+      names.push_back(header.channels[c].name);
+    }
+  }
+
+  bool all_half = std::all_of(header.channels.begin(), header.channels.end(),
+                              [](const ExrChannel &c) { return c.type == EXR_HALF; });
+  Point2i resolution(header.data_window.pmax.x - header.data_window.pmin.x,
+                     header.data_window.pmax.y - header.data_window.pmin.y);
+  Image image(all_half ? PixelFormat::Half : PixelFormat::Float, resolution, names, nullptr,
+              alloc);
+
+  size_t line_bytes = 0;
+  for (const ExrChannel &channel : header.channels) {
+    line_bytes += size_t(resolution.x) * (channel.type == EXR_HALF ? sizeof(Half) : 4);
+  }
+  int lines_per_block = exr_lines_per_block(header.compression);
+  if (offsets.size() != size_t(resolution.y + lines_per_block - 1) / lines_per_block) {
+    LOG_ERROR("Invalid EXR {}, it has {} chunks for {} scanlines", filename, offsets.size(),
+              resolution.y);
+    return {};
+  }
+
+  // With as many chunks as blocks, rejecting a block that was already filled guarantees that
+  // every one of them is filled exactly once
+  std::vector<std::atomic<bool>> filled(offsets.size());
+  std::atomic<bool> success = true;
+  parallel_for(0, int64_t(offsets.size()), [&](int64_t i) {
+    if (offsets[i] > file->size()) {
+      success = false;
+      return;
+    }
+    ExrReader chunk(data + offsets[i], file->size() - offsets[i]);
+    if (multipart && chunk.i32() != part) {
+      success = false;
+      return;
+    }
+    int64_t chunk_y = int64_t(chunk.i32()) - header.data_window.pmin.y;
+    uint32_t packed_size = chunk.u32();
+    const uint8_t *packed = chunk.take(packed_size);
+    if (!chunk.ok() || chunk_y < 0 || chunk_y >= resolution.y ||
+        chunk_y % lines_per_block != 0 || filled[chunk_y / lines_per_block].exchange(true)) {
+      success = false;
+      return;
+    }
+    int y = int(chunk_y);
+
+    int n_lines = std::min(lines_per_block, resolution.y - y);
+    size_t raw_size = n_lines * line_bytes;
+    std::vector<uint8_t> raw;
+    const uint8_t *pixels = packed;
+    if (packed_size != raw_size) {
+      std::vector<uint8_t> predicted(raw_size);
+      if (compression != ExrCompression::Rle ||
+          !exr_rle_uncompress(packed, packed_size, predicted.data(), raw_size)) {
+        success = false;
+        return;
+      }
+      raw.resize(raw_size);
+      exr_unpredict(predicted.data(), raw_size, raw.data());
+      pixels = raw.data();
+    }
+
+    ExrReader values(pixels, raw_size);
+    std::vector<float> row(size_t(resolution.x) * nc);
+    for (int line = 0; line < n_lines; ++line) {
+      for (size_t c = 0; c < nc; ++c) {
+        float *out = row.data() + channel_index[c];
+        int32_t type = header.channels[c].type;
+        for (int x = 0; x < resolution.x; ++x, out += nc) {
+          if (type == EXR_HALF) {
+            const uint8_t *p = values.take(sizeof(Half));
+            *out = float(Half::from_bits(uint16_t(p[0] | (p[1] << 8))));
+          } else if (type == EXR_FLOAT) {
+            *out = values.f32();
+          } else {
+            *out = float(values.u32());
+          }
+        }
+      }
+      image.copy_rect_in(Bounds2i({0, y + line}, {resolution.x, y + line + 1}), row);
+    }
+  });
+  if (!success) {
+    LOG_ERROR("Invalid scanline block in EXR {}", filename);
+    return {};
+  }
+
+  ImageMetadata metadata = header.metadata;
+  metadata.full_resolution = Point2i(header.display_window.pmax.x - header.display_window.pmin.x,
+                                     header.display_window.pmax.y - header.display_window.pmin.y);
+  metadata.pixel_bounds = header.data_window;
+  if (!metadata.color_space) {
+    metadata.color_space = RgbColorSpace::SRGB;
+  }
+  return ImageAndMetadata{std::move(image), metadata};
+}
+
+std::unique_ptr<specula::ExrStreamWriter>
+specula::ExrStreamWriter::open(const std::string &filename, Point2i resolution,
+                               pstd::span<const std::string> channels, PixelFormat format,
+                               const ImageMetadata &metadata, ExrCompression compression,
+                               int queue_depth) {
+  Bounds2i data_window, display_window;
+  if (!exr_windows(metadata, resolution, &data_window, &display_window)) {
+    LOG_ERROR("Unable to write EXR {}, the pixel bounds do not match the resolution", filename);
+    return nullptr;
+  }
+
+  std::unique_ptr<ExrStreamWriter> writer(new ExrStreamWriter);
+  writer->filename = filename;
+  writer->resolution = resolution;
+  writer->data_window_y = data_window.pmin.y;
+  std::vector<std::string> names(channels.begin(), channels.end());
+  writer->order = exr_channel_order(names);
+  writer->type = format == PixelFormat::Float ? EXR_FLOAT : EXR_HALF;
+  writer->compression = compression;
+  writer->queue_depth = std::max(1, queue_depth);
+  writer->rows.resize(resolution.y);
+  writer->row_pixels.resize(resolution.y);
+  writer->offsets.resize(resolution.y);
+
+  std::vector<uint8_t> header(std::begin(EXR_MAGIC), std::end(EXR_MAGIC));
+  put_u32(header, EXR_VERSION | (exr_long_names(names, metadata) ? EXR_LONG_NAMES_FLAG : 0));
+  // Scanlines are stored as they complete, which need not be in order
+  exr_put_header(header, names, "", writer->order, writer->type, compression, data_window,
+                 display_window, metadata, EXR_RANDOM_Y, false);
+
+  writer->file = fopen(filename.c_str(), "wb");
+  if (writer->file == nullptr) {
+    LOG_ERROR("Unable to open {} for writing", filename);
+    return nullptr;
+  }
+
+  // Space for the offset table, which is filled in by `finish`
+  std::vector<uint8_t> table(writer->offsets.size() * sizeof(uint64_t));
+  writer->table_offset = header.size();
+  writer->offset = header.size() + table.size();
+  writer->failed =
+      fwrite(header.data(), 1, header.size(), writer->file) != header.size() ||
+      fwrite(table.data(), 1, table.size(), writer->file) != table.size();
+
+  writer->io_thread = std::thread(&ExrStreamWriter::io_loop, writer.get());
+  return writer;
+}
+
+specula::ExrStreamWriter::~ExrStreamWriter() {
+  if (file != nullptr) {
+    finish();
+  }
+}
+
+void specula::ExrStreamWriter::write(Point2i origin, const SubImage &tile) {
+  Point2i size = tile.resolution();
+  size_t nc = order.size();
+  ASSERT_EQ(tile.n_channels(), int(nc));
+  ASSERT(origin.x >= 0 && origin.y >= 0 && origin.x + size.x <= resolution.x &&
+        origin.y + size.y <= resolution.y);
+
+  std::vector<float> pixels(size_t(size.x) * size.y * nc);
+  tile.copy_rect_out(Bounds2i({0, 0}, size), pixels);
+
+  std::unique_lock<std::mutex> lock(mutex);
+  for (int ty = 0; ty < size.y; ++ty) {
+    int y = origin.y + ty;
+    std::vector<float> &row = rows[y];
+    if (row.empty()) {
+      row.resize(size_t(resolution.x) * nc);
+    }
+    std::copy_n(pixels.begin() + size_t(ty) * size.x * nc, size_t(size.x) * nc,
+                row.begin() + size_t(origin.x) * nc);
+
+    row_pixels[y] += size.x;
+    DASSERT_LE(row_pixels[y], resolution.x);
+    if (row_pixels[y] == resolution.x) {
+      queue_not_full.wait(lock, [&]() { return queue.size() < queue_depth; });
+      queue.push_back(y);
+      queue_not_empty.notify_one();
+    }
+  }
+}
+
+void specula::ExrStreamWriter::io_loop() {
+  std::vector<uint8_t> block;
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    queue_not_empty.wait(lock, [&]() { return !queue.empty() || closed; });
+    if (queue.empty()) {
+      return;
+    }
+    int y = queue.front();
+    queue.pop_front();
+    std::vector<float> row = std::move(rows[y]);
+    rows[y] = {};
+    queue_not_full.notify_one();
+
+    // Compress and write without holding the lock, so rendering threads can keep adding tiles
+    lock.unlock();
+    exr_encode_row(row, order, type, compression, block);
+    offsets[y] = offset;
+    failed = failed || !exr_write_chunk(file, -1, data_window_y + y, block, &offset);
+    lock.lock();
+  }
+}
+
+bool specula::ExrStreamWriter::finish() {
+  if (file == nullptr) {
+    return false;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+  }
+  queue_not_empty.notify_all();
+  io_thread.join();
+
+  int missing = std::count_if(row_pixels.begin(), row_pixels.end(),
+                              [&](int n) { return n != resolution.x; });
+  if (missing > 0) {
+    LOG_ERROR("Unable to write EXR {}, {} scanlines were never completed", filename, missing);
+  }
+  bool success = !failed && missing == 0 && exr_write_table(file, table_offset, offsets);
+  success = fclose(file) == 0 && success;
+  file = nullptr;
+  rows.clear();
+
+  if (!success) {
+    LOG_ERROR("Unable to write EXR {}", filename);
+  }
+  return success;
+}
@@ -0,0 +1,2361 @@
+#include "util/image/image.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "util/blue_noise.hpp"
+#include "util/check.hpp"
+#include "util/file.hpp"
+#include "util/image/exr.hpp"
+#include "util/image/qoi.hpp"
+#include "util/log.hpp"
+#include "util/math.hpp"
+#include "util/parallel.hpp"
+#include "util/simd.hpp"
+#include "util/stats.hpp"
+#include "util/string.hpp"
+
+namespace specula {
+  /// Number of values converted at a time when going through an intermediate `Float` buffer
+  static constexpr size_t CONVERSION_CHUNK_SIZE = 4096;
+
+  /**
+   * Size of the tiles that `generate_pyramid` filters independently. A tile of four `float`
+   * channels and its first downsampled level fit in the L2 cache, so every level after the first
+   * is built from data that is still cached.
+   */
+  static constexpr int PYRAMID_TILE_SIZE = 64;
+
+  /// Size of the output tiles that the filters process independently
+  static constexpr int FILTER_TILE_SIZE = 64;
+
+  /// Number of values that are scanned for NaN and infinity as a single task
+  static constexpr size_t NON_FINITE_CHUNK_SIZE = 1 << 16;
+
+  static constexpr char RAW_IMAGE_MAGIC[8] = {'S', 'P', 'I', 'M', 'A', 'G', 'E', '1'};
+  /// Alignment of the pixels in a raw image file, so they can be used in place once mapped
+  static constexpr size_t RAW_IMAGE_ALIGNMENT = 64;
+
+  /**
+   * Header of the native raw image format, followed by the NUL terminated channel names and then
+   * the pixels, stored in the byte order and layout they have in memory.
+   */
+  struct RawImageHeader {
+    char magic[8];
+    uint32_t format;
+    uint32_t layout;
+    uint32_t n_channels;
+    int32_t resolution[2];
+    uint32_t data_offset;
+  };
+
+  STAT_PERCENT("Texture/Pyramid cache hits", pyramid_cache_hits, pyramid_cache_lookups);
+
+  /// Bumped whenever the way pyramids are generated changes, which invalidates every cache file
+  static constexpr char PYRAMID_CACHE_MAGIC[8] = {'S', 'P', 'P', 'Y', 'R', 'M', 'D', '1'};
+  /// Number of bytes of pixels hashed as a single task by `pyramid_cache_key`
+  static constexpr size_t PYRAMID_HASH_CHUNK_SIZE = 1 << 20;
+
+  /**
+   * Header of a pyramid cache file, followed by a `PyramidCacheLevel` for every level, the NUL
+   * terminated channel names and then the pixels of the levels, each stored like the pixels of a
+   * raw image.
+   */
+  struct PyramidCacheHeader {
+    char magic[8];
+    uint64_t key;
+    uint32_t format;
+    uint32_t layout;
+    uint32_t n_channels;
+    uint32_t n_levels;
+  };
+
+  struct PyramidCacheLevel {
+    int32_t resolution[2];
+    uint64_t data_offset;
+  };
+
+  static size_t align_raw_image_offset(size_t offset) {
+    return (offset + RAW_IMAGE_ALIGNMENT - 1) & ~(RAW_IMAGE_ALIGNMENT - 1);
+  }
+
+  /**
+   * Number of bytes of the pixels of a mapped image as described by the header of a file, or
+   * false if they do not fit in a `size_t`, which would otherwise wrap the bounds check of a
+   * corrupt or hostile header.
+   */
+  static bool mapped_pixel_bytes(PixelFormat format, ImageLayout layout, Point2i resolution,
+                                 uint32_t n_channels, size_t *bytes) {
+    size_t element_size = is_8bit(format) ? 1 : (is_16bit(format) ? 2 : 4);
+    size_t n_values;
+    return !__builtin_mul_overflow(layout_pixel_count(layout, resolution), size_t(n_channels),
+                                   &n_values) &&
+           !__builtin_mul_overflow(n_values, element_size, bytes);
+  }
+
+  /// Resource of the pixel storage of images that use a `MappedFile` in place
+  static pstd::pmr::unowned_buffer_resource *mapped_pixel_resource() {
+    // Never destroyed, as images with static storage duration may still release their pixels
+    static pstd::pmr::unowned_buffer_resource *resource =
+        new pstd::pmr::unowned_buffer_resource(pstd::pmr::new_delete_resource());
+    return resource;
+  }
+
+  /// Read the next whitespace separated token of a PFM header, starting at `*pos`
+  static std::string_view read_pfm_token(const MappedFile &file, size_t *pos) {
+    const char *data = reinterpret_cast<const char *>(file.data());
+    while (*pos < file.size() && std::isspace(data[*pos])) {
+      ++*pos;
+    }
+    size_t start = *pos;
+    while (*pos < file.size() && !std::isspace(data[*pos])) {
+      ++*pos;
+    }
+    return {data + start, *pos - start};
+  }
+
+  /**
+   * Call `op` with the offset of every channel of every pixel in `extent`, remapping pixels
+   * outside of the image with `wrap_mode`. Pixels that are discarded by the wrap mode are reported
+   * with an offset of `-1`.
+   */
+  template <typename F>
+  static void for_extent(const Bounds2i &extent, WrapMode2D wrap_mode, const Image &image, F op) {
+    DASSERT_LT(extent.pmin.x, extent.pmax.x);
+    DASSERT_LT(extent.pmin.y, extent.pmax.y);
+
+    int nx = extent.pmax.x - extent.pmin.x;
+    int nc = image.n_channels();
+    if (image.layout() == ImageLayout::Scanline &&
+        intersect(extent, Bounds2i({0, 0}, image.resolution())) == extent) {
+      for (int y = extent.pmin.y; y < extent.pmax.y; ++y) {
+        int64_t offset = image.pixel_offset({extent.pmin.x, y});
+        for (int x = 0; x < nx; ++x) {
+          for (int c = 0; c < nc; ++c) {
+            op(offset++);
+          }
+        }
+      }
+    } else {
+      for (int y = extent.pmin.y; y < extent.pmax.y; ++y) {
+        for (int x = 0; x < nx; ++x) {
+          Point2i p(extent.pmin.x + x, y);
+          if (!remap_pixel_coords(&p, image.resolution(), wrap_mode)) {
+            for (int c = 0; c < nc; ++c) {
+              op(-1);
+            }
+            continue;
+          }
+          int64_t offset = image.pixel_offset(p);
+          for (int c = 0; c < nc; ++c) {
+            op(offset++);
+          }
+        }
+      }
+    }
+  }
+
+  /**
+   * Call `op(i, offset)` with the offset of each of the `n` pixels of a row of a tiled image that
+   * start at `p`, which must all be in the same tile. Pixels are in Morton order within a tile, so
+   * the offsets only differ by the interleaved bits of x, without a full `pixel_offset` each.
+   */
+  template <typename F> static void for_tiled_run(const Image &image, Point2i p, int n, F op) {
+    int mask = (1 << tile_size_log2(image.layout())) - 1;
+    DASSERT_LE((p.x & mask) + n, mask + 1);
+    size_t nc = image.n_channels();
+    size_t base = image.pixel_offset({p.x & ~mask, p.y});
+    for (int i = 0; i < n; ++i) {
+      op(i, base + nc * encode_morton2((p.x + i) & mask, 0));
+    }
+  }
+
+  /**
+   * Apply the vertical pass of the resampling filter to `n` values, each output is the weighted
+   * sum of the values at the same position in the four `rows`, clamped to be non-negative.
+   */
+  static void resample_row_scalar(const float *const rows[4], const Float weight[4], size_t begin,
+                                  size_t n, float *out) {
+    for (size_t i = begin; i < n; ++i) {
+      out[i] = std::max<Float>(0, weight[0] * rows[0][i] + weight[1] * rows[1][i] +
+                                      weight[2] * rows[2][i] + weight[3] * rows[3][i]);
+    }
+  }
+
+  /**
+   * Average each 2x2 block of pixels from the rows `r0` and `r1` into `n` output pixels. `dx` is
+   * the offset to the second pixel of each horizontal pair, which is zero for images that are a
+   * single pixel wide.
+   */
+  static void box_filter_row_scalar(const float *r0, const float *r1, int nc, int dx, int begin,
+                                    int n, float *out) {
+    for (int i = begin * nc; i < n * nc; i += nc) {
+      int j = 2 * i;
+      for (int c = 0; c < nc; ++c) {
+        out[i + c] = (((r0[j + c] + r0[j + c + dx]) + r1[j + c]) + r1[j + c + dx]) * 0.25f;
+      }
+    }
+  }
+
+#if defined(SPECULA_USE_AVX2)
+  SPECULA_TARGET_AVX2 static void resample_row_avx2(const float *const rows[4],
+                                                    const Float weight[4], size_t n, float *out) {
+    __m256 w0 = _mm256_set1_ps(weight[0]), w1 = _mm256_set1_ps(weight[1]);
+    __m256 w2 = _mm256_set1_ps(weight[2]), w3 = _mm256_set1_ps(weight[3]);
+    for (size_t i = 0; i < n; i += 8) {
+      __m256 v = _mm256_add_ps(_mm256_mul_ps(w0, _mm256_loadu_ps(rows[0] + i)),
+                               _mm256_mul_ps(w1, _mm256_loadu_ps(rows[1] + i)));
+      v = _mm256_add_ps(v, _mm256_mul_ps(w2, _mm256_loadu_ps(rows[2] + i)));
+      v = _mm256_add_ps(v, _mm256_mul_ps(w3, _mm256_loadu_ps(rows[3] + i)));
+      // NaN selects the second operand, matching `std::max(0, v)`
+      _mm256_storeu_ps(out + i, _mm256_max_ps(v, _mm256_setzero_ps()));
+    }
+  }
+
+  /// Split sixteen single channel pixels into the even and odd pixels of each horizontal pair
+  SPECULA_TARGET_AVX2 static void deinterleave_1(const float *ptr, __m256 *even, __m256 *odd) {
+    __m256 lo = _mm256_loadu_ps(ptr), hi = _mm256_loadu_ps(ptr + 8);
+    *even = _mm256_castpd_ps(
+        _mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(lo, hi, 0x88)), 0xd8));
+    *odd = _mm256_castpd_ps(
+        _mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(lo, hi, 0xdd)), 0xd8));
+  }
+
+  /// Split four pixels of four channels into the even and odd pixels of each horizontal pair
+  SPECULA_TARGET_AVX2 static void deinterleave_4(const float *ptr, __m256 *even, __m256 *odd) {
+    __m256 lo = _mm256_loadu_ps(ptr), hi = _mm256_loadu_ps(ptr + 8);
+    *even = _mm256_permute2f128_ps(lo, hi, 0x20);
+    *odd = _mm256_permute2f128_ps(lo, hi, 0x31);
+  }
+
+  /// Vectorized `box_filter_row_scalar` for one or four channels, processing `n` output values
+  template <int NChannels>
+  SPECULA_TARGET_AVX2 static void box_filter_row_avx2(const float *r0, const float *r1, int n,
+                                                      float *out) {
+    const __m256 quarter = _mm256_set1_ps(0.25f);
+    for (int i = 0; i < n; i += 8) {
+      __m256 a, b, c, d;
+      if constexpr (NChannels == 1) {
+        deinterleave_1(r0 + 2 * i, &a, &b);
+        deinterleave_1(r1 + 2 * i, &c, &d);
+      } else {
+        deinterleave_4(r0 + 2 * i, &a, &b);
+        deinterleave_4(r1 + 2 * i, &c, &d);
+      }
+      __m256 sum = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(a, b), c), d);
+      _mm256_storeu_ps(out + i, _mm256_mul_ps(sum, quarter));
+    }
+  }
+#endif
+
+  static void resample_row(const float *const rows[4], const Float weight[4], size_t n,
+                           float *out) {
+    size_t i = 0;
+#if defined(SPECULA_USE_AVX2)
+    if (simd::has_avx2()) {
+      i = n & ~size_t(7);
+      resample_row_avx2(rows, weight, i, out);
+    }
+#endif
+    resample_row_scalar(rows, weight, i, n, out);
+  }
+
+  static void box_filter_row(const float *r0, const float *r1, int nc, int dx, int n,
+                             float *out) {
+    int i = 0;
+#if defined(SPECULA_USE_AVX2)
+    if (dx != 0 && (nc == 1 || nc == 4) && simd::has_avx2()) {
+      int count = (n * nc) & ~7;
+      if (nc == 1) {
+        box_filter_row_avx2<1>(r0, r1, count, out);
+      } else {
+        box_filter_row_avx2<4>(r0, r1, count, out);
+      }
+      i = count / nc;
+    }
+#endif
+    box_filter_row_scalar(r0, r1, nc, dx, i, n, out);
+  }
+
+  /**
+   * Downsample a `resolution` sized buffer of pixels by averaging every 2x2 block, a dimension of
+   * a single pixel is kept as is.
+   */
+  static Point2i box_filter(const float *in, Point2i resolution, int nc, float *out) {
+    Point2i half(std::max(1, resolution.x / 2), std::max(1, resolution.y / 2));
+    size_t row = size_t(nc) * resolution.x;
+    size_t dy = resolution.y > 1 ? row : 0;
+    int dx = resolution.x > 1 ? nc : 0;
+    for (int y = 0; y < half.y; ++y) {
+      const float *r0 = in + 2 * y * row;
+      box_filter_row(r0, r0 + dy, nc, dx, half.x, out + size_t(y) * half.x * nc);
+    }
+    return half;
+  }
+
+  /// Per thread buffers that the filters ping-pong between, reused by every tile of every call
+  struct FilterScratch {
+    static float *reserve(std::vector<float> &buffer, size_t n) {
+      if (buffer.size() < n) {
+        buffer.resize(n);
+      }
+      return buffer.data();
+    }
+
+    std::vector<float> ping, pong, line;
+    /// Every channel of a row of the image a view selects channels from
+    std::vector<float> pixels;
+  };
+
+  static thread_local FilterScratch filter_scratch;
+
+  /// The `tile`th tile of `FILTER_TILE_SIZE` pixels covering `resolution`, in scanline order
+  static Bounds2i filter_tile(int64_t tile, Point2i resolution) {
+    int n_tiles_x = (resolution.x + FILTER_TILE_SIZE - 1) / FILTER_TILE_SIZE;
+    Point2i pmin(int(tile % n_tiles_x) * FILTER_TILE_SIZE,
+                 int(tile / n_tiles_x) * FILTER_TILE_SIZE);
+    return Bounds2i(pmin, Point2i(std::min(pmin.x + FILTER_TILE_SIZE, resolution.x),
+                                  std::min(pmin.y + FILTER_TILE_SIZE, resolution.y)));
+  }
+
+  static int64_t filter_tile_count(Point2i resolution) {
+    return int64_t((resolution.x + FILTER_TILE_SIZE - 1) / FILTER_TILE_SIZE) *
+           ((resolution.y + FILTER_TILE_SIZE - 1) / FILTER_TILE_SIZE);
+  }
+
+  /**
+   * Copy the channels `desc` of `region` into consecutive planes of `region.area()` values in
+   * `out`. The region may extend past the image, where pixels are either clamped to the edge of the
+   * image or set to zero.
+   */
+  static void gather_planes(const SubImage &image, const Bounds2i &region,
+                            const ImageChannelDesc &desc, bool clamp, float *out) {
+    Point2i resolution = image.resolution();
+    int width = region.pmax.x - region.pmin.x, height = region.pmax.y - region.pmin.y;
+    int x0 = std::max(region.pmin.x, 0), x1 = std::min(region.pmax.x, resolution.x);
+    int nc = image.n_channels();
+    size_t plane = size_t(width) * height;
+
+    std::vector<float> &line = filter_scratch.line;
+    FilterScratch::reserve(line, size_t(x1 - x0) * nc);
+    for (int ry = 0; ry < height; ++ry) {
+      int y = region.pmin.y + ry;
+      bool inside = y >= 0 && y < resolution.y;
+      if (inside || clamp) {
+        int yc = std::clamp(y, 0, resolution.y - 1);
+        image.copy_rect_out(Bounds2i({x0, yc}, {x1, yc + 1}),
+                            pstd::span<float>(line.data(), size_t(x1 - x0) * nc));
+      }
+
+      for (size_t c = 0; c < desc.size(); ++c) {
+        float *row = out + c * plane + size_t(ry) * width;
+        for (int rx = 0; rx < width; ++rx) {
+          int x = region.pmin.x + rx;
+          if (!clamp && (!inside || x < x0 || x >= x1)) {
+            row[rx] = 0;
+          } else {
+            row[rx] = line[size_t(std::clamp(x, x0, x1 - 1) - x0) * nc + desc.offset[c]];
+          }
+        }
+      }
+    }
+  }
+
+  static void convolve_row_scalar(const float *in, const float *weights, int n_taps, int begin,
+                                  int n, float *out) {
+    for (int i = begin; i < n; ++i) {
+      float sum = 0;
+      for (int k = 0; k < n_taps; ++k) {
+        sum += weights[k] * in[i + k];
+      }
+      out[i] = sum;
+    }
+  }
+
+  /// Weights of the range kernel of the joint bilateral filter, and the planes of a padded tile
+  struct BilateralTile {
+    const float *joint, *filter, *mask;
+    size_t plane;
+    int width, half_width, nj, nf;
+    const float *spatial, *inv_two_sigma2;
+  };
+
+  /**
+   * Filter the pixels \f$[begin, end)\f$ of the row `y` of a bilateral tile, writing each channel
+   * to its own row of `out`. The range kernel is evaluated as a single exponential of the sum over
+   * the joint channels, with fused multiply-adds where the vectorized version uses them.
+   */
+  static void bilateral_row_scalar(const BilateralTile &t, int y, int begin, int end,
+                                   int out_stride, float *out) {
+    int n_taps = 2 * t.half_width + 1;
+    for (int x = begin; x < end; ++x) {
+      size_t center = size_t(y + t.half_width) * t.width + x + t.half_width;
+      float weight_sum = 0;
+      for (int c = 0; c < t.nf; ++c) {
+        out[c * out_stride + x] = 0;
+      }
+
+      for (int dy = 0; dy < n_taps; ++dy) {
+        for (int dx = 0; dx < n_taps; ++dx) {
+          size_t index = size_t(y + dy) * t.width + x + dx;
+          float e = 0;
+          for (int c = 0; c < t.nj; ++c) {
+            float d = t.joint[c * t.plane + index] - t.joint[c * t.plane + center];
+            e = fma(d * t.inv_two_sigma2[c], d, e);
+          }
+          float r = -e > -100.f ? -e : -100.f;
+          r = fast_exp(r);
+
+          float s = t.spatial[dy * n_taps + dx] * t.mask[index];
+          float w = s * r;
+          weight_sum = fma(s, r, weight_sum);
+          for (int c = 0; c < t.nf; ++c) {
+            out[c * out_stride + x] =
+                fma(w, t.filter[c * t.plane + index], out[c * out_stride + x]);
+          }
+        }
+      }
+
+      if (weight_sum > 0) {
+        for (int c = 0; c < t.nf; ++c) {
+          out[c * out_stride + x] /= weight_sum;
+        }
+      }
+    }
+  }
+
+#if defined(SPECULA_USE_AVX2)
+  /// Vectorized `convolve_row_scalar`, processing `n` output values
+  SPECULA_TARGET_AVX2 static void convolve_row_avx2(const float *in, const float *weights,
+                                                    int n_taps, int n, float *out) {
+    for (int i = 0; i < n; i += 8) {
+      __m256 sum = _mm256_setzero_ps();
+      for (int k = 0; k < n_taps; ++k) {
+        sum = _mm256_add_ps(sum,
+                            _mm256_mul_ps(_mm256_set1_ps(weights[k]), _mm256_loadu_ps(in + i + k)));
+      }
+      _mm256_storeu_ps(out + i, sum);
+    }
+  }
+
+  /// Vectorized `bilateral_row_scalar` over eight neighboring pixels at a time
+  SPECULA_TARGET_AVX2_FMA static void bilateral_row_avx2(const BilateralTile &t, int y, int end,
+                                                         int out_stride, float *out) {
+    int n_taps = 2 * t.half_width + 1;
+    const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+    const __m256 min_exponent = _mm256_set1_ps(-100.f);
+    for (int x = 0; x < end; x += 8) {
+      size_t center = size_t(y + t.half_width) * t.width + x + t.half_width;
+      __m256 weight_sum = _mm256_setzero_ps();
+      for (int c = 0; c < t.nf; ++c) {
+        _mm256_storeu_ps(out + c * out_stride + x, _mm256_setzero_ps());
+      }
+
+      for (int dy = 0; dy < n_taps; ++dy) {
+        for (int dx = 0; dx < n_taps; ++dx) {
+          size_t index = size_t(y + dy) * t.width + x + dx;
+          __m256 e = _mm256_setzero_ps();
+          for (int c = 0; c < t.nj; ++c) {
+            __m256 d = _mm256_sub_ps(_mm256_loadu_ps(t.joint + c * t.plane + index),
+                                     _mm256_loadu_ps(t.joint + c * t.plane + center));
+            e = _mm256_fmadd_ps(_mm256_mul_ps(d, _mm256_set1_ps(t.inv_two_sigma2[c])), d, e);
+          }
+          // The operand order maps NaN to the minimum, like the scalar comparison
+          __m256 r = _mm256_max_ps(_mm256_xor_ps(e, sign_mask), min_exponent);
+          r = simd::fast_exp(r);
+
+          __m256 s = _mm256_mul_ps(_mm256_set1_ps(t.spatial[dy * n_taps + dx]),
+                                   _mm256_loadu_ps(t.mask + index));
+          __m256 w = _mm256_mul_ps(s, r);
+          weight_sum = _mm256_fmadd_ps(s, r, weight_sum);
+          for (int c = 0; c < t.nf; ++c) {
+            float *o = out + c * out_stride + x;
+            _mm256_storeu_ps(o, _mm256_fmadd_ps(w, _mm256_loadu_ps(t.filter + c * t.plane + index),
+                                                _mm256_loadu_ps(o)));
+          }
+        }
+      }
+
+      __m256 positive = _mm256_cmp_ps(weight_sum, _mm256_setzero_ps(), _CMP_GT_OQ);
+      for (int c = 0; c < t.nf; ++c) {
+        float *o = out + c * out_stride + x;
+        __m256 v = _mm256_loadu_ps(o);
+        _mm256_storeu_ps(o, simd::select(positive, _mm256_div_ps(v, weight_sum), v));
+      }
+    }
+  }
+#endif
+
+  static void convolve_row(const float *in, const float *weights, int n_taps, int n,
+                           float *out) {
+    int i = 0;
+#if defined(SPECULA_USE_AVX2)
+    if (simd::has_avx2()) {
+      i = n & ~7;
+      convolve_row_avx2(in, weights, n_taps, i, out);
+    }
+#endif
+    convolve_row_scalar(in, weights, n_taps, i, n, out);
+  }
+
+  static void bilateral_row(const BilateralTile &t, int y, int n, int out_stride, float *out) {
+    int i = 0;
+#if defined(SPECULA_USE_AVX2)
+    if (simd::has_avx2()) {
+      i = n & ~7;
+      bilateral_row_avx2(t, y, i, out_stride, out);
+    }
+#endif
+    bilateral_row_scalar(t, y, i, n, out_stride, out);
+  }
+
+  /**
+   * Range `(lo, hi]` of the bit patterns, with the sign bit cleared, of the non-finite values to
+   * look for. Infinity is the largest pattern with every exponent bit set, and NaNs are all of the
+   * patterns above it.
+   */
+  struct NonFiniteRange {
+    template <typename T> static NonFiniteRange of(bool nan, bool infinite) {
+      constexpr uint32_t inf = sizeof(T) == 2 ? 0x7c00 : 0x7f800000;
+      constexpr uint32_t max = sizeof(T) == 2 ? 0x7fff : 0x7fffffff;
+      return {nan && !infinite ? inf : inf - 1, infinite && !nan ? inf : max};
+    }
+
+    uint32_t lo, hi;
+  };
+
+  static uint32_t value_bits(float v) { return std::bit_cast<uint32_t>(v); }
+  static uint32_t value_bits(Half v) { return v.bits(); }
+
+  template <typename T>
+  static bool any_non_finite_scalar(const T *v, size_t begin, size_t end, NonFiniteRange range) {
+    constexpr uint32_t abs_mask = sizeof(T) == 2 ? 0x7fff : 0x7fffffff;
+    bool found = false;
+    for (size_t i = begin; i < end; ++i) {
+      uint32_t a = value_bits(v[i]) & abs_mask;
+      found |= a > range.lo && a <= range.hi;
+    }
+    return found;
+  }
+
+#if defined(SPECULA_USE_AVX2)
+  // The patterns with the sign bit cleared are non-negative, so signed comparisons order them
+  SPECULA_TARGET_AVX2 static bool any_non_finite_avx2(const float *v, size_t n,
+                                                      NonFiniteRange range) {
+    const __m256i abs_mask = _mm256_set1_epi32(0x7fffffff);
+    const __m256i lo = _mm256_set1_epi32(range.lo), hi = _mm256_set1_epi32(range.hi);
+    __m256i found = _mm256_setzero_si256();
+    for (size_t i = 0; i < n; i += 8) {
+      __m256i a = _mm256_and_si256(
+          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(v + i)), abs_mask);
+      found = _mm256_or_si256(
+          found, _mm256_andnot_si256(_mm256_cmpgt_epi32(a, hi), _mm256_cmpgt_epi32(a, lo)));
+    }
+    return !_mm256_testz_si256(found, found);
+  }
+
+  SPECULA_TARGET_AVX2 static bool any_non_finite_avx2(const Half *v, size_t n,
+                                                      NonFiniteRange range) {
+    const __m256i abs_mask = _mm256_set1_epi16(0x7fff);
+    const __m256i lo = _mm256_set1_epi16(range.lo), hi = _mm256_set1_epi16(range.hi);
+    __m256i found = _mm256_setzero_si256();
+    for (size_t i = 0; i < n; i += 16) {
+      __m256i a = _mm256_and_si256(
+          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(v + i)), abs_mask);
+      found = _mm256_or_si256(
+          found, _mm256_andnot_si256(_mm256_cmpgt_epi16(a, hi), _mm256_cmpgt_epi16(a, lo)));
+    }
+    return !_mm256_testz_si256(found, found);
+  }
+#endif
+
+  /// Check if any of the values `v[begin, end)` falls in `range`
+  template <typename T>
+  static bool any_non_finite(const T *v, size_t begin, size_t end, NonFiniteRange range) {
+#if defined(SPECULA_USE_AVX2)
+    if (simd::has_avx2()) {
+      constexpr size_t lanes = 32 / sizeof(T);
+      size_t n = (end - begin) & ~(lanes - 1);
+      if (any_non_finite_avx2(v + begin, n, range)) {
+        return true;
+      }
+      begin += n;
+    }
+#endif
+    return any_non_finite_scalar(v, begin, end, range);
+  }
+
+  /// Position of the pixel stored at `index`, which is outside of the image for tile padding
+  static Point2i layout_pixel_position(ImageLayout layout, Point2i resolution, size_t index) {
+    int log2 = tile_size_log2(layout);
+    if (log2 == 0) {
+      return Point2i(index % resolution.x, index / resolution.x);
+    }
+    size_t tiles_x = (resolution.x + (1 << log2) - 1) >> log2;
+    size_t tile = index >> (2 * log2);
+    uint32_t x, y;
+    decode_morton2(index & ((size_t(1) << (2 * log2)) - 1), &x, &y);
+    return Point2i(int(tile % tiles_x << log2) + x, int(tile / tiles_x << log2) + y);
+  }
+
+  /// Check if any of the first `n` values of `v` falls in `range`, stopping early once one does
+  template <typename T>
+  static bool scan_non_finite(const T *v, size_t n, NonFiniteRange range) {
+    std::atomic<bool> found = false;
+    int64_t n_chunks = (n + NON_FINITE_CHUNK_SIZE - 1) / NON_FINITE_CHUNK_SIZE;
+    parallel_for(0, n_chunks, [&](int64_t chunk) {
+      if (found.load(std::memory_order_relaxed)) {
+        return;
+      }
+      size_t begin = chunk * NON_FINITE_CHUNK_SIZE;
+      if (any_non_finite(v, begin, std::min(n, begin + NON_FINITE_CHUNK_SIZE), range)) {
+        found.store(true, std::memory_order_relaxed);
+      }
+    });
+    return found;
+  }
+
+  /**
+   * Count and bound the pixels with a non-finite channel. Chunks without any are skipped by the
+   * vectorized scan, only those with a match are walked a pixel at a time.
+   */
+  template <typename T>
+  static NonFinitePixels find_non_finite(const T *v, ImageLayout layout, Point2i resolution,
+                                         int nc) {
+    NonFiniteRange range = NonFiniteRange::of<T>(true, true);
+    size_t n_pixels = layout_pixel_count(layout, resolution);
+    size_t chunk_pixels = std::max<size_t>(1, NON_FINITE_CHUNK_SIZE / std::max(nc, 1));
+    NonFinitePixels result;
+    std::mutex mutex;
+    parallel_for(0, (n_pixels + chunk_pixels - 1) / chunk_pixels, [&](int64_t chunk) {
+      size_t begin = chunk * chunk_pixels, end = std::min(n_pixels, begin + chunk_pixels);
+      if (!any_non_finite(v, begin * nc, end * nc, range)) {
+        return;
+      }
+
+      NonFinitePixels found;
+      for (size_t i = begin; i < end; ++i) {
+        if (any_non_finite_scalar(v, i * nc, (i + 1) * nc, range)) {
+          Point2i p = layout_pixel_position(layout, resolution, i);
+          if (p.x < resolution.x && p.y < resolution.y) {
+            ++found.count;
+            found.bounds = bounds_union(found.bounds, Bounds2i(p, p + Vector2i(1, 1)));
+          }
+        }
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      result.count += found.count;
+      result.bounds = bounds_union(result.bounds, found.bounds);
+    });
+    return result;
+  }
+
+  /// Per pixel quantity that `image_error` averages
+  enum class ErrorMetric { Value, Absolute, Squared, RelativeSquared };
+
+  /// Per pixel error of `v` against `ref`, infinite errors are excluded by mapping them to zero
+  static void error_row_scalar(ErrorMetric metric, const float *v, const float *ref, int begin,
+                               int end, float *err) {
+    for (int i = begin; i < end; ++i) {
+      float d = v[i] - ref[i], e = 0;
+      switch (metric) {
+      case ErrorMetric::Absolute:
+        e = std::abs(d);
+        break;
+      case ErrorMetric::Squared:
+        e = d * d;
+        break;
+      case ErrorMetric::RelativeSquared:
+        e = (d * d) / sqr(ref[i] + 0.01f);
+        break;
+      default:
+        e = v[i];
+      }
+      err[i] = isinf(e) ? 0.f : e;
+    }
+  }
+
+  /**
+   * Sum of a row in double precision. The values are accumulated in eight interleaved partial sums
+   * that are combined in a fixed order, so that the vectorized version gives identical results.
+   */
+  static double sum_row_scalar(const float *v, int n) {
+    double s[8] = {};
+    int n8 = n & ~7;
+    for (int i = 0; i < n8; ++i) {
+      s[i & 7] += v[i];
+    }
+    double sum = ((s[0] + s[4]) + (s[1] + s[5])) + ((s[2] + s[6]) + (s[3] + s[7]));
+    for (int i = n8; i < n; ++i) {
+      sum += v[i];
+    }
+    return sum;
+  }
+
+#if defined(SPECULA_USE_AVX2)
+  SPECULA_TARGET_AVX2 static void error_row_avx2(ErrorMetric metric, const float *v,
+                                                 const float *ref, int n, float *err) {
+    const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+    const __m256 infinity = _mm256_set1_ps(Infinity);
+    for (int i = 0; i < n; i += 8) {
+      __m256 r = _mm256_loadu_ps(ref + i);
+      __m256 d = _mm256_sub_ps(_mm256_loadu_ps(v + i), r);
+      __m256 e;
+      if (metric == ErrorMetric::Absolute) {
+        e = _mm256_andnot_ps(sign_mask, d);
+      } else if (metric == ErrorMetric::Squared) {
+        e = _mm256_mul_ps(d, d);
+      } else {
+        __m256 q = _mm256_add_ps(r, _mm256_set1_ps(0.01f));
+        e = _mm256_div_ps(_mm256_mul_ps(d, d), _mm256_mul_ps(q, q));
+      }
+      // Unordered, so that NaN is kept like the scalar `isinf` test does
+      __m256 finite = _mm256_cmp_ps(_mm256_andnot_ps(sign_mask, e), infinity, _CMP_NEQ_UQ);
+      _mm256_storeu_ps(err + i, _mm256_and_ps(e, finite));
+    }
+  }
+
+  SPECULA_TARGET_AVX2 static double sum_row_avx2(const float *v, int n) {
+    __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+    int n8 = n & ~7;
+    for (int i = 0; i < n8; i += 8) {
+      s0 = _mm256_add_pd(s0, _mm256_cvtps_pd(_mm_loadu_ps(v + i)));
+      s1 = _mm256_add_pd(s1, _mm256_cvtps_pd(_mm_loadu_ps(v + i + 4)));
+    }
+    __m256d s = _mm256_add_pd(s0, s1);
+    __m128d h = _mm_hadd_pd(_mm256_castpd256_pd128(s), _mm256_extractf128_pd(s, 1));
+    double sum = _mm_cvtsd_f64(h) + _mm_cvtsd_f64(_mm_unpackhi_pd(h, h));
+    for (int i = n8; i < n; ++i) {
+      sum += v[i];
+    }
+    return sum;
+  }
+#endif
+
+  static void error_row(ErrorMetric metric, const float *v, const float *ref, int n,
+                        float *err) {
+    int i = 0;
+#if defined(SPECULA_USE_AVX2)
+    if (simd::has_avx2()) {
+      i = n & ~7;
+      error_row_avx2(metric, v, ref, i, err);
+    }
+#endif
+    error_row_scalar(metric, v, ref, i, n, err);
+  }
+
+  static double sum_row(const float *v, int n) {
+#if defined(SPECULA_USE_AVX2)
+    if (simd::has_avx2()) {
+      return sum_row_avx2(v, n);
+    }
+#endif
+    return sum_row_scalar(v, n);
+  }
+
+  /**
+   * Average of `metric` over every channel of every pixel. Rows are processed in parallel and
+   * each produces its own partial sums, which are then combined in order with compensated
+   * summation, so the result does not depend on the number of threads.
+   */
+  static ImageChannelValues image_error(const SubImage &image, const SubImage *ref,
+                                        ErrorMetric metric, Image *error_image) {
+    Point2i resolution = image.resolution();
+    ImageChannelDesc desc = image.all_channels_desc(), ref_desc;
+    if (ref) {
+      ASSERT(ref->resolution() == resolution);
+      ASSERT_EQ(ref->n_channels(), image.n_channels());
+      ref_desc = ref->all_channels_desc();
+    }
+    if (error_image) {
+      *error_image = Image(PixelFormat::Float, resolution, image.channel_names());
+    }
+
+    int width = resolution.x, nc = desc.size();
+    std::vector<double> row_sums(size_t(resolution.y) * nc);
+    parallel_for(0, resolution.y, [&](int64_t y0, int64_t y1) {
+      size_t plane = size_t(nc) * width;
+      float *v = FilterScratch::reserve(filter_scratch.ping, 3 * plane);
+      float *r = v + plane, *err = r + plane;
+      for (int y = y0; y < y1; ++y) {
+        Bounds2i row({0, y}, {width, y + 1});
+        gather_planes(image, row, desc, true, v);
+        if (metric == ErrorMetric::Value) {
+          err = v;
+        } else {
+          gather_planes(*ref, row, ref_desc, true, r);
+          for (int c = 0; c < nc; ++c) {
+            error_row(metric, v + c * width, r + c * width, width, err + c * width);
+          }
+        }
+        for (int c = 0; c < nc; ++c) {
+          row_sums[size_t(y) * nc + c] = sum_row(err + c * width, width);
+        }
+
+        if (error_image) {
+          float *out = FilterScratch::reserve(filter_scratch.pong, plane);
+          for (int x = 0; x < width; ++x) {
+            for (int c = 0; c < nc; ++c) {
+              out[x * nc + c] = err[c * width + x];
+            }
+          }
+          error_image->copy_rect_in(row, pstd::span<const float>(out, plane));
+        }
+      }
+    });
+
+    ImageChannelValues result(nc);
+    double n_pixels = double(resolution.x) * resolution.y;
+    for (int c = 0; c < nc; ++c) {
+      CompensatedSum<double> sum;
+      double plain_sum = 0;
+      for (int y = 0; y < resolution.y; ++y) {
+        sum += row_sums[size_t(y) * nc + c];
+        plain_sum += row_sums[size_t(y) * nc + c];
+      }
+      // The compensation turns infinite sums into NaN
+      result[c] = (std::isfinite(plain_sum) ? double(sum) : plain_sum) / n_pixels;
+    }
+    return result;
+  }
+
+  /// View of the channels of `ref` with the same names as the channels `desc` of `image`
+  static SubImage reference_channels(const Image &image, const ImageChannelDesc &desc,
+                                     const Image &ref) {
+    ImageChannelDesc ref_desc = ref.get_channel_desc(image.channel_names(desc));
+    ASSERT(ref_desc);
+    return SubImage(ref).select_channels(ref_desc);
+  }
+} // namespace specula
+
+specula::Image::Image(pstd::vector<uint8_t> p8c, Point2i resolution,
+                      pstd::span<const std::string> channels, ColorEncoding encoding)
+    : format_(PixelFormat::U256), resolution_(resolution),
+      channel_names_(channels.begin(), channels.end()), encoding_(encoding), p8(std::move(p8c)) {
+  ASSERT_EQ(p8.size(), n_channels() * resolution_[0] * resolution_[1]);
+}
+
+specula::Image::Image(pstd::vector<Half> p16c, Point2i resolution,
+                      pstd::span<const std::string> channels)
+    : format_(PixelFormat::Half), resolution_(resolution),
+      channel_names_(channels.begin(), channels.end()), p16(std::move(p16c)) {
+  ASSERT_EQ(p16.size(), n_channels() * resolution_[0] * resolution_[1]);
+}
+
+specula::Image::Image(pstd::vector<float> p32c, Point2i resolution,
+                      pstd::span<const std::string> channels)
+    : format_(PixelFormat::Float), resolution_(resolution),
+      channel_names_(channels.begin(), channels.end()), p32(std::move(p32c)) {
+  ASSERT_EQ(p32.size(), n_channels() * resolution_[0] * resolution_[1]);
+}
+
+specula::Image::Image(PixelFormat format, Point2i resolution,
+                      pstd::span<const std::string> channels, ColorEncoding encoding,
+                      Allocator alloc, ImageLayout layout)
+    : format_(format), resolution_(resolution), layout_(layout),
+      channel_names_(channels.begin(), channels.end()), encoding_(encoding), p8(alloc), p16(alloc),
+      p32(alloc) {
+  size_t n = size_t(n_channels()) * layout_pixel_count(layout_, resolution_);
+  switch (format_) {
+  case PixelFormat::U256:
+    ASSERT(encoding_);
+    p8.resize(n);
+    break;
+  case PixelFormat::Half:
+    p16.resize(n);
+    break;
+  case PixelFormat::Float:
+    p32.resize(n);
+    break;
+  default:
+    LOG_CRITICAL("Unhandled PixelFormat: {}", format_);
+  }
+}
+
+std::vector<std::string> specula::Image::channel_names() const {
+  return {channel_names_.begin(), channel_names_.end()};
+}
+
+std::vector<std::string> specula::Image::channel_names(const ImageChannelDesc &desc) const {
+  std::vector<std::string> names;
+  for (size_t i = 0; i < desc.offset.size(); ++i) {
+    names.push_back(channel_names_[desc.offset[i]]);
+  }
+  return names;
+}
+
+specula::ImageChannelDesc
+specula::Image::get_channel_desc(pstd::span<const std::string> requested_channels) const {
+  ImageChannelDesc desc;
+  desc.offset.resize(requested_channels.size());
+  for (size_t i = 0; i < requested_channels.size(); ++i) {
+    size_t j = 0;
+    for (; j < channel_names_.size(); ++j) {
+      if (requested_channels[i] == channel_names_[j]) {
+        desc.offset[i] = j;
+        break;
+      }
+    }
+    if (j == channel_names_.size()) {
+      return {};
+    }
+  }
+  return desc;
+}
+
+specula::ImageChannelValues specula::Image::get_channels(Point2i p, WrapMode2D wrap_mode) const {
+  ImageChannelValues cv(n_channels(), Float(0));
+  if (!remap_pixel_coords(&p, resolution_, wrap_mode)) {
+    return cv;
+  }
+
+  size_t pixel = pixel_offset(p);
+  switch (format_) {
+  case PixelFormat::U256:
+    encoding_.to_linear({&p8[pixel], cv.size()}, {cv.data(), cv.size()});
+    break;
+  case PixelFormat::Half:
+    half_to_float({&p16[pixel], cv.size()}, {cv.data(), cv.size()});
+    break;
+  case PixelFormat::Float:
+    for (int i = 0; i < n_channels(); ++i) {
+      cv[i] = p32[pixel + i];
+    }
+    break;
+  default:
+    LOG_CRITICAL("Unhandled PixelFormat: {}", format_);
+  }
+  return cv;
+}
+
+specula::ImageChannelValues specula::Image::get_channels(Point2i p, const ImageChannelDesc &desc,
+                                                         WrapMode2D wrap_mode) const {
+  ImageChannelValues cv(desc.offset.size(), Float(0));
+  if (!remap_pixel_coords(&p, resolution_, wrap_mode)) {
+    return cv;
+  }
+
+  size_t pixel = pixel_offset(p);
+  switch (format_) {
+  case PixelFormat::U256:
+    for (size_t i = 0; i < desc.offset.size(); ++i) {
+      encoding_.to_linear({&p8[pixel + desc.offset[i]], 1}, {&cv[i], 1});
+    }
+    break;
+  case PixelFormat::Half:
+    for (size_t i = 0; i < desc.offset.size(); ++i) {
+      cv[i] = Float(p16[pixel + desc.offset[i]]);
+    }
+    break;
+  case PixelFormat::Float:
+    for (size_t i = 0; i < desc.offset.size(); ++i) {
+      cv[i] = p32[pixel + desc.offset[i]];
+    }
+    break;
+  default:
+    LOG_CRITICAL("Unhandled PixelFormat: {}", format_);
+  }
+  return cv;
+}
+
+specula::Image specula::Image::select_channels(const ImageChannelDesc &desc,
+                                               Allocator alloc) const {
+  return SubImage(*this).select_channels(desc).to_image(alloc);
+}
+
+specula::Image specula::Image::crop(const Bounds2i &bounds, Allocator alloc) const {
+  ASSERT_GT(bounds.area(), 0);
+  return SubImage(*this).crop(bounds).to_image(alloc);
+}
+
+specula::SubImage::SubImage(const Image &image, const Bounds2i &bounds,
+                            const ImageChannelDesc &channels)
+    : image_(&image), bounds_(bounds), channels_(channels) {
+  ASSERT(inside(bounds.pmin, Bounds2i({0, 0}, image.resolution())) &&
+         inside(bounds.pmax, Bounds2i({0, 0}, image.resolution())));
+  for (size_t c = 0; c < channels.size(); ++c) {
+    ASSERT(channels.offset[c] >= 0 && channels.offset[c] < image.n_channels());
+  }
+}
+
+bool specula::SubImage::is_whole_image() const {
+  return bounds_ == Bounds2i({0, 0}, image_->resolution()) && channels_.is_identity() &&
+         n_channels() == image_->n_channels();
+}
+
+specula::ImageChannelDesc
+specula::SubImage::get_channel_desc(pstd::span<const std::string> requested_channels) const {
+  std::vector<std::string> names = channel_names();
+  ImageChannelDesc desc;
+  desc.offset.resize(requested_channels.size());
+  for (size_t i = 0; i < requested_channels.size(); ++i) {
+    auto iter = std::find(names.begin(), names.end(), requested_channels[i]);
+    if (iter == names.end()) {
+      return {};
+    }
+    desc.offset[i] = iter - names.begin();
+  }
+  return desc;
+}
+
+specula::ImageChannelDesc specula::SubImage::all_channels_desc() const {
+  ImageChannelDesc desc;
+  desc.offset.resize(n_channels());
+  for (int i = 0; i < n_channels(); ++i) {
+    desc.offset[i] = i;
+  }
+  return desc;
+}
+
+specula::SubImage specula::SubImage::crop(const Bounds2i &bounds) const {
+  Vector2i origin(bounds_.pmin);
+  return SubImage(*image_, Bounds2i(bounds.pmin + origin, bounds.pmax + origin), channels_);
+}
+
+specula::SubImage specula::SubImage::select_channels(const ImageChannelDesc &desc) const {
+  ImageChannelDesc channels;
+  channels.offset.resize(desc.size());
+  for (size_t i = 0; i < desc.size(); ++i) {
+    channels.offset[i] = channels_.offset[desc.offset[i]];
+  }
+  return SubImage(*image_, bounds_, channels);
+}
+
+void specula::SubImage::copy_rect_out(const Bounds2i &extent, pstd::span<float> buf,
+                                      WrapMode2D wrap_mode) const {
+  int nc = n_channels();
+  ASSERT_GE(buf.size(), extent.area() * nc);
+  if (is_whole_image()) {
+    image_->copy_rect_out(extent, buf, wrap_mode);
+    return;
+  }
+
+  Point2i resolution = this->resolution();
+  Vector2i origin(bounds_.pmin);
+  float *out = buf.data();
+  if (intersect(extent, Bounds2i({0, 0}, resolution)) == extent) {
+    Bounds2i src(extent.pmin + origin, extent.pmax + origin);
+    if (channels_.is_identity() && nc == image_->n_channels()) {
+      image_->copy_rect_out(src, buf);
+      return;
+    }
+
+    // Convert every channel of a row of the image at a time, and pick the selected ones
+    int nx = extent.pmax.x - extent.pmin.x, n_all = image_->n_channels();
+    size_t count = size_t(nx) * n_all;
+    float *pixels = FilterScratch::reserve(filter_scratch.pixels, count);
+    for (int y = src.pmin.y; y < src.pmax.y; ++y) {
+      image_->copy_rect_out(Bounds2i({src.pmin.x, y}, {src.pmax.x, y + 1}), {pixels, count});
+      for (int x = 0; x < nx; ++x) {
+        for (int c = 0; c < nc; ++c) {
+          *out++ = pixels[size_t(x) * n_all + channels_.offset[c]];
+        }
+      }
+    }
+    return;
+  }
+
+  // Pixels outside of the view are remapped within the view, not the image
+  for (int y = extent.pmin.y; y < extent.pmax.y; ++y) {
+    for (int x = extent.pmin.x; x < extent.pmax.x; ++x) {
+      Point2i p(x, y);
+      bool valid = remap_pixel_coords(&p, resolution, wrap_mode);
+      for (int c = 0; c < nc; ++c) {
+        *out++ = valid ? image_->get_channel(p + origin, channels_.offset[c]) : 0;
+      }
+    }
+  }
+}
+
+specula::Image specula::SubImage::to_image(Allocator alloc) const {
+  const Image &src = *image_;
+  Point2i resolution = this->resolution();
+  Image image(src.format_, resolution, channel_names(), src.encoding_, alloc, src.layout_);
+
+  // With every channel and a scanline layout the rows of the view are contiguous, so they can be
+  // copied directly. Otherwise only the channels of each pixel are, or not even those.
+  bool all_channels = channels_.is_identity() && n_channels() == src.n_channels();
+  bool rows = all_channels && src.layout_ == ImageLayout::Scanline;
+  size_t count = all_channels ? size_t(n_channels()) * (rows ? resolution.x : 1) : 1;
+  auto copy = [&](size_t from, size_t to) {
+    switch (src.format_) {
+    case PixelFormat::U256:
+      std::memcpy(&image.p8[to], &src.p8[from], count * sizeof(uint8_t));
+      break;
+    case PixelFormat::Half:
+      std::memcpy(&image.p16[to], &src.p16[from], count * sizeof(Half));
+      break;
+    case PixelFormat::Float:
+      std::memcpy(&image.p32[to], &src.p32[from], count * sizeof(float));
+      break;
+    default:
+      LOG_CRITICAL("Unhandled PixelFormat: {}", src.format_);
+    }
+  };
+
+  for (int y = 0; y < resolution.y; ++y) {
+    for (int x = 0; x < resolution.x; x += rows ? resolution.x : 1) {
+      size_t from = src.pixel_offset(bounds_.pmin + Vector2i(x, y));
+      size_t to = image.pixel_offset({x, y});
+      if (all_channels) {
+        copy(from, to);
+      } else {
+        for (int c = 0; c < n_channels(); ++c) {
+          copy(from + channels_.offset[c], to + c);
+        }
+      }
+    }
+  }
+  return image;
+}
+
+void specula::Image::copy_rect_out(const Bounds2i &extent, pstd::span<float> buf,
+                                   WrapMode2D wrap_mode) const {
+  ASSERT_GE(buf.size(), extent.area() * n_channels());
+
+  if (intersect(extent, Bounds2i({0, 0}, resolution_)) == extent &&
+      layout_ == ImageLayout::Scanline) {
+    // Entirely inside of the image, so each scanline is converted as a single span
+    int nx = extent.pmax.x - extent.pmin.x;
+    size_t count = size_t(n_channels()) * nx;
+    float *out = buf.data();
+    for (int y = extent.pmin.y; y < extent.pmax.y; ++y, out += count) {
+      size_t offset = pixel_offset({extent.pmin.x, y});
+      switch (format_) {
+      case PixelFormat::U256:
+        encoding_.to_linear({&p8[offset], count}, {out, count});
+        break;
+      case PixelFormat::Half:
+        half_to_float({&p16[offset], count}, {out, count});
+        break;
+      case PixelFormat::Float:
+        std::memcpy(out, &p32[offset], count * sizeof(float));
+        break;
+      default:
+        LOG_CRITICAL("Unhandled PixelFormat: {}", format_);
+      }
+    }
+    return;
+  }
+
+  if (intersect(extent, Bounds2i({0, 0}, resolution_)) == extent) {
+    // The part of a row within a tile is gathered and then converted as a single span
+    int tile_size = 1 << tile_size_log2(layout_);
+    size_t nc = n_channels();
+    std::vector<uint8_t> texels8(format_ == PixelFormat::U256 ? nc * tile_size : 0);
+    std::vector<Half> texels16(format_ == PixelFormat::Half ? nc * tile_size : 0);
+    float *out = buf.data();
+    for (int y = extent.pmin.y; y < extent.pmax.y; ++y) {
+      for (int x = extent.pmin.x, run; x < extent.pmax.x; x += run) {
+        run = std::min((x & -tile_size) + tile_size, extent.pmax.x) - x;
+        size_t count = nc * run;
+        switch (format_) {
+        case PixelFormat::U256:
+          for_tiled_run(*this, {x, y}, run, [&](int i, size_t offset) {
+            std::memcpy(&texels8[i * nc], &p8[offset], nc * sizeof(uint8_t));
+          });
+          encoding_.to_linear({texels8.data(), count}, {out, count});
+          break;
+        case PixelFormat::Half:
+          for_tiled_run(*this, {x, y}, run, [&](int i, size_t offset) {
+            std::memcpy(&texels16[i * nc], &p16[offset], nc * sizeof(Half));
+          });
+          half_to_float({texels16.data(), count}, {out, count});
+          break;
+        case PixelFormat::Float:
+          for_tiled_run(*this, {x, y}, run, [&](int i, size_t offset) {
+            std::memcpy(out + i * nc, &p32[offset], nc * sizeof(float));
+          });
+          break;
+        default:
+          LOG_CRITICAL("Unhandled PixelFormat: {}", format_);
+        }
+        out += count;
+      }
+    }
+    return;
+  }
+
+  float *out = buf.data();
+  for_extent(extent, wrap_mode, *this, [&](int64_t offset) {
+    if (offset < 0) {
+      *out++ = 0;
+      return;
+    }
+    switch (format_) {
+    case PixelFormat::U256:
+      encoding_.to_linear({&p8[offset], 1}, {out, 1});
+      break;
+    case PixelFormat::Half:
+      *out = float(p16[offset]);
+      break;
+    case PixelFormat::Float:
+      *out = p32[offset];
+      break;
+    default:
+      LOG_CRITICAL("Unhandled PixelFormat: {}", format_);
+    }
+    ++out;
+  });
+}
+
+void specula::Image::copy_rect_in(const Bounds2i &extent, pstd::span<const float> buf) {
+  ASSERT_GE(buf.size(), extent.area() * n_channels());
+
+  if (intersect(extent, Bounds2i({0, 0}, resolution_)) == extent &&
+      layout_ == ImageLayout::Scanline) {
+    int nx = extent.pmax.x - extent.pmin.x;
+    size_t count = size_t(n_channels()) * nx;
+    const float *in = buf.data();
+    for (int y = extent.pmin.y; y < extent.pmax.y; ++y, in += count) {
+      size_t offset = pixel_offset({extent.pmin.x, y});
+      switch (format_) {
+      case PixelFormat::U256:
+        encoding_.from_linear({in, count}, {&p8[offset], count});
+        break;
+      case PixelFormat::Half:
+        float_to_half({in, count}, {&p16[offset], count});
+        break;
+      case PixelFormat::Float:
+        std::memcpy(&p32[offset], in, count * sizeof(float));
+        break;
+      default:
+        LOG_CRITICAL("Unhandled PixelFormat: {}", format_);
+      }
+    }
+    return;
+  }
+
+  if (intersect(extent, Bounds2i({0, 0}, resolution_)) == extent) {
+    // The part of a row within a tile is converted as a single span and then scattered
+    int tile_size = 1 << tile_size_log2(layout_);
+    size_t nc = n_channels();
+    std::vector<uint8_t> texels8(format_ == PixelFormat::U256 ? nc * tile_size : 0);
+    std::vector<Half> texels16(format_ == PixelFormat::Half ? nc * tile_size : 0);
+    const float *in = buf.data();
+    for (int y = extent.pmin.y; y < extent.pmax.y; ++y) {
+      for (int x = extent.pmin.x, run; x < extent.pmax.x; x += run) {
+        run = std::min((x & -tile_size) + tile_size, extent.pmax.x) - x;
+        size_t count = nc * run;
+        switch (format_) {
+        case PixelFormat::U256:
+          encoding_.from_linear({in, count}, {texels8.data(), count});
+          for_tiled_run(*this, {x, y}, run, [&](int i, size_t offset) {
+            std::memcpy(&p8[offset], &texels8[i * nc], nc * sizeof(uint8_t));
+          });
+          break;
+        case PixelFormat::Half:
+          float_to_half({in, count}, {texels16.data(), count});
+          for_tiled_run(*this, {x, y}, run, [&](int i, size_t offset) {
+            std::memcpy(&p16[offset], &texels16[i * nc], nc * sizeof(Half));
+          });
+          break;
+        case PixelFormat::Float:
+          for_tiled_run(*this, {x, y}, run, [&](int i, size_t offset) {
+            std::memcpy(&p32[offset], in + i * nc, nc * sizeof(float));
+          });
+          break;
+        default:
+          LOG_CRITICAL("Unhandled PixelFormat: {}", format_);
+        }
+        in += count;
+      }
+    }
+    return;
+  }
+
+  const float *in = buf.data();
+  for_extent(extent, WrapMode::Clamp, *this, [&](int64_t offset) {
+    switch (format_) {
+    case PixelFormat::U256:
+      encoding_.from_linear({in, 1}, {&p8[offset], 1});
+      break;
+    case PixelFormat::Half:
+      p16[offset] = Half(*in);
+      break;
+    case PixelFormat::Float:
+      p32[offset] = *in;
+      break;
+    default:
+      LOG_CRITICAL("Unhandled PixelFormat: {}", format_);
+    }
+    ++in;
+  });
+}
+
+specula::Image specula::Image::convert_to_format(PixelFormat format,
+                                                 ColorEncoding encoding) const {
+  if (format == format_) {
+    return *this;
+  }
+
+  Image image(format, resolution_, channel_names(), encoding, {}, layout_);
+
+  // Everything goes through `Float`, converting bounded chunks at a time so the intermediate
+  // buffer stays in cache regardless of the image size. Both images share the same layout, so
+  // this includes any tile padding.
+  size_t n = size_t(n_channels()) * layout_pixel_count(layout_, resolution_);
+  Float buf[CONVERSION_CHUNK_SIZE];
+  for (size_t start = 0; start < n; start += CONVERSION_CHUNK_SIZE) {
+    size_t count = std::min(CONVERSION_CHUNK_SIZE, n - start);
+    pstd::span<Float> chunk(buf, count);
+
+    switch (format_) {
+    case PixelFormat::U256:
+      encoding_.to_linear({&p8[start], count}, chunk);
+      break;
+    case PixelFormat::Half:
+      half_to_float({&p16[start], count}, chunk);
+      break;
+    case PixelFormat::Float:
+      std::copy(&p32[start], &p32[start] + count, buf);
+      break;
+    default:
+      LOG_CRITICAL("Unhandled PixelFormat: {}", format_);
+    }
+
+    switch (format) {
+    case PixelFormat::U256:
+      image.encoding_.from_linear(chunk, {&image.p8[start], count});
+      break;
+    case PixelFormat::Half:
+      float_to_half(chunk, {&image.p16[start], count});
+      break;
+    case PixelFormat::Float:
+      std::copy(buf, buf + count, &image.p32[start]);
+      break;
+    default:
+      LOG_CRITICAL("Unhandled PixelFormat: {}", format);
+    }
+  }
+  return image;
+}
+
+specula::Image specula::Image::convert_to_layout(ImageLayout layout, Allocator alloc) const {
+  Image image(format_, resolution_, channel_names(), encoding_, alloc, layout);
+  size_t count = n_channels();
+  for (int y = 0; y < resolution_.y; ++y) {
+    for (int x = 0; x < resolution_.x; ++x) {
+      size_t src = pixel_offset({x, y}), dst = image.pixel_offset({x, y});
+      switch (format_) {
+      case PixelFormat::U256:
+        std::memcpy(&image.p8[dst], &p8[src], count * sizeof(uint8_t));
+        break;
+      case PixelFormat::Half:
+        std::memcpy(&image.p16[dst], &p16[src], count * sizeof(Half));
+        break;
+      case PixelFormat::Float:
+        std::memcpy(&image.p32[dst], &p32[src], count * sizeof(float));
+        break;
+      default:
+        LOG_CRITICAL("Unhandled PixelFormat: {}", format_);
+      }
+    }
+  }
+  return image;
+}
+
+specula::ImageChannelValues specula::Image::lookup_nearest(Point2f p, WrapMode2D wrap_mode) const {
+  ImageChannelValues cv(n_channels(), Float(0));
+  Point2i pi(p.x * resolution_.x, p.y * resolution_.y);
+  dispatch_view([&](auto view) { view.get_channels(pi, {cv.data(), cv.size()}, wrap_mode); });
+  return cv;
+}
+
+specula::ImageChannelValues specula::Image::lookup_nearest(Point2f p, const ImageChannelDesc &desc,
+                                                           WrapMode2D wrap_mode) const {
+  ImageChannelValues cv(desc.offset.size(), Float(0));
+  dispatch_view([&](auto view) {
+    for (size_t i = 0; i < desc.offset.size(); ++i) {
+      cv[i] = view.lookup_nearest_channel(p, desc.offset[i], wrap_mode);
+    }
+  });
+  return cv;
+}
+
+specula::ImageChannelValues specula::Image::bilerp(Point2f p, WrapMode2D wrap_mode) const {
+  ImageChannelValues cv(n_channels(), Float(0));
+  dispatch_view([&](auto view) { view.bilerp(p, {cv.data(), cv.size()}, wrap_mode); });
+  return cv;
+}
+
+specula::ImageChannelValues specula::Image::bilerp(Point2f p, const ImageChannelDesc &desc,
+                                                   WrapMode2D wrap_mode) const {
+  ImageChannelValues cv(desc.offset.size(), Float(0));
+  dispatch_view([&](auto view) {
+    for (size_t i = 0; i < desc.offset.size(); ++i) {
+      cv[i] = view.bilerp_channel(p, desc.offset[i], wrap_mode);
+    }
+  });
+  return cv;
+}
+
+void specula::Image::set_channels(Point2i p, const ImageChannelValues &values) {
+  ASSERT_LE(values.size(), n_channels());
+  for (size_t i = 0; i < values.size(); ++i) {
+    set_channel(p, i, values[i]);
+  }
+}
+
+void specula::Image::set_channels(Point2i p, pstd::span<const Float> values) {
+  ASSERT_LE(values.size(), n_channels());
+  for (size_t i = 0; i < values.size(); ++i) {
+    set_channel(p, i, values[i]);
+  }
+}
+
+void specula::Image::set_channels(Point2i p, const ImageChannelDesc &desc,
+                                  pstd::span<const Float> values) {
+  ASSERT_LE(values.size(), desc.offset.size());
+  for (size_t i = 0; i < values.size(); ++i) {
+    set_channel(p, desc.offset[i], values[i]);
+  }
+}
+
+void specula::Image::flip_y() {
+  for (int y = 0; y < resolution_.y / 2; ++y) {
+    for (int x = 0; x < resolution_.x; ++x) {
+      size_t o1 = pixel_offset({x, y}), o2 = pixel_offset({x, resolution_.y - 1 - y});
+      for (int c = 0; c < n_channels(); ++c) {
+        switch (format_) {
+        case PixelFormat::U256:
+          std::swap(p8[o1 + c], p8[o2 + c]);
+          break;
+        case PixelFormat::Half:
+          std::swap(p16[o1 + c], p16[o2 + c]);
+          break;
+        case PixelFormat::Float:
+          std::swap(p32[o1 + c], p32[o2 + c]);
+          break;
+        default:
+          LOG_CRITICAL("Unhandled PixelFormat: {}", format_);
+        }
+      }
+    }
+  }
+}
+
+specula::pstd::vector<specula::Image> specula::Image::generate_pyramid(Image image,
+                                                                       WrapMode2D wrap_mode,
+                                                                       Allocator alloc) {
+  PixelFormat format = image.format();
+  ColorEncoding encoding = image.encoding();
+  ImageLayout layout = image.layout();
+  std::vector<std::string> channel_names = image.channel_names();
+  int nc = image.n_channels();
+
+  Point2i resolution = image.resolution();
+  if (!std::has_single_bit(uint32_t(resolution.x)) ||
+      !std::has_single_bit(uint32_t(resolution.y))) {
+    resolution = Point2i(std::bit_ceil(uint32_t(resolution.x)),
+                         std::bit_ceil(uint32_t(resolution.y)));
+    image = image.float_resize_up(resolution, wrap_mode);
+  }
+
+  int n_levels = 1 + log2_int(std::max(resolution.x, resolution.y));
+  pstd::vector<Image> pyramid(alloc);
+  pyramid.reserve(n_levels);
+
+  // The first level keeps the original pixels, only a resampled image has to be converted back.
+  // An image that is already stored the way the pyramid needs is moved into it instead of being
+  // copied, and the first stage then reads its tiles from the pyramid.
+  bool moved = image.format() == format && image.layout() == layout &&
+               image.p8.get_allocator().resource() == alloc.resource();
+  if (moved) {
+    pyramid.push_back(std::move(image));
+  } else if (image.format() == format) {
+    pyramid.push_back(image.convert_to_layout(layout, alloc));
+  } else {
+    pyramid.push_back(image.convert_to_format(format, encoding).convert_to_layout(layout, alloc));
+  }
+  for (int level = 1; level < n_levels; ++level) {
+    Point2i level_resolution(std::max(1, resolution.x >> level),
+                             std::max(1, resolution.y >> level));
+    pyramid.push_back(Image(format, level_resolution, channel_names, encoding, alloc, layout));
+  }
+
+  // Each stage splits its first level into tiles and filters every tile all the way down to a
+  // single pixel before moving on to the next one, so each level is built from the previous one
+  // while it is still in cache. The single pixels form the first level of the next stage, and are
+  // kept at full precision regardless of the format of the pyramid.
+  int base = 0;
+  while (base < n_levels - 1) {
+    const Image &source = base == 0 && moved ? pyramid[0] : image;
+    Point2i stage_resolution = source.resolution();
+    Point2i tile(std::min(PYRAMID_TILE_SIZE, stage_resolution.x),
+                 std::min(PYRAMID_TILE_SIZE, stage_resolution.y));
+    Point2i n_tiles(stage_resolution.x / tile.x, stage_resolution.y / tile.y);
+    int tile_levels = log2_int(std::max(tile.x, tile.y));
+
+    Image next(PixelFormat::Float, n_tiles, channel_names);
+    parallel_for(0, int64_t(n_tiles.x) * n_tiles.y, [&](int64_t begin, int64_t end) {
+      std::vector<float> buf(size_t(nc) * tile.x * tile.y), scratch(buf.size());
+      for (int64_t t = begin; t < end; ++t) {
+        Point2i tile_index(t % n_tiles.x, t / n_tiles.x);
+        Point2i pmin(tile_index.x * tile.x, tile_index.y * tile.y);
+        source.copy_rect_out(Bounds2i(pmin, pmin + tile), buf);
+
+        Point2i size = tile;
+        for (int level = 1; level <= tile_levels; ++level) {
+          size = box_filter(buf.data(), size, nc, scratch.data());
+          std::swap(buf, scratch);
+
+          Point2i level_min(tile_index.x * size.x, tile_index.y * size.y);
+          pyramid[base + level].copy_rect_in(Bounds2i(level_min, level_min + size),
+                                             {buf.data(), size_t(nc) * size.x * size.y});
+        }
+        next.copy_rect_in(Bounds2i(tile_index, tile_index + Point2i(1, 1)),
+                          {buf.data(), size_t(nc)});
+      }
+    });
+
+    image = std::move(next);
+    base += tile_levels;
+  }
+
+  return pyramid;
+}
+
+specula::pstd::vector<specula::Image> specula::Image::cached_pyramid(
+    Image image, WrapMode2D wrap_mode, const std::string &cache_directory, Allocator alloc) {
+  uint64_t key = pyramid_cache_key(image, wrap_mode);
+  std::string filename =
+      (std::filesystem::path(cache_directory) / fmt::format("{:016x}.pyramid", key)).string();
+
+  ++pyramid_cache_lookups;
+  pstd::vector<Image> pyramid = read_pyramid_cache(filename, key, image.encoding(), alloc);
+  if (!pyramid.empty()) {
+    ++pyramid_cache_hits;
+    return pyramid;
+  }
+
+  pyramid = generate_pyramid(std::move(image), wrap_mode, alloc);
+  std::error_code error;
+  std::filesystem::create_directories(cache_directory, error);
+  if (error) {
+    LOG_WARN("Unable to create pyramid cache directory {}: {}", cache_directory,
+             error.message());
+  } else {
+    write_pyramid_cache(filename, key, pyramid);
+  }
+  return pyramid;
+}
+
+uint64_t specula::Image::pyramid_cache_key(const Image &image, WrapMode2D wrap_mode) {
+  // Chunks are hashed in parallel, and their hashes are hashed in order
+  size_t bytes = image.bytes_used();
+  const std::byte *pixels = static_cast<const std::byte *>(image.raw_pointer({0, 0}));
+  size_t n_chunks = (bytes + PYRAMID_HASH_CHUNK_SIZE - 1) / PYRAMID_HASH_CHUNK_SIZE;
+  std::vector<uint64_t> chunk_hashes(n_chunks);
+  parallel_for(0, n_chunks, [&](int64_t begin, int64_t end) {
+    for (int64_t i = begin; i < end; ++i) {
+      size_t offset = i * PYRAMID_HASH_CHUNK_SIZE;
+      chunk_hashes[i] =
+          hash_buffer(pixels + offset, std::min(PYRAMID_HASH_CHUNK_SIZE, bytes - offset));
+    }
+  });
+
+  uint64_t key = hash_buffer(chunk_hashes.data(), n_chunks * sizeof(uint64_t));
+  key = hash(key, image.format_, image.layout_, image.resolution_, image.n_channels(),
+             wrap_mode.wrap[0], wrap_mode.wrap[1]);
+  for (const std::string &channel : image.channel_names_) {
+    key = hash_buffer(channel.data(), channel.size() + 1, key);
+  }
+  if (is_8bit(image.format_) && image.encoding_) {
+    if (const Float *table = image.encoding_.to_linear_table(); table) {
+      key = hash_buffer(table, 256 * sizeof(Float), key);
+    }
+  }
+  return key;
+}
+
+specula::pstd::vector<specula::Image> specula::Image::read_pyramid_cache(
+    const std::string &filename, uint64_t key, ColorEncoding encoding, Allocator alloc) {
+  std::error_code error;
+  if (!std::filesystem::exists(filename, error)) {
+    return pstd::vector<Image>(alloc);
+  }
+  std::shared_ptr<MappedFile> file = MappedFile::open(filename);
+  if (!file) {
+    return pstd::vector<Image>(alloc);
+  }
+
+  // A file that does not match is only reported, as it is replaced with a new one
+  auto invalid = [&]() {
+    LOG_WARN("Ignoring invalid pyramid cache file {}", filename);
+    return pstd::vector<Image>(alloc);
+  };
+
+  PyramidCacheHeader header;
+  if (file->size() < sizeof(header)) {
+    return invalid();
+  }
+  std::memcpy(&header, file->data(), sizeof(header));
+  size_t names_offset = sizeof(header) + size_t(header.n_levels) * sizeof(PyramidCacheLevel);
+  if (std::memcmp(header.magic, PYRAMID_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.key != key || header.format > uint32_t(PixelFormat::Float) ||
+      header.layout > uint32_t(ImageLayout::Tiled64) || header.n_channels == 0 ||
+      header.n_levels == 0 || header.n_levels > 32 || names_offset > file->size()) {
+    return invalid();
+  }
+
+  PixelFormat format = PixelFormat(header.format);
+  ImageLayout layout = ImageLayout(header.layout);
+
+  std::vector<std::string> channel_names;
+  const char *names = reinterpret_cast<const char *>(file->data()) + names_offset;
+  const char *file_end = reinterpret_cast<const char *>(file->data()) + file->size();
+  for (uint32_t c = 0; c < header.n_channels; ++c) {
+    const char *end = std::find(names, file_end, '\0');
+    if (end == file_end) {
+      return invalid();
+    }
+    channel_names.push_back(std::string(names, end));
+    names = end + 1;
+  }
+
+  pstd::vector<Image> pyramid(alloc);
+  pyramid.reserve(header.n_levels);
+  for (uint32_t i = 0; i < header.n_levels; ++i) {
+    PyramidCacheLevel level;
+    std::memcpy(&level, file->data() + sizeof(header) + i * sizeof(level), sizeof(level));
+    Point2i resolution(level.resolution[0], level.resolution[1]);
+    if (resolution.x <= 0 || resolution.y <= 0 || level.data_offset % RAW_IMAGE_ALIGNMENT != 0) {
+      return invalid();
+    }
+    size_t bytes;
+    if (!mapped_pixel_bytes(format, layout, resolution, header.n_channels, &bytes) ||
+        level.data_offset > file->size() || bytes > file->size() - level.data_offset) {
+      return invalid();
+    }
+
+    Image image(mapped_pixel_resource());
+    image.format_ = format;
+    image.layout_ = layout;
+    image.resolution_ = resolution;
+    image.encoding_ = is_8bit(format) ? (encoding ? encoding : ColorEncoding::SRGB) : nullptr;
+    for (const std::string &channel : channel_names) {
+      image.channel_names_.push_back(channel);
+    }
+    image.adopt_mapped_pixels(file->data() + level.data_offset, file);
+    pyramid.push_back(std::move(image));
+  }
+  return pyramid;
+}
+
+bool specula::Image::write_pyramid_cache(const std::string &filename, uint64_t key,
+                                         pstd::span<const Image> levels) {
+  const Image &base = levels[0];
+  std::string names;
+  for (const std::string &channel : base.channel_names_) {
+    names.append(channel);
+    names.push_back('\0');
+  }
+
+  PyramidCacheHeader header;
+  std::memcpy(header.magic, PYRAMID_CACHE_MAGIC, sizeof(header.magic));
+  header.key = key;
+  header.format = uint32_t(base.format_);
+  header.layout = uint32_t(base.layout_);
+  header.n_channels = base.n_channels();
+  header.n_levels = levels.size();
+
+  std::vector<PyramidCacheLevel> table(levels.size());
+  size_t offset =
+      align_raw_image_offset(sizeof(header) + levels.size() * sizeof(PyramidCacheLevel) +
+                             names.size());
+  names.resize(offset - sizeof(header) - levels.size() * sizeof(PyramidCacheLevel), '\0');
+  for (size_t i = 0; i < levels.size(); ++i) {
+    DASSERT(levels[i].format_ == base.format_ && levels[i].layout_ == base.layout_);
+    table[i].resolution[0] = levels[i].resolution_.x;
+    table[i].resolution[1] = levels[i].resolution_.y;
+    table[i].data_offset = offset;
+    offset = align_raw_image_offset(offset + levels[i].bytes_used());
+  }
+
+  // Written under a unique name and then renamed, so that other processes sharing the cache never
+  // map a partially written file
+  std::string temp_filename = fmt::format("{}.{:08x}.tmp", filename, std::random_device()());
+  FILE *f = fopen(temp_filename.c_str(), "wb");
+  if (f == nullptr) {
+    LOG_WARN("Unable to open {} for writing", temp_filename);
+    return false;
+  }
+
+  static const char padding[RAW_IMAGE_ALIGNMENT] = {};
+  bool success = fwrite(&header, sizeof(header), 1, f) == 1 &&
+                 fwrite(table.data(), sizeof(PyramidCacheLevel), table.size(), f) ==
+                     table.size() &&
+                 fwrite(names.data(), 1, names.size(), f) == names.size();
+  for (size_t i = 0; i < levels.size() && success; ++i) {
+    size_t bytes = levels[i].bytes_used();
+    size_t pad = align_raw_image_offset(bytes) - bytes;
+    success = fwrite(levels[i].raw_pointer({0, 0}), 1, bytes, f) == bytes &&
+              fwrite(padding, 1, pad, f) == pad;
+  }
+
+  std::error_code error;
+  if (fclose(f) != 0 || !success) {
+    LOG_WARN("Unable to write pyramid cache file {}", temp_filename);
+    std::filesystem::remove(temp_filename, error);
+    return false;
+  }
+  std::filesystem::rename(temp_filename, filename, error);
+  if (error) {
+    LOG_WARN("Unable to write pyramid cache file {}: {}", filename, error.message());
+    std::filesystem::remove(temp_filename, error);
+    return false;
+  }
+  return true;
+}
+
+specula::Image specula::Image::float_resize_up(Point2i new_resolution,
+                                               WrapMode2D wrap_mode) const {
+  ASSERT_GE(new_resolution.x, resolution_.x);
+  ASSERT_GE(new_resolution.y, resolution_.y);
+
+  Image resampled(PixelFormat::Float, new_resolution, channel_names());
+  // Computed once for the whole image and shared by every tile, which costs far less than the
+  // resize itself
+  std::vector<ResampleWeight> x_weights = resample_weights(resolution_.x, new_resolution.x);
+  std::vector<ResampleWeight> y_weights = resample_weights(resolution_.y, new_resolution.y);
+  int nc = n_channels();
+
+  parallel_for_2d(Bounds2i({0, 0}, new_resolution), [&](Bounds2i out_extent) {
+    Bounds2i in_extent(Point2i(x_weights[out_extent.pmin.x].first_pixel,
+                               y_weights[out_extent.pmin.y].first_pixel),
+                       Point2i(x_weights[out_extent.pmax.x - 1].first_pixel + 4,
+                               y_weights[out_extent.pmax.y - 1].first_pixel + 4));
+    std::vector<float> in_buf(nc * in_extent.area());
+    copy_rect_out(in_extent, in_buf, wrap_mode);
+
+    int nx_out = out_extent.pmax.x - out_extent.pmin.x;
+    int ny_out = out_extent.pmax.y - out_extent.pmin.y;
+    int nx_in = in_extent.pmax.x - in_extent.pmin.x;
+    int ny_in = in_extent.pmax.y - in_extent.pmin.y;
+
+    // Resize in the x dimension, for every row of the input extent
+    std::vector<float> x_buf(nc * ny_in * nx_out);
+    size_t x_buf_offset = 0;
+    for (int y = 0; y < ny_in; ++y) {
+      for (int x = out_extent.pmin.x; x < out_extent.pmax.x; ++x) {
+        const ResampleWeight &rsw = x_weights[x];
+        size_t in_offset = nc * ((rsw.first_pixel - in_extent.pmin.x) + size_t(nx_in) * y);
+        for (int c = 0; c < nc; ++c, ++x_buf_offset, ++in_offset) {
+          x_buf[x_buf_offset] = rsw.weight[0] * in_buf[in_offset] +
+                                rsw.weight[1] * in_buf[in_offset + nc] +
+                                rsw.weight[2] * in_buf[in_offset + 2 * nc] +
+                                rsw.weight[3] * in_buf[in_offset + 3 * nc];
+        }
+      }
+    }
+
+    // Resize in the y dimension, each output row is a weighted sum of four rows of `x_buf`
+    size_t row = size_t(nc) * nx_out;
+    std::vector<float> out_buf(row * ny_out);
+    for (int y = 0; y < ny_out; ++y) {
+      const ResampleWeight &rsw = y_weights[out_extent.pmin.y + y];
+      const float *first = x_buf.data() + row * (rsw.first_pixel - in_extent.pmin.y);
+      const float *rows[4] = {first, first + row, first + 2 * row, first + 3 * row};
+      resample_row(rows, rsw.weight, row, out_buf.data() + row * y);
+    }
+
+    resampled.copy_rect_in(out_extent, out_buf);
+  });
+  return resampled;
+}
+
+specula::Image specula::Image::gaussian_filter(const ImageChannelDesc &desc, int half_width,
+                                               Float sigma) const {
+  return SubImage(*this).select_channels(desc).gaussian_filter(half_width, sigma);
+}
+
+specula::Image specula::SubImage::gaussian_filter(int half_width, Float sigma) const {
+  int n_taps = 2 * half_width + 1;
+  std::vector<float> weights(n_taps);
+  Float weight_sum = 0;
+  for (int i = 0; i < n_taps; ++i) {
+    weights[i] = gaussian(i - half_width, 0, sigma);
+    weight_sum += weights[i];
+  }
+  for (float &w : weights) {
+    w /= weight_sum;
+  }
+
+  Point2i resolution = this->resolution();
+  ImageChannelDesc desc = all_channels_desc();
+  Image result(PixelFormat::Float, resolution, channel_names());
+  size_t nc = desc.size();
+  parallel_for(0, filter_tile_count(resolution), [&](int64_t tile) {
+    Bounds2i bounds = filter_tile(tile, resolution);
+    int tw = bounds.pmax.x - bounds.pmin.x, th = bounds.pmax.y - bounds.pmin.y;
+    int in_width = tw + 2 * half_width, in_height = th + 2 * half_width;
+    Vector2i padding(half_width, half_width);
+
+    float *in = FilterScratch::reserve(filter_scratch.ping, nc * in_width * in_height);
+    float *transposed = FilterScratch::reserve(filter_scratch.pong, nc * tw * in_height);
+    gather_planes(*this, Bounds2i(bounds.pmin - padding, bounds.pmax + padding), desc, true,
+                  in);
+
+    // Filter the rows and store them transposed, so that the columns are contiguous and the
+    // second pass filters them with the same row kernel
+    std::vector<float> &line = filter_scratch.line;
+    float *out = FilterScratch::reserve(line, std::max(tw, th));
+    for (size_t c = 0; c < nc; ++c) {
+      for (int y = 0; y < in_height; ++y) {
+        convolve_row(in + (c * in_height + y) * in_width, weights.data(), n_taps, tw, out);
+        for (int x = 0; x < tw; ++x) {
+          transposed[(c * tw + x) * in_height + y] = out[x];
+        }
+      }
+    }
+
+    for (size_t c = 0; c < nc; ++c) {
+      for (int x = 0; x < tw; ++x) {
+        convolve_row(transposed + (c * tw + x) * in_height, weights.data(), n_taps, th, out);
+        float *dst = result.p32.data() +
+                     nc * (size_t(bounds.pmin.y) * resolution.x + bounds.pmin.x + x) + c;
+        for (int y = 0; y < th; ++y) {
+          dst[nc * size_t(y) * resolution.x] = out[y];
+        }
+      }
+    }
+  });
+  return result;
+}
+
+specula::Image specula::Image::joint_bilateral_filter(const ImageChannelDesc &to_filter,
+                                                      int half_width, const Float xy_sigma[2],
+                                                      const ImageChannelDesc &joint,
+                                                      const ImageChannelValues &joint_sigma) const {
+  return SubImage(*this).joint_bilateral_filter(to_filter, half_width, xy_sigma, joint,
+                                                joint_sigma);
+}
+
+specula::Image
+specula::SubImage::joint_bilateral_filter(const ImageChannelDesc &to_filter, int half_width,
+                                          const Float xy_sigma[2], const ImageChannelDesc &joint,
+                                          const ImageChannelValues &joint_sigma) const {
+  ASSERT_EQ(joint.size(), joint_sigma.size());
+
+  // The normalization of the Gaussians cancels out when dividing by the sum of the weights
+  int n_taps = 2 * half_width + 1;
+  std::vector<float> spatial(n_taps * n_taps);
+  for (int dy = 0; dy < n_taps; ++dy) {
+    for (int dx = 0; dx < n_taps; ++dx) {
+      spatial[dy * n_taps + dx] =
+          gaussian(dx - half_width, 0, xy_sigma[0]) * gaussian(dy - half_width, 0, xy_sigma[1]);
+    }
+  }
+  std::vector<float> inv_two_sigma2(joint.size());
+  for (size_t c = 0; c < joint.size(); ++c) {
+    inv_two_sigma2[c] = 1 / (2 * sqr(joint_sigma[c]));
+  }
+
+  Point2i resolution = this->resolution();
+  Image result(PixelFormat::Float, resolution, select_channels(to_filter).channel_names());
+  int nj = joint.size(), nf = to_filter.size();
+  parallel_for(0, filter_tile_count(resolution), [&](int64_t tile) {
+    Bounds2i bounds = filter_tile(tile, resolution);
+    int tw = bounds.pmax.x - bounds.pmin.x, th = bounds.pmax.y - bounds.pmin.y;
+    Vector2i padding(half_width, half_width);
+    Bounds2i region(bounds.pmin - padding, bounds.pmax + padding);
+    size_t plane = region.area();
+
+    // Neighbors outside of the image are excluded by the mask plane, which is zero there
+    float *planes = FilterScratch::reserve(filter_scratch.ping, (nj + nf + 1) * plane);
+    gather_planes(*this, region, joint, false, planes);
+    gather_planes(*this, region, to_filter, false, planes + nj * plane);
+    float *mask = planes + (nj + nf) * plane;
+    int width = region.pmax.x - region.pmin.x;
+    for (int y = region.pmin.y; y < region.pmax.y; ++y) {
+      for (int x = region.pmin.x; x < region.pmax.x; ++x) {
+        bool inside = x >= 0 && x < resolution.x && y >= 0 && y < resolution.y;
+        *mask++ = inside ? 1.f : 0.f;
+      }
+    }
+
+    BilateralTile t{planes, planes + nj * plane, planes + (nj + nf) * plane, plane, width,
+                    half_width, nj, nf, spatial.data(), inv_two_sigma2.data()};
+    float *out = FilterScratch::reserve(filter_scratch.pong, size_t(nf) * tw);
+    for (int y = 0; y < th; ++y) {
+      bilateral_row(t, y, tw, tw, out);
+      float *dst = result.p32.data() +
+                   size_t(nf) * ((size_t(bounds.pmin.y) + y) * resolution.x + bounds.pmin.x);
+      for (int x = 0; x < tw; ++x) {
+        for (int c = 0; c < nf; ++c) {
+          dst[size_t(x) * nf + c] = out[c * tw + x];
+        }
+      }
+    }
+  });
+  return result;
+}
+
+specula::ImageChannelValues specula::Image::avarge(const ImageChannelDesc &desc) const {
+  return SubImage(*this).select_channels(desc).avarge();
+}
+
+bool specula::Image::has_any_infinite_pixels() const {
+  switch (format_) {
+  case PixelFormat::Half:
+    return scan_non_finite(p16.data(), p16.size(), NonFiniteRange::of<Half>(false, true));
+  case PixelFormat::Float:
+    return scan_non_finite(p32.data(), p32.size(), NonFiniteRange::of<float>(false, true));
+  default:
+    return false;
+  }
+}
+
+bool specula::Image::has_any_nan_pixels() const {
+  switch (format_) {
+  case PixelFormat::Half:
+    return scan_non_finite(p16.data(), p16.size(), NonFiniteRange::of<Half>(true, false));
+  case PixelFormat::Float:
+    return scan_non_finite(p32.data(), p32.size(), NonFiniteRange::of<float>(true, false));
+  default:
+    return false;
+  }
+}
+
+specula::NonFinitePixels specula::Image::find_non_finite_pixels() const {
+  switch (format_) {
+  case PixelFormat::Half:
+    return find_non_finite(p16.data(), layout_, resolution_, n_channels());
+  case PixelFormat::Float:
+    return find_non_finite(p32.data(), layout_, resolution_, n_channels());
+  default:
+    return {};
+  }
+}
+
+specula::ImageChannelValues specula::Image::mae(const ImageChannelDesc &desc, const Image &ref,
+                                                Image *error_image) const {
+  return SubImage(*this).select_channels(desc).mae(reference_channels(*this, desc, ref),
+                                                   error_image);
+}
+
+specula::ImageChannelValues specula::Image::mse(const ImageChannelDesc &desc, const Image &ref,
+                                                Image *error_image) const {
+  return SubImage(*this).select_channels(desc).mse(reference_channels(*this, desc, ref),
+                                                   error_image);
+}
+
+specula::ImageChannelValues specula::Image::mrse(const ImageChannelDesc &desc, const Image &ref,
+                                                 Image *error_image) const {
+  return SubImage(*this).select_channels(desc).mrse(reference_channels(*this, desc, ref),
+                                                    error_image);
+}
+
+specula::ImageChannelValues specula::SubImage::avarge() const {
+  return image_error(*this, nullptr, ErrorMetric::Value, nullptr);
+}
+
+specula::ImageChannelValues specula::SubImage::mae(const SubImage &ref,
+                                                   Image *error_image) const {
+  return image_error(*this, &ref, ErrorMetric::Absolute, error_image);
+}
+
+specula::ImageChannelValues specula::SubImage::mse(const SubImage &ref,
+                                                   Image *error_image) const {
+  return image_error(*this, &ref, ErrorMetric::Squared, error_image);
+}
+
+specula::ImageChannelValues specula::SubImage::mrse(const SubImage &ref,
+                                                    Image *error_image) const {
+  return image_error(*this, &ref, ErrorMetric::RelativeSquared, error_image);
+}
+
+std::vector<specula::ResampleWeight> specula::Image::resample_weights(int old_res, int new_res) {
+  ASSERT_GE(new_res, old_res);
+
+  std::vector<ResampleWeight> weights(new_res);
+  Float filter_radius = 2, tau = 2;
+  for (int i = 0; i < new_res; ++i) {
+    Float center = (i + 0.5f) * old_res / new_res;
+    weights[i].first_pixel = std::floor((center - filter_radius) + 0.5f);
+    for (int j = 0; j < 4; ++j) {
+      Float pos = weights[i].first_pixel + j + 0.5f;
+      weights[i].weight[j] = windowed_sinc(pos - center, filter_radius, tau);
+    }
+
+    Float inv_sum_weights = 1 / (weights[i].weight[0] + weights[i].weight[1] +
+                                 weights[i].weight[2] + weights[i].weight[3]);
+    for (int j = 0; j < 4; ++j) {
+      weights[i].weight[j] *= inv_sum_weights;
+    }
+  }
+  return weights;
+}
+
+specula::ImageAndMetadata specula::Image::read(std::string filename, Allocator alloc,
+                                               ColorEncoding encoding) {
+  if (has_extension(filename, "exr")) {
+    return exr_read(filename, alloc);
+  } else if (has_extension(filename, "pfm")) {
+    return read_pfm(filename, alloc);
+  } else if (has_extension(filename, "qoi")) {
+    return read_qoi(filename, alloc);
+  } else if (has_extension(filename, "simg")) {
+    return read_raw(filename, encoding);
+  }
+  LOG_ERROR("Unable to read image {}, unsupported file format", filename);
+  return {};
+}
+
+bool specula::Image::write(std::string name, const ImageMetadata &metadata) const {
+  return SubImage(*this).write(name, metadata);
+}
+
+bool specula::SubImage::write(const std::string &name, const ImageMetadata &metadata) const {
+  if (has_extension(name, "exr")) {
+    return write_exr(name, metadata);
+  } else if (has_extension(name, "pfm")) {
+    return write_pfm(name, metadata);
+  } else if (has_extension(name, "qoi")) {
+    return write_qoi(name, metadata);
+  } else if (has_extension(name, "simg")) {
+    return write_raw(name, metadata);
+  }
+  LOG_ERROR("Unable to write image {}, unsupported file format", name);
+  return false;
+}
+
+specula::ImageAndMetadata specula::Image::read_pfm(const std::string &filename,
+                                                   Allocator alloc) {
+  std::shared_ptr<MappedFile> file = MappedFile::open(filename);
+  if (!file) {
+    return {};
+  }
+
+  size_t pos = 0;
+  std::string_view magic = read_pfm_token(*file, &pos);
+  int n_channels = magic == "PF" ? 3 : (magic == "Pf" ? 1 : 0);
+  Point2i resolution;
+  float scale;
+  if (n_channels == 0 || !atoi(read_pfm_token(*file, &pos), &resolution.x) ||
+      !atoi(read_pfm_token(*file, &pos), &resolution.y) ||
+      !atof(read_pfm_token(*file, &pos), &scale) || resolution.x <= 0 || resolution.y <= 0) {
+    LOG_ERROR("Unable to read PFM header of {}", filename);
+    return {};
+  }
+  // A single whitespace character separates the header from the pixels
+  ++pos;
+
+  size_t row = size_t(n_channels) * resolution.x;
+  if (pos + row * resolution.y * sizeof(float) > file->size()) {
+    LOG_ERROR("Premature end of file in PFM {}", filename);
+    return {};
+  }
+
+  std::vector<std::string> channel_names =
+      n_channels == 1 ? std::vector<std::string>{"Y"} : std::vector<std::string>{"R", "G", "B"};
+  Image image(PixelFormat::Float, resolution, channel_names, nullptr, alloc);
+
+  // A negative scale marks little endian data, and the rows are stored bottom to top
+  bool swap_bytes = (scale < 0) != (std::endian::native == std::endian::little);
+  scale = std::abs(scale);
+  const std::byte *pixels = file->data() + pos;
+  for (int y = 0; y < resolution.y; ++y) {
+    float *out = image.p32.data() + row * y;
+    std::memcpy(out, pixels + row * (resolution.y - 1 - y) * sizeof(float), row * sizeof(float));
+    for (size_t i = 0; i < row; ++i) {
+      if (swap_bytes) {
+        uint32_t bits = std::bit_cast<uint32_t>(out[i]);
+        out[i] = std::bit_cast<float>((bits >> 24) | ((bits >> 8) & 0xff00) |
+                                      ((bits << 8) & 0xff0000) | (bits << 24));
+      }
+      if (scale != 1) {
+        out[i] *= scale;
+      }
+    }
+  }
+
+  ImageMetadata metadata;
+  metadata.color_space = RgbColorSpace::SRGB;
+  return ImageAndMetadata{std::move(image), metadata};
+}
+
+specula::ImageAndMetadata specula::Image::read_qoi(const std::string &filename,
+                                                   Allocator alloc) {
+  std::shared_ptr<MappedFile> file = MappedFile::open(filename);
+  if (!file) {
+    return {};
+  }
+
+  pstd::span<const std::byte> data(file->data(), file->size());
+  QoiDesc desc;
+  if (!qoi_read_header(data, &desc)) {
+    LOG_ERROR("Invalid QOI header in {}", filename);
+    return {};
+  }
+
+  std::vector<std::string> channel_names =
+      desc.channels == 3 ? std::vector<std::string>{"R", "G", "B"}
+                         : std::vector<std::string>{"R", "G", "B", "A"};
+  ColorEncoding encoding = desc.linear ? ColorEncoding::LINEAR : ColorEncoding::SRGB;
+  Image image(PixelFormat::U256, {desc.width, desc.height}, channel_names, encoding, alloc);
+  if (!qoi_decode(data, desc, {image.p8.data(), image.p8.size()})) {
+    LOG_ERROR("Premature end of file in QOI {}", filename);
+    return {};
+  }
+
+  ImageMetadata metadata;
+  metadata.color_space = RgbColorSpace::SRGB;
+  return ImageAndMetadata{std::move(image), metadata};
+}
+
+specula::ImageAndMetadata specula::Image::read_raw(const std::string &filename,
+                                                   ColorEncoding encoding) {
+  std::shared_ptr<MappedFile> file = MappedFile::open(filename);
+  if (!file) {
+    return {};
+  }
+
+  RawImageHeader header;
+  if (file->size() < sizeof(header)) {
+    LOG_ERROR("Premature end of file in raw image {}", filename);
+    return {};
+  }
+  std::memcpy(&header, file->data(), sizeof(header));
+  if (std::memcmp(header.magic, RAW_IMAGE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.format > uint32_t(PixelFormat::Float) ||
+      header.layout > uint32_t(ImageLayout::Tiled64) || header.n_channels == 0 ||
+      header.resolution[0] <= 0 || header.resolution[1] <= 0 ||
+      header.data_offset % RAW_IMAGE_ALIGNMENT != 0 || header.data_offset > file->size()) {
+    LOG_ERROR("Invalid raw image header in {}", filename);
+    return {};
+  }
+
+  PixelFormat format = PixelFormat(header.format);
+  ImageLayout layout = ImageLayout(header.layout);
+  Point2i resolution(header.resolution[0], header.resolution[1]);
+  size_t bytes;
+  if (!mapped_pixel_bytes(format, layout, resolution, header.n_channels, &bytes) ||
+      bytes > file->size() - header.data_offset) {
+    LOG_ERROR("Premature end of file in raw image {}", filename);
+    return {};
+  }
+
+  Image image(mapped_pixel_resource());
+  image.format_ = format;
+  image.layout_ = layout;
+  image.resolution_ = resolution;
+  image.encoding_ = is_8bit(format) ? (encoding ? encoding : ColorEncoding::SRGB) : nullptr;
+
+  const char *names = reinterpret_cast<const char *>(file->data()) + sizeof(header);
+  const char *names_end = reinterpret_cast<const char *>(file->data()) + header.data_offset;
+  for (uint32_t c = 0; c < header.n_channels; ++c) {
+    const char *end = std::find(names, names_end, '\0');
+    if (end == names_end) {
+      LOG_ERROR("Invalid channel names in raw image {}", filename);
+      return {};
+    }
+    image.channel_names_.push_back(std::string(names, end));
+    names = end + 1;
+  }
+
+  image.adopt_mapped_pixels(file->data() + header.data_offset, file);
+  return ImageAndMetadata{std::move(image), {}};
+}
+
+void specula::Image::adopt_mapped_pixels(std::byte *pixels, std::shared_ptr<MappedFile> file) {
+  DASSERT(p8.get_allocator().resource() == mapped_pixel_resource());
+  size_t n = size_t(n_channels()) * layout_pixel_count(layout_, resolution_);
+  mapped_pixel_resource()->adopt(pixels, std::move(file));
+  switch (format_) {
+  case PixelFormat::U256:
+    p8.adopt(reinterpret_cast<uint8_t *>(pixels), n);
+    break;
+  case PixelFormat::Half:
+    p16.adopt(reinterpret_cast<Half *>(pixels), n);
+    break;
+  case PixelFormat::Float:
+    p32.adopt(reinterpret_cast<float *>(pixels), n);
+    break;
+  default:
+    LOG_CRITICAL("Unhandled PixelFormat: {}", format_);
+  }
+}
+
+bool specula::SubImage::write_exr(const std::string &name,
+                                  const ImageMetadata &metadata) const {
+  ExrPart part{"", *this};
+  return exr_write(name, {&part, 1}, metadata);
+}
+
+bool specula::SubImage::write_pfm(const std::string &name, const ImageMetadata &) const {
+  // PFM files have no room for metadata, which is dropped
+  ImageChannelDesc desc;
+  if (n_channels() != 1) {
+    desc = get_channel_desc(std::vector<std::string>{"R", "G", "B"});
+    if (!desc) {
+      LOG_ERROR("Unable to write PFM {}, the image has no R, G and B channels", name);
+      return false;
+    }
+  }
+
+  FILE *f = fopen(name.c_str(), "wb");
+  if (f == nullptr) {
+    LOG_ERROR("Unable to open {} for writing", name);
+    return false;
+  }
+
+  Point2i resolution = this->resolution();
+  SubImage pixels = desc ? select_channels(desc) : *this;
+
+  // The scale is negative for little endian data
+  float scale = std::endian::native == std::endian::little ? -1.f : 1.f;
+  bool success =
+      fprintf(f, "%s\n%d %d\n%f\n", desc ? "PF" : "Pf", resolution.x, resolution.y, scale) > 0;
+
+  // The rows are stored bottom to top
+  size_t row = desc ? 3 * size_t(resolution.x) : size_t(resolution.x);
+  std::vector<float> scanline(row);
+  for (int y = resolution.y - 1; y >= 0 && success; --y) {
+    pixels.copy_rect_out(Bounds2i({0, y}, {resolution.x, y + 1}), scanline);
+    success = fwrite(scanline.data(), sizeof(float), row, f) == row;
+  }
+
+  if (fclose(f) != 0 || !success) {
+    LOG_ERROR("Unable to write PFM {}", name);
+    return false;
+  }
+  return true;
+}
+
+bool specula::SubImage::write_qoi(const std::string &name, const ImageMetadata &) const {
+  // QOI files only record whether the pixels are linear, so the metadata is dropped
+  ImageChannelDesc desc = get_channel_desc(std::vector<std::string>{"R", "G", "B", "A"});
+  if (!desc) {
+    desc = get_channel_desc(std::vector<std::string>{"R", "G", "B"});
+  }
+  if (!desc) {
+    LOG_ERROR("Unable to write QOI {}, the image has no R, G and B channels", name);
+    return false;
+  }
+
+  // Whole 8-bit images that QOI can represent are written as they are, everything else is
+  // quantized to sRGB
+  SubImage selected = select_channels(desc);
+  const Image &image = *image_;
+  Point2i resolution = this->resolution();
+  QoiDesc qoi{resolution.x, resolution.y, int(desc.size()), false};
+  std::unique_ptr<uint8_t[]> quantized;
+  pstd::span<const uint8_t> pixels;
+  if (selected.is_whole_image() && image.format_ == PixelFormat::U256 &&
+      image.layout_ == ImageLayout::Scanline &&
+      (image.encoding_.is<sRgbColorEncoding>() || image.encoding_.is<LinearColorEncoding>())) {
+    qoi.linear = image.encoding_.is<LinearColorEncoding>();
+    pixels = {image.p8.data(), image.p8.size()};
+  } else {
+    int n_out_of_gamut = 0;
+    quantized = selected.quantize_pixels_to_u256(&n_out_of_gamut);
+    if (n_out_of_gamut > 0) {
+      LOG_WARN("{}: {} out of gamut pixel channels clamped to [0,1]", name, n_out_of_gamut);
+    }
+    pixels = {quantized.get(), size_t(qoi.channels) * resolution.x * resolution.y};
+  }
+
+  std::vector<uint8_t> data = qoi_encode(pixels, qoi);
+  FILE *f = fopen(name.c_str(), "wb");
+  if (f == nullptr) {
+    LOG_ERROR("Unable to open {} for writing", name);
+    return false;
+  }
+  bool success = fwrite(data.data(), 1, data.size(), f) == data.size();
+  if (fclose(f) != 0 || !success) {
+    LOG_ERROR("Unable to write QOI {}", name);
+    return false;
+  }
+  return true;
+}
+
+bool specula::SubImage::write_raw(const std::string &name,
+                                  const ImageMetadata &metadata) const {
+  // The file stores the pixels exactly as they are laid out in memory, so a view is copied into an
+  // image of its own first
+  if (!is_whole_image()) {
+    Image image = to_image();
+    return SubImage(image).write_raw(name, metadata);
+  }
+  const Image &image = *image_;
+
+  FILE *f = fopen(name.c_str(), "wb");
+  if (f == nullptr) {
+    LOG_ERROR("Unable to open {} for writing", name);
+    return false;
+  }
+
+  std::string names;
+  for (const std::string &channel : image.channel_names_) {
+    names.append(channel);
+    names.push_back('\0');
+  }
+
+  RawImageHeader header;
+  std::memcpy(header.magic, RAW_IMAGE_MAGIC, sizeof(header.magic));
+  header.format = uint32_t(image.format_);
+  header.layout = uint32_t(image.layout_);
+  header.n_channels = image.n_channels();
+  header.resolution[0] = image.resolution_.x;
+  header.resolution[1] = image.resolution_.y;
+  header.data_offset = align_raw_image_offset(sizeof(header) + names.size());
+  names.resize(header.data_offset - sizeof(header), '\0');
+
+  // Written exactly as laid out in memory, including any tile padding
+  size_t bytes = image.bytes_used();
+  const void *pixels = is_8bit(image.format_)    ? static_cast<const void *>(image.p8.data())
+                       : is_16bit(image.format_) ? static_cast<const void *>(image.p16.data())
+                                                 : static_cast<const void *>(image.p32.data());
+  bool success = fwrite(&header, sizeof(header), 1, f) == 1 &&
+                 fwrite(names.data(), 1, names.size(), f) == names.size() &&
+                 fwrite(pixels, 1, bytes, f) == bytes;
+
+  if (fclose(f) != 0 || !success) {
+    LOG_ERROR("Unable to write raw image {}", name);
+    return false;
+  }
+  return true;
+}
+
+std::unique_ptr<uint8_t[]>
+specula::SubImage::quantize_pixels_to_u256(int *n_out_of_gamut) const {
+  Point2i resolution = this->resolution();
+  int nc = n_channels();
+  size_t row = size_t(nc) * resolution.x;
+  std::unique_ptr<uint8_t[]> u256 = std::make_unique<uint8_t[]>(row * resolution.y);
+  std::atomic<int> out_of_gamut = 0;
+  parallel_for(0, resolution.y, [&](int64_t y0, int64_t y1) {
+    // The dither repeats with the blue noise mask, so a single period of it is built for each row
+    // and the row is encoded a period at a time
+    size_t period = std::min(row, size_t(nc) * BLUE_NOISE_RESOLUTION);
+    float *buf = FilterScratch::reserve(filter_scratch.ping, row);
+    float *dither = FilterScratch::reserve(filter_scratch.pong, period);
+    size_t count = 0;
+    for (int y = y0; y < y1; ++y) {
+      copy_rect_out(Bounds2i({0, y}, {resolution.x, y + 1}), pstd::span<float>(buf, row));
+      for (size_t i = 0; i < period; ++i) {
+        dither[i] = blue_noise(i % nc, Point2i(i / nc, y)) - 0.5f;
+      }
+      for (size_t i = 0; i < row; i += period) {
+        size_t n = std::min(period, row - i);
+        count += linear_to_srgb8({buf + i, n}, {dither, n}, {u256.get() + row * y + i, n});
+      }
+    }
+    out_of_gamut += count;
+  });
+  if (n_out_of_gamut != nullptr) {
+    *n_out_of_gamut = out_of_gamut;
+  }
+  return u256;
+}
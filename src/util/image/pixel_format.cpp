@@ -3,7 +3,9 @@
 #include <magic_enum/magic_enum.hpp>
 
 #include "specula.hpp"
+#include "util/check.hpp"
 #include "util/log.hpp"
+#include "util/simd.hpp"
 
 SPECULA_CPU_GPU int specula::texel_bytes(PixelFormat format) {
   switch (format) {
@@ -19,6 +21,53 @@ SPECULA_CPU_GPU int specula::texel_bytes(PixelFormat format) {
   }
 }
 
+#if defined(SPECULA_USE_AVX2)
+namespace specula {
+  SPECULA_TARGET_AVX2 static void half_to_float_avx2(const Half *vin, Float *vout, size_t n) {
+    static_assert(sizeof(Half) == sizeof(uint16_t));
+    for (size_t i = 0; i < n; i += 8) {
+      __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i *>(vin + i));
+      _mm256_storeu_ps(vout + i, _mm256_cvtph_ps(h));
+    }
+  }
+
+  SPECULA_TARGET_AVX2 static void float_to_half_avx2(const Float *vin, Half *vout, size_t n) {
+    for (size_t i = 0; i < n; i += 8) {
+      __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(vin + i), _MM_FROUND_TO_NEAREST_INT);
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(vout + i), h);
+    }
+  }
+} // namespace specula
+#endif
+
+void specula::half_to_float(pstd::span<const Half> vin, pstd::span<Float> vout) {
+  DASSERT_EQ(vin.size(), vout.size());
+  size_t i = 0;
+#if defined(SPECULA_USE_AVX2)
+  if (simd::has_avx2()) {
+    i = vin.size() & ~size_t(7);
+    half_to_float_avx2(vin.data(), vout.data(), i);
+  }
+#endif
+  for (; i < vin.size(); ++i) {
+    vout[i] = Float(vin[i]);
+  }
+}
+
+void specula::float_to_half(pstd::span<const Float> vin, pstd::span<Half> vout) {
+  DASSERT_EQ(vin.size(), vout.size());
+  size_t i = 0;
+#if defined(SPECULA_USE_AVX2)
+  if (simd::has_avx2()) {
+    i = vin.size() & ~size_t(7);
+    float_to_half_avx2(vin.data(), vout.data(), i);
+  }
+#endif
+  for (; i < vin.size(); ++i) {
+    vout[i] = Half(vin[i]);
+  }
+}
+
 auto fmt::formatter<specula::PixelFormat>::format(const specula::PixelFormat &v,
                                                   format_context &ctx) const
     -> format_context::iterator {
@@ -0,0 +1,292 @@
+#include "util/image/qoi.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#include "util/check.hpp"
+#include "util/parallel.hpp"
+
+namespace specula {
+  static constexpr uint8_t QOI_OP_INDEX = 0x00;
+  static constexpr uint8_t QOI_OP_DIFF = 0x40;
+  static constexpr uint8_t QOI_OP_LUMA = 0x80;
+  static constexpr uint8_t QOI_OP_RUN = 0xc0;
+  static constexpr uint8_t QOI_OP_RGB = 0xfe;
+  static constexpr uint8_t QOI_OP_RGBA = 0xff;
+  static constexpr uint8_t QOI_MASK_2 = 0xc0;
+
+  static constexpr size_t QOI_HEADER_SIZE = 14;
+  static constexpr uint8_t QOI_END_MARKER[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+  /// Identifies the strip table at the end of the file
+  static constexpr char QOI_STRIP_MAGIC[4] = {'s', 'q', 'o', 'i'};
+  /// Size of the fields following the strip offsets: rows per strip, strip count and magic
+  static constexpr size_t QOI_STRIP_FOOTER_SIZE = 12;
+
+  struct QoiPixel {
+    bool operator==(const QoiPixel &other) const = default;
+
+    int hash() const { return (r * 3 + g * 5 + b * 7 + a * 11) % 64; }
+
+    uint8_t r = 0, g = 0, b = 0, a = 255;
+  };
+
+  static void write_u32(std::vector<uint8_t> &out, uint32_t v) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+      out.push_back(uint8_t(v >> shift));
+    }
+  }
+
+  static uint32_t read_u32(const uint8_t *p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+  }
+
+  /**
+   * Encode `n` pixels starting from the initial coder state. The `first` strip is coded exactly as
+   * the reference encoder codes it. Every other strip starts with a literal and only uses index
+   * entries written by the strip itself, so it decodes the same regardless of what precedes it in
+   * the stream.
+   */
+  static void encode_strip(const uint8_t *pixels, size_t n, int channels, bool first,
+                           std::vector<uint8_t> &out) {
+    QoiPixel index[64], prev;
+    std::fill(std::begin(index), std::end(index), QoiPixel{0, 0, 0, 0});
+    // Only the first strip can rely on the zeroed index of the initial state
+    uint64_t valid = first ? ~uint64_t(0) : 0;
+    int run = 0;
+    out.reserve(n * (channels + 1));
+
+    for (size_t i = 0; i < n; ++i, pixels += channels) {
+      QoiPixel px = prev;
+      px.r = pixels[0];
+      px.g = pixels[1];
+      px.b = pixels[2];
+      if (channels == 4) {
+        px.a = pixels[3];
+      }
+
+      if ((first || i > 0) && px == prev) {
+        if (++run == 62 || i == n - 1) {
+          out.push_back(QOI_OP_RUN | (run - 1));
+          run = 0;
+        }
+        continue;
+      }
+
+      if (run > 0) {
+        out.push_back(QOI_OP_RUN | (run - 1));
+        run = 0;
+      }
+
+      int pos = px.hash();
+      if (((valid >> pos) & 1) && index[pos] == px) {
+        out.push_back(QOI_OP_INDEX | pos);
+      } else {
+        index[pos] = px;
+        valid |= uint64_t(1) << pos;
+
+        if ((first || i > 0) && px.a == prev.a) {
+          int8_t vr = px.r - prev.r, vg = px.g - prev.g, vb = px.b - prev.b;
+          int8_t vg_r = vr - vg, vg_b = vb - vg;
+          if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+            out.push_back(QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2));
+          } else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8) {
+            out.push_back(QOI_OP_LUMA | (vg + 32));
+            out.push_back((vg_r + 8) << 4 | (vg_b + 8));
+          } else {
+            out.insert(out.end(), {QOI_OP_RGB, px.r, px.g, px.b});
+          }
+        } else if (channels == 3) {
+          // The alpha of RGB images is always opaque, whatever the preceding strip
+          out.insert(out.end(), {QOI_OP_RGB, px.r, px.g, px.b});
+        } else {
+          out.insert(out.end(), {QOI_OP_RGBA, px.r, px.g, px.b, px.a});
+        }
+      }
+      prev = px;
+    }
+  }
+
+  /// Decode `n` pixels from `data[begin, end)`, starting from the initial coder state
+  static bool decode_strip(const uint8_t *data, size_t begin, size_t end, size_t n, int channels,
+                           uint8_t *pixels) {
+    // The index starts out as transparent black, unlike the previous pixel which is opaque
+    QoiPixel index[64], px;
+    std::fill(std::begin(index), std::end(index), QoiPixel{0, 0, 0, 0});
+    int run = 0;
+    size_t p = begin;
+
+    for (size_t i = 0; i < n; ++i, pixels += channels) {
+      if (run > 0) {
+        --run;
+      } else {
+        if (p >= end) {
+          return false;
+        }
+        uint8_t b1 = data[p++];
+        if (b1 == QOI_OP_RGB) {
+          if (p + 3 > end) {
+            return false;
+          }
+          px.r = data[p];
+          px.g = data[p + 1];
+          px.b = data[p + 2];
+          p += 3;
+        } else if (b1 == QOI_OP_RGBA) {
+          if (p + 4 > end) {
+            return false;
+          }
+          px.r = data[p];
+          px.g = data[p + 1];
+          px.b = data[p + 2];
+          px.a = data[p + 3];
+          p += 4;
+        } else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
+          px = index[b1];
+        } else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
+          px.r += ((b1 >> 4) & 0x03) - 2;
+          px.g += ((b1 >> 2) & 0x03) - 2;
+          px.b += (b1 & 0x03) - 2;
+        } else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
+          if (p >= end) {
+            return false;
+          }
+          uint8_t b2 = data[p++];
+          int vg = (b1 & 0x3f) - 32;
+          px.r += vg - 8 + ((b2 >> 4) & 0x0f);
+          px.g += vg;
+          px.b += vg - 8 + (b2 & 0x0f);
+        } else {
+          run = b1 & 0x3f;
+        }
+        index[px.hash()] = px;
+      }
+
+      pixels[0] = px.r;
+      pixels[1] = px.g;
+      pixels[2] = px.b;
+      if (channels == 4) {
+        pixels[3] = px.a;
+      }
+    }
+    return true;
+  }
+} // namespace specula
+
+std::vector<uint8_t> specula::qoi_encode(pstd::span<const uint8_t> pixels, const QoiDesc &desc,
+                                         bool strips) {
+  size_t n_pixels = size_t(desc.width) * desc.height;
+  ASSERT_GE(pixels.size(), n_pixels * desc.channels);
+
+  int rows_per_strip = strips ? std::max(1, QOI_STRIP_PIXELS / desc.width) : desc.height;
+  int n_strips = (desc.height + rows_per_strip - 1) / rows_per_strip;
+  std::vector<std::vector<uint8_t>> coded(n_strips);
+  parallel_for(0, n_strips, [&](int64_t strip) {
+    int y0 = strip * rows_per_strip, y1 = std::min(desc.height, y0 + rows_per_strip);
+    size_t offset = size_t(y0) * desc.width * desc.channels;
+    encode_strip(pixels.data() + offset, size_t(y1 - y0) * desc.width, desc.channels, strip == 0,
+                 coded[strip]);
+  });
+
+  size_t size = QOI_HEADER_SIZE + sizeof(QOI_END_MARKER);
+  for (const std::vector<uint8_t> &strip : coded) {
+    size += strip.size();
+  }
+  if (n_strips > 1) {
+    size += n_strips * sizeof(uint64_t) + QOI_STRIP_FOOTER_SIZE;
+  }
+
+  std::vector<uint8_t> out;
+  out.reserve(size);
+  out.insert(out.end(), {'q', 'o', 'i', 'f'});
+  write_u32(out, desc.width);
+  write_u32(out, desc.height);
+  out.push_back(desc.channels);
+  out.push_back(desc.linear ? 1 : 0);
+
+  std::vector<uint64_t> offsets;
+  for (const std::vector<uint8_t> &strip : coded) {
+    offsets.push_back(out.size());
+    out.insert(out.end(), strip.begin(), strip.end());
+  }
+  out.insert(out.end(), std::begin(QOI_END_MARKER), std::end(QOI_END_MARKER));
+
+  if (n_strips > 1) {
+    for (uint64_t offset : offsets) {
+      write_u32(out, offset >> 32);
+      write_u32(out, offset & 0xffffffff);
+    }
+    write_u32(out, rows_per_strip);
+    write_u32(out, n_strips);
+    out.insert(out.end(), std::begin(QOI_STRIP_MAGIC), std::end(QOI_STRIP_MAGIC));
+  }
+  return out;
+}
+
+bool specula::qoi_read_header(pstd::span<const std::byte> data, QoiDesc *desc) {
+  const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data.data());
+  if (data.size() < QOI_HEADER_SIZE + sizeof(QOI_END_MARKER) ||
+      std::memcmp(bytes, "qoif", 4) != 0) {
+    return false;
+  }
+
+  uint32_t width = read_u32(bytes + 4), height = read_u32(bytes + 8);
+  desc->channels = bytes[12];
+  desc->linear = bytes[13] == 1;
+  if (width == 0 || height == 0 || width > (1u << 30) / height ||
+      (desc->channels != 3 && desc->channels != 4) || bytes[13] > 1) {
+    return false;
+  }
+  desc->width = width;
+  desc->height = height;
+  return true;
+}
+
+bool specula::qoi_decode(pstd::span<const std::byte> data, const QoiDesc &desc,
+                         pstd::span<uint8_t> pixels) {
+  const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data.data());
+  size_t size = data.size();
+  size_t n_pixels = size_t(desc.width) * desc.height;
+  ASSERT_GE(pixels.size(), n_pixels * desc.channels);
+
+  // Look for a strip table after the end marker, and check that it is consistent before trusting
+  // any of the offsets in it
+  std::vector<size_t> offsets;
+  int rows_per_strip = desc.height;
+  if (size >= QOI_HEADER_SIZE + sizeof(QOI_END_MARKER) + QOI_STRIP_FOOTER_SIZE &&
+      std::memcmp(bytes + size - 4, QOI_STRIP_MAGIC, 4) == 0) {
+    uint32_t rows = read_u32(bytes + size - 12), n_strips = read_u32(bytes + size - 8);
+    size_t table_size = size_t(n_strips) * sizeof(uint64_t) + QOI_STRIP_FOOTER_SIZE;
+    bool valid = rows > 0 && n_strips > 1 && n_strips == (desc.height + rows - 1) / rows &&
+                 table_size + QOI_HEADER_SIZE + sizeof(QOI_END_MARKER) <= size;
+    const uint8_t *table = bytes + size - table_size;
+    size_t data_end = size - table_size - sizeof(QOI_END_MARKER);
+    for (uint32_t i = 0; valid && i < n_strips; ++i) {
+      uint64_t offset = (uint64_t(read_u32(table + 8 * i)) << 32) | read_u32(table + 8 * i + 4);
+      valid = offset >= (offsets.empty() ? QOI_HEADER_SIZE : offsets.back()) && offset <= data_end;
+      offsets.push_back(offset);
+    }
+    if (valid) {
+      rows_per_strip = rows;
+      offsets.push_back(data_end);
+      size = data_end;
+    } else {
+      offsets.clear();
+    }
+  }
+  if (offsets.empty()) {
+    offsets = {QOI_HEADER_SIZE, size};
+  }
+
+  int n_strips = offsets.size() - 1;
+  std::atomic<bool> success = true;
+  parallel_for(0, n_strips, [&](int64_t strip) {
+    int y0 = strip * rows_per_strip, y1 = std::min(desc.height, y0 + rows_per_strip);
+    size_t offset = size_t(y0) * desc.width * desc.channels;
+    if (!decode_strip(bytes, offsets[strip], offsets[strip + 1], size_t(y1 - y0) * desc.width,
+                      desc.channels, pixels.data() + offset)) {
+      success = false;
+    }
+  });
+  return success;
+}
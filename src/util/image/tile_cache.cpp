@@ -0,0 +1,480 @@
+#include "util/image/tile_cache.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <thread>
+
+#if defined(SPECULA_HAVE_MMAP)
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+#include "util/check.hpp"
+#include "util/hash.hpp"
+#include "util/image/image.hpp"
+#include "util/log.hpp"
+#include "util/stats.hpp"
+
+namespace specula {
+  STAT_PERCENT("Texture/Tile cache hits", tile_cache_hits, tile_cache_lookups);
+  STAT_MEMORY_COUNTER("Memory/Texture tile cache", tile_cache_bytes);
+
+  static constexpr uint64_t EMPTY_KEY = ~uint64_t(0);
+  static constexpr uint32_t EMPTY_ENTRY = 0;
+  /// Number of bits of a key used for the index of the tile, the rest identify the image
+  static constexpr int TILE_KEY_BITS = 40;
+
+  static constexpr char TILED_IMAGE_MAGIC[8] = {'S', 'P', 'T', 'I', 'L', 'E', 'D', '1'};
+
+  struct TiledImageHeader {
+    char magic[8];
+    uint32_t format;
+    uint32_t n_channels;
+    uint32_t tile_log2;
+    uint32_t n_levels;
+  };
+
+  /// Per-thread cache of the most recently used tiles, checked before the shared table
+  struct FrontCache {
+    struct Entry {
+      uint64_t key = EMPTY_KEY;
+      TileCacheSlot *slot = nullptr;
+    };
+
+    uint32_t cache_id = 0;
+    Entry entries[TileCache::FRONT_CACHE_SIZE];
+  };
+
+  static thread_local FrontCache front_cache;
+  static std::atomic<uint32_t> next_cache_id = 1;
+
+  /// Pin `slot` if it currently holds the tile with `key`
+  static bool try_pin(TileCacheSlot &slot, uint64_t key) {
+    int32_t pins = slot.pins.load(std::memory_order_acquire);
+    do {
+      if (pins < 0) {
+        return false;
+      }
+    } while (!slot.pins.compare_exchange_weak(pins, pins + 1, std::memory_order_acquire));
+
+    if (slot.key.load(std::memory_order_acquire) != key) {
+      slot.pins.fetch_sub(1, std::memory_order_release);
+      return false;
+    }
+    if (!slot.referenced.load(std::memory_order_relaxed)) {
+      slot.referenced.store(true, std::memory_order_relaxed);
+    }
+    return true;
+  }
+} // namespace specula
+
+specula::TileCache::TileCache(size_t max_bytes, size_t tile_bytes, Allocator alloc)
+    : alloc(alloc), slot_bytes(tile_bytes), slot_count(max_bytes / tile_bytes),
+      id(next_cache_id.fetch_add(1, std::memory_order_relaxed)) {
+  ASSERT_GT(slot_count, 0);
+  ASSERT_LT(slot_count, size_t(1) << 30);
+
+  storage = static_cast<std::byte *>(alloc.allocate_bytes(slot_count * slot_bytes, 64));
+  slots = std::make_unique<TileCacheSlot[]>(slot_count);
+  for (size_t i = 0; i < slot_count; ++i) {
+    slots[i].key.store(EMPTY_KEY, std::memory_order_relaxed);
+    slots[i].data = storage + i * slot_bytes;
+  }
+
+  // Keeping the table at most half full keeps the probe sequences short
+  size_t table_size = std::bit_ceil(2 * slot_count);
+  table = std::make_unique<std::atomic<uint32_t>[]>(table_size);
+  for (size_t i = 0; i < table_size; ++i) {
+    table[i].store(EMPTY_ENTRY, std::memory_order_relaxed);
+  }
+  table_mask = table_size - 1;
+}
+
+specula::TileCache::~TileCache() {
+  for (size_t i = 0; i < slot_count; ++i) {
+    DASSERT_EQ(slots[i].pins.load(), 0);
+    tile_cache_bytes -= slots[i].bytes;
+  }
+  alloc.deallocate_bytes(storage, slot_count * slot_bytes, 64);
+}
+
+void specula::TileCache::Tile::release() {
+  if (slot) {
+    slot->pins.fetch_sub(1, std::memory_order_release);
+    slot = nullptr;
+  }
+}
+
+specula::TileCache::Tile specula::TileCache::lookup(const TiledImagePyramid &image,
+                                                    uint64_t tile) const {
+  DASSERT_EQ(image.cache, this);
+  DASSERT_LT(tile, uint64_t(1) << TILE_KEY_BITS);
+  uint64_t key = (uint64_t(image.id) << TILE_KEY_BITS) | tile;
+  ++tile_cache_lookups;
+
+  if (front_cache.cache_id != id) {
+    front_cache = FrontCache();
+    front_cache.cache_id = id;
+  }
+  FrontCache::Entry &entry = front_cache.entries[mix_bits(key) % FRONT_CACHE_SIZE];
+  if (entry.key == key && try_pin(*entry.slot, key)) {
+    ++tile_cache_hits;
+    return Tile(entry.slot);
+  }
+
+  int slot = find(key);
+  if (slot >= 0 && try_pin(slots[slot], key)) {
+    ++tile_cache_hits;
+    entry = {key, &slots[slot]};
+    return Tile(&slots[slot]);
+  }
+
+  Tile result = load(image, tile, key);
+  entry = {key, result.slot};
+  return result;
+}
+
+int specula::TileCache::find(uint64_t key) const {
+  size_t index = mix_bits(key) & table_mask;
+  for (size_t n = 0; n <= table_mask; ++n, index = (index + 1) & table_mask) {
+    uint32_t e = table[index].load(std::memory_order_acquire);
+    if (e == EMPTY_ENTRY) {
+      return -1;
+    } else if (slots[e - 1].key.load(std::memory_order_acquire) == key) {
+      return e - 1;
+    }
+  }
+  return -1;
+}
+
+void specula::TileCache::insert(uint64_t key, int slot) const {
+  size_t index = mix_bits(key) & table_mask;
+  while (table[index].load(std::memory_order_relaxed) != EMPTY_ENTRY) {
+    index = (index + 1) & table_mask;
+  }
+  table[index].store(slot + 1, std::memory_order_release);
+}
+
+void specula::TileCache::remove(uint64_t key, int slot) const {
+  size_t hole = mix_bits(key) & table_mask;
+  for (size_t n = 0;; ++n, hole = (hole + 1) & table_mask) {
+    uint32_t e = table[hole].load(std::memory_order_relaxed);
+    if (e == EMPTY_ENTRY || n > table_mask) {
+      return;
+    } else if (e == uint32_t(slot + 1)) {
+      break;
+    }
+  }
+
+  // Shift back the following entries of the cluster that may fill the hole without moving before
+  // their home index, so that the table never fills up with deleted entries. A lock free `find`
+  // racing with the shift may miss a moved tile, in which case `load` finds it under the lock.
+  for (size_t index = (hole + 1) & table_mask;; index = (index + 1) & table_mask) {
+    uint32_t e = table[index].load(std::memory_order_relaxed);
+    if (e == EMPTY_ENTRY) {
+      break;
+    }
+    size_t home = mix_bits(slots[e - 1].key.load(std::memory_order_relaxed)) & table_mask;
+    if (((index - home) & table_mask) >= ((index - hole) & table_mask)) {
+      table[hole].store(e, std::memory_order_release);
+      hole = index;
+    }
+  }
+  table[hole].store(EMPTY_ENTRY, std::memory_order_release);
+}
+
+size_t specula::TileCache::longest_cluster() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  size_t longest = 0, length = 0;
+  // Two passes over the table, so that a cluster wrapping around its end is measured whole
+  for (size_t i = 0; i < 2 * (table_mask + 1); ++i) {
+    if (table[i & table_mask].load(std::memory_order_relaxed) == EMPTY_ENTRY) {
+      length = 0;
+    } else {
+      longest = std::max(longest, ++length);
+    }
+  }
+  return std::min(longest, table_mask + 1);
+}
+
+int specula::TileCache::evict() const {
+  // Two full sweeps clear every reference bit, so anything still not evictable is pinned
+  for (size_t n = 0; n < 2 * slot_count; ++n) {
+    TileCacheSlot &slot = slots[hand];
+    int index = hand;
+    hand = (hand + 1) % slot_count;
+
+    if (slot.referenced.load(std::memory_order_relaxed)) {
+      slot.referenced.store(false, std::memory_order_relaxed);
+      continue;
+    }
+    int32_t pins = 0;
+    if (slot.pins.compare_exchange_strong(pins, -1, std::memory_order_acquire)) {
+      return index;
+    }
+  }
+  return -1;
+}
+
+specula::TileCache::Tile specula::TileCache::load(const TiledImagePyramid &image, uint64_t tile,
+                                                  uint64_t key) const {
+  bool warned = false;
+  for (;;) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    // Another thread may have loaded (or be loading) the tile since the lock free lookup
+    if (int index = find(key); index >= 0) {
+      lock.unlock();
+      if (try_pin(slots[index], key)) {
+        ++tile_cache_hits;
+        return Tile(&slots[index]);
+      }
+      std::this_thread::yield();
+      continue;
+    }
+
+    int index = evict();
+    if (index < 0) {
+      lock.unlock();
+      if (!warned) {
+        LOG_WARN("All {} tile cache slots are pinned, waiting for one to be released", slot_count);
+        warned = true;
+      }
+      std::this_thread::yield();
+      continue;
+    }
+
+    // The slot is locked by `evict`, so it can be repurposed before the tile has been read
+    TileCacheSlot &slot = slots[index];
+    uint64_t old_key = slot.key.load(std::memory_order_relaxed);
+    if (old_key != EMPTY_KEY) {
+      remove(old_key, index);
+    }
+    slot.key.store(key, std::memory_order_release);
+    insert(key, index);
+    lock.unlock();
+
+    image.read_tile(tile, slot.data);
+    tile_cache_bytes += int64_t(image.tile_bytes) - int64_t(slot.bytes);
+    slot.bytes = image.tile_bytes;
+    slot.referenced.store(true, std::memory_order_relaxed);
+    slot.pins.store(1, std::memory_order_release);
+    return Tile(&slot);
+  }
+}
+
+bool specula::TiledImagePyramid::write(const std::string &filename,
+                                       pstd::span<const Image> levels, ImageLayout layout) {
+  ASSERT(!levels.empty());
+  ASSERT(layout != ImageLayout::Scanline);
+
+  FILE *f = fopen(filename.c_str(), "wb");
+  if (f == nullptr) {
+    LOG_ERROR("Unable to open output file {}", filename);
+    return false;
+  }
+
+  TiledImageHeader header;
+  std::memcpy(header.magic, TILED_IMAGE_MAGIC, sizeof(header.magic));
+  header.format = uint32_t(levels[0].format());
+  header.n_channels = levels[0].n_channels();
+  header.tile_log2 = tile_size_log2(layout);
+  header.n_levels = levels.size();
+
+  bool success = fwrite(&header, sizeof(header), 1, f) == 1;
+  for (const Image &level : levels) {
+    int32_t resolution[2] = {level.resolution().x, level.resolution().y};
+    success = success && fwrite(resolution, sizeof(resolution), 1, f) == 1;
+  }
+
+  // The storage of an image with a tiled layout is the sequence of its tiles
+  for (const Image &level : levels) {
+    ASSERT(level.format() == levels[0].format());
+    ASSERT_EQ(level.n_channels(), levels[0].n_channels());
+    // Only levels with another layout are converted, the others are written in place
+    Image converted;
+    if (level.layout() != layout) {
+      converted = level.convert_to_layout(layout);
+    }
+    const Image &tiled = level.layout() == layout ? level : converted;
+    size_t bytes = layout_pixel_count(layout, tiled.resolution()) * tiled.n_channels() *
+                   texel_bytes(tiled.format());
+    success = success && fwrite(tiled.raw_pointer({0, 0}), 1, bytes, f) == bytes;
+  }
+
+  if (fclose(f) != 0 || !success) {
+    LOG_ERROR("Error writing tiled image file {}", filename);
+    return false;
+  }
+  return true;
+}
+
+std::unique_ptr<specula::TiledImagePyramid>
+specula::TiledImagePyramid::open(const std::string &filename, TileCache *cache,
+                                 ColorEncoding encoding) {
+  std::unique_ptr<TiledImagePyramid> image(new TiledImagePyramid);
+  image->filename = filename;
+  image->file = fopen(filename.c_str(), "rb");
+  if (image->file == nullptr) {
+    LOG_ERROR("Unable to open tiled image file {}", filename);
+    return nullptr;
+  }
+
+  TiledImageHeader header;
+  if (fread(&header, sizeof(header), 1, image->file) != 1 ||
+      std::memcmp(header.magic, TILED_IMAGE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.format > uint32_t(PixelFormat::Float) || header.n_channels == 0 ||
+      (header.tile_log2 != 5 && header.tile_log2 != 6) || header.n_levels == 0) {
+    LOG_ERROR("{}: not a valid tiled image file", filename);
+    return nullptr;
+  }
+
+  image->cache = cache;
+  image->id = cache->register_image();
+  image->format_ = PixelFormat(header.format);
+  image->n_channels_ = header.n_channels;
+  image->encoding = encoding;
+  image->tile_log2 = header.tile_log2;
+  image->tile_bytes =
+      (size_t(1) << (2 * image->tile_log2)) * image->n_channels_ * texel_bytes(image->format_);
+  image->data_offset = sizeof(header) + header.n_levels * 2 * sizeof(int32_t);
+
+  if (image->format_ == PixelFormat::U256 && !encoding) {
+    LOG_ERROR("{}: a color encoding is required for 8-bit images", filename);
+    return nullptr;
+  }
+  if (image->tile_bytes > cache->tile_bytes()) {
+    LOG_ERROR("{}: tiles of {} bytes do not fit in the {} byte tile cache slots", filename,
+              image->tile_bytes, cache->tile_bytes());
+    return nullptr;
+  }
+
+  uint64_t n_tiles = 0;
+  for (uint32_t i = 0; i < header.n_levels; ++i) {
+    int32_t resolution[2];
+    if (fread(resolution, sizeof(resolution), 1, image->file) != 1) {
+      LOG_ERROR("{}: premature end of file", filename);
+      return nullptr;
+    }
+    Point2i res(resolution[0], resolution[1]);
+    image->level_resolution_.push_back(res);
+    image->level_first_tile.push_back(n_tiles);
+    n_tiles += layout_pixel_count(ImageLayout::Scanline,
+                                  {(res.x + (1 << image->tile_log2) - 1) >> image->tile_log2,
+                                   (res.y + (1 << image->tile_log2) - 1) >> image->tile_log2});
+  }
+
+#if defined(SPECULA_HAVE_MMAP)
+  // Tiles are read with `pread`, which does not share a file position between threads
+  fclose(image->file);
+  image->file = nullptr;
+  image->fd = ::open(filename.c_str(), O_RDONLY);
+  if (image->fd < 0) {
+    LOG_ERROR("Unable to open tiled image file {}", filename);
+    return nullptr;
+  }
+#endif
+  return image;
+}
+
+specula::TiledImagePyramid::~TiledImagePyramid() {
+#if defined(SPECULA_HAVE_MMAP)
+  if (fd >= 0) {
+    close(fd);
+  }
+#endif
+  if (file != nullptr) {
+    fclose(file);
+  }
+}
+
+void specula::TiledImagePyramid::read_tile(uint64_t tile, std::byte *dst) const {
+  size_t offset = data_offset + tile * tile_bytes;
+  bool success;
+#if defined(SPECULA_HAVE_MMAP)
+  size_t read = 0;
+  while (read < tile_bytes) {
+    ssize_t n = pread(fd, dst + read, tile_bytes - read, offset + read);
+    if (n <= 0) {
+      break;
+    }
+    read += n;
+  }
+  success = read == tile_bytes;
+#else
+  {
+    std::lock_guard<std::mutex> lock(file_mutex);
+    success = fseek(file, long(offset), SEEK_SET) == 0 &&
+              fread(dst, 1, tile_bytes, file) == tile_bytes;
+  }
+#endif
+  if (!success) {
+    LOG_ERROR("{}: unable to read tile {}", filename, tile);
+    std::memset(dst, 0, tile_bytes);
+  }
+}
+
+specula::Float specula::TiledImagePyramid::texel(const std::byte *data, size_t offset) const {
+  switch (format_) {
+  case PixelFormat::U256: {
+    Float r;
+    encoding.to_linear({reinterpret_cast<const uint8_t *>(data) + offset, 1}, {&r, 1});
+    return r;
+  }
+  case PixelFormat::Half:
+    return Float(reinterpret_cast<const Half *>(data)[offset]);
+  case PixelFormat::Float:
+    return reinterpret_cast<const float *>(data)[offset];
+  default:
+    LOG_CRITICAL("Unhandled PixelFormat: {}", format_);
+    return 0;
+  }
+}
+
+specula::Float specula::TiledImagePyramid::get_channel(int level, Point2i p, int c,
+                                                       WrapMode2D wrap_mode) const {
+  Point2i resolution = level_resolution_[level];
+  if (!remap_pixel_coords(&p, resolution, wrap_mode)) {
+    return 0;
+  }
+  int mask = (1 << tile_log2) - 1;
+  int tiles_x = (resolution.x + mask) >> tile_log2;
+  uint64_t tile =
+      level_first_tile[level] + uint64_t(p.y >> tile_log2) * tiles_x + (p.x >> tile_log2);
+  TileCache::Tile t = cache->lookup(*this, tile);
+  return texel(t.data(), n_channels_ * encode_morton2(p.x & mask, p.y & mask) + c);
+}
+
+specula::Float specula::TiledImagePyramid::bilerp_channel(int level, Point2f p, int c,
+                                                          WrapMode2D wrap_mode) const {
+  Point2i resolution = level_resolution_[level];
+  Float x = p[0] * resolution.x - 0.5f, y = p[1] * resolution.y - 0.5f;
+  int xi = pstd::floor(x), yi = pstd::floor(y);
+  Float dx = x - xi, dy = y - yi;
+  const Float weight[4] = {(1 - dx) * (1 - dy), dx * (1 - dy), (1 - dx) * dy, dx * dy};
+  const Point2i corners[4] = {{xi, yi}, {xi + 1, yi}, {xi, yi + 1}, {xi + 1, yi + 1}};
+
+  // Most lookups fall within a single tile, so the pinned tile is reused between the corners
+  int mask = (1 << tile_log2) - 1;
+  int tiles_x = (resolution.x + mask) >> tile_log2;
+  TileCache::Tile t;
+  uint64_t pinned_tile = ~uint64_t(0);
+  Float v[4];
+  for (int i = 0; i < 4; ++i) {
+    Point2i pi = corners[i];
+    if (!remap_pixel_coords(&pi, resolution, wrap_mode)) {
+      v[i] = 0;
+      continue;
+    }
+    uint64_t tile =
+        level_first_tile[level] + uint64_t(pi.y >> tile_log2) * tiles_x + (pi.x >> tile_log2);
+    if (tile != pinned_tile) {
+      t.release();
+      t = cache->lookup(*this, tile);
+      pinned_tile = tile;
+    }
+    v[i] = texel(t.data(), n_channels_ * encode_morton2(pi.x & mask, pi.y & mask) + c);
+  }
+  return weight[0] * v[0] + weight[1] * v[1] + weight[2] * v[2] + weight[3] * v[3];
+}
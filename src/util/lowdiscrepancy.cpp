@@ -0,0 +1,247 @@
+#include "util/lowdiscrepancy.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <vector>
+
+#include "util/log.hpp"
+#include "util/parallel.hpp"
+
+int specula::DigitPermutation::digit_count(int base) {
+  // Digits stop contributing once their weight no longer changes a value just below one
+  Float inv_base = Float(1) / Float(base), inv_base_m = 1;
+  int n_digits = 0;
+  while (1 - (base - 1) * inv_base_m < 1) {
+    ++n_digits;
+    inv_base_m *= inv_base;
+  }
+  return n_digits;
+}
+
+void specula::DigitPermutation::fill(int base, uint32_t seed, pstd::span<uint16_t> permutations) {
+  ASSERT_LT(base, 65536);
+  int n_digits = digit_count(base);
+  DASSERT_EQ(permutations.size(), size_t(n_digits) * base);
+  for (int digit_index = 0; digit_index < n_digits; ++digit_index) {
+    uint64_t digit_seed = mix_bits(hash(base, digit_index, seed));
+    for (int digit_value = 0; digit_value < base; ++digit_value) {
+      permutations[digit_index * base + digit_value] =
+          permutation_element(digit_value, base, digit_seed);
+    }
+  }
+}
+
+specula::DigitPermutations::DigitPermutations(int n_bases, uint32_t seed, Allocator alloc)
+    : offsets(n_bases + 1, alloc), table(alloc) {
+  ASSERT(n_bases > 0 && size_t(n_bases) <= PRIME_TABLE_SIZE);
+  offsets[0] = 0;
+  for (int i = 0; i < n_bases; ++i) {
+    offsets[i + 1] = offsets[i] + size_t(DigitPermutation::digit_count(PRIMES[i])) * PRIMES[i];
+  }
+
+  table = pstd::vector<uint16_t>(offsets[n_bases], alloc);
+  parallel_for(0, n_bases, [&](int64_t b0, int64_t b1) {
+    for (int64_t i = b0; i < b1; ++i) {
+      DigitPermutation::fill(PRIMES[i], seed,
+                             {table.data() + offsets[i], offsets[i + 1] - offsets[i]});
+    }
+  });
+}
+
+namespace specula {
+  /// Whether the polynomial over GF(2) with the bits of `p` as coefficients is primitive
+  static bool is_primitive_polynomial(uint32_t p) {
+    int degree = std::bit_width(p) - 1;
+    uint64_t order = (uint64_t(1) << degree) - 1;
+    // Multiplication modulo p of polynomials of lower degree
+    auto multiply = [&](uint32_t a, uint32_t b) {
+      uint32_t result = 0;
+      for (; b != 0; b >>= 1) {
+        if (b & 1) {
+          result ^= a;
+        }
+        a <<= 1;
+        if (a >> degree) {
+          a ^= p;
+        }
+      }
+      return result;
+    };
+    auto power_of_x = [&](uint64_t e) {
+      uint32_t result = 1, base = degree == 1 ? (2 ^ p) : 2;
+      for (; e != 0; e >>= 1) {
+        if (e & 1) {
+          result = multiply(result, base);
+        }
+        base = multiply(base, base);
+      }
+      return result;
+    };
+
+    // x generates the multiplicative group iff its order is exactly 2^degree - 1
+    if ((p & 1) == 0 || power_of_x(order) != 1) {
+      return false;
+    }
+    uint64_t n = order;
+    for (uint64_t q = 2; q * q <= n; ++q) {
+      if (n % q == 0) {
+        if (power_of_x(order / q) == 1) {
+          return false;
+        }
+        while (n % q == 0) {
+          n /= q;
+        }
+      }
+    }
+    return n == 1 || n == order || power_of_x(order / n) != 1;
+  }
+
+  static std::vector<uint32_t> compute_sobol_matrices() {
+    std::vector<uint32_t> matrices(size_t(N_SOBOL_DIMENSIONS) * SOBOL_MATRIX_SIZE);
+    // Direction numbers are computed with SOBOL_MATRIX_SIZE fraction bits, of which the most
+    // significant 32 are kept, so that indices with more than 32 bits still give distinct points
+    std::vector<uint64_t> m(SOBOL_MATRIX_SIZE + 1);
+    auto store = [&](int dimension) {
+      for (int k = 1; k <= SOBOL_MATRIX_SIZE; ++k) {
+        matrices[size_t(dimension) * SOBOL_MATRIX_SIZE + k - 1] =
+            uint32_t((m[k] << (SOBOL_MATRIX_SIZE - k)) >> (SOBOL_MATRIX_SIZE - 32));
+      }
+    };
+
+    std::fill(m.begin(), m.end(), 1);
+    store(0);
+
+    uint32_t p = 2;
+    for (int dimension = 1; dimension < N_SOBOL_DIMENSIONS; ++dimension) {
+      do {
+        ++p;
+      } while (!is_primitive_polynomial(p));
+      int degree = std::bit_width(p) - 1;
+
+      // Any odd initial direction numbers below 2^k give a valid Sobol sequence
+      for (int k = 1; k <= degree && k <= SOBOL_MATRIX_SIZE; ++k) {
+        m[k] = (mix_bits(hash(dimension, k)) & ((uint64_t(1) << k) - 1)) | 1;
+      }
+      for (int k = degree + 1; k <= SOBOL_MATRIX_SIZE; ++k) {
+        uint64_t value = m[k - degree] ^ (m[k - degree] << degree);
+        for (int j = 1; j < degree; ++j) {
+          if ((p >> (degree - j)) & 1) {
+            value ^= m[k - j] << j;
+          }
+        }
+        m[k] = value;
+      }
+      store(dimension);
+    }
+    return matrices;
+  }
+} // namespace specula
+
+const uint32_t *specula::sobol_matrices_32() {
+  static const std::vector<uint32_t> matrices = compute_sobol_matrices();
+  return matrices.data();
+}
+
+namespace specula {
+  /// Bumped whenever the way the points are generated changes
+  static constexpr char PMJ02_TABLE_MAGIC[8] = {'S', 'P', 'P', 'M', 'J', '0', '2', '1'};
+
+  /// Header of a PMJ02 table file, followed by the coordinates of the points of each set
+  struct PMJ02TableHeader {
+    char magic[8];
+    uint32_t n_sets;
+    uint32_t n_samples;
+  };
+} // namespace specula
+
+specula::PMJ02Table specula::PMJ02Table::generate(int n_sets, int n_samples, uint32_t seed,
+                                                  Allocator alloc) {
+  ASSERT_GT(n_sets, 0);
+  ASSERT(n_samples > 0 && std::has_single_bit(uint32_t(n_samples)));
+  PMJ02Table table(alloc);
+  table.n_sets_ = n_sets;
+  table.n_samples_ = n_samples;
+  table.storage = pstd::vector<uint32_t>(2 * size_t(n_sets) * n_samples, alloc);
+
+  uint32_t *points = table.storage.data();
+  parallel_for(0, n_sets, [&](int64_t s0, int64_t s1) {
+    for (int64_t set = s0; set < s1; ++set) {
+      OwenScrambler scramble_x(mix_bits(hash(set, seed, 0))),
+          scramble_y(mix_bits(hash(set, seed, 1)));
+      uint32_t *p = points + 2 * size_t(set) * n_samples;
+      for (int i = 0; i < n_samples; ++i) {
+        p[2 * i] = scramble_x(sobol_bits(i, 0));
+        p[2 * i + 1] = scramble_y(sobol_bits(i, 1));
+      }
+    }
+  });
+  return table;
+}
+
+specula::PMJ02Table specula::PMJ02Table::open(const std::string &filename) {
+  std::error_code error;
+  if (!std::filesystem::exists(filename, error)) {
+    LOG_WARN("PMJ02 table {} does not exist", filename);
+    return {};
+  }
+  std::shared_ptr<MappedFile> file = MappedFile::open(filename);
+  if (!file) {
+    return {};
+  }
+
+  PMJ02TableHeader header;
+  if (file->size() < sizeof(header)) {
+    LOG_WARN("Invalid PMJ02 table {}", filename);
+    return {};
+  }
+  std::memcpy(&header, file->data(), sizeof(header));
+  size_t bytes = 2 * sizeof(uint32_t) * size_t(header.n_sets) * header.n_samples;
+  if (std::memcmp(header.magic, PMJ02_TABLE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.n_sets == 0 || header.n_samples == 0 || header.n_sets > (1u << 20) ||
+      header.n_samples > (1u << 24) || bytes != file->size() - sizeof(header)) {
+    LOG_WARN("Invalid PMJ02 table {}", filename);
+    return {};
+  }
+
+  PMJ02Table table;
+  table.n_sets_ = header.n_sets;
+  table.n_samples_ = header.n_samples;
+  table.mapped_points = reinterpret_cast<const uint32_t *>(file->data() + sizeof(header));
+  table.file = std::move(file);
+  return table;
+}
+
+bool specula::PMJ02Table::write(const std::string &filename) const {
+  PMJ02TableHeader header;
+  std::memcpy(header.magic, PMJ02_TABLE_MAGIC, sizeof(header.magic));
+  header.n_sets = n_sets_;
+  header.n_samples = n_samples_;
+
+  // Written under a unique name and then renamed, so that a table is never mapped while it is
+  // only partially written
+  std::string temp_filename = fmt::format("{}.{:08x}.tmp", filename, std::random_device()());
+  FILE *f = fopen(temp_filename.c_str(), "wb");
+  if (f == nullptr) {
+    LOG_WARN("Unable to open {} for writing", temp_filename);
+    return false;
+  }
+  size_t n = 2 * size_t(n_sets_) * n_samples_;
+  bool success = fwrite(&header, sizeof(header), 1, f) == 1 &&
+                 fwrite(points(), sizeof(uint32_t), n, f) == n;
+  success &= fclose(f) == 0;
+
+  std::error_code error;
+  if (success) {
+    std::filesystem::rename(temp_filename, filename, error);
+    success = !error;
+  }
+  if (!success) {
+    LOG_WARN("Unable to write PMJ02 table {}", filename);
+    std::filesystem::remove(temp_filename, error);
+  }
+  return success;
+}
@@ -0,0 +1,181 @@
+#include "util/parallel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "util/check.hpp"
+
+namespace specula {
+  /// A single parallel loop, whose chunks are claimed by incrementing `next`
+  struct ParallelJob {
+    bool has_work() const { return next.load(std::memory_order_relaxed) < end; }
+
+    void run_chunks() {
+      int64_t begin;
+      while ((begin = next.fetch_add(chunk_size, std::memory_order_relaxed)) < end) {
+        func(begin, std::min(begin + chunk_size, end));
+      }
+    }
+
+    const std::function<void(int64_t, int64_t)> &func;
+    int64_t end, chunk_size;
+    std::atomic<int64_t> next;
+    /// Number of worker threads currently running chunks of the job, guarded by the pool mutex
+    int active_workers = 0;
+  };
+
+  /// Set on the worker threads, and on any thread while it is running a parallel loop
+  static thread_local bool in_parallel_loop = false;
+
+  class ThreadPool {
+  public:
+    explicit ThreadPool(int n_threads) {
+      for (int i = 0; i < n_threads - 1; ++i) {
+        threads.emplace_back(&ThreadPool::worker, this);
+      }
+    }
+
+    ~ThreadPool() {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        shutdown = true;
+      }
+      work_condition.notify_all();
+      for (std::thread &thread : threads) {
+        thread.join();
+      }
+    }
+
+    int size() const { return threads.size() + 1; }
+
+    void run(ParallelJob &job) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(&job);
+      }
+      work_condition.notify_all();
+
+      in_parallel_loop = true;
+      job.run_chunks();
+      in_parallel_loop = false;
+
+      // Every chunk has been claimed, but workers may still be finishing theirs
+      std::unique_lock<std::mutex> lock(mutex);
+      jobs.erase(std::find(jobs.begin(), jobs.end(), &job));
+      done_condition.wait(lock, [&]() { return job.active_workers == 0; });
+    }
+
+  private:
+    void worker() {
+      in_parallel_loop = true;
+      std::unique_lock<std::mutex> lock(mutex);
+      while (true) {
+        ParallelJob *job = nullptr;
+        work_condition.wait(lock, [&]() {
+          for (ParallelJob *j : jobs) {
+            if (j->has_work()) {
+              job = j;
+              return true;
+            }
+          }
+          return shutdown;
+        });
+        if (job == nullptr) {
+          return;
+        }
+
+        ++job->active_workers;
+        lock.unlock();
+        job->run_chunks();
+        lock.lock();
+        if (--job->active_workers == 0) {
+          done_condition.notify_all();
+        }
+      }
+    }
+
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable work_condition, done_condition;
+    std::vector<ParallelJob *> jobs;
+    bool shutdown = false;
+  };
+
+  static std::unique_ptr<ThreadPool> thread_pool;
+  static std::mutex thread_pool_mutex;
+
+  static ThreadPool *get_thread_pool() {
+    std::lock_guard<std::mutex> lock(thread_pool_mutex);
+    if (!thread_pool) {
+      thread_pool = std::make_unique<ThreadPool>(available_cores());
+    }
+    return thread_pool.get();
+  }
+} // namespace specula
+
+void specula::parallel_init(int n_threads) {
+  std::lock_guard<std::mutex> lock(thread_pool_mutex);
+  thread_pool.reset();
+  thread_pool = std::make_unique<ThreadPool>(n_threads > 0 ? n_threads : available_cores());
+}
+
+void specula::parallel_cleanup() {
+  std::lock_guard<std::mutex> lock(thread_pool_mutex);
+  thread_pool.reset();
+}
+
+int specula::available_cores() { return std::max(1u, std::thread::hardware_concurrency()); }
+
+int specula::running_threads() { return get_thread_pool()->size(); }
+
+void specula::parallel_for(int64_t start, int64_t end,
+                           std::function<void(int64_t, int64_t)> func) {
+  if (start >= end) {
+    return;
+  }
+
+  ThreadPool *pool = in_parallel_loop ? nullptr : get_thread_pool();
+  if (pool == nullptr || pool->size() == 1 || end - start == 1) {
+    func(start, end);
+    return;
+  }
+
+  // Enough chunks per thread to balance uneven work, without making them too small to amortize
+  // claiming them
+  int64_t chunk_size = std::max<int64_t>(1, (end - start) / (8 * pool->size()));
+  ParallelJob job{func, end, chunk_size, start};
+  pool->run(job);
+}
+
+void specula::parallel_for(int64_t start, int64_t end, std::function<void(int64_t)> func) {
+  parallel_for(start, end, [&func](int64_t begin, int64_t end) {
+    for (int64_t i = begin; i < end; ++i) {
+      func(i);
+    }
+  });
+}
+
+void specula::parallel_for_2d(const Bounds2i &extent, std::function<void(Bounds2i)> func) {
+  if (extent.is_empty()) {
+    return;
+  }
+
+  int tile_size = std::clamp(
+      int(std::sqrt(double(extent.area()) / (8 * running_threads()))), 1, 32);
+  int n_tiles_x = (extent.pmax.x - extent.pmin.x + tile_size - 1) / tile_size;
+  int n_tiles_y = (extent.pmax.y - extent.pmin.y + tile_size - 1) / tile_size;
+
+  parallel_for(0, int64_t(n_tiles_x) * n_tiles_y, [&](int64_t tile) {
+    Point2i pmin(extent.pmin.x + int(tile % n_tiles_x) * tile_size,
+                 extent.pmin.y + int(tile / n_tiles_x) * tile_size);
+    Point2i pmax(std::min(pmin.x + tile_size, extent.pmax.x),
+                 std::min(pmin.y + tile_size, extent.pmax.y));
+    func(Bounds2i(pmin, pmax));
+  });
+}
@@ -15,7 +15,7 @@ namespace specula::pstd::pmr {
         return malloc(size);
       if (posix_memalign(&ptr, alignment, size) != 0)
         ptr = nullptr;
-      return nullptr;
+      return ptr;
 #else
       return memalign(alignment, size);
 #endif
@@ -70,4 +70,19 @@ namespace specula::pstd::pmr {
     return ptr;
   }
 
+  void unowned_buffer_resource::do_deallocate(void *p, size_t bytes, size_t alignment) {
+    std::shared_ptr<const void> owner;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto it = buffers.find(p);
+      if (it != buffers.end()) {
+        // The owner is released outside of the lock, as that may unmap a file
+        owner = std::move(it->second);
+        buffers.erase(it);
+        return;
+      }
+    }
+    upstream->deallocate(p, bytes, alignment);
+  }
+
 } // namespace specula::pstd::pmr
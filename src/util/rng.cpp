@@ -0,0 +1,130 @@
+#include "util/rng.hpp"
+
+#include <algorithm>
+#include <type_traits>
+
+#include "util/simd.hpp"
+
+namespace specula {
+  /**
+   * Step every lane once and return the 32-bit outputs. The generic loop only exists for CPUs
+   * without AVX2, and for the values of a final partial group of eight.
+   */
+  static void next_x8(std::uint64_t *state, const std::uint64_t *inc, std::uint32_t *out) {
+    for (int l = 0; l < RngX8::WIDTH; ++l) {
+      std::uint64_t oldstate = state[l];
+      state[l] = oldstate * PCG32_MULT + inc[l];
+      std::uint32_t xorshifted = (std::uint32_t)(((oldstate >> 18u) ^ oldstate) >> 27u);
+      std::uint32_t rot = (std::uint32_t)(oldstate >> 59u);
+      out[l] = (xorshifted >> rot) | (xorshifted << ((~rot + 1u) & 31));
+    }
+  }
+
+  static float to_uniform_float(std::uint32_t v) {
+    return std::min<float>(OneMinusEpsilon, v * 0x1p-32f);
+  }
+
+#if defined(SPECULA_TARGET_AVX2)
+  /// Low 64 bits of the product of each lane of `a` and the constant `b`
+  SPECULA_TARGET_AVX2 static __m256i mullo_epi64(__m256i a, std::uint64_t b) {
+    const __m256i b_lo = _mm256_set1_epi64x(b & 0xffffffff);
+    const __m256i b_hi = _mm256_set1_epi64x(b >> 32);
+    __m256i lo = _mm256_mul_epu32(a, b_lo);
+    __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b_lo),
+                                     _mm256_mul_epu32(a, b_hi));
+    return _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+  }
+
+  /// Output of four PCG32 states, in the low 32 bits of each 64-bit lane
+  SPECULA_TARGET_AVX2 static __m256i output_x4(__m256i oldstate) {
+    __m256i xorshifted = _mm256_srli_epi64(
+        _mm256_xor_si256(_mm256_srli_epi64(oldstate, 18), oldstate), 27);
+    xorshifted = _mm256_and_si256(xorshifted, _mm256_set1_epi64x(0xffffffff));
+    __m256i rot = _mm256_srli_epi64(oldstate, 59);
+    // Shifting a 32-bit value left by 32 - rot within 64 bits leaves nothing in the low half when
+    // rot is zero, which matches the masked shift of the scalar rotation
+    __m256i left = _mm256_sub_epi64(_mm256_set1_epi64x(32), rot);
+    __m256i rotated = _mm256_or_si256(_mm256_srlv_epi64(xorshifted, rot),
+                                      _mm256_sllv_epi64(xorshifted, left));
+    return _mm256_and_si256(rotated, _mm256_set1_epi64x(0xffffffff));
+  }
+
+  /// `uint32_t` to `float` conversion with a single rounding, as AVX2 only converts signed values
+  SPECULA_TARGET_AVX2 static __m256 cvtepu32_ps(__m256i v) {
+    __m256 hi = _mm256_cvtepi32_ps(_mm256_srli_epi32(v, 16));
+    __m256 lo = _mm256_cvtepi32_ps(_mm256_and_si256(v, _mm256_set1_epi32(0xffff)));
+    return _mm256_add_ps(_mm256_mul_ps(hi, _mm256_set1_ps(65536.0f)), lo);
+  }
+
+  /**
+   * Fill `count` groups of eight values, either the 32-bit outputs themselves or the `float`
+   * values in \f$[0, 1)\f$ derived from them. The states are split into two registers of four
+   * lanes, whose outputs are packed back into lane order before being stored.
+   */
+  template <typename T>
+  SPECULA_TARGET_AVX2 static void uniform_avx2(std::uint64_t *state, const std::uint64_t *inc,
+                                               T *values, size_t count) {
+    const __m256i inc_lo = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(inc));
+    const __m256i inc_hi = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(inc + 4));
+    const __m256i even = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+    __m256i state_lo = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(state));
+    __m256i state_hi = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(state + 4));
+    for (size_t i = 0; i < count; ++i) {
+      __m128i out_lo =
+          _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(output_x4(state_lo), even));
+      __m128i out_hi =
+          _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(output_x4(state_hi), even));
+      __m256i out = _mm256_inserti128_si256(_mm256_castsi128_si256(out_lo), out_hi, 1);
+      if constexpr (std::is_same_v<T, float>) {
+        __m256 u = _mm256_min_ps(_mm256_mul_ps(cvtepu32_ps(out), _mm256_set1_ps(0x1p-32f)),
+                                 _mm256_set1_ps(OneMinusEpsilon));
+        _mm256_storeu_ps(values + 8 * i, u);
+      } else {
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(values + 8 * i), out);
+      }
+      state_lo = _mm256_add_epi64(mullo_epi64(state_lo, PCG32_MULT), inc_lo);
+      state_hi = _mm256_add_epi64(mullo_epi64(state_hi, PCG32_MULT), inc_hi);
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(state), state_lo);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(state + 4), state_hi);
+  }
+#endif
+
+  /// Fill `values` group by group, with the AVX2 kernel for the full groups when it is available
+  template <typename T, typename Kernel, typename Convert>
+  static void uniform_x8(std::uint64_t *state, const std::uint64_t *inc, pstd::span<T> values,
+                         Kernel kernel, Convert convert) {
+    size_t groups = values.size() / RngX8::WIDTH, i = 0;
+    if (kernel) {
+      kernel(state, inc, values.data(), groups);
+      i = groups * RngX8::WIDTH;
+    }
+    std::uint32_t out[RngX8::WIDTH];
+    for (; i < values.size(); i += RngX8::WIDTH) {
+      next_x8(state, inc, out);
+      for (size_t l = 0; l < RngX8::WIDTH && i + l < values.size(); ++l) {
+        values[i + l] = convert(out[l]);
+      }
+    }
+  }
+} // namespace specula
+
+template <> void specula::RngX8::uniform<std::uint32_t>(pstd::span<std::uint32_t> values) {
+  void (*kernel)(std::uint64_t *, const std::uint64_t *, std::uint32_t *, size_t) = nullptr;
+#if defined(SPECULA_TARGET_AVX2)
+  if (simd::has_avx2()) {
+    kernel = uniform_avx2<std::uint32_t>;
+  }
+#endif
+  uniform_x8(state.data(), inc.data(), values, kernel, [](std::uint32_t v) { return v; });
+}
+
+template <> void specula::RngX8::uniform<float>(pstd::span<float> values) {
+  void (*kernel)(std::uint64_t *, const std::uint64_t *, float *, size_t) = nullptr;
+#if defined(SPECULA_TARGET_AVX2)
+  if (simd::has_avx2()) {
+    kernel = uniform_avx2<float>;
+  }
+#endif
+  uniform_x8(state.data(), inc.data(), values, kernel, to_uniform_float);
+}
@@ -0,0 +1,79 @@
+#include "util/samplers.hpp"
+
+#include <bit>
+
+#include "util/log.hpp"
+
+specula::HaltonSampler::HaltonSampler(int samples_per_pixel, Point2i full_resolution,
+                                      RandomizeStrategy randomize, int seed, Allocator alloc)
+    : samples_per_pixel_(samples_per_pixel), randomize(randomize), seed(seed),
+      digit_permutations(alloc), pixel_offset_x(MAX_HALTON_RESOLUTION, alloc),
+      pixel_offset_y(MAX_HALTON_RESOLUTION, alloc) {
+  if (randomize == RandomizeStrategy::PermuteDigits) {
+    digit_permutations = DigitPermutations(MAX_DIMENSION, seed, alloc);
+  }
+
+  // Find the powers of 2 and 3 that cover the resolution, up to the size of the tile
+  for (int i = 0; i < 2; ++i) {
+    int base = i == 0 ? 2 : 3;
+    int scale = 1, exponent = 0;
+    while (scale < std::min(full_resolution[i], MAX_HALTON_RESOLUTION)) {
+      scale *= base;
+      ++exponent;
+    }
+    base_scales[i] = scale;
+    base_exponents[i] = exponent;
+  }
+  sample_stride = uint64_t(base_scales[0]) * base_scales[1];
+
+  // The first samples of the pixels are the first `sample_stride` points, as their first
+  // `base_exponents` digits in each base are those of the pixel coordinates. Reconstructing the
+  // index from both sets of digits with the Chinese remainder theorem splits into one term per
+  // coordinate, so each term is computed once per column and row.
+  uint64_t mult_inverse[2] = {multiplicative_inverse(base_scales[1], base_scales[0]),
+                              multiplicative_inverse(base_scales[0], base_scales[1])};
+  for (int i = 0; i < 2; ++i) {
+    pstd::vector<uint64_t> &offsets = i == 0 ? pixel_offset_x : pixel_offset_y;
+    int base = i == 0 ? 2 : 3;
+    for (int p = 0; p < MAX_HALTON_RESOLUTION; ++p) {
+      uint64_t dim_offset = inverse_radical_inverse(p, base, base_exponents[i]);
+      offsets[p] = dim_offset * (sample_stride / base_scales[i]) % sample_stride *
+                   mult_inverse[i] % sample_stride;
+    }
+  }
+}
+
+specula::ZSobolSampler::ZSobolSampler(int samples_per_pixel, Point2i full_resolution,
+                                      RandomizeStrategy randomize, int seed)
+    : randomize(randomize), seed(seed) {
+  ASSERT_GT(samples_per_pixel, 0);
+  if (!std::has_single_bit(uint32_t(samples_per_pixel))) {
+    LOG_WARN("Rounding {} samples per pixel up to a power of two for the ZSobol sampler",
+             samples_per_pixel);
+  }
+  log2_samples_per_pixel = std::bit_width(uint32_t(samples_per_pixel - 1));
+  int resolution = std::bit_ceil(uint32_t(std::max(full_resolution.x, full_resolution.y)));
+  int log4_samples_per_pixel = (log2_samples_per_pixel + 1) / 2;
+  n_base4_digits = log2_int(resolution) + log4_samples_per_pixel;
+}
+
+void specula::ZSobolSampler::get_1d(pstd::span<const Point2i> pixels, int index, int dim,
+                                    pstd::span<Float> u) const {
+  DASSERT_EQ(pixels.size(), u.size());
+  // The scrambler is selected once for the whole batch
+  dispatch([&](auto r) {
+    for (size_t i = 0; i < pixels.size(); ++i) {
+      u[i] = sample_1d<decltype(r)>(morton_sample_index(pixels[i], index), dim);
+    }
+  });
+}
+
+void specula::ZSobolSampler::get_2d(pstd::span<const Point2i> pixels, int index, int dim,
+                                    pstd::span<Point2f> u) const {
+  DASSERT_EQ(pixels.size(), u.size());
+  dispatch([&](auto r) {
+    for (size_t i = 0; i < pixels.size(); ++i) {
+      u[i] = sample_2d<decltype(r)>(morton_sample_index(pixels[i], index), dim);
+    }
+  });
+}
@@ -0,0 +1,376 @@
+#include "util/sampling.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#include "util/parallel.hpp"
+#include "util/simd.hpp"
+
+namespace specula {
+  /// Number of weights, or of steps of the pairing sweep, processed as a single task
+  static constexpr size_t ALIAS_CHUNK_SIZE = 1 << 16;
+
+  /// Run `func` over the chunks of \f$[0, n)\f$, in parallel when there is more than one
+  template <typename F> static void for_each_chunk(size_t n, F &&func) {
+    int64_t n_chunks = (n + ALIAS_CHUNK_SIZE - 1) / ALIAS_CHUNK_SIZE;
+    parallel_for(0, n_chunks, [&](int64_t c0, int64_t c1) {
+      for (int64_t c = c0; c < c1; ++c) {
+        func(c, c * ALIAS_CHUNK_SIZE, std::min<size_t>((c + 1) * ALIAS_CHUNK_SIZE, n));
+      }
+    });
+  }
+
+  /**
+   * Exclusive prefix sums of `value(i)` for \f$i \in [0, n)\f$, with the total as the last of the
+   * \f$n + 1\f$ values. Chunks are summed in parallel and then offset in order, so the result only
+   * depends on the chunk size.
+   */
+  template <typename F> static std::vector<double> prefix_sums(size_t n, F &&value) {
+    std::vector<double> sums(n + 1);
+    std::vector<double> chunk_sums((n + ALIAS_CHUNK_SIZE - 1) / ALIAS_CHUNK_SIZE);
+    for_each_chunk(n, [&](int64_t c, size_t begin, size_t end) {
+      double sum = 0;
+      for (size_t i = begin; i < end; ++i) {
+        sum += value(i);
+      }
+      chunk_sums[c] = sum;
+    });
+    double offset = 0;
+    for (double &sum : chunk_sums) {
+      offset += std::exchange(sum, offset);
+    }
+    sums[n] = offset;
+    for_each_chunk(n, [&](int64_t c, size_t begin, size_t end) {
+      double sum = chunk_sums[c];
+      for (size_t i = begin; i < end; ++i) {
+        sums[i] = sum;
+        sum += value(i);
+      }
+    });
+    return sums;
+  }
+
+  /// Pack the probability `q` of keeping `index` and its `alias` into an entry
+  static uint32_t pack_alias_entry(double q, uint32_t index, uint32_t alias, int index_bits) {
+    int fraction_bits = AliasTable::fraction_bits(index_bits);
+    uint32_t one = uint32_t(1) << fraction_bits;
+    uint32_t q_fixed = uint32_t(std::clamp(q, 0.0, 1.0) * one + 0.5);
+    if (q > 0) {
+      // Entries that have a chance of being kept must not round it away
+      q_fixed = std::max<uint32_t>(q_fixed, 1);
+    }
+    if (q_fixed >= one) {
+      // Always kept, which is expressed as being its own alias
+      q_fixed = one - 1;
+      alias = index;
+    }
+    return (q_fixed << index_bits) | alias;
+  }
+
+#if defined(SPECULA_USE_AVX2)
+  SPECULA_TARGET_AVX2 static void sample_alias_avx2(const uint32_t *entries, const Float *pmfs,
+                                                    int n, const Float *u, int *indices,
+                                                    Float *pmf, size_t count) {
+    int bits = AliasTable::index_bits(n);
+    const __m256 nf = _mm256_set1_ps(Float(n));
+    const __m256i last = _mm256_set1_epi32(n - 1);
+    const __m256 one_minus_epsilon = _mm256_set1_ps(OneMinusEpsilon);
+    const __m256 scale = _mm256_set1_ps(AliasTable::quantization_scale(bits));
+    const __m256i alias_mask = _mm256_set1_epi32((uint32_t(1) << bits) - 1);
+    const __m128i shift = _mm_cvtsi32_si128(bits);
+    for (size_t i = 0; i < count; i += 8) {
+      __m256 un = _mm256_mul_ps(_mm256_loadu_ps(u + i), nf);
+      __m256i offset = _mm256_min_epi32(_mm256_cvttps_epi32(un), last);
+      __m256 up = _mm256_min_ps(_mm256_sub_ps(un, _mm256_cvtepi32_ps(offset)), one_minus_epsilon);
+
+      __m256i entry =
+          _mm256_i32gather_epi32(reinterpret_cast<const int *>(entries), offset, 4);
+      __m256 q = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srl_epi32(entry, shift)), scale);
+      __m256 keep = _mm256_cmp_ps(up, q, _CMP_LT_OQ);
+      __m256i index = _mm256_castps_si256(simd::select(keep, _mm256_castsi256_ps(offset),
+                                                       _mm256_castsi256_ps(_mm256_and_si256(
+                                                           entry, alias_mask))));
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(indices + i), index);
+      if (pmf) {
+        _mm256_storeu_ps(pmf + i, _mm256_i32gather_ps(pmfs, index, 4));
+      }
+    }
+  }
+#endif
+} // namespace specula
+
+specula::AliasTable::AliasTable(pstd::span<const Float> weights, Allocator alloc)
+    : entries(weights.size(), alloc), pmfs(weights.size(), alloc) {
+  build(weights, entries, pmfs);
+}
+
+double specula::AliasTable::build(pstd::span<const Float> weights, pstd::span<uint32_t> entries,
+                                  pstd::span<Float> pmf) {
+  size_t n = weights.size();
+  ASSERT_GT(n, 0);
+  ASSERT_LE(n, MAX_SIZE);
+  DASSERT_EQ(entries.size(), n);
+  DASSERT_EQ(pmf.size(), n);
+  int bits = index_bits(n);
+
+  double sum = 0;
+  {
+    std::vector<double> chunk_sums((n + ALIAS_CHUNK_SIZE - 1) / ALIAS_CHUNK_SIZE);
+    for_each_chunk(n, [&](int64_t c, size_t begin, size_t end) {
+      double chunk_sum = 0;
+      for (size_t i = begin; i < end; ++i) {
+        DASSERT_GE(weights[i], 0);
+        chunk_sum += weights[i];
+      }
+      chunk_sums[c] = chunk_sum;
+    });
+    for (double chunk_sum : chunk_sums) {
+      sum += chunk_sum;
+    }
+  }
+  // Each entry is picked with probability 1 / n, and is light or heavy depending on whether its
+  // index is sampled less or more often than that
+  double scale = sum > 0 ? n / sum : 0;
+  auto p_hat = [&](size_t i) { return sum > 0 ? weights[i] * scale : 1.0; };
+
+  // Split the indices into the light and the heavy ones, keeping them in order
+  std::vector<uint32_t> lights, heavies;
+  {
+    std::vector<double> light_counts =
+        prefix_sums(n, [&](size_t i) { return p_hat(i) < 1 ? 1.0 : 0.0; });
+    size_t n_lights = light_counts[n];
+    lights.resize(n_lights);
+    heavies.resize(n - n_lights);
+    for_each_chunk(n, [&](int64_t, size_t begin, size_t end) {
+      size_t light = light_counts[begin], heavy = begin - light;
+      for (size_t i = begin; i < end; ++i) {
+        if (p_hat(i) < 1) {
+          lights[light++] = i;
+        } else {
+          heavies[heavy++] = i;
+        }
+      }
+    });
+  }
+  size_t n_lights = lights.size(), n_heavies = heavies.size();
+
+  if (n_heavies == 0) {
+    // Only possible through rounding, when every weight is just below the average
+    for_each_chunk(n, [&](int64_t, size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        entries[i] = pack_alias_entry(1, i, i, bits);
+        pmf[i] = Float(1) / n;
+      }
+    });
+    return sum;
+  }
+
+  // Sweep over the light entries in order, giving each the current heavy one as its alias and
+  // taking what it is missing from that heavy one. Once a heavy entry has given away its excess
+  // it is itself completed with the next heavy one. With the cumulative deficits of the light
+  // entries and excesses of the heavy ones, the sweep is a merge of the two sequences: a light
+  // entry comes before the heavy one at `j` being completed iff its cumulative deficit is below
+  // the cumulative excess up to and including `j`. It can thus be split into independent ranges
+  // of steps, as in merge path, and the remaining excess of the current heavy entry at any point
+  // follows from the cumulative sums rather than from the steps before it.
+  std::vector<double> deficit =
+      prefix_sums(n_lights, [&](size_t i) { return 1 - p_hat(lights[i]); });
+  std::vector<double> excess =
+      prefix_sums(n_heavies, [&](size_t j) { return p_hat(heavies[j]) - 1; });
+  size_t n_completions = n_heavies - 1, n_steps = n_lights + n_completions;
+  auto light_first = [&](size_t i, size_t j) {
+    return i < n_lights && (j >= n_completions || deficit[i] < excess[j + 1]);
+  };
+
+  for_each_chunk(n_steps, [&](int64_t, size_t begin, size_t end) {
+    // Number of light entries among the first `begin` steps
+    size_t lo = begin > n_completions ? begin - n_completions : 0, hi = std::min(begin, n_lights);
+    while (lo < hi) {
+      size_t i = (lo + hi) / 2;
+      if (light_first(i, begin - i - 1)) {
+        lo = i + 1;
+      } else {
+        hi = i;
+      }
+    }
+
+    size_t i = lo, j = begin - lo;
+    for (size_t step = begin; step < end; ++step) {
+      if (light_first(i, j)) {
+        entries[lights[i]] = pack_alias_entry(p_hat(lights[i]), lights[i], heavies[j], bits);
+        ++i;
+      } else {
+        double remaining = 1 + excess[j + 1] - deficit[i];
+        entries[heavies[j]] = pack_alias_entry(remaining, heavies[j], heavies[j + 1], bits);
+        ++j;
+      }
+    }
+  });
+  entries[heavies.back()] = pack_alias_entry(1, heavies.back(), heavies.back(), bits);
+
+  // The probability of each index follows from the quantized entries. Light indices are only
+  // sampled through their own entry, heavy ones also through the entries aliased to them: the
+  // light entries whose cumulative deficit falls in their range, and the previous heavy entry.
+  Float q_scale = quantization_scale(bits);
+  auto kept = [&](uint32_t index) {
+    uint32_t entry = entries[index];
+    if ((entry & ((uint32_t(1) << bits) - 1)) == index) {
+      return 1.0;
+    }
+    return double(Float(entry >> bits) * q_scale);
+  };
+  auto given = [&](uint32_t index) {
+    uint32_t entry = entries[index];
+    return (entry & ((uint32_t(1) << bits) - 1)) == index ? 0.0 : 1 - kept(index);
+  };
+  for_each_chunk(n_lights, [&](int64_t, size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      pmf[lights[i]] = kept(lights[i]) / n;
+    }
+  });
+  for_each_chunk(n_heavies, [&](int64_t, size_t begin, size_t end) {
+    for (size_t j = begin; j < end; ++j) {
+      size_t first = j == 0 ? 0
+                            : std::lower_bound(deficit.begin(), deficit.begin() + n_lights,
+                                               excess[j]) -
+                                  deficit.begin();
+      size_t last = j == n_completions
+                        ? n_lights
+                        : std::lower_bound(deficit.begin(), deficit.begin() + n_lights,
+                                           excess[j + 1]) -
+                              deficit.begin();
+      double p = kept(heavies[j]);
+      for (size_t i = first; i < last; ++i) {
+        p += given(lights[i]);
+      }
+      if (j > 0) {
+        p += given(heavies[j - 1]);
+      }
+      pmf[heavies[j]] = p / n;
+    }
+  });
+  return sum;
+}
+
+void specula::AliasTable::sample(pstd::span<const Float> u, pstd::span<int> indices,
+                                 pstd::span<Float> pmf) const {
+  DASSERT_EQ(u.size(), indices.size());
+  DASSERT(pmf.empty() || pmf.size() == u.size());
+  size_t i = 0;
+#if defined(SPECULA_USE_AVX2)
+  if (simd::has_avx2()) {
+    i = u.size() & ~size_t(7);
+    sample_alias_avx2(entries.data(), pmfs.data(), size(), u.data(), indices.data(),
+                      pmf.empty() ? nullptr : pmf.data(), i);
+  }
+#endif
+  for (; i < u.size(); ++i) {
+    indices[i] = sample(u[i], pmf.empty() ? nullptr : &pmf[i]);
+  }
+}
+
+void specula::AliasTable::sample_bits(pstd::span<const uint64_t> u, pstd::span<int> indices,
+                                      pstd::span<Float> pmf) const {
+  DASSERT_EQ(u.size(), indices.size());
+  DASSERT(pmf.empty() || pmf.size() == u.size());
+  for (size_t i = 0; i < u.size(); ++i) {
+    indices[i] = sample_bits(u[i], pmf.empty() ? nullptr : &pmf[i]);
+  }
+}
+
+specula::PiecewiseConstant1D::PiecewiseConstant1D(pstd::span<const Float> f, Float min,
+                                                  Float max, Allocator alloc)
+    : func(f.begin(), f.end(), alloc), cdf(f.size() + 1, alloc), min(min), max(max) {
+  DASSERT_GT(max, min);
+  for (Float &value : func) {
+    value = std::abs(value);
+  }
+
+  size_t n = f.size();
+  cdf[0] = 0;
+  for (size_t i = 1; i < n + 1; ++i) {
+    DASSERT_GE(func[i - 1], 0);
+    cdf[i] = cdf[i - 1] + func[i - 1] * (max - min) / n;
+  }
+
+  func_int = cdf[n];
+  if (func_int == 0) {
+    for (size_t i = 1; i < n + 1; ++i) {
+      cdf[i] = Float(i) / Float(n);
+    }
+  } else {
+    for (size_t i = 1; i < n + 1; ++i) {
+      cdf[i] /= func_int;
+    }
+  }
+}
+
+specula::PiecewiseConstant2D::PiecewiseConstant2D(pstd::span<const Float> f, int nu, int nv,
+                                                  const Bounds2f &domain, Allocator alloc)
+    : domain_(domain), nu(nu), nv(nv), conditional(size_t(nu) * nv, alloc),
+      conditional_pmf(size_t(nu) * nv, alloc), marginal(alloc) {
+  ASSERT_EQ(f.size(), size_t(nu) * nv);
+
+  // The rows are independent, so their alias tables are built in parallel
+  Float du = (domain.pmax.x - domain.pmin.x) / nu;
+  std::vector<Float> row_integrals(nv);
+  parallel_for(0, nv, [&](int64_t v0, int64_t v1) {
+    std::vector<Float> row(nu);
+    for (int64_t v = v0; v < v1; ++v) {
+      size_t offset = size_t(v) * nu;
+      for (int u = 0; u < nu; ++u) {
+        row[u] = std::abs(f[offset + u]);
+      }
+      double sum = AliasTable::build(row, {conditional.data() + offset, size_t(nu)},
+                                     {conditional_pmf.data() + offset, size_t(nu)});
+      row_integrals[v] = sum * du;
+    }
+  });
+  marginal = PiecewiseConstant1D(row_integrals, domain.pmin.y, domain.pmax.y, alloc);
+}
+
+specula::PiecewiseConstant2D specula::PiecewiseConstant2D::compensated(const Array2D<Float> &f,
+                                                                       const Bounds2f &domain,
+                                                                       Allocator alloc) {
+  int nu = f.xsize(), nv = f.ysize();
+  std::vector<double> row_sums(nv);
+  parallel_for(0, nv, [&](int64_t v0, int64_t v1) {
+    for (int64_t v = v0; v < v1; ++v) {
+      double sum = 0;
+      for (int u = 0; u < nu; ++u) {
+        sum += std::abs(f(u, v));
+      }
+      row_sums[v] = sum;
+    }
+  });
+
+  // Summed in row order, so the average does not depend on the number of threads
+  double sum = 0;
+  for (double row_sum : row_sums) {
+    sum += row_sum;
+  }
+  Float average = sum / (double(nu) * nv);
+
+  std::vector<Float> compensated(size_t(nu) * nv);
+  std::atomic<bool> all_zero = true;
+  parallel_for(0, nv, [&](int64_t v0, int64_t v1) {
+    bool zero = true;
+    for (int64_t v = v0; v < v1; ++v) {
+      for (int u = 0; u < nu; ++u) {
+        Float value = std::max<Float>(std::abs(f(u, v)) - average, 0);
+        compensated[size_t(v) * nu + u] = value;
+        zero &= value == 0;
+      }
+    }
+    if (!zero) {
+      all_zero.store(false, std::memory_order_relaxed);
+    }
+  });
+  if (all_zero.load()) {
+    std::fill(compensated.begin(), compensated.end(), Float(1));
+  }
+  return PiecewiseConstant2D(compensated, nu, nv, domain, alloc);
+}
@@ -0,0 +1,12 @@
+#include "util/simd.hpp"
+
+bool specula::simd::has_avx2() {
+#if defined(SPECULA_HAVE_AVX2)
+  static const bool supported = __builtin_cpu_supports("avx2") != 0 &&
+                                __builtin_cpu_supports("fma") != 0 &&
+                                __builtin_cpu_supports("f16c") != 0;
+  return supported;
+#else
+  return false;
+#endif
+}
@@ -37,3 +37,12 @@ bool specula::atof(std::string_view str, double *ptr) {
   }
   return true;
 }
+
+bool specula::atoi(std::string_view str, int *ptr) {
+  try {
+    *ptr = std::stoi(std::string(str.begin(), str.end()));
+  } catch (...) {
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,46 @@
+#include <algorithm>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+#include <specula/util/blue_noise.hpp>
+
+using namespace specula;
+
+TEST_CASE("Blue noise", "[util]") {
+  constexpr int n = BLUE_NOISE_RESOLUTION * BLUE_NOISE_RESOLUTION;
+  const Float *mask = blue_noise_mask();
+
+  SECTION("Every rank appears once") {
+    std::vector<Float> values(mask, mask + n);
+    std::sort(values.begin(), values.end());
+    int mismatches = 0;
+    for (int i = 0; i < n; ++i) {
+      mismatches += values[i] != (i + 0.5f) / n;
+    }
+    CHECK(mismatches == 0);
+  }
+
+  SECTION("Thresholds are evenly spread") {
+    // At a density of one in eight, every wrapped 4x4 window holds two pixels on average, and
+    // blue noise leaves none of them empty
+    int empty = 0;
+    for (int y = 0; y < BLUE_NOISE_RESOLUTION; ++y) {
+      for (int x = 0; x < BLUE_NOISE_RESOLUTION; ++x) {
+        int count = 0;
+        for (int dy = 0; dy < 4; ++dy) {
+          for (int dx = 0; dx < 4; ++dx) {
+            count += blue_noise(0, {x + dx, y + dy}) < 0.125f;
+          }
+        }
+        empty += count == 0;
+      }
+    }
+    CHECK(empty == 0);
+  }
+
+  SECTION("Tiles seamlessly") {
+    CHECK(blue_noise(1, {-3, 5}) == blue_noise(1, {BLUE_NOISE_RESOLUTION - 3, 5}));
+    CHECK(blue_noise(2, {7, 9}) == blue_noise(2, {7, 9 + 3 * BLUE_NOISE_RESOLUTION}));
+    CHECK(blue_noise(0, {7, 9}) != blue_noise(1, {7, 9}));
+  }
+}
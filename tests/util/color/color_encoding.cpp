@@ -0,0 +1,69 @@
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+#include <specula/util/color/color_encoding.hpp>
+#include <specula/util/hash.hpp>
+
+using namespace specula;
+
+template <typename Encoding> static void check_bulk_matches_single(const Encoding &encoding) {
+  std::vector<uint8_t> encoded(1003);
+  for (size_t i = 0; i < encoded.size(); ++i) {
+    encoded[i] = static_cast<uint8_t>(i);
+  }
+  std::vector<Float> decoded(encoded.size());
+  encoding.to_linear(encoded, decoded);
+  for (size_t i = 0; i < encoded.size(); ++i) {
+    Float single;
+    encoding.to_linear(pstd::span<const uint8_t>(&encoded[i], 1), pstd::span<Float>(&single, 1));
+    CHECK(decoded[i] == single);
+  }
+
+  std::vector<Float> values;
+  for (int i = 0; i < 4099; ++i) {
+    values.push_back(1.2f * hash_float(i) - 0.1f);
+  }
+  for (int i = 0; i < 256; ++i) {
+    values.push_back(i / 255.0f);
+    values.push_back(0.0031308f * i / 255.0f);
+  }
+  values.push_back(0.0f);
+  values.push_back(-0.0f);
+  values.push_back(1.0f);
+  values.push_back(Infinity);
+  values.push_back(-Infinity);
+
+  std::vector<uint8_t> result(values.size());
+  encoding.from_linear(values, result);
+  for (size_t i = 0; i < values.size(); ++i) {
+    uint8_t single;
+    encoding.from_linear(pstd::span<const Float>(&values[i], 1), pstd::span<uint8_t>(&single, 1));
+    CHECK(int(result[i]) == int(single));
+  }
+}
+
+TEST_CASE("ColorEncoding", "[util][color]") {
+  SECTION("Linear") { check_bulk_matches_single(LinearColorEncoding()); }
+  SECTION("sRGB") { check_bulk_matches_single(sRgbColorEncoding()); }
+  SECTION("Gamma") { check_bulk_matches_single(GammaColorEncoding(2.2f)); }
+
+  SECTION("Dithered sRGB") {
+    std::vector<Float> values, dither;
+    for (int i = 0; i < 4099; ++i) {
+      values.push_back(1.2f * hash_float(i) - 0.1f);
+      dither.push_back(hash_float(i, 1) - 0.5f);
+    }
+    size_t expected_out_of_gamut = 0;
+    for (Float v : values) {
+      expected_out_of_gamut += v < 0 || v > 1;
+    }
+
+    std::vector<uint8_t> result(values.size());
+    CHECK(linear_to_srgb8(values, dither, result) == expected_out_of_gamut);
+    int mismatches = 0;
+    for (size_t i = 0; i < values.size(); ++i) {
+      mismatches += result[i] != linear_to_srgb8(values[i], dither[i]);
+    }
+    CHECK(mismatches == 0);
+  }
+}
@@ -0,0 +1,53 @@
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_floating_point.hpp>
+#include <specula/util/color/rgb_spectrum_table.hpp>
+#include <specula/util/hash.hpp>
+#include <specula/util/rng.hpp>
+
+using namespace specula;
+using namespace Catch::Matchers;
+
+TEST_CASE("RgbToSpectrumTable", "[util][color]") {
+  constexpr int RES = RgbToSpectrumTable::RES;
+
+  // Synthetic table with the same node distribution as the generated tables
+  std::vector<float> z_nodes(RES);
+  for (int i = 0; i < RES; ++i) {
+    z_nodes[i] = smooth_step(smooth_step(Float(i) / (RES - 1), 0, 1), 0, 1);
+  }
+
+  std::vector<float> data(sizeof(RgbToSpectrumTable::CoefficientArray) / sizeof(float));
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = (i % 3 == 0 ? 1e-4f : (i % 3 == 1 ? 1e-2f : 1.0f)) * (hash_float(i) - 0.5f);
+  }
+
+  RgbToSpectrumTable table(
+      z_nodes.data(), reinterpret_cast<const RgbToSpectrumTable::CoefficientArray *>(data.data()));
+
+  SECTION("Batched lookup matches single lookup") {
+    Rng rng(7);
+    std::vector<Rgb> rgb;
+    for (int i = 0; i < 1000; ++i) {
+      rgb.emplace_back(rng.uniform<Float>(), rng.uniform<Float>(), rng.uniform<Float>());
+    }
+    rgb.emplace_back(0.25f, 0.25f, 0.25f);
+    rgb.emplace_back(1.0f, 0.0f, 0.0f);
+    rgb.emplace_back(0.0f, 1.0f, 0.0f);
+    rgb.emplace_back(0.0f, 0.0f, 1.0f);
+    rgb.emplace_back(0.5f, 0.5f, 0.0f);
+    rgb.emplace_back(1e-5f, 2e-5f, 0.0f);
+    rgb.emplace_back(1.0f, 1.0f, 0.999f);
+
+    std::vector<RgbSigmoidPolynomial> batch(rgb.size());
+    table.lookup(rgb, batch);
+
+    for (size_t i = 0; i < rgb.size(); ++i) {
+      RgbSigmoidPolynomial single = table(rgb[i]);
+      for (Float lambda : {360.0f, 450.0f, 550.0f, 650.0f, 830.0f}) {
+        CHECK_THAT(batch[i](lambda), WithinAbs(single(lambda), 1e-5f));
+      }
+    }
+  }
+}
@@ -0,0 +1,236 @@
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+#include <specula/util/hash.hpp>
+#include <specula/util/image/exr.hpp>
+#include <specula/util/image/image.hpp>
+
+using namespace specula;
+
+static Image make_image(PixelFormat format, Point2i resolution,
+                        const std::vector<std::string> &channels, bool constant = false) {
+  Image image(format, resolution, channels);
+  for (int y = 0; y < resolution.y; ++y) {
+    for (int x = 0; x < resolution.x; ++x) {
+      for (int c = 0; c < image.n_channels(); ++c) {
+        image.set_channel({x, y}, c, constant ? 0.5f : 4.f * hash_float(x, y, c) - 1.f);
+      }
+    }
+  }
+  return image;
+}
+
+static void check_channels(const Image &read, const Image &image) {
+  REQUIRE(read.resolution() == image.resolution());
+  for (const std::string &name : image.channel_names()) {
+    ImageChannelDesc read_desc = read.get_channel_desc(std::vector<std::string>{name});
+    ImageChannelDesc desc = image.get_channel_desc(std::vector<std::string>{name});
+    REQUIRE(read_desc);
+    int mismatches = 0;
+    for (int y = 0; y < image.resolution().y; ++y) {
+      for (int x = 0; x < image.resolution().x; ++x) {
+        mismatches +=
+            read.get_channels({x, y}, read_desc)[0] != image.get_channels({x, y}, desc)[0];
+      }
+    }
+    CHECK(mismatches == 0);
+  }
+}
+
+/// Overwrite the 32-bit values of the first attribute `name` of type `type` in a file
+static void patch_attribute(const std::string &filename, const std::string &name,
+                            const std::string &type, const std::vector<int32_t> &values) {
+  std::fstream file(filename, std::ios::binary | std::ios::in | std::ios::out);
+  std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  std::string attribute = name + '\0' + type + '\0';
+  size_t pos = data.find(attribute);
+  REQUIRE(pos != std::string::npos);
+  file.seekp(pos + attribute.size() + 4);
+  for (int32_t value : values) {
+    for (int shift = 0; shift < 32; shift += 8) {
+      file.put(char(uint32_t(value) >> shift));
+    }
+  }
+}
+
+/// The value of the lineOrder attribute of a file, or -1 if it has none
+static int exr_line_order(const std::string &filename) {
+  std::ifstream in(filename, std::ios::binary);
+  std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  std::string attribute("lineOrder\0lineOrder\0\1\0\0\0", 24);
+  size_t pos = data.find(attribute);
+  return pos == std::string::npos || pos + attribute.size() >= data.size()
+             ? -1
+             : data[pos + attribute.size()];
+}
+
+TEST_CASE("EXR", "[util][image]") {
+  std::string filename =
+      (std::filesystem::temp_directory_path() / "specula_exr_test.exr").string();
+
+  SECTION("Layers") {
+    Image image = make_image(PixelFormat::Half, {67, 45},
+                             {"R", "G", "B", "A", "albedo.R", "albedo.G", "albedo.B"});
+    for (ExrCompression compression : {ExrCompression::None, ExrCompression::Rle}) {
+      ExrPart part{"", SubImage(image)};
+      REQUIRE(exr_write(filename, {&part, 1}, {}, compression));
+      ImageAndMetadata read = Image::read(filename);
+      CHECK(read.image.format() == PixelFormat::Half);
+      CHECK(read.image.channel_names() ==
+            std::vector<std::string>{"R", "G", "B", "A", "albedo.B", "albedo.G", "albedo.R"});
+      check_channels(read.image, image);
+      CHECK(exr_line_order(filename) == 0);
+    }
+  }
+
+  SECTION("Compression") {
+    Image image = make_image(PixelFormat::Half, {128, 40}, {"R", "G", "B"}, true);
+    size_t sizes[2];
+    for (ExrCompression compression : {ExrCompression::None, ExrCompression::Rle}) {
+      ExrPart part{"", SubImage(image)};
+      REQUIRE(exr_write(filename, {&part, 1}, {}, compression));
+      sizes[int(compression)] = std::filesystem::file_size(filename);
+      check_channels(Image::read(filename).image, image);
+    }
+    CHECK(sizes[1] < sizes[0] / 10);
+  }
+
+  SECTION("Metadata") {
+    Image image = make_image(PixelFormat::Float, {20, 10}, {"Y"});
+    ImageMetadata metadata;
+    metadata.render_time_seconds = 12.5f;
+    metadata.samples_per_pixel = 64;
+    metadata.mse = 0.25f;
+    metadata.camera_from_world =
+        SquareMatrix<4>(1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 0, 0, 0, 1);
+    metadata.pixel_bounds = Bounds2i({5, 3}, {25, 13});
+    metadata.full_resolution = Point2i(40, 30);
+    metadata.strings["renderer"] = "specula";
+    metadata.string_vectors["scene"] = {"a", "", "bc"};
+    REQUIRE(image.write(filename, metadata));
+
+    ImageAndMetadata read = Image::read(filename);
+    CHECK(read.image.format() == PixelFormat::Float);
+    check_channels(read.image, image);
+    REQUIRE(read.metadata.render_time_seconds);
+    CHECK(*read.metadata.render_time_seconds == 12.5f);
+    REQUIRE(read.metadata.samples_per_pixel);
+    CHECK(*read.metadata.samples_per_pixel == 64);
+    REQUIRE(read.metadata.mse);
+    CHECK(*read.metadata.mse == 0.25f);
+    REQUIRE(read.metadata.camera_from_world);
+    CHECK(*read.metadata.camera_from_world == *metadata.camera_from_world);
+    CHECK(!read.metadata.ndc_from_world);
+    REQUIRE(read.metadata.pixel_bounds);
+    CHECK(*read.metadata.pixel_bounds == *metadata.pixel_bounds);
+    REQUIRE(read.metadata.full_resolution);
+    CHECK(*read.metadata.full_resolution == *metadata.full_resolution);
+    CHECK(read.metadata.strings == metadata.strings);
+    CHECK(read.metadata.string_vectors == metadata.string_vectors);
+  }
+
+  SECTION("Multipart") {
+    Image beauty = make_image(PixelFormat::Half, {33, 70}, {"R", "G", "B"});
+    Image depth = make_image(PixelFormat::Float, {33, 70}, {"Z"});
+    std::vector<ExrPart> parts = {{"beauty", SubImage(beauty)}, {"depth", SubImage(depth)}};
+    REQUIRE(exr_write(filename, parts, {}));
+    check_channels(exr_read(filename, {}, 0).image, beauty);
+    check_channels(exr_read(filename, {}, 1).image, depth);
+    CHECK(!exr_read(filename, {}, 2).image.resolution().x);
+
+    parts[1].name = "beauty";
+    CHECK(!exr_write(filename, parts, {}));
+  }
+
+  SECTION("Streaming") {
+    Image image = make_image(PixelFormat::Float, {100, 70}, {"R", "G", "B"});
+    std::vector<std::string> channels = image.channel_names();
+    auto writer = ExrStreamWriter::open(filename, image.resolution(), channels,
+                                        PixelFormat::Float, {}, ExrCompression::Rle, 4);
+    REQUIRE(writer);
+
+    // Tiles are written from several threads in an order that completes scanlines out of order
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+      threads.emplace_back([&, t]() {
+        for (int tile = t; tile < 7 * 5; tile += 4) {
+          Bounds2i bounds({(tile / 5) * 16, (4 - tile % 5) * 16},
+                          {std::min(100, (tile / 5 + 1) * 16), std::min(70, (5 - tile % 5) * 16)});
+          writer->write(bounds.pmin, SubImage(image).crop(bounds));
+        }
+      });
+    }
+    for (std::thread &thread : threads) {
+      thread.join();
+    }
+    REQUIRE(writer->finish());
+    check_channels(Image::read(filename).image, image);
+    // Scanlines are stored as they complete, so readers must not assume increasing y
+    CHECK(exr_line_order(filename) == 2);
+
+    writer = ExrStreamWriter::open(filename, image.resolution(), channels);
+    writer->write({0, 0}, SubImage(image).crop(Bounds2i({0, 0}, {100, 69})));
+    CHECK(!writer->finish());
+  }
+
+  SECTION("Corrupt sizes") {
+    // Chunk counts and data windows far larger than the file are rejected without allocating
+    Image beauty = make_image(PixelFormat::Half, {16, 16}, {"R", "G", "B"});
+    Image depth = make_image(PixelFormat::Float, {16, 16}, {"Z"});
+    std::vector<ExrPart> parts = {{"beauty", SubImage(beauty)}, {"depth", SubImage(depth)}};
+    REQUIRE(exr_write(filename, parts, {}));
+    patch_attribute(filename, "chunkCount", "int", {0x7fffffff});
+    CHECK(exr_read(filename, {}, 0).image.resolution() == Point2i(0, 0));
+    CHECK(exr_read(filename, {}, 1).image.resolution() == Point2i(0, 0));
+
+    REQUIRE(beauty.write(filename));
+    patch_attribute(filename, "dataWindow", "box2i", {-0x7fffffff, 0, 0x7ffffffe, 15});
+    CHECK(Image::read(filename).image.resolution() == Point2i(0, 0));
+    patch_attribute(filename, "dataWindow", "box2i", {0, 0, 0x7fffffff, 15});
+    CHECK(Image::read(filename).image.resolution() == Point2i(0, 0));
+    patch_attribute(filename, "dataWindow", "box2i", {0, 0, 15, 0x7ffffffe});
+    CHECK(Image::read(filename).image.resolution() == Point2i(0, 0));
+  }
+
+  SECTION("Missing blocks") {
+    // A chunk count short of the blocks of the data window is rejected
+    Image beauty = make_image(PixelFormat::Half, {16, 16}, {"R", "G", "B"});
+    Image depth = make_image(PixelFormat::Float, {16, 16}, {"Z"});
+    std::vector<ExrPart> parts = {{"beauty", SubImage(beauty)}, {"depth", SubImage(depth)}};
+    REQUIRE(exr_write(filename, parts, {}));
+    patch_attribute(filename, "chunkCount", "int", {15});
+    CHECK(exr_read(filename, {}, 0).image.resolution() == Point2i(0, 0));
+
+    // So is a block that is stored twice in place of another one
+    REQUIRE(beauty.write(filename));
+    std::fstream file(filename, std::ios::binary | std::ios::in | std::ios::out);
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    size_t table = 0;
+    for (uint64_t first = 0; table + 16 <= data.size(); ++table) {
+      std::memcpy(&first, data.data() + table, sizeof(first));
+      if (first == table + 16 * sizeof(uint64_t)) {
+        break;
+      }
+    }
+    REQUIRE(table + 16 <= data.size());
+    file.seekp(table + sizeof(uint64_t));
+    file.write(data.data() + table, sizeof(uint64_t));
+    file.close();
+    CHECK(Image::read(filename).image.resolution() == Point2i(0, 0));
+  }
+
+  SECTION("Truncated") {
+    Image image = make_image(PixelFormat::Half, {16, 16}, {"R", "G", "B"});
+    REQUIRE(image.write(filename));
+    std::filesystem::resize_file(filename, std::filesystem::file_size(filename) - 10);
+    CHECK(Image::read(filename).image.resolution() == Point2i(0, 0));
+  }
+
+  std::filesystem::remove(filename);
+}
@@ -0,0 +1,872 @@
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_floating_point.hpp>
+#include <specula/util/hash.hpp>
+#include <specula/util/image/image.hpp>
+#include <specula/util/vecmath/bounds2i_iterator.hpp>
+
+using namespace specula;
+using namespace Catch::Matchers;
+
+TEST_CASE("Pixel format conversion", "[util][image]") {
+  SECTION("Half round trip") {
+    std::vector<Float> values;
+    for (int i = 0; i < 1003; ++i) {
+      values.push_back(65504.0f * (hash_float(i) - 0.5f) * hash_float(i, 1));
+    }
+    values.push_back(0.0f);
+    values.push_back(-0.0f);
+    values.push_back(6e-8f);
+    values.push_back(1e10f);
+    values.push_back(-Infinity);
+
+    std::vector<Half> half(values.size());
+    float_to_half(values, half);
+    std::vector<Float> result(values.size());
+    half_to_float(half, result);
+
+    for (size_t i = 0; i < values.size(); ++i) {
+      CHECK(half[i].bits() == Half(values[i]).bits());
+      CHECK(result[i] == Float(Half(values[i])));
+    }
+  }
+}
+
+TEST_CASE("Image", "[util][image]") {
+  std::vector<std::string> channels = {"R", "G", "B"};
+  Point2i resolution(37, 19);
+
+  Image image(PixelFormat::Float, resolution, channels);
+  for (int y = 0; y < resolution.y; ++y) {
+    for (int x = 0; x < resolution.x; ++x) {
+      for (int c = 0; c < 3; ++c) {
+        image.set_channel({x, y}, c, hash_float(x, y, c));
+      }
+    }
+  }
+
+  SECTION("Convert to half and back") {
+    Image half = image.convert_to_format(PixelFormat::Half);
+    CHECK(half.format() == PixelFormat::Half);
+    Image back = half.convert_to_format(PixelFormat::Float);
+    for (int y = 0; y < resolution.y; ++y) {
+      for (int x = 0; x < resolution.x; ++x) {
+        for (int c = 0; c < 3; ++c) {
+          Float expected = Float(Half(image.get_channel({x, y}, c)));
+          CHECK(half.get_channel({x, y}, c) == expected);
+          CHECK(back.get_channel({x, y}, c) == expected);
+        }
+      }
+    }
+  }
+
+  SECTION("Convert to U256") {
+    LinearColorEncoding linear;
+    Image u8 = image.convert_to_format(PixelFormat::U256, ColorEncoding(&linear));
+    for (int y = 0; y < resolution.y; ++y) {
+      for (int x = 0; x < resolution.x; ++x) {
+        for (int c = 0; c < 3; ++c) {
+          CHECK_THAT(u8.get_channel({x, y}, c), WithinAbs(image.get_channel({x, y}, c), 0.5 / 255));
+        }
+      }
+    }
+  }
+
+  SECTION("Copy rect out and in") {
+    Image half = image.convert_to_format(PixelFormat::Half);
+    Bounds2i extent({3, 2}, {30, 17});
+    std::vector<float> buf(extent.area() * 3);
+    half.copy_rect_out(extent, buf);
+
+    size_t i = 0;
+    for (Point2i p : extent) {
+      for (int c = 0; c < 3; ++c, ++i) {
+        CHECK(buf[i] == half.get_channel(p, c));
+      }
+    }
+
+    Image copy(PixelFormat::Half, resolution, channels);
+    copy.copy_rect_in(extent, buf);
+    for (Point2i p : extent) {
+      for (int c = 0; c < 3; ++c) {
+        CHECK(copy.get_channel(p, c) == half.get_channel(p, c));
+      }
+    }
+  }
+
+  SECTION("Copy rect out with wrapping") {
+    Bounds2i extent({-4, -3}, {5, 4});
+    std::vector<float> buf(extent.area() * 3);
+    image.copy_rect_out(extent, buf, WrapMode::Repeat);
+
+    size_t i = 0;
+    for (Point2i p : extent) {
+      for (int c = 0; c < 3; ++c, ++i) {
+        CHECK(buf[i] == image.get_channel(p, c, WrapMode::Repeat));
+      }
+    }
+  }
+}
+
+TEST_CASE("ImageView", "[util][image]") {
+  std::vector<std::string> channels = {"R", "G", "B"};
+  Point2i resolution(13, 7);
+
+  Image image(PixelFormat::Float, resolution, channels);
+  for (int y = 0; y < resolution.y; ++y) {
+    for (int x = 0; x < resolution.x; ++x) {
+      for (int c = 0; c < 3; ++c) {
+        image.set_channel({x, y}, c, hash_float(x, y, c));
+      }
+    }
+  }
+
+  SECTION("Bilerp at texel centers") {
+    for (int y = 0; y < resolution.y; ++y) {
+      for (int x = 0; x < resolution.x; ++x) {
+        Point2f p((x + 0.5f) / resolution.x, (y + 0.5f) / resolution.y);
+        for (int c = 0; c < 3; ++c) {
+          CHECK_THAT(image.bilerp_channel(p, c), WithinAbs(image.get_channel({x, y}, c), 1e-6));
+        }
+      }
+    }
+  }
+
+  SECTION("Bilerp matches texel fetches") {
+    sRgbColorEncoding srgb;
+    Image images[] = {image, image.convert_to_format(PixelFormat::Half),
+                      image.convert_to_format(PixelFormat::U256, ColorEncoding(&srgb))};
+    WrapMode2D wrap_modes[] = {WrapMode::Clamp, WrapMode::Repeat, WrapMode::Black};
+
+    for (const Image &img : images) {
+      for (WrapMode2D wrap_mode : wrap_modes) {
+        for (int i = 0; i < 200; ++i) {
+          Point2f p(1.2f * hash_float(i, 0) - 0.1f, 1.2f * hash_float(i, 1) - 0.1f);
+
+          Float x = p[0] * resolution.x - 0.5f, y = p[1] * resolution.y - 0.5f;
+          int xi = pstd::floor(x), yi = pstd::floor(y);
+          Float dx = x - xi, dy = y - yi;
+
+          ImageChannelValues values = img.bilerp(p, wrap_mode);
+          for (int c = 0; c < 3; ++c) {
+            Float expected = (1 - dx) * (1 - dy) * img.get_channel({xi, yi}, c, wrap_mode) +
+                             dx * (1 - dy) * img.get_channel({xi + 1, yi}, c, wrap_mode) +
+                             (1 - dx) * dy * img.get_channel({xi, yi + 1}, c, wrap_mode) +
+                             dx * dy * img.get_channel({xi + 1, yi + 1}, c, wrap_mode);
+            CHECK(img.bilerp_channel(p, c, wrap_mode) == expected);
+            CHECK(values[c] == expected);
+          }
+        }
+      }
+    }
+  }
+
+  SECTION("Static channel lookups match dynamic ones") {
+    sRgbColorEncoding srgb;
+    Image images[] = {image, image.convert_to_format(PixelFormat::Half),
+                      image.convert_to_format(PixelFormat::U256, ColorEncoding(&srgb))};
+    StaticChannelDesc<3> bgr(image.get_channel_desc(std::vector<std::string>{"B", "G", "R"}));
+    ImageChannelDesc bgr_desc = image.get_channel_desc(std::vector<std::string>{"B", "G", "R"});
+    StaticChannelDesc<1> g(image.get_channel_desc(std::vector<std::string>{"G"}));
+
+    for (const Image &img : images) {
+      for (WrapMode2D wrap_mode : {WrapMode::Clamp, WrapMode::Repeat, WrapMode::Black}) {
+        for (int i = 0; i < 200; ++i) {
+          Point2f p(1.2f * hash_float(i, 0) - 0.1f, 1.2f * hash_float(i, 1) - 0.1f);
+          Point2i pi(p.x * resolution.x, p.y * resolution.y);
+
+          ChannelsRGB rgb = img.bilerp<3>(p, wrap_mode);
+          ImageChannelValues expected = img.bilerp(p, wrap_mode);
+          ChannelsRGB swizzled = img.bilerp(p, bgr, wrap_mode);
+          ImageChannelValues expected_swizzled = img.bilerp(p, bgr_desc, wrap_mode);
+          ChannelsRGB nearest = img.lookup_nearest(p, bgr, wrap_mode);
+          ImageChannelValues expected_nearest = img.lookup_nearest(p, bgr_desc, wrap_mode);
+          ChannelsRGB texel = img.get_channels<3>(pi, wrap_mode);
+          ImageChannelValues expected_texel = img.get_channels(pi, wrap_mode);
+          for (int c = 0; c < 3; ++c) {
+            CHECK(rgb[c] == expected[c]);
+            CHECK(swizzled[c] == expected_swizzled[c]);
+            CHECK(nearest[c] == expected_nearest[c]);
+            CHECK(texel[c] == expected_texel[c]);
+          }
+          CHECK(Float(img.bilerp(p, g, wrap_mode)) == img.bilerp_channel(p, 1, wrap_mode));
+        }
+      }
+    }
+  }
+
+  SECTION("Dispatch resolves the channel count") {
+    int n = image.dispatch_view([](auto view) {
+      using View = decltype(view);
+      CHECK(std::is_same_v<View, ImageView<PixelFormat::Float, 3>>);
+      return view.n_channels();
+    });
+    CHECK(n == 3);
+  }
+}
+
+TEST_CASE("Image layout", "[util][image]") {
+  std::vector<std::string> channels = {"R", "G", "B"};
+  Point2i resolution(70, 37);
+
+  Image image(PixelFormat::Half, resolution, channels);
+  for (int y = 0; y < resolution.y; ++y) {
+    for (int x = 0; x < resolution.x; ++x) {
+      for (int c = 0; c < 3; ++c) {
+        image.set_channel({x, y}, c, hash_float(x, y, c));
+      }
+    }
+  }
+
+  for (ImageLayout layout : {ImageLayout::Tiled32, ImageLayout::Tiled64}) {
+    Image tiled = image.convert_to_layout(layout);
+    CHECK(tiled.layout() == layout);
+    CHECK(tiled.bytes_used() >= image.bytes_used());
+
+    for (int y = 0; y < resolution.y; ++y) {
+      for (int x = 0; x < resolution.x; ++x) {
+        for (int c = 0; c < 3; ++c) {
+          CHECK(tiled.get_channel({x, y}, c) == image.get_channel({x, y}, c));
+        }
+      }
+    }
+
+    for (int i = 0; i < 200; ++i) {
+      Point2f p(1.2f * hash_float(i, 0) - 0.1f, 1.2f * hash_float(i, 1) - 0.1f);
+      for (WrapMode2D wrap_mode : {WrapMode2D(WrapMode::Clamp), WrapMode2D(WrapMode::Repeat)}) {
+        ImageChannelValues expected = image.bilerp(p, wrap_mode);
+        ImageChannelValues values = tiled.bilerp(p, wrap_mode);
+        for (int c = 0; c < 3; ++c) {
+          CHECK(values[c] == expected[c]);
+        }
+      }
+    }
+
+    for (Bounds2i extent : {Bounds2i({3, 2}, {67, 35}), Bounds2i({-4, -3}, {40, 5})}) {
+      std::vector<float> expected(extent.area() * 3), buf(extent.area() * 3);
+      image.copy_rect_out(extent, expected, WrapMode::Repeat);
+      tiled.copy_rect_out(extent, buf, WrapMode::Repeat);
+      CHECK(buf == expected);
+    }
+
+    Image crop = tiled.crop(Bounds2i({33, 5}, {69, 36}));
+    Image back =
+        tiled.convert_to_format(PixelFormat::Float).convert_to_layout(ImageLayout::Scanline);
+    for (int y = 0; y < resolution.y; ++y) {
+      for (int x = 0; x < resolution.x; ++x) {
+        for (int c = 0; c < 3; ++c) {
+          CHECK(back.get_channel({x, y}, c) == image.get_channel({x, y}, c));
+          if (x >= 33 && x < 69 && y >= 5 && y < 36) {
+            CHECK(crop.get_channel({x - 33, y - 5}, c) == image.get_channel({x, y}, c));
+          }
+        }
+      }
+    }
+  }
+
+  // Rectangles crossing several tiles are copied in and out the same way in every format
+  sRgbColorEncoding srgb;
+  Bounds2i extent({5, 3}, {69, 36});
+  std::vector<float> values(extent.area() * 3);
+  for (size_t i = 0; i < values.size(); ++i) {
+    values[i] = hash_float(i);
+  }
+  for (PixelFormat format : {PixelFormat::U256, PixelFormat::Half, PixelFormat::Float}) {
+    Image scanline = image.convert_to_format(format, ColorEncoding(&srgb));
+    Image tiled = scanline.convert_to_layout(ImageLayout::Tiled32);
+    scanline.copy_rect_in(extent, values);
+    tiled.copy_rect_in(extent, values);
+    std::vector<float> expected(values.size()), buf(values.size());
+    scanline.copy_rect_out(extent, expected);
+    tiled.copy_rect_out(extent, buf);
+    CHECK(buf == expected);
+    for (Point2i p : {Point2i(4, 3), Point2i(69, 20), Point2i(40, 36)}) {
+      CHECK(tiled.get_channel(p, 1) == scanline.get_channel(p, 1));
+    }
+  }
+}
+
+TEST_CASE("Image pyramid", "[util][image]") {
+  std::vector<std::string> channels = {"R", "G", "B", "A"};
+
+  SECTION("Levels average the previous level") {
+    for (int nc : {1, 3, 4}) {
+      std::vector<std::string> names(channels.begin(), channels.begin() + nc);
+      Point2i resolution(256, 128);
+      Image image(PixelFormat::Float, resolution, names);
+      for (int y = 0; y < resolution.y; ++y) {
+        for (int x = 0; x < resolution.x; ++x) {
+          for (int c = 0; c < nc; ++c) {
+            image.set_channel({x, y}, c, hash_float(x, y, c));
+          }
+        }
+      }
+
+      pstd::vector<Image> pyramid = Image::generate_pyramid(image, WrapMode::Clamp);
+      REQUIRE(pyramid.size() == 9);
+      for (size_t level = 1; level < pyramid.size(); ++level) {
+        const Image &prev = pyramid[level - 1];
+        Point2i level_resolution(std::max(1, resolution.x >> level),
+                                 std::max(1, resolution.y >> level));
+        REQUIRE(pyramid[level].resolution() == level_resolution);
+        for (int y = 0; y < level_resolution.y; ++y) {
+          for (int x = 0; x < level_resolution.x; ++x) {
+            for (int c = 0; c < nc; ++c) {
+              Float expected = (((prev.get_channel({2 * x, 2 * y}, c) +
+                                  prev.get_channel({2 * x + 1, 2 * y}, c)) +
+                                 prev.get_channel({2 * x, 2 * y + 1}, c)) +
+                                prev.get_channel({2 * x + 1, 2 * y + 1}, c)) *
+                               0.25f;
+              CHECK(pyramid[level].get_channel({x, y}, c) == expected);
+            }
+          }
+        }
+      }
+    }
+  }
+
+  SECTION("Non power of two resolutions are resized up") {
+    Image image(PixelFormat::Half, {100, 37}, channels);
+    for (int y = 0; y < 37; ++y) {
+      for (int x = 0; x < 100; ++x) {
+        for (int c = 0; c < 4; ++c) {
+          image.set_channel({x, y}, c, 0.5f);
+        }
+      }
+    }
+
+    pstd::vector<Image> pyramid = Image::generate_pyramid(image, WrapMode::Repeat);
+    REQUIRE(pyramid.size() == 8);
+    CHECK(pyramid[0].resolution() == Point2i(128, 64));
+    CHECK(pyramid[7].resolution() == Point2i(1, 1));
+    for (const Image &level : pyramid) {
+      CHECK(level.format() == PixelFormat::Half);
+      for (int c = 0; c < 4; ++c) {
+        CHECK_THAT(level.get_channel({0, level.resolution().y - 1}, c),
+                   Catch::Matchers::WithinAbs(0.5f, 1e-3f));
+      }
+    }
+  }
+}
+
+TEST_CASE("Image pyramid cache", "[util][image]") {
+  std::filesystem::path directory =
+      std::filesystem::temp_directory_path() / "specula_pyramid_cache_test";
+  std::filesystem::remove_all(directory);
+
+  std::vector<std::string> channels = {"R", "G", "B"};
+  Image image(PixelFormat::Half, {100, 60}, channels, nullptr, {}, ImageLayout::Tiled32);
+  for (int y = 0; y < 60; ++y) {
+    for (int x = 0; x < 100; ++x) {
+      for (int c = 0; c < 3; ++c) {
+        image.set_channel({x, y}, c, hash_float(x, y, c));
+      }
+    }
+  }
+
+  auto check_equal = [](const pstd::vector<Image> &a, const pstd::vector<Image> &b) {
+    REQUIRE(a.size() == b.size());
+    for (size_t level = 0; level < a.size(); ++level) {
+      REQUIRE(a[level].resolution() == b[level].resolution());
+      CHECK(a[level].format() == b[level].format());
+      CHECK(a[level].layout() == b[level].layout());
+      CHECK(a[level].channel_names() == b[level].channel_names());
+      int mismatches = 0;
+      for (int y = 0; y < a[level].resolution().y; ++y) {
+        for (int x = 0; x < a[level].resolution().x; ++x) {
+          for (int c = 0; c < 3; ++c) {
+            mismatches += a[level].get_channel({x, y}, c) != b[level].get_channel({x, y}, c);
+          }
+        }
+      }
+      CHECK(mismatches == 0);
+    }
+  };
+
+  pstd::vector<Image> expected = Image::generate_pyramid(image, WrapMode::Repeat);
+  uint64_t key = Image::pyramid_cache_key(image, WrapMode::Repeat);
+  std::filesystem::path filename = directory / fmt::format("{:016x}.pyramid", key);
+
+  // The first lookup generates and writes the pyramid, the second maps it
+  check_equal(Image::cached_pyramid(image, WrapMode::Repeat, directory.string()), expected);
+  REQUIRE(std::filesystem::exists(filename));
+  check_equal(Image::cached_pyramid(image, WrapMode::Repeat, directory.string()), expected);
+
+  SECTION("The key covers the pixels and the wrap mode") {
+    CHECK(Image::pyramid_cache_key(image, WrapMode::Clamp) != key);
+    Image changed = image;
+    changed.set_channel({99, 59}, 2, 2.0f);
+    CHECK(Image::pyramid_cache_key(changed, WrapMode::Repeat) != key);
+    check_equal(Image::cached_pyramid(changed, WrapMode::Repeat, directory.string()),
+                Image::generate_pyramid(changed, WrapMode::Repeat));
+  }
+
+  SECTION("Invalid files are replaced") {
+    std::filesystem::resize_file(filename, 100);
+    check_equal(Image::cached_pyramid(image, WrapMode::Repeat, directory.string()), expected);
+    CHECK(std::filesystem::file_size(filename) > 100);
+    check_equal(Image::cached_pyramid(image, WrapMode::Repeat, directory.string()), expected);
+  }
+
+  SECTION("Files with oversized levels are replaced") {
+    // 4 half channels of 2^31 x 2^31 tiled pixels are 2^65 bytes, which wraps to 0
+    {
+      std::fstream file(filename, std::ios::binary | std::ios::in | std::ios::out);
+      uint32_t n_channels = 4;
+      file.seekp(24);
+      file.write(reinterpret_cast<const char *>(&n_channels), sizeof(n_channels));
+      int32_t resolution[2] = {std::numeric_limits<int32_t>::max(),
+                               std::numeric_limits<int32_t>::max()};
+      file.seekp(32);
+      file.write(reinterpret_cast<const char *>(resolution), sizeof(resolution));
+    }
+    check_equal(Image::cached_pyramid(image, WrapMode::Repeat, directory.string()), expected);
+    check_equal(Image::cached_pyramid(image, WrapMode::Repeat, directory.string()), expected);
+  }
+
+  std::filesystem::remove_all(directory);
+}
+
+TEST_CASE("Image resize", "[util][image]") {
+  std::vector<std::string> channels = {"R", "G", "B"};
+  Image image(PixelFormat::Float, {45, 30}, channels);
+  for (int y = 0; y < 30; ++y) {
+    for (int x = 0; x < 45; ++x) {
+      for (int c = 0; c < 3; ++c) {
+        image.set_channel({x, y}, c, 0.25f * (c + 1));
+      }
+    }
+  }
+
+  Image resized = image.float_resize_up({128, 97}, WrapMode::Clamp);
+  REQUIRE(resized.resolution() == Point2i(128, 97));
+  for (int y = 0; y < 97; ++y) {
+    for (int x = 0; x < 128; ++x) {
+      for (int c = 0; c < 3; ++c) {
+        CHECK_THAT(resized.get_channel({x, y}, c),
+                   Catch::Matchers::WithinAbs(0.25f * (c + 1), 1e-5f));
+      }
+    }
+  }
+}
+
+TEST_CASE("Image filters", "[util][image]") {
+  std::vector<std::string> channels = {"R", "G", "B", "N"};
+  Point2i resolution(150, 83);
+  Image image(PixelFormat::Half, resolution, channels);
+  for (int y = 0; y < resolution.y; ++y) {
+    for (int x = 0; x < resolution.x; ++x) {
+      for (int c = 0; c < 3; ++c) {
+        image.set_channel({x, y}, c, hash_float(x, y, c));
+      }
+      // A piecewise constant guide with an edge through the image
+      image.set_channel({x, y}, 3, x + y < 120 ? 0.2f : 0.8f);
+    }
+  }
+  ImageChannelDesc rgb = image.get_channel_desc(std::vector<std::string>{"R", "G", "B"});
+  ImageChannelDesc guide = image.get_channel_desc(std::vector<std::string>{"N"});
+
+  SECTION("Gaussian") {
+    int half_width = 4;
+    Float sigma = 2;
+    Image filtered = image.gaussian_filter(rgb, half_width, sigma);
+    REQUIRE(filtered.channel_names() == std::vector<std::string>{"R", "G", "B"});
+
+    Float weight_sum = 0;
+    for (int d = -half_width; d <= half_width; ++d) {
+      weight_sum += gaussian(d, 0, sigma);
+    }
+    for (int i = 0; i < 500; ++i) {
+      Point2i p(hash(i, 0) % resolution.x, hash(i, 1) % resolution.y);
+      for (int c = 0; c < 3; ++c) {
+        Float expected = 0;
+        for (int dy = -half_width; dy <= half_width; ++dy) {
+          for (int dx = -half_width; dx <= half_width; ++dx) {
+            expected += gaussian(dx, 0, sigma) * gaussian(dy, 0, sigma) / sqr(weight_sum) *
+                        image.get_channel({p.x + dx, p.y + dy}, c, WrapMode::Clamp);
+          }
+        }
+        CHECK_THAT(filtered.get_channel(p, c), WithinAbs(expected, 1e-5f));
+      }
+    }
+  }
+
+  SECTION("Joint bilateral") {
+    int half_width = 3;
+    Float xy_sigma[2] = {2, 1.5f};
+    ImageChannelValues joint_sigma(1, 0.1f);
+    Image filtered = image.joint_bilateral_filter(rgb, half_width, xy_sigma, guide, joint_sigma);
+    REQUIRE(filtered.channel_names() == std::vector<std::string>{"R", "G", "B"});
+
+    for (int i = 0; i < 500; ++i) {
+      Point2i p(hash(i, 0) % resolution.x, hash(i, 1) % resolution.y);
+      if (i < 4) {
+        p = Point2i(i % 2 ? resolution.x - 1 : 0, i / 2 ? resolution.y - 1 : 0);
+      }
+      Float center = image.get_channel(p, 3);
+      Float sum[3] = {0, 0, 0}, weight_sum = 0;
+      for (int dy = -half_width; dy <= half_width; ++dy) {
+        for (int dx = -half_width; dx <= half_width; ++dx) {
+          Point2i q(p.x + dx, p.y + dy);
+          if (q.x < 0 || q.y < 0 || q.x >= resolution.x || q.y >= resolution.y) {
+            continue;
+          }
+          Float w = gaussian(dx, 0, xy_sigma[0]) * gaussian(dy, 0, xy_sigma[1]) *
+                    std::exp(-sqr(image.get_channel(q, 3) - center) / (2 * sqr(joint_sigma[0])));
+          for (int c = 0; c < 3; ++c) {
+            sum[c] += w * image.get_channel(q, c);
+          }
+          weight_sum += w;
+        }
+      }
+      for (int c = 0; c < 3; ++c) {
+        CHECK_THAT(filtered.get_channel(p, c), WithinRel(sum[c] / weight_sum, 1e-3f));
+      }
+    }
+  }
+}
+
+TEST_CASE("Image metrics", "[util][image]") {
+  std::vector<std::string> channels = {"R", "G", "B"};
+  Point2i resolution(97, 61);
+  Image image(PixelFormat::Float, resolution, channels);
+  Image ref(PixelFormat::Half, resolution, {"B", "G", "R"});
+  for (int y = 0; y < resolution.y; ++y) {
+    for (int x = 0; x < resolution.x; ++x) {
+      for (int c = 0; c < 3; ++c) {
+        image.set_channel({x, y}, c, 2 * hash_float(x, y, c));
+        ref.set_channel({x, y}, 2 - c, hash_float(y, x, c));
+      }
+    }
+  }
+  image.set_channel({5, 7}, 1, Infinity);
+  ImageChannelDesc desc = image.all_channels_desc();
+
+  SECTION("Match the per pixel definitions") {
+    double sums[4][3] = {};
+    for (int y = 0; y < resolution.y; ++y) {
+      for (int x = 0; x < resolution.x; ++x) {
+        for (int c = 0; c < 3; ++c) {
+          float v = image.get_channel({x, y}, c), r = ref.get_channel({x, y}, 2 - c);
+          float errors[4] = {v, std::abs(v - r), sqr(v - r), sqr(v - r) / sqr(r + 0.01f)};
+          for (int m = 0; m < 4; ++m) {
+            sums[m][c] += m > 0 && isinf(errors[m]) ? 0 : errors[m];
+          }
+        }
+      }
+    }
+
+    Image error_image;
+    ImageChannelValues metrics[4] = {image.avarge(desc), image.mae(desc, ref),
+                                     image.mse(desc, ref, &error_image), image.mrse(desc, ref)};
+    for (int m = 0; m < 4; ++m) {
+      for (int c = 0; c < 3; ++c) {
+        if (isinf(sums[m][c])) {
+          CHECK(isinf(metrics[m][c]));
+        } else {
+          CHECK_THAT(metrics[m][c], WithinRel(sums[m][c] / resolution.x / resolution.y, 1e-5));
+        }
+      }
+    }
+
+    REQUIRE(error_image.channel_names() == channels);
+    CHECK(error_image.get_channel({5, 7}, 1) == 0);
+    CHECK(error_image.get_channel({8, 3}, 2) ==
+          sqr(image.get_channel({8, 3}, 2) - ref.get_channel({8, 3}, 0)));
+  }
+
+  SECTION("Independent of the thread count") {
+    ImageChannelValues serial = image.mse(desc, ref);
+    parallel_init(4);
+    ImageChannelValues parallel = image.mse(desc, ref);
+    parallel_cleanup();
+    for (int c = 0; c < 3; ++c) {
+      CHECK(serial[c] == parallel[c]);
+    }
+  }
+}
+
+TEST_CASE("Image non-finite pixels", "[util][image]") {
+  std::vector<std::string> channels = {"R", "G", "B"};
+  Point2i resolution(300, 250);
+  pstd::vector<float> pixels(3 * resolution.x * resolution.y, 0.5f);
+  Image image(pixels, resolution, channels);
+  CHECK(!image.has_any_nan_pixels());
+  CHECK(!image.has_any_infinite_pixels());
+  CHECK(image.find_non_finite_pixels().count == 0);
+  CHECK(image.find_non_finite_pixels().bounds.is_empty());
+
+  // Spread over several chunks, with the last value of the image checked by the scalar tail
+  pixels[3 * (17 * resolution.x + 250) + 1] = std::numeric_limits<float>::quiet_NaN();
+  pixels[3 * (200 * resolution.x + 20)] = -Infinity;
+  pixels[3 * (200 * resolution.x + 20) + 2] = Infinity;
+  pixels.back() = Infinity;
+  image = Image(pixels, resolution, channels);
+  Image half = image.convert_to_format(PixelFormat::Half);
+  Image tiled = half.convert_to_layout(ImageLayout::Tiled64);
+
+  for (const Image *test : {&image, &half, &tiled}) {
+    CHECK(test->has_any_nan_pixels());
+    CHECK(test->has_any_infinite_pixels());
+    NonFinitePixels found = test->find_non_finite_pixels();
+    CHECK(found.count == 3);
+    CHECK(found.bounds == Bounds2i({20, 17}, {300, 250}));
+  }
+
+  pixels[3 * (17 * resolution.x + 250) + 1] = 0;
+  CHECK(!Image(pixels, resolution, channels).has_any_nan_pixels());
+  CHECK(Image(PixelFormat::U256, resolution, channels).find_non_finite_pixels().count == 0);
+}
+
+TEST_CASE("SubImage", "[util][image]") {
+  std::vector<std::string> channels = {"R", "G", "B", "A"};
+  Point2i resolution(90, 70);
+  Image image(PixelFormat::Half, resolution, channels);
+  for (int y = 0; y < resolution.y; ++y) {
+    for (int x = 0; x < resolution.x; ++x) {
+      for (int c = 0; c < 4; ++c) {
+        image.set_channel({x, y}, c, hash_float(x, y, c));
+      }
+    }
+  }
+  Image tiled = image.convert_to_layout(ImageLayout::Tiled32);
+  Bounds2i bounds({13, 7}, {80, 61});
+  ImageChannelDesc bgr = image.get_channel_desc(std::vector<std::string>{"B", "G", "R"});
+
+  auto check_equal = [](const Image &a, const Image &b) {
+    REQUIRE(a.resolution() == b.resolution());
+    REQUIRE(a.channel_names() == b.channel_names());
+    int mismatches = 0;
+    for (int y = 0; y < a.resolution().y; ++y) {
+      for (int x = 0; x < a.resolution().x; ++x) {
+        for (int c = 0; c < a.n_channels(); ++c) {
+          mismatches += a.get_channel({x, y}, c) != b.get_channel({x, y}, c);
+        }
+      }
+    }
+    CHECK(mismatches == 0);
+  };
+
+  SECTION("Views match copies") {
+    for (const Image *source : {&image, &tiled}) {
+      SubImage view = SubImage(*source).crop(bounds).select_channels(bgr);
+      REQUIRE(view.resolution() == Point2i(67, 54));
+      REQUIRE(view.channel_names() == std::vector<std::string>{"B", "G", "R"});
+      Image copy = view.to_image();
+      CHECK(copy.format() == PixelFormat::Half);
+      CHECK(copy.layout() == source->layout());
+      CHECK(copy.get_channel({0, 0}, 0) == image.get_channel(bounds.pmin, 2));
+      check_equal(copy, source->crop(bounds).select_channels(bgr));
+
+      // Extents partly outside of the view wrap within the view, not the image
+      for (WrapMode wrap : {WrapMode::Clamp, WrapMode::Repeat, WrapMode::Black}) {
+        Bounds2i extent({-5, 40}, {30, 60});
+        std::vector<float> from_view(extent.area() * 3), from_copy(extent.area() * 3);
+        view.copy_rect_out(extent, from_view, wrap);
+        copy.copy_rect_out(extent, from_copy, wrap);
+        CHECK(from_view == from_copy);
+      }
+      std::vector<float> from_view(20 * 3), from_copy(20 * 3);
+      view.crop(Bounds2i({2, 3}, {12, 5})).copy_rect_out(Bounds2i({0, 0}, {10, 2}), from_view);
+      copy.copy_rect_out(Bounds2i({2, 3}, {12, 5}), from_copy);
+      CHECK(from_view == from_copy);
+    }
+  }
+
+  SECTION("Filters, metrics and writers accept views") {
+    SubImage view = SubImage(image).crop(bounds).select_channels(bgr);
+    Image copy = view.to_image();
+    check_equal(view.gaussian_filter(3, 1.5f), SubImage(copy).gaussian_filter(3, 1.5f));
+
+    SubImage ref = SubImage(tiled).crop(Bounds2i({0, 0}, {67, 54})).select_channels(bgr);
+    Image ref_copy = ref.to_image();
+    ImageChannelValues mse = view.mse(ref), expected = SubImage(copy).mse(SubImage(ref_copy));
+    for (int c = 0; c < 3; ++c) {
+      CHECK(mse[c] == expected[c]);
+    }
+
+    std::string filename =
+        (std::filesystem::temp_directory_path() / "specula_sub_image_test.pfm").string();
+    REQUIRE(view.write(filename));
+    Image read = Image::read(filename).image;
+    std::filesystem::remove(filename);
+    check_equal(read.select_channels(read.get_channel_desc(std::vector<std::string>{"R"})),
+                copy.select_channels(copy.get_channel_desc(std::vector<std::string>{"R"})));
+  }
+}
+
+TEST_CASE("Image IO", "[util][image]") {
+  std::vector<std::string> channels = {"R", "G", "B"};
+  std::filesystem::path directory = std::filesystem::temp_directory_path();
+  Point2i resolution(71, 40);
+
+  auto fill = [&](Image &image) {
+    for (int y = 0; y < resolution.y; ++y) {
+      for (int x = 0; x < resolution.x; ++x) {
+        for (int c = 0; c < image.n_channels(); ++c) {
+          image.set_channel({x, y}, c, 4 * hash_float(x, y, c));
+        }
+      }
+    }
+  };
+
+  auto check_equal = [&](const Image &a, const Image &b) {
+    REQUIRE(a.resolution() == b.resolution());
+    REQUIRE(a.n_channels() == b.n_channels());
+    int mismatches = 0;
+    for (int y = 0; y < resolution.y; ++y) {
+      for (int x = 0; x < resolution.x; ++x) {
+        for (int c = 0; c < a.n_channels(); ++c) {
+          mismatches += a.get_channel({x, y}, c) != b.get_channel({x, y}, c);
+        }
+      }
+    }
+    CHECK(mismatches == 0);
+  };
+
+  SECTION("PFM round trip") {
+    for (int nc : {1, 3}) {
+      std::vector<std::string> names = nc == 1 ? std::vector<std::string>{"Y"} : channels;
+      Image image(PixelFormat::Float, resolution, names);
+      fill(image);
+
+      std::string filename = (directory / "specula_image_io_test.pfm").string();
+      REQUIRE(image.write(filename));
+      ImageAndMetadata read = Image::read(filename);
+      CHECK(read.image.format() == PixelFormat::Float);
+      CHECK(read.image.channel_names() == names);
+      check_equal(read.image, image);
+      std::filesystem::remove(filename);
+    }
+  }
+
+  SECTION("QOI round trip") {
+    // Reading QOI files uses the shared encodings
+    if (!ColorEncoding::SRGB) {
+      ColorEncoding::initialize({});
+    }
+
+    std::string filename = (directory / "specula_image_io_test.qoi").string();
+    std::vector<std::string> bagr = {"B", "A", "G", "R"};
+    for (const std::vector<std::string> &names : {channels, bagr}) {
+      Image image(PixelFormat::U256, resolution, names, ColorEncoding::SRGB);
+      fill(image);
+
+      REQUIRE(image.write(filename));
+      Image read = Image::read(filename).image;
+      REQUIRE(read.format() == PixelFormat::U256);
+      REQUIRE(read.n_channels() == image.n_channels());
+      int mismatches = 0;
+      for (int y = 0; y < resolution.y; ++y) {
+        for (int x = 0; x < resolution.x; ++x) {
+          ImageChannelValues expected =
+              image.get_channels({x, y}, image.get_channel_desc(read.channel_names()));
+          for (int c = 0; c < read.n_channels(); ++c) {
+            mismatches += std::abs(read.get_channel({x, y}, c) - expected[c]) > 1e-6f;
+          }
+        }
+      }
+      CHECK(mismatches == 0);
+    }
+    std::filesystem::remove(filename);
+  }
+
+  SECTION("QOI dithered quantization") {
+    if (!ColorEncoding::SRGB) {
+      ColorEncoding::initialize({});
+    }
+
+    // A shallow gradient that rounds to a handful of bands, the dither keeps the average of each
+    // column within a small fraction of a step of its exact encoded value
+    std::string filename = (directory / "specula_image_io_test.qoi").string();
+    Point2i size(200, 64);
+    Image image(PixelFormat::Float, size, channels);
+    for (int y = 0; y < size.y; ++y) {
+      for (int x = 0; x < size.x; ++x) {
+        for (int c = 0; c < 3; ++c) {
+          image.set_channel({x, y}, c, 0.2f + 0.01f * x / size.x);
+        }
+      }
+    }
+    image.set_channel({3, 4}, 1, 1.5f);
+    image.set_channel({5, 6}, 2, -0.5f);
+    REQUIRE(image.write(filename));
+    Image read = Image::read(filename).image;
+    REQUIRE(read.format() == PixelFormat::U256);
+
+    int bad_columns = 0;
+    for (int x = 10; x < size.x; ++x) {
+      for (int c = 0; c < 3; ++c) {
+        Float sum = 0;
+        for (int y = 0; y < size.y; ++y) {
+          sum += linear_to_srgb(read.get_channel({x, y}, c));
+        }
+        Float exact = linear_to_srgb(image.get_channel({x, 0}, c));
+        bad_columns += std::abs(255 * (sum / size.y - exact)) > 0.15f;
+      }
+    }
+    CHECK(bad_columns == 0);
+    CHECK(read.get_channel({3, 4}, 1) == 1);
+    CHECK(read.get_channel({5, 6}, 2) == 0);
+    std::filesystem::remove(filename);
+  }
+
+  SECTION("Raw round trip") {
+    std::string filename = (directory / "specula_image_io_test.simg").string();
+    sRgbColorEncoding srgb;
+    for (PixelFormat format : {PixelFormat::U256, PixelFormat::Half, PixelFormat::Float}) {
+      for (ImageLayout layout : {ImageLayout::Scanline, ImageLayout::Tiled32}) {
+        Image image(format, resolution, channels, ColorEncoding(&srgb), {}, layout);
+        fill(image);
+
+        REQUIRE(image.write(filename));
+        Image read = Image::read(filename, {}, ColorEncoding(&srgb)).image;
+        CHECK(read.format() == format);
+        CHECK(read.layout() == layout);
+        CHECK(read.channel_names() == channels);
+        check_equal(read, image);
+
+        // The mapping is private, so modifying the pixels leaves the file as it was
+        read.set_channel({3, 5}, 1, 0.25f);
+        check_equal(Image::read(filename, {}, ColorEncoding(&srgb)).image, image);
+
+        // Replacing the pixels of a mapped image releases the mapping
+        read = image.convert_to_layout(ImageLayout::Scanline);
+        check_equal(read, image);
+      }
+    }
+    std::filesystem::remove(filename);
+  }
+
+  SECTION("Raw headers with oversized pixels") {
+    std::string filename = (directory / "specula_image_io_test.simg").string();
+    Image image(PixelFormat::Float, resolution, channels);
+    fill(image);
+    REQUIRE(image.write(filename));
+
+    // Overwrite the layout, channel count and resolution of the header
+    auto patch = [&](uint32_t layout, uint32_t n_channels, int32_t x, int32_t y) {
+      std::fstream file(filename, std::ios::binary | std::ios::in | std::ios::out);
+      file.seekp(12);
+      for (uint32_t value : {layout, n_channels, uint32_t(x), uint32_t(y)}) {
+        file.write(reinterpret_cast<const char *>(&value), sizeof(value));
+      }
+    };
+
+    // 4 float channels of 2^30 x 2^30 pixels are 2^64 bytes, which wraps to 0
+    patch(uint32_t(ImageLayout::Scanline), 4, 1 << 30, 1 << 30);
+    CHECK(Image::read(filename).image.resolution() == Point2i(0, 0));
+    // Rounding up to whole tiles must not overflow either
+    patch(uint32_t(ImageLayout::Tiled64), 3, std::numeric_limits<int32_t>::max(), 1);
+    CHECK(Image::read(filename).image.resolution() == Point2i(0, 0));
+    patch(uint32_t(ImageLayout::Scanline), 3, resolution.x, resolution.y);
+    check_equal(Image::read(filename).image, image);
+    std::filesystem::remove(filename);
+  }
+}
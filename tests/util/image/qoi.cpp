@@ -0,0 +1,89 @@
+#include <cstddef>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+#include <specula/util/hash.hpp>
+#include <specula/util/image/qoi.hpp>
+
+using namespace specula;
+
+static pstd::span<const std::byte> as_bytes(const std::vector<uint8_t> &data) {
+  return {reinterpret_cast<const std::byte *>(data.data()), data.size()};
+}
+
+TEST_CASE("QOI", "[util][image]") {
+  for (int channels : {3, 4}) {
+    QoiDesc desc{300, 700, channels, false};
+    std::vector<uint8_t> pixels(size_t(desc.width) * desc.height * channels);
+    for (size_t i = 0; i < pixels.size(); ++i) {
+      // Mix smooth gradients, runs and noise, so that every op is exercised
+      size_t pixel = i / channels;
+      int x = pixel % desc.width, y = pixel / desc.width;
+      if (y % 7 == 0) {
+        pixels[i] = 17;
+      } else if (y % 3 == 0) {
+        pixels[i] = hash(i) & 0xff;
+      } else {
+        pixels[i] = (x + 2 * y + 40 * (i % channels)) & 0xff;
+      }
+    }
+
+    SECTION("Single stream round trip") {
+      std::vector<uint8_t> data = qoi_encode(pixels, desc, false);
+      QoiDesc read;
+      REQUIRE(qoi_read_header(as_bytes(data), &read));
+      CHECK(read.width == desc.width);
+      CHECK(read.height == desc.height);
+      CHECK(read.channels == channels);
+      std::vector<uint8_t> decoded(pixels.size());
+      REQUIRE(qoi_decode(as_bytes(data), read, decoded));
+      CHECK(decoded == pixels);
+    }
+
+    SECTION("Strips decode in parallel and as a single stream") {
+      std::vector<uint8_t> data = qoi_encode(pixels, desc);
+      std::vector<uint8_t> decoded(pixels.size());
+      REQUIRE(qoi_decode(as_bytes(data), desc, decoded));
+      CHECK(decoded == pixels);
+
+      // Dropping the strip table leaves a standard stream that is decoded sequentially
+      int n_strips = (desc.height + QOI_STRIP_PIXELS / desc.width - 1) /
+                     (QOI_STRIP_PIXELS / desc.width);
+      REQUIRE(n_strips > 1);
+      data.resize(data.size() - 8 * n_strips - 12);
+      std::vector<uint8_t> sequential(pixels.size());
+      REQUIRE(qoi_decode(as_bytes(data), desc, sequential));
+      CHECK(sequential == pixels);
+    }
+
+    SECTION("Truncated files are rejected") {
+      std::vector<uint8_t> data = qoi_encode(pixels, desc, false);
+      data.resize(data.size() / 2);
+      std::vector<uint8_t> decoded(pixels.size());
+      CHECK(!qoi_decode(as_bytes(data), desc, decoded));
+    }
+  }
+}
+
+TEST_CASE("QOI reference streams", "[util][image]") {
+  SECTION("Index hits on unwritten slots are transparent black") {
+    // A 1x1 RGBA image coded as QOI_OP_INDEX 0, as the reference encoder codes transparent black
+    std::vector<uint8_t> data = {'q', 'o', 'i', 'f', 0, 0, 0, 1, 0, 0, 0, 1, 4, 0,
+                                 0x00, 0, 0, 0, 0, 0, 0, 0, 1};
+    QoiDesc desc;
+    REQUIRE(qoi_read_header(as_bytes(data), &desc));
+    std::vector<uint8_t> decoded(4, 0xff);
+    REQUIRE(qoi_decode(as_bytes(data), desc, decoded));
+    CHECK(decoded == std::vector<uint8_t>{0, 0, 0, 0});
+  }
+
+  SECTION("Single strip images are coded as the reference encoder codes them") {
+    // Transparent black hits the zeroed index, and opaque black continues the initial pixel
+    std::vector<uint8_t> pixels = {0, 0, 0, 0, 0, 0, 0, 255, 0, 0, 0, 255, 1, 0, 0, 255};
+    std::vector<uint8_t> data = qoi_encode(pixels, {4, 1, 4, false});
+    std::vector<uint8_t> expected = {'q', 'o', 'i', 'f', 0, 0, 0, 4, 0, 0, 0, 1, 4, 0,
+                                     0x00, 0xff, 0, 0, 0, 255, 0xc0, 0x7a,
+                                     0, 0, 0, 0, 0, 0, 0, 1};
+    CHECK(data == expected);
+  }
+}
@@ -0,0 +1,104 @@
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+#include <specula/util/hash.hpp>
+#include <specula/util/image/image.hpp>
+#include <specula/util/image/tile_cache.hpp>
+
+using namespace specula;
+
+TEST_CASE("TileCache", "[util][image]") {
+  std::vector<std::string> channels = {"R", "G", "B"};
+  std::vector<Image> levels;
+  for (Point2i resolution : {Point2i(150, 97), Point2i(75, 48), Point2i(37, 24)}) {
+    Image level(PixelFormat::Half, resolution, channels);
+    for (int y = 0; y < resolution.y; ++y) {
+      for (int x = 0; x < resolution.x; ++x) {
+        for (int c = 0; c < 3; ++c) {
+          level.set_channel({x, y}, c, hash_float(resolution.x, x, y, c));
+        }
+      }
+    }
+    levels.push_back(level);
+  }
+
+  std::string filename =
+      (std::filesystem::temp_directory_path() / "specula_tile_cache_test.tiled").string();
+  REQUIRE(TiledImagePyramid::write(filename, levels, ImageLayout::Tiled32));
+
+  // Only a handful of slots, so that looking up every pixel forces evictions
+  size_t tile_bytes = 32 * 32 * 3 * sizeof(Half);
+  TileCache cache(5 * tile_bytes, tile_bytes);
+  auto image = TiledImagePyramid::open(filename, &cache);
+  REQUIRE(image);
+  REQUIRE(image->n_levels() == 3);
+
+  SECTION("Texel lookups") {
+    for (int level = 0; level < 3; ++level) {
+      CHECK(image->level_resolution(level) == levels[level].resolution());
+      for (int i = 0; i < 2000; ++i) {
+        Point2i p(hash(level, i, 0) % 160 - 5, hash(level, i, 1) % 110 - 5);
+        int c = i % 3;
+        CHECK(image->get_channel(level, p, c) == levels[level].get_channel(p, c));
+      }
+    }
+  }
+
+  SECTION("Bilinear lookups") {
+    for (int i = 0; i < 2000; ++i) {
+      Point2f p(1.2f * hash_float(i, 0) - 0.1f, 1.2f * hash_float(i, 1) - 0.1f);
+      for (WrapMode2D wrap_mode : {WrapMode2D(WrapMode::Clamp), WrapMode2D(WrapMode::Repeat)}) {
+        CHECK(image->bilerp_channel(0, p, 1, wrap_mode) ==
+              levels[0].bilerp_channel(p, 1, wrap_mode));
+      }
+    }
+  }
+
+  SECTION("Concurrent lookups") {
+    std::vector<std::thread> threads;
+    std::vector<int> mismatches(4, 0);
+    for (int t = 0; t < 4; ++t) {
+      threads.emplace_back([&, t]() {
+        for (int i = 0; i < 20000; ++i) {
+          int level = hash(t, i) % 3;
+          Point2i resolution = levels[level].resolution();
+          Point2i p(hash(t, i, 0) % resolution.x, hash(t, i, 1) % resolution.y);
+          if (image->get_channel(level, p, 2) != levels[level].get_channel(p, 2)) {
+            ++mismatches[t];
+          }
+        }
+      });
+    }
+    for (std::thread &thread : threads) {
+      thread.join();
+    }
+    CHECK(mismatches == std::vector<int>(4, 0));
+  }
+
+  SECTION("Repeated evictions") {
+    // More tiles than slots, so every pass evicts all of them. The hash table has at least twice
+    // as many entries as there are slots, which keeps clusters far shorter than the number of
+    // slots as long as removed tiles are shifted out instead of left behind.
+    TileCache small_cache(20 * tile_bytes, tile_bytes);
+    auto churned = TiledImagePyramid::open(filename, &small_cache);
+    REQUIRE(churned);
+    for (int pass = 0; pass < 50; ++pass) {
+      for (int level = 0; level < 3; ++level) {
+        Point2i resolution = levels[level].resolution();
+        for (int y = 0; y < resolution.y; y += 32) {
+          for (int x = 0; x < resolution.x; x += 32) {
+            REQUIRE(churned->get_channel(level, {x, y}, 0) ==
+                    levels[level].get_channel({x, y}, 0));
+          }
+        }
+      }
+    }
+    CHECK(small_cache.longest_cluster() <= small_cache.n_slots() / 2);
+  }
+
+  image.reset();
+  std::filesystem::remove(filename);
+}
@@ -0,0 +1,174 @@
+#include <algorithm>
+#include <filesystem>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_floating_point.hpp>
+#include <specula/util/lowdiscrepancy.hpp>
+#include <specula/util/math.hpp>
+#include <specula/util/parallel.hpp>
+
+using namespace specula;
+using namespace Catch::Matchers;
+
+TEST_CASE("Radical inverse", "[util][lowdiscrepancy]") {
+  for (uint32_t a = 0; a < 1024; ++a) {
+    CHECK(radical_inverse(0, a) == reverse_bits_32(a) * 0x1p-32f);
+  }
+  CHECK_THAT(radical_inverse(1, 1), WithinAbs(1.0f / 3, 1e-7));
+  CHECK_THAT(radical_inverse(1, 5), WithinAbs(2.0f / 3 + 1.0f / 9, 1e-7));
+  CHECK_THAT(radical_inverse(2, 7), WithinAbs(2.0f / 5 + 1.0f / 25, 1e-7));
+
+  // The reversed digits of the first 3^4 points give back their index
+  for (uint64_t a = 0; a < 81; ++a) {
+    uint64_t inverse = radical_inverse(1, a) * 81 + 0.5f;
+    CHECK(inverse_radical_inverse(inverse, 3, 4) == a);
+  }
+}
+
+TEST_CASE("Scrambled radical inverse", "[util][lowdiscrepancy]") {
+  DigitPermutations permutations(10, 1234);
+  REQUIRE(permutations.size() == 10);
+
+  for (int base_index = 0; base_index < 10; ++base_index) {
+    int base = PRIMES[base_index];
+    DigitPermutation perm = permutations[base_index];
+    for (int digit = 0; digit < DigitPermutation::digit_count(base); ++digit) {
+      std::vector<bool> seen(base, false);
+      for (int v = 0; v < base; ++v) {
+        seen[perm.permute(digit, v)] = true;
+      }
+      CHECK(std::count(seen.begin(), seen.end(), true) == base);
+    }
+
+    // Both scramblings keep the first b^2 points stratified over the b^2 intervals of [0, 1)
+    int n = base * base;
+    std::vector<int> permuted(n, 0), owen(n, 0);
+    for (int a = 0; a < n; ++a) {
+      Float u = scrambled_radical_inverse(base_index, a, perm);
+      Float v = owen_scrambled_radical_inverse(base_index, a, mix_bits(base_index + 1));
+      REQUIRE(u >= 0);
+      REQUIRE(u < 1);
+      REQUIRE(v >= 0);
+      REQUIRE(v < 1);
+      ++permuted[int(u * n)];
+      ++owen[int(v * n)];
+    }
+    CHECK(std::count(permuted.begin(), permuted.end(), 1) == n);
+    CHECK(std::count(owen.begin(), owen.end(), 1) == n);
+  }
+
+  // The tables only depend on the seed
+  DigitPermutations same(10, 1234), other(10, 4321);
+  int differences = 0;
+  for (int a = 0; a < 100; ++a) {
+    CHECK(scrambled_radical_inverse(5, a, permutations[5]) ==
+          scrambled_radical_inverse(5, a, same[5]));
+    differences += scrambled_radical_inverse(5, a, permutations[5]) !=
+                   scrambled_radical_inverse(5, a, other[5]);
+  }
+  CHECK(differences > 90);
+}
+
+TEST_CASE("Sobol", "[util][lowdiscrepancy]") {
+  for (uint64_t a : {0ull, 1ull, 6ull, 1000ull, 123456789ull, (1ull << 32) - 1}) {
+    CHECK(sobol_bits(a, 0) == reverse_bits_32(a));
+  }
+
+  // Every dimension is a (0, 1)-sequence, so the first 2^k points fall in distinct intervals
+  for (int dim : {0, 1, 2, 3, 17, 100, 511, N_SOBOL_DIMENSIONS - 1}) {
+    std::vector<bool> seen(1024, false);
+    for (int a = 0; a < 1024; ++a) {
+      seen[sobol_bits(a, dim) >> 22] = true;
+    }
+    CHECK(std::count(seen.begin(), seen.end(), true) == 1024);
+  }
+  // Indices beyond 32 bits still give new points
+  CHECK(sobol_bits(1ull << 40, 5) != 0);
+
+  // The first two dimensions form a (0, 2)-sequence, which all scramblers preserve: the first
+  // 2^8 points have one point in each of the elementary intervals of area 2^-8
+  auto check_net = [](auto randomizer_x, auto randomizer_y) {
+    for (int log_x = 0; log_x <= 8; ++log_x) {
+      int nx = 1 << log_x, ny = 256 / nx;
+      std::vector<int> counts(256, 0);
+      for (int a = 0; a < 256; ++a) {
+        Float x = sobol_sample(a, 0, randomizer_x), y = sobol_sample(a, 1, randomizer_y);
+        ++counts[int(x * nx) * ny + int(y * ny)];
+      }
+      REQUIRE(std::count(counts.begin(), counts.end(), 1) == 256);
+    }
+  };
+  check_net(NoRandomizer(), NoRandomizer());
+  check_net(BinaryPermuteScrambler(0x1234567), BinaryPermuteScrambler(0xabcdef));
+  check_net(FastOwenScrambler(0x1234567), FastOwenScrambler(0xabcdef));
+  check_net(OwenScrambler(0x1234567), OwenScrambler(0xabcdef));
+
+  // Owen scrambling changes the points, not only their order
+  CHECK(sobol_sample(1, 0, OwenScrambler(99)) != sobol_sample(1, 0, NoRandomizer()));
+  CHECK(sobol_sample(1, 0, FastOwenScrambler(99)) != sobol_sample(1, 0, NoRandomizer()));
+}
+
+TEST_CASE("PMJ02Table", "[util][lowdiscrepancy]") {
+  PMJ02Table table = PMJ02Table::generate(6, 256, 7);
+  REQUIRE(table.n_sets() == 6);
+  REQUIRE(table.n_samples() == 256);
+
+  // Every prefix of 2^k points of every set is a (0, 2)-net
+  for (int set = 0; set < table.n_sets(); ++set) {
+    for (int log_n = 0; log_n <= 8; ++log_n) {
+      int n = 1 << log_n;
+      for (int log_x = 0; log_x <= log_n; ++log_x) {
+        int nx = 1 << log_x, ny = n / nx;
+        std::vector<int> counts(n, 0);
+        for (int i = 0; i < n; ++i) {
+          Point2f u = table.sample(set, i);
+          ++counts[int(u.x * nx) * ny + int(u.y * ny)];
+        }
+        REQUIRE(std::count(counts.begin(), counts.end(), 1) == n);
+      }
+    }
+  }
+  // So are digitally shifted ones
+  for (int log_x = 0; log_x <= 8; ++log_x) {
+    int nx = 1 << log_x, ny = 256 / nx;
+    std::vector<int> counts(256, 0);
+    for (int i = 0; i < 256; ++i) {
+      Point2f u = table.sample(2, i, 0x0123456789abcdefull);
+      ++counts[int(u.x * nx) * ny + int(u.y * ny)];
+    }
+    REQUIRE(std::count(counts.begin(), counts.end(), 1) == 256);
+  }
+  CHECK(table.sample(0, 1) != table.sample(1, 1));
+
+  // Generating in parallel gives the same points as serially
+  parallel_init(4);
+  PMJ02Table parallel = PMJ02Table::generate(6, 256, 7);
+  parallel_cleanup();
+  for (int set = 0; set < table.n_sets(); ++set) {
+    for (int i = 0; i < table.n_samples(); ++i) {
+      REQUIRE(parallel.sample(set, i) == table.sample(set, i));
+    }
+  }
+
+  // A written table maps back to the same points
+  std::filesystem::path filename =
+      std::filesystem::temp_directory_path() / "specula_pmj02_table_test.pmj";
+  REQUIRE(table.write(filename.string()));
+  {
+    PMJ02Table mapped = PMJ02Table::open(filename.string());
+    REQUIRE(mapped.n_sets() == table.n_sets());
+    REQUIRE(mapped.n_samples() == table.n_samples());
+    for (int set = 0; set < table.n_sets(); ++set) {
+      for (int i = 0; i < table.n_samples(); ++i) {
+        REQUIRE(mapped.sample(set, i, 99) == table.sample(set, i, 99));
+      }
+    }
+  }
+
+  // Truncated and missing files give empty tables
+  std::filesystem::resize_file(filename, std::filesystem::file_size(filename) - 4);
+  CHECK(PMJ02Table::open(filename.string()).empty());
+  std::filesystem::remove(filename);
+  CHECK(PMJ02Table::open(filename.string()).empty());
+}
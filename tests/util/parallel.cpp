@@ -0,0 +1,61 @@
+#include <atomic>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+#include <specula/util/parallel.hpp>
+
+using namespace specula;
+
+TEST_CASE("Parallel", "[util]") {
+  SECTION("Every index is visited once") {
+    std::vector<std::atomic<int>> visits(10000);
+    parallel_for(0, 10000, [&](int64_t i) { ++visits[i]; });
+    int mismatches = 0;
+    for (const std::atomic<int> &v : visits) {
+      mismatches += v.load() != 1;
+    }
+    CHECK(mismatches == 0);
+  }
+
+  SECTION("Nested loops") {
+    std::atomic<int64_t> sum = 0;
+    parallel_for(0, 100, [&](int64_t i) {
+      parallel_for(0, 100, [&](int64_t begin, int64_t end) {
+        for (int64_t j = begin; j < end; ++j) {
+          sum += i * 100 + j;
+        }
+      });
+    });
+    CHECK(sum == 10000 * 9999 / 2);
+  }
+
+  SECTION("Tiles cover the extent") {
+    Bounds2i extent({-3, 5}, {117, 64});
+    std::vector<std::atomic<int>> visits(extent.area());
+    parallel_for_2d(extent, [&](Bounds2i tile) {
+      for (int y = tile.pmin.y; y < tile.pmax.y; ++y) {
+        for (int x = tile.pmin.x; x < tile.pmax.x; ++x) {
+          ++visits[(y - extent.pmin.y) * 120 + (x - extent.pmin.x)];
+        }
+      }
+    });
+    int mismatches = 0;
+    for (const std::atomic<int> &v : visits) {
+      mismatches += v.load() != 1;
+    }
+    CHECK(mismatches == 0);
+  }
+
+  SECTION("Explicit thread count") {
+    parallel_init(4);
+    CHECK(running_threads() == 4);
+    std::atomic<int64_t> sum = 0;
+    parallel_for(0, 1000, [&](int64_t begin, int64_t end) {
+      for (int64_t i = begin; i < end; ++i) {
+        sum += i;
+      }
+    });
+    CHECK(sum == 1000 * 999 / 2);
+    parallel_cleanup();
+  }
+}
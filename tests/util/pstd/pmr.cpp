@@ -1,7 +1,9 @@
 #include <map>
+#include <memory>
 
 #include <catch2/catch_test_macros.hpp>
 #include <specula/util/pstd/pmr.hpp>
+#include <specula/util/pstd/vector.hpp>
 
 #include "specula/util/rng.hpp"
 
@@ -53,3 +55,33 @@ TEST_CASE("Monotonic Buffer Resource", "[util][pstd][pmr]") {
     spans.push_back(Span{p, size});
   }
 }
+
+TEST_CASE("Unowned Buffer Resource", "[util][pstd][pmr]") {
+  TrackingResource tr;
+  pstd::pmr::unowned_buffer_resource ub(&tr);
+  float buffer[16];
+  for (int i = 0; i < 16; ++i)
+    buffer[i] = i;
+  std::shared_ptr<int> owner = std::make_shared<int>(0);
+
+  {
+    pstd::vector<float> v(Allocator{&ub});
+    ub.adopt(buffer, owner);
+    CHECK(owner.use_count() == 2);
+    v.adopt(buffer, 16);
+    REQUIRE(v.size() == 16);
+    CHECK(v.data() == buffer);
+    CHECK(v[7] == 7);
+    CHECK(tr.allocs.empty());
+
+    // Growing moves the elements into storage from the upstream resource
+    v.push_back(16);
+    CHECK(v.data() != buffer);
+    CHECK(v[7] == 7);
+    CHECK(v[16] == 16);
+    CHECK(tr.allocs.size() == 1);
+    CHECK(owner.use_count() == 1);
+  }
+  CHECK(tr.allocs.empty());
+  CHECK(buffer[15] == 15);
+}
@@ -109,3 +109,56 @@ TEST_CASE("RNG", "[util]") {
     }
   }
 }
+
+TEST_CASE("RNG X8", "[util]") {
+  std::vector<std::uint64_t> seq_index, offset;
+  for (std::uint64_t l = 0; l < RngX8::WIDTH; ++l) {
+    seq_index.push_back(1234 + 17 * l);
+    offset.push_back(mix_bits(l) >> 3);
+  }
+
+  SECTION("Lanes match scalar generators") {
+    RngX8 rng(seq_index);
+    std::vector<float> values(8 * 100 + 5);
+    rng.uniform<float>(values);
+    for (int l = 0; l < RngX8::WIDTH; ++l) {
+      Rng scalar(seq_index[l]);
+      for (std::size_t i = l; i < values.size(); i += RngX8::WIDTH) {
+        CHECK(values[i] == scalar.uniform<float>());
+      }
+      // The partial final group still advances every lane
+      if (std::size_t(l) >= values.size() % RngX8::WIDTH) {
+        scalar.uniform<std::uint32_t>();
+      }
+      CHECK(rng.lane(l).uniform<std::uint32_t>() == scalar.uniform<std::uint32_t>());
+    }
+  }
+
+  SECTION("Integers and offsets") {
+    RngX8 rng(seq_index, offset);
+    std::vector<std::uint32_t> values(8 * 37);
+    rng.uniform<std::uint32_t>(values);
+    for (int l = 0; l < RngX8::WIDTH; ++l) {
+      Rng scalar(seq_index[l], offset[l]);
+      for (std::size_t i = l; i < values.size(); i += RngX8::WIDTH) {
+        CHECK(values[i] == scalar.uniform<std::uint32_t>());
+      }
+    }
+  }
+
+  SECTION("Advance") {
+    RngX8 rng(seq_index), skipped(seq_index);
+    std::vector<std::uint32_t> values(8 * 20);
+    rng.uniform<std::uint32_t>(values);
+    skipped.advance(20);
+    for (int l = 0; l < RngX8::WIDTH; ++l) {
+      CHECK(rng.lane(l) - skipped.lane(l) == 0);
+    }
+
+    Rng replaced(99);
+    rng.set_lane(3, replaced);
+    std::vector<float> next(8);
+    rng.uniform<float>(next);
+    CHECK(next[3] == replaced.uniform<float>());
+  }
+}
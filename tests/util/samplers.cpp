@@ -0,0 +1,259 @@
+#include <algorithm>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_floating_point.hpp>
+#include <specula/util/parallel.hpp>
+#include <specula/util/samplers.hpp>
+
+using namespace specula;
+using namespace Catch::Matchers;
+
+TEST_CASE("IndependentSampler", "[util][samplers]") {
+  constexpr int spp = 8, n_dims = 6;
+  Point2i resolution(32, 24);
+  IndependentSampler sampler(spp, 5);
+
+  // Reference values, rendering the image in scanline order
+  std::vector<Float> reference;
+  for (int y = 0; y < resolution.y; ++y) {
+    for (int x = 0; x < resolution.x; ++x) {
+      for (int index = 0; index < spp; ++index) {
+        sampler.start_pixel_sample({x, y}, index);
+        for (int dim = 0; dim < n_dims; ++dim) {
+          reference.push_back(sampler.get_1d());
+        }
+      }
+    }
+  }
+  auto reference_value = [&](Point2i p, int index, int dim) {
+    return reference[((size_t(p.y) * resolution.x + p.x) * spp + index) * n_dims + dim];
+  };
+
+  // Tiles rendered by several threads, each with its own sampler, and samples started in the
+  // middle of their dimensions, give the same values
+  parallel_init(4);
+  std::vector<Float> tiled(reference.size());
+  parallel_for(0, resolution.y / 8 * (resolution.x / 8), [&](int64_t t0, int64_t t1) {
+    IndependentSampler tile_sampler(spp, 5);
+    for (int64_t tile = t0; tile < t1; ++tile) {
+      int x0 = int(tile % (resolution.x / 8)) * 8, y0 = int(tile / (resolution.x / 8)) * 8;
+      for (int index = spp - 1; index >= 0; --index) {
+        for (int y = y0; y < y0 + 8; ++y) {
+          for (int x = x0; x < x0 + 8; ++x) {
+            size_t offset = ((size_t(y) * resolution.x + x) * spp + index) * n_dims;
+            tile_sampler.start_pixel_sample({x, y}, index, 2);
+            for (int dim = 2; dim < n_dims; ++dim) {
+              tiled[offset + dim] = tile_sampler.get_1d();
+            }
+            tile_sampler.start_pixel_sample({x, y}, index);
+            Point2f u = tile_sampler.get_2d();
+            tiled[offset] = u.x;
+            tiled[offset + 1] = u.y;
+          }
+        }
+      }
+    }
+  });
+  parallel_cleanup();
+  CHECK(tiled == reference);
+
+  // Different pixels, samples and seeds are not correlated
+  sampler.start_pixel_sample({3, 4}, 1);
+  Float u = sampler.get_1d();
+  CHECK(u == reference_value({3, 4}, 1, 0));
+  CHECK(u != reference_value({4, 4}, 1, 0));
+  CHECK(u != reference_value({3, 4}, 2, 0));
+  IndependentSampler reseeded(spp, 6);
+  reseeded.start_pixel_sample({3, 4}, 1);
+  CHECK(reseeded.get_1d() != u);
+}
+
+TEST_CASE("HaltonSampler", "[util][samplers]") {
+  // A resolution of exactly 2^6 by 3^4 pixels, so that the first two dimensions of the first
+  // samples of the pixels map back to the pixels themselves
+  Point2i resolution(64, 81);
+
+  SECTION("Sample indices follow the pixels") {
+    HaltonSampler sampler(16, resolution, RandomizeStrategy::None);
+    std::vector<bool> seen(64 * 81, false);
+    for (int y = 0; y < resolution.y; ++y) {
+      for (int x = 0; x < resolution.x; ++x) {
+        for (int i = 0; i < 4; ++i) {
+          sampler.start_pixel_sample({x, y}, i);
+          uint64_t index = sampler.sample_index();
+          REQUIRE(int(radical_inverse(0, index) * 64) == x);
+          REQUIRE(int(radical_inverse(1, index) * 81) == y);
+          if (i == 0) {
+            REQUIRE(index < 64 * 81);
+            seen[index] = true;
+          }
+
+          Point2f u = sampler.get_pixel_2d();
+          CHECK(u.x >= 0);
+          CHECK(u.x < 1);
+          CHECK(u.y >= 0);
+          CHECK(u.y < 1);
+        }
+      }
+    }
+    CHECK(std::count(seen.begin(), seen.end(), true) == 64 * 81);
+
+    // Pixels outside of the tile reuse its indices
+    sampler.start_pixel_sample({3, 5}, 2);
+    uint64_t index = sampler.sample_index();
+    sampler.start_pixel_sample({3 + HaltonSampler::MAX_HALTON_RESOLUTION, 5}, 2);
+    CHECK(sampler.sample_index() == index);
+  }
+
+  for (RandomizeStrategy randomize :
+       {RandomizeStrategy::None, RandomizeStrategy::PermuteDigits, RandomizeStrategy::Owen}) {
+    HaltonSampler sampler(64, resolution, randomize, 7);
+
+    // The samples of a pixel are well distributed in every dimension
+    for (int dim = 2; dim < 8; ++dim) {
+      std::vector<int> strata(8, 0);
+      for (int i = 0; i < 64; ++i) {
+        sampler.start_pixel_sample({10, 20}, i, dim);
+        Float u = sampler.get_1d();
+        REQUIRE(u >= 0);
+        REQUIRE(u < 1);
+        ++strata[int(u * 8)];
+      }
+      for (int count : strata) {
+        CHECK(count >= 4);
+        CHECK(count <= 12);
+      }
+    }
+
+    // Values only depend on the pixel, sample and dimension
+    sampler.start_pixel_sample({5, 6}, 3, 4);
+    Point2f u = sampler.get_2d();
+    Float v = sampler.get_1d();
+    sampler.start_pixel_sample({40, 2}, 9);
+    sampler.get_2d();
+    sampler.start_pixel_sample({5, 6}, 3, 4);
+    CHECK(sampler.get_2d() == u);
+    CHECK(sampler.get_1d() == v);
+  }
+}
+
+TEST_CASE("ZSobolSampler", "[util][samplers]") {
+  Point2i resolution(20, 13);
+  for (RandomizeStrategy randomize :
+       {RandomizeStrategy::None, RandomizeStrategy::PermuteDigits, RandomizeStrategy::FastOwen,
+        RandomizeStrategy::Owen}) {
+    ZSobolSampler sampler(16, resolution, randomize, 3);
+    REQUIRE(sampler.samples_per_pixel() == 16);
+
+    // The samples of a pixel are stratified in every pair of dimensions
+    for (int dim = 0; dim < 10; dim += 2) {
+      std::vector<int> grid(16, 0), strips(16, 0);
+      for (int i = 0; i < 16; ++i) {
+        sampler.start_pixel_sample({7, 9}, i, dim);
+        Point2f u = sampler.get_2d();
+        REQUIRE(u.x >= 0);
+        REQUIRE(u.x < 1);
+        REQUIRE(u.y >= 0);
+        REQUIRE(u.y < 1);
+        ++grid[int(u.x * 4) * 4 + int(u.y * 4)];
+        ++strips[int(u.x * 16)];
+      }
+      CHECK(std::count(grid.begin(), grid.end(), 1) == 16);
+      CHECK(std::count(strips.begin(), strips.end(), 1) == 16);
+    }
+
+    // With a single sample per pixel, the pixels of an aligned 2x2 block are stratified
+    ZSobolSampler single(1, resolution, randomize, 3);
+    for (int dim = 0; dim < 6; dim += 2) {
+      std::vector<int> quadrants(4, 0);
+      for (Point2i p : {Point2i(4, 6), Point2i(5, 6), Point2i(4, 7), Point2i(5, 7)}) {
+        single.start_pixel_sample(p, 0, dim);
+        Point2f u = single.get_2d();
+        ++quadrants[int(u.x * 2) * 2 + int(u.y * 2)];
+      }
+      CHECK(std::count(quadrants.begin(), quadrants.end(), 1) == 4);
+    }
+
+    // Batched values match the scalar ones
+    std::vector<Point2i> pixels;
+    for (int y = 0; y < resolution.y; ++y) {
+      for (int x = 0; x < resolution.x; ++x) {
+        pixels.emplace_back(x, y);
+      }
+    }
+    std::vector<Float> u1(pixels.size());
+    std::vector<Point2f> u2(pixels.size());
+    sampler.get_1d(pixels, 5, 3, u1);
+    sampler.get_2d(pixels, 5, 4, u2);
+    for (size_t i = 0; i < pixels.size(); ++i) {
+      sampler.start_pixel_sample(pixels[i], 5, 3);
+      REQUIRE(sampler.get_1d() == u1[i]);
+      REQUIRE(sampler.get_2d() == u2[i]);
+    }
+  }
+
+  ZSobolSampler rounded(12, resolution);
+  CHECK(rounded.samples_per_pixel() == 16);
+}
+
+TEST_CASE("PMJ02Sampler", "[util][samplers]") {
+  PMJ02Table table = PMJ02Table::generate(4, 64, 3);
+  PMJ02Sampler sampler(64, &table);
+  CHECK(sampler.samples_per_pixel() == 64);
+
+  for (Point2i p : {Point2i(0, 0), Point2i(17, 3)}) {
+    // All the samples of a pixel are stratified, including the dimensions past the sets
+    for (int dim : {0, 2, 6, 20}) {
+      std::vector<int> counts(64, 0);
+      for (int index = 0; index < 64; ++index) {
+        sampler.start_pixel_sample(p, index, dim);
+        Point2f u = sampler.get_2d();
+        ++counts[int(u.x * 8) * 8 + int(u.y * 8)];
+      }
+      CHECK(std::count(counts.begin(), counts.end(), 1) == 64);
+    }
+  }
+
+  // Every power of two prefix of the samples of a pixel is stratified within the table's sets
+  for (Point2i p : {Point2i(0, 0), Point2i(17, 3), Point2i(40, 21)}) {
+    for (int dim : {0, 2, 4, 6}) {
+      for (int n : {4, 16}) {
+        int sqrt_n = n == 4 ? 2 : 4;
+        std::vector<int> grid(n, 0), strips_x(n, 0), strips_y(n, 0);
+        for (int index = 0; index < n; ++index) {
+          sampler.start_pixel_sample(p, index, dim);
+          Point2f u = sampler.get_2d();
+          ++grid[int(u.x * sqrt_n) * sqrt_n + int(u.y * sqrt_n)];
+          ++strips_x[int(u.x * n)];
+          ++strips_y[int(u.y * n)];
+        }
+        CHECK(std::count(grid.begin(), grid.end(), 1) == n);
+        CHECK(std::count(strips_x.begin(), strips_x.end(), 1) == n);
+        CHECK(std::count(strips_y.begin(), strips_y.end(), 1) == n);
+      }
+    }
+  }
+
+  // get_1d uses up a whole pair of dimensions
+  sampler.start_pixel_sample({5, 9}, 3, 0);
+  Float first = sampler.get_1d();
+  Point2f next = sampler.get_2d();
+  sampler.start_pixel_sample({5, 9}, 3, 0);
+  CHECK(sampler.get_2d().x == first);
+  CHECK(sampler.get_2d() == next);
+
+  // Values only depend on the pixel, sample index and dimension
+  sampler.start_pixel_sample({5, 9}, 11, 0);
+  Float u0 = sampler.get_1d();
+  Point2f u2 = sampler.get_2d();
+  sampler.start_pixel_sample({6, 9}, 11, 2);
+  Point2f other = sampler.get_2d();
+  PMJ02Sampler copy(64, &table);
+  copy.start_pixel_sample({5, 9}, 11, 2);
+  CHECK(copy.get_2d() == u2);
+  copy.start_pixel_sample({5, 9}, 11, 0);
+  CHECK(copy.get_1d() == u0);
+  // Pixels sharing a set get different points
+  CHECK(other != u2);
+}
@@ -0,0 +1,332 @@
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_floating_point.hpp>
+#include <specula/util/hash.hpp>
+#include <specula/util/image/image.hpp>
+#include <specula/util/parallel.hpp>
+#include <specula/util/rng.hpp>
+#include <specula/util/sampling.hpp>
+
+using namespace specula;
+using namespace Catch::Matchers;
+
+TEST_CASE("AliasTable", "[util][sampling]") {
+  std::vector<Float> weights;
+  for (int i = 0; i < 100; ++i) {
+    weights.push_back(i % 7 == 3 ? 0 : hash_float(i) * (i % 5 + 1));
+  }
+  Float sum = 0;
+  for (Float w : weights) {
+    sum += w;
+  }
+
+  AliasTable table(weights);
+  REQUIRE(table.size() == weights.size());
+  for (size_t i = 0; i < weights.size(); ++i) {
+    CHECK_THAT(table.pmf(i), WithinAbs(weights[i] / sum, 1e-6));
+  }
+
+  // Stratified samples hit every index with close to its exact probability
+  constexpr int n = 1 << 20;
+  std::vector<int> counts(weights.size(), 0);
+  Float remapped_sum = 0;
+  for (int i = 0; i < n; ++i) {
+    Float pmf, u_remapped;
+    int index = table.sample((i + 0.5f) / n, &pmf, &u_remapped);
+    REQUIRE(index >= 0);
+    REQUIRE(index < int(weights.size()));
+    CHECK(pmf == table.pmf(index));
+    REQUIRE(u_remapped >= 0);
+    REQUIRE(u_remapped < 1);
+    remapped_sum += u_remapped;
+    ++counts[index];
+  }
+  for (size_t i = 0; i < weights.size(); ++i) {
+    CHECK_THAT(Float(counts[i]) / n, WithinAbs(table.pmf(i), 1e-5));
+    if (weights[i] == 0) {
+      CHECK(counts[i] == 0);
+    }
+  }
+  CHECK_THAT(remapped_sum / n, WithinAbs(0.5, 1e-3));
+
+  SECTION("Zero weights are sampled uniformly") {
+    std::vector<Float> zeros(10, 0);
+    AliasTable uniform(zeros);
+    for (int i = 0; i < 10; ++i) {
+      CHECK_THAT(uniform.pmf(i), WithinAbs(0.1, 1e-6));
+      CHECK(uniform.sample((i + 0.5f) / 10) == i);
+    }
+  }
+
+  SECTION("Batched samples match single ones") {
+    std::vector<Float> u(1003);
+    for (size_t i = 0; i < u.size(); ++i) {
+      u[i] = hash_float(i);
+    }
+    u[0] = 0;
+    u[1] = OneMinusEpsilon;
+    std::vector<int> indices(u.size());
+    std::vector<Float> pmfs(u.size());
+    table.sample(u, indices, pmfs);
+    for (size_t i = 0; i < u.size(); ++i) {
+      Float pmf;
+      CHECK(indices[i] == table.sample(u[i], &pmf));
+      CHECK(pmfs[i] == pmf);
+    }
+  }
+
+  SECTION("Samples from 64 bits match the probabilities of large tables") {
+    // Light even entries alias heavy odd ones across the whole table, so the odd indices are
+    // only sampled as often as their probabilities if the entries are decided precisely for
+    // every offset, including those in the upper half of the table
+    std::vector<Float> alternating(1 << 22);
+    for (size_t i = 0; i < alternating.size(); ++i) {
+      alternating[i] = i % 2 ? 2 : 1;
+    }
+    AliasTable large(alternating);
+
+    double odd_pmf = 0;
+    for (size_t i = 1; i < alternating.size(); i += 2) {
+      odd_pmf += large.pmf(i);
+    }
+    CHECK_THAT(odd_pmf, WithinAbs(2.0 / 3, 1e-3));
+
+    Rng rng(7);
+    constexpr int n = 1 << 22;
+    int odd = 0, odd_upper = 0, upper = 0;
+    for (int i = 0; i < n; ++i) {
+      Float pmf, u_remapped;
+      int index = large.sample_bits(rng.uniform<uint64_t>(), &pmf, &u_remapped);
+      REQUIRE(pmf == large.pmf(index));
+      REQUIRE(u_remapped >= 0);
+      REQUIRE(u_remapped < 1);
+      odd += index % 2;
+      if (index >= int(alternating.size() / 2)) {
+        ++upper;
+        odd_upper += index % 2;
+      }
+    }
+    CHECK_THAT(double(odd) / n, WithinAbs(odd_pmf, 2e-3));
+    CHECK_THAT(double(odd_upper) / upper, WithinAbs(odd_pmf, 3e-3));
+
+    // Batched samples match single ones
+    std::vector<uint64_t> u(100);
+    for (uint64_t &v : u) {
+      v = rng.uniform<uint64_t>();
+    }
+    u[0] = 0;
+    u[1] = ~uint64_t(0);
+    std::vector<int> indices(u.size());
+    large.sample_bits(u, indices);
+    for (size_t i = 0; i < u.size(); ++i) {
+      CHECK(indices[i] == large.sample_bits(u[i]));
+    }
+  }
+
+  SECTION("Large tables are independent of the thread count") {
+    std::vector<Float> large(300000);
+    for (size_t i = 0; i < large.size(); ++i) {
+      large[i] = i % 11 == 0 ? 0 : hash_float(i) * hash_float(i, 1) * 100;
+    }
+    large[12345] = 1e5;
+
+    AliasTable serial(large);
+    parallel_init(4);
+    AliasTable parallel(large);
+    parallel_cleanup();
+
+    double pmf_sum = 0;
+    for (size_t i = 0; i < large.size(); ++i) {
+      pmf_sum += serial.pmf(i);
+      REQUIRE(serial.pmf(i) == parallel.pmf(i));
+      if (large[i] == 0) {
+        REQUIRE(serial.pmf(i) == 0);
+      }
+    }
+    CHECK_THAT(pmf_sum, WithinAbs(1, 1e-4));
+    for (int i = 0; i < 10000; ++i) {
+      Float u = hash_float(i, 2);
+      REQUIRE(serial.sample(u) == parallel.sample(u));
+    }
+
+    // The probability of an index gathers the entries aliased to it
+    constexpr int n = 1 << 22;
+    int bright = 0;
+    for (int i = 0; i < n; ++i) {
+      bright += serial.sample((i + 0.5f) / n) == 12345;
+    }
+    CHECK_THAT(Float(bright) / n, WithinRel(serial.pmf(12345), 5e-3f));
+  }
+}
+
+TEST_CASE("PiecewiseConstant1D", "[util][sampling]") {
+  std::vector<Float> func = {0, 1, 3, 0, 4};
+  PiecewiseConstant1D distrib(func, -1, 3);
+  CHECK_THAT(distrib.integral(), WithinAbs(8 * 0.8, 1e-5));
+
+  for (int i = 0; i < 100; ++i) {
+    Float u = (i + 0.5f) / 100, pdf;
+    int offset;
+    Float x = distrib.sample(u, &pdf, &offset);
+    CHECK(func[offset] > 0);
+    CHECK_THAT(pdf, WithinAbs(func[offset] / distrib.integral(), 1e-5));
+    CHECK(x >= -1 + 0.8f * offset - 1e-5f);
+    CHECK(x <= -1 + 0.8f * (offset + 1) + 1e-5f);
+  }
+}
+
+TEST_CASE("PiecewiseConstant2D", "[util][sampling]") {
+  int nu = 37, nv = 21;
+  Array2D<Float> func(nu, nv);
+  for (int v = 0; v < nv; ++v) {
+    for (int u = 0; u < nu; ++u) {
+      func(u, v) = (u + v) % 5 == 0 ? 0 : hash_float(u, v) * (1 + v);
+    }
+  }
+  Bounds2f domain(Point2f(-1, 2), Point2f(3, 4));
+
+  auto check_samples = [&](const PiecewiseConstant2D &distrib, const Array2D<Float> &expected) {
+    Float integral = 0;
+    for (Float f : expected) {
+      integral += f * (4.0f / nu) * (2.0f / nv);
+    }
+    CHECK_THAT(distrib.integral(), WithinRel(integral, 1e-4f));
+
+    constexpr int n = 512;
+    Array2D<int> counts(nu, nv, 0);
+    for (int j = 0; j < n; ++j) {
+      for (int i = 0; i < n; ++i) {
+        Point2f u((i + hash_float(i, j)) / n, (j + hash_float(j, i)) / n);
+        Float pdf;
+        Point2i offset;
+        Point2f p = distrib.sample(u, &pdf, &offset);
+        REQUIRE(inside(p, domain));
+        REQUIRE(expected(offset.x, offset.y) > 0);
+        CHECK_THAT(pdf, WithinRel(expected(offset.x, offset.y) / integral, 1e-3f));
+        Point2f center = domain.lerp(Point2f((offset.x + 0.5f) / nu, (offset.y + 0.5f) / nv));
+        CHECK_THAT(distrib.pdf(center), WithinRel(pdf, 1e-3f));
+        ++counts(offset.x, offset.y);
+      }
+    }
+
+    Float cell_area = (4.0f / nu) * (2.0f / nv);
+    for (int v = 0; v < nv; ++v) {
+      for (int u = 0; u < nu; ++u) {
+        Float probability = expected(u, v) * cell_area / integral;
+        CHECK_THAT(Float(counts(u, v)) / (n * n), WithinAbs(probability, 2e-3));
+      }
+    }
+  };
+
+  SECTION("Samples follow the function") {
+    check_samples(PiecewiseConstant2D(func, domain), func);
+  }
+
+  SECTION("Independent of the thread count") {
+    PiecewiseConstant2D serial(func, domain);
+    parallel_init(4);
+    PiecewiseConstant2D parallel(func, domain);
+    parallel_cleanup();
+    for (int i = 0; i < 1000; ++i) {
+      Point2f u(hash_float(i, 0), hash_float(i, 1));
+      Float serial_pdf, parallel_pdf;
+      CHECK(serial.sample(u, &serial_pdf) == parallel.sample(u, &parallel_pdf));
+      CHECK(serial_pdf == parallel_pdf);
+    }
+  }
+
+  SECTION("Compensation removes values below the average") {
+    double sum = 0;
+    for (Float f : func) {
+      sum += f;
+    }
+    Float average = sum / (nu * nv);
+    Array2D<Float> expected(nu, nv);
+    for (int v = 0; v < nv; ++v) {
+      for (int u = 0; u < nu; ++u) {
+        expected(u, v) = std::max<Float>(func(u, v) - average, 0);
+      }
+    }
+    check_samples(PiecewiseConstant2D::compensated(func, domain), expected);
+
+    Array2D<Float> constant(nu, nv, 2.0f);
+    PiecewiseConstant2D uniform = PiecewiseConstant2D::compensated(constant, domain);
+    CHECK_THAT(uniform.pdf(Point2f(0, 3)), WithinRel(1.0f / 8, 1e-5f));
+  }
+
+  SECTION("Environment maps") {
+    std::vector<std::string> channels = {"R", "G", "B"};
+    Point2i resolution(64, 64);
+    Image image(PixelFormat::Half, resolution, channels);
+    for (int y = 0; y < resolution.y; ++y) {
+      for (int x = 0; x < resolution.x; ++x) {
+        for (int c = 0; c < 3; ++c) {
+          image.set_channel({x, y}, c, x == 10 && y == 50 ? 10000 : hash_float(x, y, c));
+        }
+      }
+    }
+
+    Array2D<Float> dist = image.get_sampling_distribution();
+    for (int y = 0; y < resolution.y; y += 7) {
+      for (int x = 0; x < resolution.x; x += 5) {
+        CHECK(dist(x, y) == image.get_channels({x, y}).average());
+      }
+    }
+
+    // The bright pixel gets most of the samples
+    PiecewiseConstant2D distrib(dist);
+    int bright = 0;
+    for (int i = 0; i < 1000; ++i) {
+      Point2i offset;
+      Point2f p = distrib.sample(Point2f(hash_float(i, 0), hash_float(i, 1)), nullptr, &offset);
+      Point2i pixel(p.x * resolution.x, p.y * resolution.y);
+      CHECK(pixel == offset);
+      bright += offset == Point2i(10, 50);
+    }
+    CHECK(bright > 750);
+  }
+}
+
+TEST_CASE("PiecewiseConstant2D wide rows", "[util][sampling]") {
+  // Rows as wide as a large environment map, where half the pixels are nearly black
+  int nu = 16384, nv = 2;
+  Array2D<Float> func(nu, nv);
+  for (int v = 0; v < nv; ++v) {
+    for (int u = 0; u < nu; ++u) {
+      func(u, v) = hash(u, v) & 1 ? 1e-4f : 0.5f + hash_float(u, v);
+    }
+  }
+  PiecewiseConstant2D distrib(func);
+
+  // Sample frequencies of the dark pixels and of blocks of pixels match their densities
+  constexpr int n = 1 << 22, block = 1024;
+  Rng rng;
+  double dark_pdf = 0;
+  std::vector<double> block_pdf(nu / block * nv, 0);
+  for (int v = 0; v < nv; ++v) {
+    for (int u = 0; u < nu; ++u) {
+      Float pdf = distrib.pdf(Point2f((u + 0.5f) / nu, (v + 0.5f) / nv)) / (nu * nv);
+      block_pdf[v * (nu / block) + u / block] += pdf;
+      dark_pdf += func(u, v) < 1e-3f ? pdf : 0;
+    }
+  }
+  int dark = 0;
+  std::vector<int> block_counts(block_pdf.size(), 0);
+  for (int i = 0; i < n; ++i) {
+    Float pdf;
+    Point2i offset;
+    distrib.sample(rng.uniform<Float>(), rng.uniform<uint64_t>(), &pdf, &offset);
+    REQUIRE(pdf == distrib.pdf(Point2f((offset.x + 0.5f) / nu, (offset.y + 0.5f) / nv)));
+    dark += func(offset.x, offset.y) < 1e-3f;
+    ++block_counts[offset.y * (nu / block) + offset.x / block];
+  }
+  // Dark pixels only get a few hundred samples, so allow five standard deviations
+  CHECK_THAT(double(dark), WithinAbs(dark_pdf * n, 5 * std::sqrt(dark_pdf * n)));
+  for (size_t i = 0; i < block_pdf.size(); ++i) {
+    double expected = block_pdf[i] * n;
+    CHECK_THAT(double(block_counts[i]), WithinAbs(expected, 5 * std::sqrt(expected)));
+  }
+}